@@ -0,0 +1,906 @@
+/**
+ * @file bench.cpp
+ * @author yuwangliang (wotsen@outlook.com)
+ * @brief 有栈协程性能测试
+ * @version 0.1
+ * @date 2020-08-16
+ *
+ * @copyright Copyright (c) 2020 yuwangliang
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <memory>
+#include <vector>
+#include <chrono>
+#include <unistd.h>
+#include <ucontext.h>
+#include "coroutine.h"
+#if __cplusplus >= 202002L
+#include <new>
+#include <atomic>
+#include <cstdlib>
+#include "task.h"
+#include "scheduler.h"
+#include "channel.h"
+#include "io-service.h"
+#include <fcntl.h>
+#include <netinet/in.h>
+#include "../thread-pool/sync-queue.h"
+#endif
+
+using namespace wotsen;
+using namespace std::chrono;
+
+static double elapsed_ns(steady_clock::time_point start)
+{
+	return (double)duration_cast<nanoseconds>(steady_clock::now() - start).count();
+}
+
+// 常驻内存(字节)
+static size_t resident_bytes(void)
+{
+	FILE *fp = fopen("/proc/self/statm", "r");
+	if (!fp)
+		return 0;
+
+	unsigned long size = 0, resident = 0;
+	if (fscanf(fp, "%lu %lu", &size, &resident) != 2)
+		resident = 0;
+	fclose(fp);
+	return resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+static ucontext_t g_main, g_peer;
+static long g_count;
+
+static void uctx_loop(void)
+{
+	for (;;)
+	{
+		g_count++;
+		swapcontext(&g_peer, &g_main);
+	}
+}
+
+/**
+ * @brief 切换开销：一次resume加一次yield是两次切换
+ * @details 与glibc的swapcontext对比，后者每次切换都有一次sigprocmask系统调用
+ *
+ */
+static void bench_switch(void)
+{
+	const long rounds = 10000000;
+
+	long count = 0;
+	Coroutine co([&count] {
+		for (;;)
+		{
+			count++;
+			Coroutine::yield();
+		}
+	});
+
+	co.resume();
+	auto start = steady_clock::now();
+	for (long i = 0; i < rounds; ++i)
+		co.resume();
+	double ns = elapsed_ns(start);
+	printf("%-24s %6.2f ns/switch\n", "coroutine", ns / rounds / 2);
+
+	const long uRounds = rounds / 10;
+	std::vector<char> stack(64 * 1024);
+	getcontext(&g_peer);
+	g_peer.uc_stack.ss_sp = stack.data();
+	g_peer.uc_stack.ss_size = stack.size();
+	g_peer.uc_link = &g_main;
+	makecontext(&g_peer, uctx_loop, 0);
+
+	start = steady_clock::now();
+	for (long i = 0; i < uRounds; ++i)
+		swapcontext(&g_main, &g_peer);
+	ns = elapsed_ns(start);
+	printf("%-24s %6.2f ns/switch\n", "swapcontext", ns / uRounds / 2);
+}
+
+/**
+ * @brief 创建、执行到结束、销毁一个协程的开销，栈池复用与每次mmap对比
+ *
+ */
+static void bench_create(void)
+{
+	const int rounds = 200000;
+
+	StackPool pool;
+	auto start = steady_clock::now();
+	for (int i = 0; i < rounds; ++i)
+	{
+		Coroutine co([] { Coroutine::yield(); }, pool);
+		co.resume();
+		co.resume();
+	}
+	printf("%-24s %8.1f ns/coroutine\n", "create (stack pool)", elapsed_ns(start) / rounds);
+
+	start = steady_clock::now();
+	for (int i = 0; i < rounds; ++i)
+	{
+		Coroutine co([] { Coroutine::yield(); });
+		co.resume();
+		co.resume();
+	}
+	printf("%-24s %8.1f ns/coroutine\n", "create (mmap)", elapsed_ns(start) / rounds);
+}
+
+static void run_live(const char *name, size_t stackSize, bool guard, size_t count)
+{
+	StackPool pool(stackSize, 0, guard);
+	std::vector<std::unique_ptr<Coroutine>> live;
+	live.reserve(count);
+
+	size_t before = resident_bytes();
+	for (size_t i = 0; i < count; ++i)
+	{
+		try
+		{
+			live.emplace_back(new Coroutine([] { Coroutine::yield(); }, pool));
+		}
+		catch (const std::bad_alloc &)
+		{
+			break;
+		}
+		live.back()->resume(); //挂起在yield处，栈顶一页已被使用
+	}
+	size_t used = resident_bytes() - before;
+
+	double per = (double)used / live.size();
+	printf("%-24s live=%-7zu %6.0f bytes/coroutine %9.0f coroutines/GB\n", name, live.size(), per, (1 << 30) / per);
+}
+
+/**
+ * @brief 每GB内存可以同时存在的挂起协程数
+ * @details 栈按需缺页，挂起的协程只占用栈顶一页与协程对象；
+ *          每个带保护页的栈是两个内存映射，数量受vm.max_map_count限制
+ *
+ */
+static void bench_live(void)
+{
+	size_t maxMaps = 65530;
+	if (FILE *fp = fopen("/proc/sys/vm/max_map_count", "r"))
+	{
+		if (fscanf(fp, "%zu", &maxMaps) != 1)
+			maxMaps = 65530;
+		fclose(fp);
+	}
+
+	size_t guarded = maxMaps / 2 > 1024 ? maxMaps / 2 - 1024 : 0;
+	printf("vm.max_map_count=%zu\n", maxMaps);
+	run_live("64K stack + guard", 64 * 1024, true, guarded);
+	run_live("16K stack, no guard", 16 * 1024, false, 200000);
+}
+
+#if __cplusplus >= 202002L
+// 统计堆分配次数，替换全部形式的operator new/delete，统一经malloc/free，
+// 不内联，避免编译器把内联后的free与new配对检查
+static std::atomic<long> g_allocs{0};
+
+__attribute__((noinline)) static void *counted_alloc(size_t size, size_t align = 0)
+{
+	g_allocs.fetch_add(1, std::memory_order_relaxed);
+	void *p = nullptr;
+	if (align > sizeof(void *))
+	{
+		if (posix_memalign(&p, align, size ? size : 1) != 0)
+			p = nullptr;
+	}
+	else
+	{
+		p = malloc(size ? size : 1);
+	}
+	return p;
+}
+
+__attribute__((noinline)) static void counted_free(void *p) noexcept
+{
+	free(p);
+}
+
+void *operator new(size_t size)
+{
+	if (void *p = counted_alloc(size))
+		return p;
+	throw std::bad_alloc();
+}
+
+void *operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void *operator new(size_t size, std::align_val_t align)
+{
+	if (void *p = counted_alloc(size, (size_t)align))
+		return p;
+	throw std::bad_alloc();
+}
+
+void *operator new[](size_t size, std::align_val_t align)
+{
+	return operator new(size, align);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+	return counted_alloc(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+	return counted_alloc(size);
+}
+
+void operator delete(void *p) noexcept
+{
+	counted_free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+	counted_free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	counted_free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+	counted_free(p);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept
+{
+	counted_free(p);
+}
+
+void operator delete[](void *p, std::align_val_t) noexcept
+{
+	counted_free(p);
+}
+
+void operator delete(void *p, size_t, std::align_val_t) noexcept
+{
+	counted_free(p);
+}
+
+void operator delete[](void *p, size_t, std::align_val_t) noexcept
+{
+	counted_free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept
+{
+	counted_free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+	counted_free(p);
+}
+
+static Task<long> leaf(long v)
+{
+	co_return v + 1;
+}
+
+static Task<long> await_loop(long rounds)
+{
+	long v = 0;
+	for (long i = 0; i < rounds; ++i)
+		v = co_await leaf(v);
+	co_return v;
+}
+
+static Task<long> depth(long n)
+{
+	if (n == 0)
+		co_return 0;
+	co_return 1 + co_await depth(n - 1);
+}
+
+/**
+ * @brief co_await一个子任务的开销与帧分配次数，以及深度等待链
+ * @details 子任务的帧在结束后回到FramePool，稳定后每次co_await不再调用全局new
+ *
+ */
+static void bench_await(void)
+{
+	const long rounds = 10000000;
+
+	sync_wait(await_loop(1000)); //预热帧池
+	long allocs = g_allocs.load();
+	auto start = steady_clock::now();
+	long v = sync_wait(await_loop(rounds));
+	double ns = elapsed_ns(start);
+	printf("%-24s %6.2f ns/await %6.3f allocs/await (%ld)\n", "co_await leaf", ns / rounds,
+		   (double)(g_allocs.load() - allocs) / rounds, v);
+
+	const long levels = 1000000;
+	start = steady_clock::now();
+	v = sync_wait(depth(levels));
+	ns = elapsed_ns(start);
+	printf("%-24s %6.2f ns/level (%ld levels)\n", "nested chain", ns / levels, v);
+}
+
+static long step(long v)
+{
+	return v * 31 + 7;
+}
+
+static Task<long> pipeline(ThreadPool &pool, long steps)
+{
+	long v = 1;
+	for (long i = 0; i < steps; ++i)
+	{
+		co_await schedule_on(pool);
+		v = step(v);
+	}
+	co_return v;
+}
+
+static Task<long> pipelines(ThreadPool &pool, long count, long steps)
+{
+	long v = 0;
+	for (long i = 0; i < count; ++i)
+		v += co_await pipeline(pool, steps);
+	co_return v;
+}
+
+/**
+ * @brief 每一步都在线程池中执行的流水线：add_task后future.get()与co_await schedule_on对比
+ * @details future方式每一步都要唤醒工作线程、阻塞等待结果，还要分配共享状态；
+ *          协程方式在工作线程中继续提交下一步，调用者只在最后等待一次
+ *
+ */
+static void bench_pipeline(void)
+{
+	const long steps = 100;
+	const long count = 2000;
+	const long total = steps * count;
+
+	ThreadPool pool;
+
+	long allocs = g_allocs.load();
+	auto start = steady_clock::now();
+	long sum = 0;
+	for (long i = 0; i < count; ++i)
+	{
+		long v = 1;
+		for (long j = 0; j < steps; ++j)
+			v = pool.add_task(step, v).get();
+		sum += v;
+	}
+	double ns = elapsed_ns(start);
+	printf("%-24s %8.1f ns/step %5.2f allocs/step (%ld)\n", "add_task + get", ns / total,
+		   (double)(g_allocs.load() - allocs) / total, sum);
+
+	sync_wait(pipelines(pool, 10, steps));
+	allocs = g_allocs.load();
+	start = steady_clock::now();
+	sum = sync_wait(pipelines(pool, count, steps));
+	ns = elapsed_ns(start);
+	printf("%-24s %8.1f ns/step %5.2f allocs/step (%ld)\n", "co_await schedule_on", ns / total,
+		   (double)(g_allocs.load() - allocs) / total, sum);
+}
+
+// 单值交接：take挂起时登记协程句柄，put时由调度器重新入队
+struct Baton
+{
+	Scheduler *sched = nullptr;
+	std::atomic<uintptr_t> state{0}; //0空 1有值 其他为等待的协程
+	long value = 0;
+
+	void put(long v)
+	{
+		value = v;
+		uintptr_t prev = state.exchange(1, std::memory_order_acq_rel);
+		if (prev > 1)
+			sched->post(std::coroutine_handle<>::from_address((void *)prev));
+	}
+
+	auto take()
+	{
+		struct Awaiter
+		{
+			Baton &b;
+
+			bool await_ready() const noexcept
+			{
+				return b.state.load(std::memory_order_acquire) == 1;
+			}
+
+			bool await_suspend(std::coroutine_handle<> h) noexcept
+			{
+				uintptr_t expected = 0;
+				return b.state.compare_exchange_strong(expected, (uintptr_t)h.address(), std::memory_order_acq_rel);
+			}
+
+			long await_resume() noexcept
+			{
+				b.state.store(0, std::memory_order_relaxed);
+				return b.value;
+			}
+		};
+		return Awaiter{*this};
+	}
+};
+
+static Task<void> ring_node(Baton &in, Baton &out, long rounds)
+{
+	for (long r = 0; r < rounds; ++r)
+	{
+		long v = co_await in.take();
+		out.put(v + 1);
+	}
+}
+
+static void run_ring(long nodes, long rounds, int rings, int workers, bool memory = false)
+{
+	Scheduler sched(workers);
+	std::vector<Baton> batons((size_t)(nodes * rings));
+	for (auto &b : batons)
+		b.sched = &sched;
+
+	size_t before = resident_bytes();
+	auto start = steady_clock::now();
+	for (long k = 0; k < rings; ++k)
+		for (long i = 0; i < nodes; ++i)
+			sched.spawn(ring_node(batons[k * nodes + i], batons[k * nodes + (i + 1) % nodes], rounds));
+	double spawnNs = elapsed_ns(start);
+	size_t used = resident_bytes() - before;
+
+	start = steady_clock::now();
+	for (long k = 0; k < rings; ++k)
+		batons[k * nodes].put(0);
+	sched.wait();
+	double ns = elapsed_ns(start);
+
+	long hops = nodes * rounds * rings;
+	printf("%7ld x %-2d rings workers=%d %6.1f ns/spawn %6.1f ns/hop (%ld)\n", nodes, rings, workers,
+		   spawnNs / (nodes * rings), ns / hops, batons[0].value);
+	if (memory)
+		printf("%-24s %.0f bytes/coroutine\n", "resident", (double)used / (nodes * rings));
+}
+
+/**
+ * @brief 环形传递：N个协程首尾相接，令牌绕环传递，每一跳是一次挂起与唤醒
+ * @details 唤醒放入next槽，令牌在同一线程上交接；多个环时空闲的工作线程从忙的线程偷取。
+ *          常驻内存只在第一次测量，之后释放的内存会被复用
+ *
+ */
+static void bench_ring(void)
+{
+	run_ring(1000000, 3, 1, 1, true);
+	run_ring(1000000, 3, 1, 4);
+	run_ring(1000, 1000, 1, 1);
+	run_ring(100000, 10, 8, 4);
+}
+
+static Task<void> chan_producer(Channel<long> &ch, std::atomic<int> &producers, long count)
+{
+	for (long i = 0; i < count; ++i)
+		co_await ch.send(i);
+	if (--producers == 0)
+		ch.close();
+}
+
+static Task<void> chan_consumer(Channel<long> &ch, std::atomic<long> &sum)
+{
+	long local = 0;
+	for (;;)
+	{
+		std::optional<long> v = co_await ch.recv();
+		if (!v)
+			break;
+		local += *v;
+	}
+	sum += local;
+}
+
+static void run_channel(size_t capacity, int producers, int consumers, int workers, long total)
+{
+	Scheduler sched(workers);
+	Channel<long> ch(capacity);
+	std::atomic<int> left{producers};
+	std::atomic<long> sum{0};
+
+	auto start = steady_clock::now();
+	for (int i = 0; i < consumers; ++i)
+		sched.spawn(chan_consumer(ch, sum));
+	for (int i = 0; i < producers; ++i)
+		sched.spawn(chan_producer(ch, left, total / producers));
+	sched.wait();
+	double ns = elapsed_ns(start);
+
+	char name[32];
+	if (capacity == Channel<long>::Unbounded)
+		snprintf(name, sizeof(name), "unbounded");
+	else
+		snprintf(name, sizeof(name), "cap=%zu", capacity);
+	printf("%-10s %dP/%dC workers=%d %7.1f ns/msg (%ld)\n", name, producers, consumers, workers, ns / total, sum.load());
+}
+
+// 两个通道汇入一个消费者，每条消息一次select；一个通道关闭后只从另一个接收
+static Task<void> chan_merge(Channel<long> &a, Channel<long> &b, std::atomic<long> &sum)
+{
+	long local = 0;
+	Channel<long> *rest = nullptr;
+	while (!rest)
+	{
+		std::optional<long> x, y;
+		int i = co_await select(a.on_recv(x), b.on_recv(y));
+		std::optional<long> &v = i == 0 ? x : y;
+		if (v)
+			local += *v;
+		else
+			rest = i == 0 ? &b : &a;
+	}
+
+	for (;;)
+	{
+		std::optional<long> v = co_await rest->recv();
+		if (!v)
+			break;
+		local += *v;
+	}
+	sum += local;
+}
+
+static void run_select(size_t capacity, int workers, long total)
+{
+	Scheduler sched(workers);
+	Channel<long> a(capacity), b(capacity);
+	std::atomic<int> leftA{1}, leftB{1};
+	std::atomic<long> sum{0};
+
+	auto start = steady_clock::now();
+	sched.spawn(chan_merge(a, b, sum));
+	sched.spawn(chan_producer(a, leftA, total / 2));
+	sched.spawn(chan_producer(b, leftB, total / 2));
+	sched.wait();
+	double ns = elapsed_ns(start);
+	printf("%-10s cap=%zu workers=%d %7.1f ns/msg (%ld)\n", "select", capacity, workers, ns / total, sum.load());
+}
+
+/**
+ * @brief 协程间通过通道传递消息的吞吐，单工作线程与多工作线程，以及select汇合；
+ *        对照组是两个线程经SyncQueue传递
+ * @details 同一线程上挂起与唤醒只是进出调度器的队列；跨线程时多出锁竞争与停车唤醒。
+ *          关闭的通道在接收方取完缓冲区后返回空值，消费者借此退出
+ *
+ */
+static void bench_channel(void)
+{
+	const long total = 2000000;
+
+	for (int workers : {1, 4})
+	{
+		run_channel(0, 1, 1, workers, total);
+		run_channel(128, 1, 1, workers, total);
+		run_channel(Channel<long>::Unbounded, 1, 1, workers, total);
+		run_channel(128, 4, 4, workers, total);
+		run_select(128, workers, total);
+	}
+
+	SyncQueue<long> queue(128);
+	long sum = 0;
+	auto start = steady_clock::now();
+	std::thread producer([&queue, total] {
+		for (long i = 0; i < total; ++i)
+			queue.put(i);
+	});
+	for (long i = 0; i < total; ++i)
+	{
+		long v = 0;
+		queue.take(v);
+		sum += v;
+	}
+	producer.join();
+	double ns = elapsed_ns(start);
+	printf("%-10s 1P/1C threads   %7.1f ns/msg (%ld)\n", "SyncQueue", ns / total, sum);
+}
+
+static const char *backend_name(IoBackend backend)
+{
+	return backend == IoBackend::Uring ? "io_uring" : "epoll";
+}
+
+static Task<void> echo_session(IoService &io, int fd)
+{
+	char buf[4096];
+	for (;;)
+	{
+		int n = co_await io.recv(fd, buf, sizeof(buf));
+		if (n <= 0)
+			break;
+		for (int off = 0; off < n;)
+		{
+			int w = co_await io.send(fd, buf + off, (size_t)(n - off));
+			if (w <= 0)
+			{
+				n = -1;
+				break;
+			}
+			off += w;
+		}
+		if (n < 0)
+			break;
+	}
+	close(fd);
+}
+
+static Task<void> echo_server(Scheduler &sched, IoService &io, int listener, int conns)
+{
+	for (int i = 0; i < conns; ++i)
+	{
+		int fd = co_await io.accept(listener);
+		if (fd >= 0)
+			sched.spawn(echo_session(io, fd));
+	}
+}
+
+static Task<void> echo_client(IoService &io, sockaddr_in addr, long rounds, std::atomic<long> &done)
+{
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (co_await io.connect(fd, (sockaddr *)&addr, sizeof(addr)) == 0)
+	{
+		char msg[64] = {0}, reply[64];
+		for (long r = 0; r < rounds; ++r)
+		{
+			if (co_await io.send(fd, msg, sizeof(msg)) != (int)sizeof(msg))
+				break;
+			size_t got = 0;
+			while (got < sizeof(reply))
+			{
+				int n = co_await io.recv(fd, reply + got, sizeof(reply) - got);
+				if (n <= 0)
+					break;
+				got += (size_t)n;
+			}
+			if (got < sizeof(reply))
+				break;
+			done.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+	close(fd);
+}
+
+// 监听127.0.0.1的随机端口，addr返回实际地址
+static int loopback_listener(sockaddr_in &addr, int flags)
+{
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC | flags, 0);
+	addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t len = sizeof(addr);
+	if (fd < 0 || bind(fd, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 1024) < 0 ||
+		getsockname(fd, (sockaddr *)&addr, &len) < 0)
+	{
+		perror("listen");
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void run_echo(IoBackend backend, int conns, long rounds)
+{
+	sockaddr_in addr;
+	int listener = loopback_listener(addr, SOCK_NONBLOCK);
+	if (listener < 0)
+		return;
+
+	IoService io(backend);
+	Scheduler sched(1);
+	std::atomic<long> done{0};
+	auto start = steady_clock::now();
+	sched.spawn(echo_server(sched, io, listener, conns));
+	for (int i = 0; i < conns; ++i)
+		sched.spawn(echo_client(io, addr, rounds, done));
+	sched.wait();
+	double ns = elapsed_ns(start);
+	close(listener);
+
+	printf("echo %-8s %3d conns %8.0f round trips/s %6.2f us/round trip (%ld)\n", backend_name(backend), conns,
+		   done.load() * 1e9 / ns, ns / 1000 / done.load(), done.load());
+}
+
+// 对照组：阻塞套接字，两个线程一问一答
+static void run_echo_threads(long rounds)
+{
+	sockaddr_in addr;
+	int listener = loopback_listener(addr, 0);
+	if (listener < 0)
+		return;
+
+	std::thread peer([listener, rounds] {
+		int fd = accept(listener, nullptr, nullptr);
+		char buf[64];
+		for (long r = 0; r < rounds; ++r)
+		{
+			if (recv(fd, buf, sizeof(buf), MSG_WAITALL) != (ssize_t)sizeof(buf) || send(fd, buf, sizeof(buf), MSG_NOSIGNAL) < 0)
+				break;
+		}
+		close(fd);
+	});
+
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (connect(fd, (sockaddr *)&addr, sizeof(addr)) < 0)
+		perror("connect");
+	char msg[64] = {0};
+	long done = 0;
+	auto start = steady_clock::now();
+	for (long r = 0; r < rounds; ++r)
+	{
+		if (send(fd, msg, sizeof(msg), MSG_NOSIGNAL) < 0 || recv(fd, msg, sizeof(msg), MSG_WAITALL) != (ssize_t)sizeof(msg))
+			break;
+		done++;
+	}
+	double ns = elapsed_ns(start);
+	close(fd);
+	peer.join();
+	close(listener);
+
+	printf("echo %-8s %3d conns %8.0f round trips/s %6.2f us/round trip (%ld)\n", "threads", 1, done * 1e9 / ns,
+		   ns / 1000 / done, done);
+}
+
+// 顺序扫描：depth>1时用IoBatch一次提交depth个相邻块
+static Task<long> scan(IoService &io, int fd, char *buf, size_t chunk, size_t size, int depth, bool fixed)
+{
+	long sum = 0;
+	IoBatch batch(io, (size_t)depth);
+	for (size_t off = 0; off < size; off += chunk * (size_t)depth)
+	{
+		if (depth == 1 && !fixed)
+		{
+			int n = co_await io.read(fd, buf, chunk, (int64_t)off);
+			if (n <= 0)
+				break;
+			sum += buf[0];
+			continue;
+		}
+
+		batch.clear();
+		for (int i = 0; i < depth && off + chunk * (size_t)i < size; ++i)
+		{
+			char *p = buf + chunk * (size_t)i;
+			int64_t at = (int64_t)(off + chunk * (size_t)i);
+			if (fixed)
+				batch.read_fixed(fd, p, chunk, at, 0);
+			else
+				batch.read(fd, p, chunk, at);
+		}
+		co_await batch;
+		for (size_t i = 0; i < batch.size(); ++i)
+			sum += batch.result(i) > 0 ? buf[chunk * i] : 0;
+	}
+	co_return sum;
+}
+
+static void bench_io_scan(void)
+{
+	const size_t size = 256 << 20;
+	const size_t chunk = 64 << 10;
+	const int depth = 8;
+
+	char path[] = "/dev/shm/wotsen-scan-XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0)
+	{
+		perror("mkstemp");
+		return;
+	}
+	unlink(path);
+
+	std::vector<char> buf(chunk * depth, 1);
+	for (size_t off = 0; off < size; off += buf.size())
+	{
+		if (pwrite(fd, buf.data(), buf.size(), (off_t)off) != (ssize_t)buf.size())
+		{
+			perror("pwrite");
+			close(fd);
+			return;
+		}
+	}
+
+	auto report = [&](const char *name, double ns, long sum) {
+		printf("scan %-24s %6.2f GB/s %6.2f us/64K (%ld)\n", name, size / ns, ns / 1000 / (size / chunk), sum);
+	};
+
+	auto start = steady_clock::now();
+	long sum = 0;
+	for (size_t off = 0; off < size; off += chunk)
+	{
+		if (pread(fd, buf.data(), chunk, (off_t)off) > 0)
+			sum += buf[0];
+	}
+	report("pread", elapsed_ns(start), sum);
+
+	for (IoBackend backend : {IoBackend::Uring, IoBackend::Epoll})
+	{
+		IoService io(backend);
+		char name[32];
+		iovec iov = {buf.data(), buf.size()};
+		io.register_buffers(&iov, 1);
+
+		const struct
+		{
+			const char *label;
+			int depth;
+			bool fixed;
+		} modes[] = {{"read", 1, false}, {"batch x8", depth, false}, {"batch x8 fixed", depth, true}};
+		for (auto &m : modes)
+		{
+			start = steady_clock::now();
+			sum = sync_wait(scan(io, fd, buf.data(), chunk, size, m.depth, m.fixed));
+			snprintf(name, sizeof(name), "%s %s", backend_name(backend), m.label);
+			report(name, elapsed_ns(start), sum);
+		}
+		io.unregister_buffers();
+	}
+	close(fd);
+}
+
+/**
+ * @brief 协程I/O：本机回环的回显服务器与tmpfs文件顺序扫描，io_uring与epoll对比
+ * @details 回显的服务端与客户端都是同一个单线程调度器上的协程，每次往返64字节。
+ *          扫描每块64KB，逐块co_await读、IoBatch一次提交8块、读入注册缓冲区三种方式，
+ *          对照组是两个线程阻塞收发与同步pread；epoll后端对普通文件直接同步读
+ *
+ */
+static void bench_io(void)
+{
+	for (IoBackend backend : {IoBackend::Uring, IoBackend::Epoll})
+	{
+		run_echo(backend, 1, 20000);
+		run_echo(backend, 64, 1000);
+	}
+	run_echo_threads(20000);
+	bench_io_scan();
+}
+#endif
+
+struct bench_case
+{
+	const char *name;
+	void (*fn)(void);
+};
+
+static bench_case cases[] = {
+	{"switch", bench_switch},
+	{"create", bench_create},
+	{"live", bench_live},
+#if __cplusplus >= 202002L
+	{"await", bench_await},
+	{"pipeline", bench_pipeline},
+	{"ring", bench_ring},
+	{"channel", bench_channel},
+	{"io", bench_io},
+#endif
+};
+
+int main(int argc, char **argv)
+{
+	for (auto &c : cases)
+	{
+		if (argc > 1 && strcmp(argv[1], c.name))
+			continue;
+
+		printf("== %s ==\n", c.name);
+		c.fn();
+	}
+
+	return 0;
+}
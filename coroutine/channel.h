@@ -0,0 +1,560 @@
+/**
+ * @file channel.h
+ * @author yuwangliang (wotsen@outlook.com)
+ * @brief 协程通道
+ * @version 0.1
+ * @date 2020-08-16
+ *
+ * @copyright Copyright (c) 2020 yuwangliang
+ *
+ */
+#ifndef __wotsen_CO_CHANNEL_H__
+#define __wotsen_CO_CHANNEL_H__
+
+#include <mutex>
+#include <deque>
+#include <tuple>
+#include <atomic>
+#include <cstdint>
+#include <utility>
+#include <optional>
+#include <algorithm>
+#include <coroutine>
+#include "co-sync.h"
+
+namespace wotsen
+{
+
+	namespace detail
+	{
+
+		// 一次select的所有分支共享，只有第一个认领成功的分支生效
+		struct SelectState
+		{
+			std::atomic<int> fired{-1};
+		};
+
+		struct ChanWaiter : WaitNode
+		{
+			SelectState *select = nullptr; //不属于select时为nullptr
+			int index = 0;				   //select中的分支序号
+			void *slot = nullptr;		   //发送方为待发送的T，接收方为std::optional<T>
+			bool ok = false;			   //操作完成(false为通道已关闭)
+
+			// 在通道的锁内调用，失败说明所属select已由其他分支完成，应跳过
+			bool claim()
+			{
+				if (!select)
+					return true;
+				int expected = -1;
+				return select->fired.compare_exchange_strong(expected, index, std::memory_order_acq_rel);
+			}
+		};
+
+	} // namespace detail
+
+	template <typename T>
+	class Channel;
+
+	template <typename T>
+	struct RecvCase;
+
+	template <typename T>
+	struct SendCase;
+
+	/**
+	 * @brief Go风格的协程通道
+	 * @details 容量为0时是同步通道，发送方等到接收方取走才返回；容量为Unbounded时发送从不挂起。
+	 *          等待的接收方直接从发送方取值(反之亦然)，不经过缓冲区。
+	 *          关闭后发送失败，接收方取完缓冲区后得到空值
+	 *
+	 * @tparam T 元素类型
+	 */
+	template <typename T>
+	class Channel
+	{
+	public:
+		static const size_t Unbounded = SIZE_MAX;
+
+		explicit Channel(size_t capacity = 0) : m_capacity(capacity)
+		{
+		}
+
+		Channel(const Channel &) = delete;
+		Channel &operator=(const Channel &) = delete;
+
+		/**
+		 * @brief co_await ch.send(v)
+		 *
+		 * @return true 成功
+		 * @return false 通道已关闭
+		 */
+		auto send(T value)
+		{
+			return SendAwaiter{*this, std::move(value)};
+		}
+
+		/**
+		 * @brief co_await ch.recv()
+		 *
+		 * @return std::optional<T> 通道已关闭且为空时为空值
+		 */
+		auto recv()
+		{
+			return RecvAwaiter{*this};
+		}
+
+		bool try_send(T value)
+		{
+			detail::ChanWaiter *peer = nullptr;
+			bool done;
+			{
+				std::lock_guard<std::mutex> locker(m_mutex);
+				done = !m_closed && send_locked(value, peer);
+			}
+			if (peer)
+				peer->wake();
+			return done;
+		}
+
+		std::optional<T> try_recv()
+		{
+			std::optional<T> value{};
+			detail::ChanWaiter *peer = nullptr;
+			{
+				std::lock_guard<std::mutex> locker(m_mutex);
+				recv_locked(value, peer);
+			}
+			if (peer)
+				peer->wake();
+			return value;
+		}
+
+		// 关闭通道，唤醒所有等待者
+		void close()
+		{
+			detail::WaitNode *senders = nullptr;
+			detail::WaitNode *receivers = nullptr;
+			{
+				std::lock_guard<std::mutex> locker(m_mutex);
+				if (m_closed)
+					return;
+				m_closed = true;
+				senders = claim_all(m_senders);
+				receivers = claim_all(m_receivers);
+			}
+			detail::WaitList::wake_all(senders);
+			detail::WaitList::wake_all(receivers);
+		}
+
+		bool closed()
+		{
+			std::lock_guard<std::mutex> locker(m_mutex);
+			return m_closed;
+		}
+
+		// 缓冲区中的元素数
+		size_t size()
+		{
+			std::lock_guard<std::mutex> locker(m_mutex);
+			return m_buffer.size();
+		}
+
+		size_t capacity() const
+		{
+			return m_capacity;
+		}
+
+		// select的接收分支，完成时结果写入out，通道关闭时out为空值
+		RecvCase<T> on_recv(std::optional<T> &out)
+		{
+			return RecvCase<T>{this, &out};
+		}
+
+		// select的发送分支，通道已关闭时也算完成
+		SendCase<T> on_send(T value)
+		{
+			return SendCase<T>{this, std::move(value)};
+		}
+
+	private:
+		friend struct RecvCase<T>;
+		friend struct SendCase<T>;
+
+		/**
+		 * @brief 尝试发送，需持有锁且通道未关闭
+		 *
+		 * @param value 值，成功时被移走
+		 * @param peer[out] 需要在释放锁后唤醒的接收方
+		 * @return true 已发送
+		 * @return false 需要等待
+		 */
+		bool send_locked(T &value, detail::ChanWaiter *&peer)
+		{
+			while (detail::ChanWaiter *w = static_cast<detail::ChanWaiter *>(m_receivers.pop_front()))
+			{
+				if (!w->claim())
+					continue;
+				*static_cast<std::optional<T> *>(w->slot) = std::move(value);
+				w->ok = true;
+				peer = w;
+				return true;
+			}
+
+			if (m_buffer.size() < m_capacity)
+			{
+				m_buffer.push_back(std::move(value));
+				return true;
+			}
+			return false;
+		}
+
+		/**
+		 * @brief 尝试接收，需持有锁
+		 *
+		 * @param out[out] 值，通道关闭且为空时为空值
+		 * @param peer[out] 需要在释放锁后唤醒的发送方
+		 * @return true 已完成(取到值或通道已关闭)
+		 * @return false 需要等待
+		 */
+		bool recv_locked(std::optional<T> &out, detail::ChanWaiter *&peer)
+		{
+			if (!m_buffer.empty())
+			{
+				out = std::move(m_buffer.front());
+				m_buffer.pop_front();
+
+				//空出的位置给等待的发送方
+				while (detail::ChanWaiter *w = static_cast<detail::ChanWaiter *>(m_senders.pop_front()))
+				{
+					if (!w->claim())
+						continue;
+					m_buffer.push_back(std::move(*static_cast<T *>(w->slot)));
+					w->ok = true;
+					peer = w;
+					break;
+				}
+				return true;
+			}
+
+			while (detail::ChanWaiter *w = static_cast<detail::ChanWaiter *>(m_senders.pop_front()))
+			{
+				if (!w->claim())
+					continue;
+				out = std::move(*static_cast<T *>(w->slot));
+				w->ok = true;
+				peer = w;
+				return true;
+			}
+
+			return m_closed;
+		}
+
+		// 关闭时取走能认领的等待者，ok保持为false
+		static detail::WaitNode *claim_all(detail::WaitList &list)
+		{
+			detail::WaitList claimed;
+			while (detail::ChanWaiter *w = static_cast<detail::ChanWaiter *>(list.pop_front()))
+			{
+				if (w->claim())
+					claimed.push_back(w);
+			}
+			return claimed.take_all();
+		}
+
+		struct SendAwaiter
+		{
+			Channel &ch;
+			T value;
+			detail::ChanWaiter node{};
+
+			bool await_ready() const noexcept
+			{
+				return false;
+			}
+
+			bool await_suspend(std::coroutine_handle<> h)
+			{
+				detail::ChanWaiter *peer = nullptr;
+				{
+					std::lock_guard<std::mutex> locker(ch.m_mutex);
+					if (ch.m_closed)
+						return false;
+					if (!ch.send_locked(value, peer))
+					{
+						node.suspend_on(h);
+						node.slot = &value;
+						ch.m_senders.push_back(&node);
+						return true;
+					}
+				}
+
+				node.ok = true;
+				if (peer)
+					peer->wake();
+				return false;
+			}
+
+			bool await_resume() const noexcept
+			{
+				return node.ok;
+			}
+		};
+
+		struct RecvAwaiter
+		{
+			Channel &ch;
+			std::optional<T> value{};
+			detail::ChanWaiter node{};
+
+			bool await_ready() const noexcept
+			{
+				return false;
+			}
+
+			bool await_suspend(std::coroutine_handle<> h)
+			{
+				detail::ChanWaiter *peer = nullptr;
+				{
+					std::lock_guard<std::mutex> locker(ch.m_mutex);
+					if (!ch.recv_locked(value, peer))
+					{
+						node.suspend_on(h);
+						node.slot = &value;
+						ch.m_receivers.push_back(&node);
+						return true;
+					}
+				}
+
+				if (peer)
+					peer->wake();
+				return false;
+			}
+
+			std::optional<T> await_resume()
+			{
+				return std::move(value);
+			}
+		};
+
+		const size_t m_capacity;
+		std::mutex m_mutex;
+		std::deque<T> m_buffer;
+		detail::WaitList m_senders;	  //等待发送的协程
+		detail::WaitList m_receivers; //等待接收的协程
+		bool m_closed = false;
+	};
+
+	template <typename T>
+	struct RecvCase
+	{
+		Channel<T> *ch;
+		std::optional<T> *out;
+
+		std::mutex &mutex()
+		{
+			return ch->m_mutex;
+		}
+
+		void reset()
+		{
+			out->reset();
+		}
+
+		bool try_locked(detail::ChanWaiter *&peer)
+		{
+			return ch->recv_locked(*out, peer);
+		}
+
+		void enqueue(detail::ChanWaiter &node)
+		{
+			node.slot = out;
+			ch->m_receivers.push_back(&node);
+		}
+
+		void dequeue(detail::ChanWaiter &node)
+		{
+			ch->m_receivers.remove(&node);
+		}
+	};
+
+	template <typename T>
+	struct SendCase
+	{
+		Channel<T> *ch;
+		T value;
+
+		std::mutex &mutex()
+		{
+			return ch->m_mutex;
+		}
+
+		void reset()
+		{
+		}
+
+		bool try_locked(detail::ChanWaiter *&peer)
+		{
+			return ch->m_closed || ch->send_locked(value, peer);
+		}
+
+		void enqueue(detail::ChanWaiter &node)
+		{
+			node.slot = &value;
+			ch->m_senders.push_back(&node);
+		}
+
+		void dequeue(detail::ChanWaiter &node)
+		{
+			ch->m_senders.remove(&node);
+		}
+	};
+
+	namespace detail
+	{
+
+		template <typename Tuple, typename F, size_t... I>
+		void visit_case(Tuple &cases, size_t index, F &&f, std::index_sequence<I...>)
+		{
+			((index == I ? (void)f(std::get<I>(cases)) : (void)0), ...);
+		}
+
+		/**
+		 * @brief select的实现
+		 * @details 按地址顺序锁住涉及的所有通道，有立即可完成的分支就完成它；否则把每个分支的节点挂到
+		 *          各自通道的等待队列，第一个认领成功的通道完成该分支并唤醒协程，恢复后再从其他通道摘下节点
+		 *
+		 */
+		template <typename... Cases>
+		class Select
+		{
+		public:
+			static constexpr size_t N = sizeof...(Cases);
+
+			explicit Select(Cases &&...cases) : m_cases(std::move(cases)...)
+			{
+			}
+
+			bool await_ready() const noexcept
+			{
+				return false;
+			}
+
+			bool await_suspend(std::coroutine_handle<> h)
+			{
+				return !run(&h);
+			}
+
+			int await_resume()
+			{
+				if (m_result >= 0)
+					return m_result;
+
+				//在各通道的锁内摘下节点，也保证认领失败的通道已不再访问m_state
+				for (size_t i = 0; i < N; ++i)
+				{
+					visit(i, [this, i](auto &c) {
+						std::lock_guard<std::mutex> locker(c.mutex());
+						c.dequeue(m_nodes[i]);
+					});
+				}
+				return m_state.fired.load(std::memory_order_acquire);
+			}
+
+			// 不挂起，没有可完成的分支时返回-1
+			int poll()
+			{
+				run(nullptr);
+				return m_result;
+			}
+
+		private:
+			template <typename F>
+			void visit(size_t i, F &&f)
+			{
+				visit_case(m_cases, i, std::forward<F>(f), std::index_sequence_for<Cases...>());
+			}
+
+			// 返回是否已完成，h非空且没有可完成的分支时登记等待
+			bool run(std::coroutine_handle<> *h)
+			{
+				std::mutex *locks[N];
+				for (size_t i = 0; i < N; ++i)
+					visit(i, [&locks, i](auto &c) {
+						c.reset();
+						locks[i] = &c.mutex();
+					});
+				std::sort(locks, locks + N, std::less<std::mutex *>());
+				size_t count = std::unique(locks, locks + N) - locks;
+				for (size_t i = 0; i < count; ++i)
+					locks[i]->lock();
+
+				//每次从不同的分支开始检查，避免总是偏向靠前的分支
+				static thread_local size_t s_start = 0;
+				size_t start = s_start++;
+				ChanWaiter *peer = nullptr;
+				for (size_t k = 0; k < N && m_result < 0; ++k)
+				{
+					size_t i = (start + k) % N;
+					visit(i, [&](auto &c) {
+						if (c.try_locked(peer))
+							m_result = (int)i;
+					});
+				}
+
+				if (m_result < 0 && h)
+				{
+					for (size_t i = 0; i < N; ++i)
+					{
+						m_nodes[i].suspend_on(*h);
+						m_nodes[i].select = &m_state;
+						m_nodes[i].index = (int)i;
+						visit(i, [this, i](auto &c) { c.enqueue(m_nodes[i]); });
+					}
+				}
+
+				bool done = m_result >= 0;
+				for (size_t i = count; i > 0; --i)
+					locks[i - 1]->unlock();
+
+				if (peer)
+					peer->wake();
+				return done;
+			}
+
+			std::tuple<Cases...> m_cases;
+			SelectState m_state;
+			ChanWaiter m_nodes[N];
+			int m_result = -1;
+		};
+
+	} // namespace detail
+
+	/**
+	 * @brief 等待多个通道操作中的一个完成：int i = co_await select(a.on_recv(x), b.on_send(v))
+	 * @details 同时可完成的分支中随机选一个，只有一个分支生效
+	 *
+	 * @return int 完成的分支序号
+	 */
+	template <typename... Cases>
+	detail::Select<Cases...> select(Cases... cases)
+	{
+		static_assert(sizeof...(Cases) > 0, "select needs at least one case");
+		return detail::Select<Cases...>(std::move(cases)...);
+	}
+
+	/**
+	 * @brief 不挂起的select，相当于Go select的default分支
+	 *
+	 * @return int 完成的分支序号，没有可完成的分支时为-1
+	 */
+	template <typename... Cases>
+	int try_select(Cases... cases)
+	{
+		static_assert(sizeof...(Cases) > 0, "select needs at least one case");
+		return detail::Select<Cases...>(std::move(cases)...).poll();
+	}
+
+} // namespace wotsen
+
+#endif // !__wotsen_CO_CHANNEL_H__
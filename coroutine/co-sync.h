@@ -0,0 +1,507 @@
+/**
+ * @file co-sync.h
+ * @author yuwangliang (wotsen@outlook.com)
+ * @brief 协程同步原语
+ * @version 0.1
+ * @date 2020-08-16
+ *
+ * @copyright Copyright (c) 2020 yuwangliang
+ *
+ */
+#ifndef __wotsen_CO_SYNC_H__
+#define __wotsen_CO_SYNC_H__
+
+#include <mutex>
+#include <atomic>
+#include <utility>
+#include <coroutine>
+#include "scheduler.h"
+
+namespace wotsen
+{
+
+	namespace detail
+	{
+
+		/**
+		 * @brief 挂起的协程，嵌入在awaiter中(即协程帧中)，由同步原语链入等待队列
+		 * @details 唤醒时放回挂起时所在的调度器；不在调度器中挂起的协程直接在唤醒方线程上恢复
+		 *
+		 */
+		struct WaitNode
+		{
+			WaitNode *prev = nullptr;
+			WaitNode *next = nullptr;
+			bool linked = false;
+			std::coroutine_handle<> handle;
+			Scheduler *sched = nullptr;
+
+			void suspend_on(std::coroutine_handle<> h)
+			{
+				handle = h;
+				sched = Scheduler::current();
+			}
+
+			// 调用后不能再访问本节点，协程可能已经恢复并销毁了它
+			void wake()
+			{
+				Scheduler *s = sched;
+				std::coroutine_handle<> h = handle;
+				if (s)
+					s->post(h);
+				else
+					h.resume();
+			}
+		};
+
+		// 侵入式双向链表，由所属原语的锁保护
+		class WaitList
+		{
+		public:
+			bool empty() const
+			{
+				return m_head == nullptr;
+			}
+
+			void push_back(WaitNode *node)
+			{
+				node->prev = m_tail;
+				node->next = nullptr;
+				if (m_tail)
+					m_tail->next = node;
+				else
+					m_head = node;
+				m_tail = node;
+				node->linked = true;
+			}
+
+			WaitNode *pop_front()
+			{
+				WaitNode *node = m_head;
+				if (node)
+					remove(node);
+				return node;
+			}
+
+			void remove(WaitNode *node)
+			{
+				if (!node->linked)
+					return;
+
+				if (node->prev)
+					node->prev->next = node->next;
+				else
+					m_head = node->next;
+				if (node->next)
+					node->next->prev = node->prev;
+				else
+					m_tail = node->prev;
+				node->prev = node->next = nullptr;
+				node->linked = false;
+			}
+
+			// 取走全部节点，返回链表头
+			WaitNode *take_all()
+			{
+				WaitNode *head = m_head;
+				for (WaitNode *n = head; n; n = n->next)
+					n->linked = false;
+				m_head = m_tail = nullptr;
+				return head;
+			}
+
+			// 唤醒take_all()取走的节点，需在释放锁之后调用
+			static void wake_all(WaitNode *head)
+			{
+				while (head)
+				{
+					WaitNode *next = head->next;
+					head->wake();
+					head = next;
+				}
+			}
+
+		private:
+			WaitNode *m_head = nullptr;
+			WaitNode *m_tail = nullptr;
+		};
+
+	} // namespace detail
+
+	class CoMutex;
+
+	/**
+	 * @brief CoMutex的RAII锁，由co_await mutex.scoped_lock()得到
+	 *
+	 */
+	class CoLockGuard
+	{
+	public:
+		explicit CoLockGuard(CoMutex *mutex = nullptr) noexcept : m_mutex(mutex)
+		{
+		}
+
+		CoLockGuard(CoLockGuard &&other) noexcept : m_mutex(std::exchange(other.m_mutex, nullptr))
+		{
+		}
+
+		CoLockGuard &operator=(CoLockGuard &&other) noexcept
+		{
+			if (this != &other)
+			{
+				unlock();
+				m_mutex = std::exchange(other.m_mutex, nullptr);
+			}
+			return *this;
+		}
+
+		CoLockGuard(const CoLockGuard &) = delete;
+		CoLockGuard &operator=(const CoLockGuard &) = delete;
+
+		~CoLockGuard()
+		{
+			unlock();
+		}
+
+		inline void unlock();
+
+	private:
+		CoMutex *m_mutex;
+	};
+
+	/**
+	 * @brief 协程互斥锁
+	 * @details 拿不到锁时挂起协程而不阻塞线程。解锁时有等待者则把锁直接交给队首的协程(先来先得)，
+	 *          等待期间新来的协程不会插队。可以在一个线程加锁、另一个线程解锁
+	 *
+	 */
+	class CoMutex
+	{
+	public:
+		CoMutex() = default;
+		CoMutex(const CoMutex &) = delete;
+		CoMutex &operator=(const CoMutex &) = delete;
+
+		bool try_lock()
+		{
+			bool expected = false;
+			return m_locked.compare_exchange_strong(expected, true, std::memory_order_acquire);
+		}
+
+		// co_await mutex.lock()
+		auto lock()
+		{
+			return LockAwaiter{*this};
+		}
+
+		// auto guard = co_await mutex.scoped_lock()
+		auto scoped_lock()
+		{
+			struct Awaiter : LockAwaiter
+			{
+				CoLockGuard await_resume()
+				{
+					return CoLockGuard(&this->mutex);
+				}
+			};
+			return Awaiter{{*this}};
+		}
+
+		void unlock()
+		{
+			detail::WaitNode *next = nullptr;
+			{
+				std::lock_guard<std::mutex> locker(m_mutex);
+				next = m_waiters.pop_front();
+				if (!next)
+				{
+					m_locked.store(false, std::memory_order_release);
+					return;
+				}
+			}
+
+			//锁保持为占用，所有权交给next
+			next->wake();
+		}
+
+	private:
+		struct LockAwaiter
+		{
+			CoMutex &mutex;
+			detail::WaitNode node{};
+
+			bool await_ready()
+			{
+				return mutex.try_lock();
+			}
+
+			bool await_suspend(std::coroutine_handle<> h)
+			{
+				node.suspend_on(h);
+				std::lock_guard<std::mutex> locker(mutex.m_mutex);
+				if (mutex.try_lock())
+					return false;
+				mutex.m_waiters.push_back(&node);
+				return true;
+			}
+
+			void await_resume() noexcept
+			{
+			}
+		};
+
+		std::atomic_bool m_locked{false};
+		std::mutex m_mutex; //保护m_waiters
+		detail::WaitList m_waiters;
+	};
+
+	inline void CoLockGuard::unlock()
+	{
+		if (m_mutex)
+		{
+			m_mutex->unlock();
+			m_mutex = nullptr;
+		}
+	}
+
+	/**
+	 * @brief 协程信号量
+	 * @details 计数为0时acquire挂起；release时有等待者则直接交给队首的协程，不增加计数
+	 *
+	 */
+	class CoSemaphore
+	{
+	public:
+		explicit CoSemaphore(long count = 0) : m_count(count)
+		{
+		}
+
+		CoSemaphore(const CoSemaphore &) = delete;
+		CoSemaphore &operator=(const CoSemaphore &) = delete;
+
+		bool try_acquire()
+		{
+			long c = m_count.load(std::memory_order_relaxed);
+			while (c > 0)
+			{
+				if (m_count.compare_exchange_weak(c, c - 1, std::memory_order_acquire))
+					return true;
+			}
+			return false;
+		}
+
+		// co_await sem.acquire()
+		auto acquire()
+		{
+			struct Awaiter
+			{
+				CoSemaphore &sem;
+				detail::WaitNode node{};
+
+				bool await_ready()
+				{
+					return sem.try_acquire();
+				}
+
+				bool await_suspend(std::coroutine_handle<> h)
+				{
+					node.suspend_on(h);
+					std::lock_guard<std::mutex> locker(sem.m_mutex);
+					if (sem.try_acquire())
+						return false;
+					sem.m_waiters.push_back(&node);
+					return true;
+				}
+
+				void await_resume() noexcept
+				{
+				}
+			};
+			return Awaiter{*this};
+		}
+
+		void release(long n = 1)
+		{
+			for (; n > 0; --n)
+			{
+				detail::WaitNode *waiter = nullptr;
+				{
+					std::lock_guard<std::mutex> locker(m_mutex);
+					waiter = m_waiters.pop_front();
+					if (!waiter)
+					{
+						m_count.fetch_add(n, std::memory_order_release);
+						return;
+					}
+				}
+				waiter->wake();
+			}
+		}
+
+		long count() const
+		{
+			return m_count.load(std::memory_order_relaxed);
+		}
+
+	private:
+		std::atomic<long> m_count;
+		std::mutex m_mutex; //保护m_waiters
+		detail::WaitList m_waiters;
+	};
+
+	/**
+	 * @brief 协程事件(手动复位)
+	 * @details set()唤醒所有等待者，之后的wait()不再挂起，直到reset()
+	 *
+	 */
+	class CoEvent
+	{
+	public:
+		explicit CoEvent(bool set = false) : m_set(set)
+		{
+		}
+
+		CoEvent(const CoEvent &) = delete;
+		CoEvent &operator=(const CoEvent &) = delete;
+
+		// co_await event.wait()
+		auto wait()
+		{
+			struct Awaiter
+			{
+				CoEvent &event;
+				detail::WaitNode node{};
+
+				bool await_ready() const
+				{
+					return event.is_set();
+				}
+
+				bool await_suspend(std::coroutine_handle<> h)
+				{
+					node.suspend_on(h);
+					std::lock_guard<std::mutex> locker(event.m_mutex);
+					if (event.is_set())
+						return false;
+					event.m_waiters.push_back(&node);
+					return true;
+				}
+
+				void await_resume() noexcept
+				{
+				}
+			};
+			return Awaiter{*this};
+		}
+
+		void set()
+		{
+			detail::WaitNode *waiters = nullptr;
+			{
+				std::lock_guard<std::mutex> locker(m_mutex);
+				m_set.store(true, std::memory_order_release);
+				waiters = m_waiters.take_all();
+			}
+			detail::WaitList::wake_all(waiters);
+		}
+
+		void reset()
+		{
+			m_set.store(false, std::memory_order_relaxed);
+		}
+
+		bool is_set() const
+		{
+			return m_set.load(std::memory_order_acquire);
+		}
+
+	private:
+		std::atomic_bool m_set;
+		std::mutex m_mutex; //保护m_waiters
+		detail::WaitList m_waiters;
+	};
+
+	/**
+	 * @brief 协程条件变量，配合CoMutex使用
+	 * @details wait()登记后释放锁并挂起，被通知后重新加锁再返回；与std::condition_variable一样可能虚假唤醒，
+	 *          应在循环中检查条件或使用带条件的wait()
+	 *
+	 */
+	class CoCondition
+	{
+	public:
+		CoCondition() = default;
+		CoCondition(const CoCondition &) = delete;
+		CoCondition &operator=(const CoCondition &) = delete;
+
+		// co_await cond.wait(mutex)，调用前需持有mutex
+		Task<void> wait(CoMutex &mutex)
+		{
+			co_await WaitAwaiter{*this, mutex};
+			co_await mutex.lock();
+		}
+
+		template <typename Pred>
+		Task<void> wait(CoMutex &mutex, Pred pred)
+		{
+			while (!pred())
+				co_await wait(mutex);
+		}
+
+		void notify_one()
+		{
+			detail::WaitNode *waiter = nullptr;
+			{
+				std::lock_guard<std::mutex> locker(m_mutex);
+				waiter = m_waiters.pop_front();
+			}
+			if (waiter)
+				waiter->wake();
+		}
+
+		void notify_all()
+		{
+			detail::WaitNode *waiters = nullptr;
+			{
+				std::lock_guard<std::mutex> locker(m_mutex);
+				waiters = m_waiters.take_all();
+			}
+			detail::WaitList::wake_all(waiters);
+		}
+
+	private:
+		struct WaitAwaiter
+		{
+			CoCondition &cond;
+			CoMutex &mutex;
+			detail::WaitNode node{};
+
+			bool await_ready() const noexcept
+			{
+				return false;
+			}
+
+			void await_suspend(std::coroutine_handle<> h)
+			{
+				//登记之后才释放锁，持锁通知的一方不会错过本协程；登记后可能已被唤醒，不能再访问成员
+				CoMutex &m = mutex;
+				node.suspend_on(h);
+				{
+					std::lock_guard<std::mutex> locker(cond.m_mutex);
+					cond.m_waiters.push_back(&node);
+				}
+				m.unlock();
+			}
+
+			void await_resume() noexcept
+			{
+			}
+		};
+
+		std::mutex m_mutex; //保护m_waiters
+		detail::WaitList m_waiters;
+	};
+
+} // namespace wotsen
+
+#endif // !__wotsen_CO_SYNC_H__
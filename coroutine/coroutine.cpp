@@ -0,0 +1,350 @@
+/**
+ * @file coroutine.cpp
+ * @author yuwangliang (wotsen@outlook.com)
+ * @brief 有栈协程
+ * @version 0.1
+ * @date 2020-08-16
+ *
+ * @copyright Copyright (c) 2020 yuwangliang
+ *
+ */
+#include <new>
+#include <cstdint>
+#include <cassert>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "coroutine.h"
+
+#if defined(__SANITIZE_ADDRESS__)
+#include <sanitizer/asan_interface.h>
+#define WOTSEN_CO_ASAN 1
+#endif
+
+#if defined(__SANITIZE_THREAD__)
+#include <sanitizer/tsan_interface.h>
+#define WOTSEN_CO_TSAN 1
+#endif
+
+// System V x86-64：rbx、rbp、r12~r15是callee-saved，另外保存MXCSR与x87控制字
+// 栈布局(低地址在前)：mxcsr/fpucw, r15, r14, r13, r12, rbx, rbp, 返回地址
+asm(R"(
+	.text
+	.globl wotsen_context_switch
+	.type wotsen_context_switch, @function
+	.align 16
+wotsen_context_switch:
+	pushq %rbp
+	pushq %rbx
+	pushq %r12
+	pushq %r13
+	pushq %r14
+	pushq %r15
+	subq $8, %rsp
+	stmxcsr (%rsp)
+	fnstcw 4(%rsp)
+
+	movq %rsp, (%rdi)
+	movq %rsi, %rsp
+
+	ldmxcsr (%rsp)
+	fldcw 4(%rsp)
+	addq $8, %rsp
+	popq %r15
+	popq %r14
+	popq %r13
+	popq %r12
+	popq %rbx
+	popq %rbp
+	ret
+	.size wotsen_context_switch, .-wotsen_context_switch
+
+	.globl wotsen_context_entry
+	.type wotsen_context_entry, @function
+	.align 16
+wotsen_context_entry:
+	movq %r12, %rdi
+	callq *%rbx
+	ud2
+	.size wotsen_context_entry, .-wotsen_context_entry
+)");
+
+extern "C" void wotsen_context_entry(void);
+
+namespace wotsen
+{
+
+	static size_t page_size()
+	{
+		static const size_t size = (size_t)sysconf(_SC_PAGESIZE);
+		return size;
+	}
+
+	CoStack CoStack::allocate(size_t size, bool guard)
+	{
+		CoStack stack;
+		size_t page = page_size();
+		size = (size + page - 1) / page * page;
+		size_t mapped = size + (guard ? page : 0);
+
+		void *base = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+		if (base == MAP_FAILED)
+			return stack;
+
+		if (guard && mprotect(base, page, PROT_NONE) != 0)
+		{
+			munmap(base, mapped);
+			return stack;
+		}
+
+		stack.base = base;
+		stack.mapped = mapped;
+		stack.size = size;
+		return stack;
+	}
+
+	void CoStack::deallocate(CoStack &stack)
+	{
+		if (stack.base)
+			munmap(stack.base, stack.mapped);
+		stack = CoStack();
+	}
+
+	StackPool::StackPool(size_t stackSize, size_t maxCached, bool guard)
+		: m_stackSize(stackSize), m_maxCached(maxCached), m_guard(guard)
+	{
+	}
+
+	StackPool::~StackPool()
+	{
+		for (auto &stack : m_free)
+			CoStack::deallocate(stack);
+	}
+
+	CoStack StackPool::acquire()
+	{
+		{
+			std::lock_guard<std::mutex> locker(m_mutex);
+			if (!m_free.empty())
+			{
+				CoStack stack = m_free.back();
+				m_free.pop_back();
+				return stack;
+			}
+		}
+
+		return CoStack::allocate(m_stackSize, m_guard);
+	}
+
+	void StackPool::release(CoStack &stack)
+	{
+		if (!stack)
+			return;
+
+		{
+			std::lock_guard<std::mutex> locker(m_mutex);
+			if (m_free.size() < m_maxCached)
+			{
+				m_free.push_back(stack);
+				stack = CoStack();
+				return;
+			}
+		}
+
+		CoStack::deallocate(stack);
+	}
+
+	size_t StackPool::cached()
+	{
+		std::lock_guard<std::mutex> locker(m_mutex);
+		return m_free.size();
+	}
+
+	// 不内联，协程yield前后可能在不同线程上，不能沿用切换前算出的线程局部变量地址
+	__attribute__((noinline)) static Coroutine *&current_ref()
+	{
+		static thread_local Coroutine *current = nullptr;
+		asm volatile("" ::: "memory");
+		return current;
+	}
+
+	Coroutine::Coroutine(Func fn, size_t stackSize)
+	{
+		m_stack = CoStack::allocate(stackSize, true);
+		init(std::move(fn));
+	}
+
+	Coroutine::Coroutine(Func fn, StackPool &pool) : m_pool(&pool)
+	{
+		m_stack = pool.acquire();
+		init(std::move(fn));
+	}
+
+	Coroutine::~Coroutine()
+	{
+		if (m_state == State::Suspended)
+		{
+			//在yield()处抛出Unwind，析构协程栈上的对象
+			m_unwind = true;
+			try
+			{
+				resume();
+			}
+			catch (...)
+			{
+			}
+		}
+
+#ifdef WOTSEN_CO_TSAN
+		if (m_fiber)
+			__tsan_destroy_fiber(m_fiber);
+#endif
+
+		if (m_pool)
+			m_pool->release(m_stack);
+		else
+			CoStack::deallocate(m_stack);
+	}
+
+	void Coroutine::init(Func &&fn)
+	{
+		if (!m_stack)
+			throw std::bad_alloc();
+
+		m_fn = std::move(fn);
+
+#ifdef WOTSEN_CO_ASAN
+		//复用的栈上可能留有上一个协程未返回的栈帧标记
+		ASAN_UNPOISON_MEMORY_REGION(m_stack.base, m_stack.mapped);
+#endif
+#ifdef WOTSEN_CO_TSAN
+		m_fiber = __tsan_create_fiber(0);
+#endif
+
+		//伪造一次wotsen_context_switch的现场，第一次切入时ret到wotsen_context_entry，
+		//由它以r12为参数调用rbx。ret之后栈指针16字节对齐，符合调用约定
+		uintptr_t top = reinterpret_cast<uintptr_t>(m_stack.top()) & ~(uintptr_t)15;
+		void **sp = reinterpret_cast<void **>(top - 16);
+		*--sp = reinterpret_cast<void *>(&wotsen_context_entry); //返回地址
+		*--sp = nullptr;										  //rbp
+		*--sp = reinterpret_cast<void *>(&Coroutine::entry);	  //rbx
+		*--sp = this;											  //r12
+		*--sp = nullptr;										  //r13
+		*--sp = nullptr;										  //r14
+		*--sp = nullptr;										  //r15
+
+		uint32_t mxcsr;
+		uint16_t fpucw;
+		asm volatile("stmxcsr %0" : "=m"(mxcsr));
+		asm volatile("fnstcw %0" : "=m"(fpucw));
+		uint32_t *csr = reinterpret_cast<uint32_t *>(--sp);
+		csr[0] = mxcsr;
+		csr[1] = fpucw;
+
+		m_sp = sp;
+	}
+
+	bool Coroutine::resume()
+	{
+		if (m_state == State::Done || m_state == State::Running)
+			return false;
+
+		Coroutine *&cur = current_ref();
+		m_prev = cur;
+		cur = this;
+		m_state = State::Running;
+
+#ifdef WOTSEN_CO_ASAN
+		void *fake = nullptr;
+		__sanitizer_start_switch_fiber(&fake, m_stack.base, m_stack.mapped);
+#endif
+#ifdef WOTSEN_CO_TSAN
+		m_callerFiber = __tsan_get_current_fiber();
+		__tsan_switch_to_fiber(m_fiber, 0);
+#endif
+
+		wotsen_context_switch(&m_caller, m_sp);
+
+#ifdef WOTSEN_CO_ASAN
+		__sanitizer_finish_switch_fiber(fake, nullptr, nullptr);
+#endif
+
+		//切回时一定还在调用resume()的线程上，可以继续使用cur
+		cur = m_prev;
+		if (m_error)
+		{
+			std::exception_ptr error;
+			std::swap(error, m_error);
+			std::rethrow_exception(error);
+		}
+
+		return m_state != State::Done;
+	}
+
+	void Coroutine::yield()
+	{
+		Coroutine *self = current_ref();
+		assert(self && "yield() outside coroutine");
+		self->suspend();
+	}
+
+	Coroutine *Coroutine::current()
+	{
+		return current_ref();
+	}
+
+	void Coroutine::suspend()
+	{
+		m_state = State::Suspended;
+		switch_out(false);
+
+		if (m_unwind)
+			throw Unwind();
+	}
+
+	void Coroutine::entry(void *arg)
+	{
+		Coroutine *self = static_cast<Coroutine *>(arg);
+		self->switched_in();
+
+		try
+		{
+			self->m_fn();
+		}
+		catch (const Unwind &)
+		{
+		}
+		catch (...)
+		{
+			self->m_error = std::current_exception();
+		}
+
+		self->m_fn = nullptr;
+		self->m_state = State::Done;
+		self->switch_out(true);
+		__builtin_unreachable();
+	}
+
+	void Coroutine::switch_out(bool exiting)
+	{
+#ifdef WOTSEN_CO_ASAN
+		void *fake = nullptr;
+		__sanitizer_start_switch_fiber(exiting ? nullptr : &fake, m_callerStack, m_callerStackSize);
+#endif
+#ifdef WOTSEN_CO_TSAN
+		__tsan_switch_to_fiber(m_callerFiber, 0);
+#endif
+		(void)exiting;
+
+		wotsen_context_switch(&m_sp, m_caller);
+
+		switched_in();
+	}
+
+	void Coroutine::switched_in()
+	{
+#ifdef WOTSEN_CO_ASAN
+		__sanitizer_finish_switch_fiber(nullptr, &m_callerStack, &m_callerStackSize);
+#endif
+	}
+
+} // namespace wotsen
@@ -0,0 +1,217 @@
+/**
+ * @file coroutine.h
+ * @author yuwangliang (wotsen@outlook.com)
+ * @brief 有栈协程
+ * @version 0.1
+ * @date 2020-08-16
+ *
+ * @copyright Copyright (c) 2020 yuwangliang
+ *
+ */
+#ifndef __wotsen_COROUTINE_H__
+#define __wotsen_COROUTINE_H__
+
+#include <mutex>
+#include <vector>
+#include <cstddef>
+#include <exception>
+#include <functional>
+
+#if !defined(__x86_64__)
+#error "wotsen coroutine: context switch is only implemented for x86-64"
+#endif
+
+extern "C"
+{
+	/**
+	 * @brief 切换上下文
+	 * @details 把callee-saved寄存器、MXCSR与x87控制字压入当前栈，栈指针存入*from，
+	 *          再切到to指向的栈并弹出。只有这些寄存器需要保存，因为调用方已按ABI保存了其他寄存器
+	 *
+	 * @param from[out] 保存当前栈指针
+	 * @param to 目标栈指针
+	 */
+	void wotsen_context_switch(void **from, void *to);
+}
+
+namespace wotsen
+{
+
+	/**
+	 * @brief 协程栈
+	 * @details mmap分配，低地址一侧可以有一个不可访问的保护页，栈溢出时触发SIGSEGV而不是破坏相邻内存；
+	 *          物理内存在第一次访问时才分配，未用到的部分不占内存
+	 *
+	 */
+	struct CoStack
+	{
+		void *base = nullptr; //mmap起始地址(含保护页)
+		size_t mapped = 0;	  //mmap长度
+		size_t size = 0;	  //可用栈大小
+
+		// 栈顶(高地址)
+		void *top() const
+		{
+			return static_cast<char *>(base) + mapped;
+		}
+
+		explicit operator bool() const
+		{
+			return base != nullptr;
+		}
+
+		/**
+		 * @brief 分配栈
+		 *
+		 * @param size 可用栈大小，向上取整到页
+		 * @param guard 是否加保护页
+		 * @return CoStack 失败时为空
+		 */
+		static CoStack allocate(size_t size, bool guard);
+
+		// 释放栈
+		static void deallocate(CoStack &stack);
+	};
+
+	/**
+	 * @brief 协程栈池
+	 * @details 释放的栈放回池中复用，省去mmap/munmap与缺页；池满后多余的栈直接释放。
+	 *          可以被多个线程共用
+	 *
+	 */
+	class StackPool
+	{
+	public:
+		///< 默认可用栈大小
+		static const size_t DefaultStackSize = 64 * 1024;
+
+		/**
+		 * @brief Construct a new Stack Pool object
+		 *
+		 * @param stackSize 可用栈大小
+		 * @param maxCached 最多缓存的空闲栈数
+		 * @param guard 是否加保护页；不加时相邻的栈可以合并为一个内存映射，不受vm.max_map_count限制
+		 */
+		explicit StackPool(size_t stackSize = DefaultStackSize, size_t maxCached = 1024, bool guard = true);
+		~StackPool();
+
+		StackPool(const StackPool &) = delete;
+		StackPool &operator=(const StackPool &) = delete;
+
+		// 取一个栈，失败时为空
+		CoStack acquire();
+
+		// 归还栈
+		void release(CoStack &stack);
+
+		// 空闲栈数
+		size_t cached();
+
+		size_t stack_size() const
+		{
+			return m_stackSize;
+		}
+
+	private:
+		const size_t m_stackSize;
+		const size_t m_maxCached;
+		const bool m_guard;
+		std::mutex m_mutex;
+		std::vector<CoStack> m_free; //空闲栈
+	};
+
+	/**
+	 * @brief 有栈协程
+	 * @details resume()从调用者切到协程执行，协程调用yield()切回调用者，下次resume()从yield()之后继续。
+	 *          协程可以嵌套：在协程中resume另一个协程，后者yield时回到前者。
+	 *          协程函数抛出的异常由resume()抛出。析构未执行完的协程时在其yield()处抛出内部异常展开栈，
+	 *          协程函数不应吞掉该异常(catch(...)后需重新抛出)
+	 *
+	 */
+	class Coroutine
+	{
+	public:
+		using Func = std::function<void()>;
+
+		/**
+		 * @brief Construct a new Coroutine object，创建后不会立即执行
+		 *
+		 * @param fn 协程函数
+		 * @param stackSize 可用栈大小
+		 * @throw std::bad_alloc 栈分配失败
+		 */
+		explicit Coroutine(Func fn, size_t stackSize = StackPool::DefaultStackSize);
+
+		/**
+		 * @brief Construct a new Coroutine object，栈从池中取，结束后归还
+		 *
+		 * @param fn 协程函数
+		 * @param pool 栈池，需比协程后析构
+		 * @throw std::bad_alloc 栈分配失败
+		 */
+		Coroutine(Func fn, StackPool &pool);
+
+		~Coroutine();
+
+		Coroutine(const Coroutine &) = delete;
+		Coroutine &operator=(const Coroutine &) = delete;
+
+		/**
+		 * @brief 执行协程直到它yield或结束
+		 *
+		 * @return true 协程yield，可以继续resume
+		 * @return false 协程已结束
+		 * @throw 协程函数抛出的异常
+		 */
+		bool resume();
+
+		// 在协程中调用，切回resume()的调用者
+		static void yield();
+
+		// 当前线程正在执行的协程，不在协程中为nullptr
+		static Coroutine *current();
+
+		bool done() const
+		{
+			return m_state == State::Done;
+		}
+
+	private:
+		enum class State
+		{
+			Ready,	 //未开始
+			Running, //执行中
+			Suspended,
+			Done,
+		};
+
+		struct Unwind
+		{
+		};
+
+		void init(Func &&fn);
+		void suspend();
+		void switch_out(bool exiting);
+		void switched_in();
+		static void entry(void *arg);
+
+		void *m_sp = nullptr;	  //协程栈指针
+		void *m_caller = nullptr; //resume()调用者的栈指针
+		Coroutine *m_prev = nullptr;
+		State m_state = State::Ready;
+		bool m_unwind = false; //析构时要求展开
+		CoStack m_stack;
+		StackPool *m_pool = nullptr;
+		Func m_fn;
+		std::exception_ptr m_error;
+
+		//AddressSanitizer/ThreadSanitizer的纤程标注，未启用时不使用
+		const void *m_callerStack = nullptr;
+		size_t m_callerStackSize = 0;
+		void *m_fiber = nullptr;
+		void *m_callerFiber = nullptr;
+	};
+
+} // namespace wotsen
+
+#endif // !__wotsen_COROUTINE_H__
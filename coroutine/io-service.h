@@ -0,0 +1,1108 @@
+/**
+ * @file io-service.h
+ * @author yuwangliang (wotsen@outlook.com)
+ * @brief 协程异步I/O(io_uring/epoll)
+ * @version 0.1
+ * @date 2020-08-16
+ *
+ * @copyright Copyright (c) 2020 yuwangliang
+ *
+ */
+#ifndef __wotsen_CO_IO_SERVICE_H__
+#define __wotsen_CO_IO_SERVICE_H__
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <system_error>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "co-sync.h"
+
+#if defined(__SANITIZE_THREAD__)
+#include <sanitizer/tsan_interface.h>
+#endif
+
+namespace wotsen
+{
+
+	/**
+	 * @brief I/O后端
+	 *
+	 */
+	enum class IoBackend
+	{
+		Auto,  //内核支持时用io_uring，否则用epoll
+		Uring, //io_uring，不支持时构造抛出异常
+		Epoll, //epoll就绪通知，就绪后由I/O线程执行读写
+	};
+
+	class IoService;
+
+	namespace detail
+	{
+
+		enum class IoOpcode : uint8_t
+		{
+			Read,
+			Write,
+			ReadFixed,
+			WriteFixed,
+			Recv,
+			Send,
+			Accept,
+			Connect,
+			Timeout,
+		};
+
+		// IoBatch中的操作共用一个计数，最后完成的操作唤醒等待者
+		struct IoGroup
+		{
+			std::atomic<size_t> remaining{0};
+			WaitNode node;
+		};
+
+		// 一次I/O操作，提交后到完成前地址不能变
+		struct IoOp : WaitNode
+		{
+			IoOpcode code = IoOpcode::Read;
+			int fd = -1;
+			void *addr = nullptr;		  //缓冲区或sockaddr
+			size_t len = 0;				  //缓冲区长度或地址长度
+			int64_t offset = -1;		  //文件偏移，<0为文件当前位置
+			socklen_t *addrlen = nullptr; //accept取回的地址长度
+			int flags = 0;				  //send/recv的flags，或注册缓冲区序号
+			int result = 0;
+			bool polling = false; //io_uring：当前提交的是等待就绪的POLL_ADD
+			bool started = false; //epoll：connect已经发起
+			IoGroup *group = nullptr;
+			__kernel_timespec ts{};
+			std::chrono::steady_clock::time_point deadline;
+
+			bool reads() const
+			{
+				return code == IoOpcode::Read || code == IoOpcode::ReadFixed || code == IoOpcode::Recv || code == IoOpcode::Accept;
+			}
+		};
+
+		// 操作经内核从提交线程交给I/O线程，TSAN看不到这条同步关系，需要手动标注
+		inline void io_handoff_release(void *op)
+		{
+#if defined(__SANITIZE_THREAD__)
+			__tsan_release(op);
+#else
+			(void)op;
+#endif
+		}
+
+		inline void io_handoff_acquire(void *op)
+		{
+#if defined(__SANITIZE_THREAD__)
+			__tsan_acquire(op);
+#else
+			(void)op;
+#endif
+		}
+
+		/**
+		 * @brief io_uring的提交/完成队列
+		 * @details 直接使用系统调用与内核共享的内存环，不依赖liburing。
+		 *          提交队列的使用者需自行加锁，完成队列只由一个线程读取
+		 *
+		 */
+		class IoUring
+		{
+		public:
+			IoUring() = default;
+			IoUring(const IoUring &) = delete;
+			IoUring &operator=(const IoUring &) = delete;
+
+			~IoUring()
+			{
+				close();
+			}
+
+			// 成功返回0，失败返回-errno
+			int open(unsigned entries)
+			{
+				io_uring_params p;
+				memset(&p, 0, sizeof(p));
+				int fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+				if (fd < 0)
+					return -errno;
+				m_fd = fd;
+
+				m_sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+				m_cqSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+				bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+				if (single)
+					m_sqSize = m_cqSize = std::max(m_sqSize, m_cqSize);
+				m_sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+
+				int err = 0;
+				char *sq = static_cast<char *>(map(m_sqSize, IORING_OFF_SQ_RING, err));
+				m_sqMap = sq;
+				char *cq = single ? sq : static_cast<char *>(map(m_cqSize, IORING_OFF_CQ_RING, err));
+				m_cqMap = single ? nullptr : cq;
+				m_sqes = static_cast<io_uring_sqe *>(map(m_sqesSize, IORING_OFF_SQES, err));
+				if (err)
+				{
+					close();
+					return err;
+				}
+
+				m_sqHead = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+				m_sqTail = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+				m_sqMask = *reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+				m_sqEntries = p.sq_entries;
+				m_cqHead = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+				m_cqTail = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+				m_cqMask = *reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+				m_cqes = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+
+				//提交队列的间接数组固定为恒等映射
+				unsigned *array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+				for (unsigned i = 0; i < m_sqEntries; ++i)
+					array[i] = i;
+				m_tail = *m_sqTail;
+				return 0;
+			}
+
+			void close()
+			{
+				if (m_sqes)
+					munmap(m_sqes, m_sqesSize);
+				if (m_cqMap)
+					munmap(m_cqMap, m_cqSize);
+				if (m_sqMap)
+					munmap(m_sqMap, m_sqSize);
+				if (m_fd >= 0)
+					::close(m_fd);
+				m_sqes = nullptr;
+				m_cqMap = m_sqMap = nullptr;
+				m_fd = -1;
+			}
+
+			// 内核是否支持全部操作码
+			bool supports(std::initializer_list<uint8_t> ops)
+			{
+				const unsigned count = 256;
+				std::vector<char> buf(sizeof(io_uring_probe) + count * sizeof(io_uring_probe_op), 0);
+				io_uring_probe *probe = reinterpret_cast<io_uring_probe *>(buf.data());
+				if (syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PROBE, probe, count) < 0)
+					return false;
+
+				for (uint8_t op : ops)
+				{
+					if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+						return false;
+				}
+				return true;
+			}
+
+			// 取一个空的提交项，队列满时返回nullptr，需先submit()
+			io_uring_sqe *get_sqe()
+			{
+				if (m_tail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) >= m_sqEntries)
+					return nullptr;
+
+				io_uring_sqe *sqe = &m_sqes[m_tail & m_sqMask];
+				memset(sqe, 0, sizeof(*sqe));
+				return sqe;
+			}
+
+			// 填好get_sqe()取得的提交项后调用
+			void advance()
+			{
+				__atomic_store_n(m_sqTail, ++m_tail, __ATOMIC_RELEASE);
+				m_unsubmitted++;
+			}
+
+			unsigned unsubmitted() const
+			{
+				return m_unsubmitted;
+			}
+
+			// 一次系统调用提交所有未提交的项，返回提交数或-errno
+			int submit()
+			{
+				if (m_unsubmitted == 0)
+					return 0;
+
+				int ret = enter(m_unsubmitted, 0, 0);
+				if (ret < 0)
+					return -errno;
+				m_unsubmitted -= (unsigned)ret;
+				return ret;
+			}
+
+			// 阻塞直到至少有一个完成项
+			void wait()
+			{
+				enter(0, 1, IORING_ENTER_GETEVENTS);
+			}
+
+			// 依次处理完成项，处理前先归还该项
+			template <typename F>
+			void reap(F &&f)
+			{
+				unsigned head = *m_cqHead;
+				unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+				for (; head != tail; ++head)
+				{
+					io_uring_cqe *cqe = &m_cqes[head & m_cqMask];
+					uint64_t data = cqe->user_data;
+					int res = cqe->res;
+					__atomic_store_n(m_cqHead, head + 1, __ATOMIC_RELEASE);
+					f(data, res);
+				}
+			}
+
+			int register_buffers(const iovec *iov, unsigned count)
+			{
+				return syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_BUFFERS, iov, count) < 0 ? -errno : 0;
+			}
+
+			int unregister_buffers()
+			{
+				return syscall(__NR_io_uring_register, m_fd, IORING_UNREGISTER_BUFFERS, nullptr, 0) < 0 ? -errno : 0;
+			}
+
+		private:
+			void *map(size_t size, off_t offset, int &err)
+			{
+				if (err)
+					return nullptr;
+
+				void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, offset);
+				if (p != MAP_FAILED)
+					return p;
+				err = -errno;
+				return nullptr;
+			}
+
+			int enter(unsigned submit, unsigned complete, unsigned flags)
+			{
+				return (int)syscall(__NR_io_uring_enter, m_fd, submit, complete, flags, nullptr, 0);
+			}
+
+			int m_fd = -1;
+			void *m_sqMap = nullptr;
+			void *m_cqMap = nullptr;
+			size_t m_sqSize = 0;
+			size_t m_cqSize = 0;
+			size_t m_sqesSize = 0;
+			io_uring_sqe *m_sqes = nullptr;
+			unsigned *m_sqHead = nullptr;
+			unsigned *m_sqTail = nullptr;
+			unsigned m_sqMask = 0;
+			unsigned m_sqEntries = 0;
+			unsigned m_tail = 0;
+			unsigned m_unsubmitted = 0;
+			unsigned *m_cqHead = nullptr;
+			unsigned *m_cqTail = nullptr;
+			unsigned m_cqMask = 0;
+			io_uring_cqe *m_cqes = nullptr;
+		};
+
+		// co_await io.read(...)等单个操作
+		struct IoAwaiter : IoOp
+		{
+			IoService *io = nullptr;
+
+			inline bool await_ready();
+			inline bool await_suspend(std::coroutine_handle<> h);
+
+			int await_resume() const noexcept
+			{
+				return result;
+			}
+		};
+
+	} // namespace detail
+
+	/**
+	 * @brief 协程异步I/O
+	 * @details co_await读写、accept、connect与定时，等待期间不占用工作线程。
+	 *          io_uring后端：提交方在自己的线程上一次系统调用提交，I/O线程等待完成队列；
+	 *          recv/send/accept先直接尝试，EAGAIN时才提交；内核对非阻塞套接字返回EAGAIN时先提交POLL_ADD，
+	 *          就绪后重新提交。
+	 *          epoll后端：先在调用线程上直接尝试，EAGAIN时登记等待，就绪后由I/O线程执行并唤醒；
+	 *          普通文件不支持epoll，读写总是在调用线程上同步完成。
+	 *          完成后协程回到挂起时所在的调度器，不在调度器中挂起的协程在I/O线程上恢复。
+	 *          结果与io_uring一致：成功为字节数(accept为新fd)，失败为-errno。
+	 *          套接字应为非阻塞，accept得到的fd也是非阻塞的。
+	 *          析构前应等所有I/O协程结束，析构时仍挂起的操作不会再恢复
+	 *
+	 */
+	class IoService
+	{
+	public:
+		/**
+		 * @brief Construct a new Io Service object
+		 *
+		 * @param backend 后端
+		 * @param entries io_uring提交队列长度
+		 * @throw std::system_error 指定Uring但内核不支持，或创建epoll/eventfd失败
+		 */
+		explicit IoService(IoBackend backend = IoBackend::Auto, unsigned entries = 256)
+		{
+			if (backend != IoBackend::Epoll)
+			{
+				int err = m_ring.open(entries);
+				if (err == 0 && !m_ring.supports({IORING_OP_NOP, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_READ_FIXED,
+												  IORING_OP_WRITE_FIXED, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_ACCEPT,
+												  IORING_OP_CONNECT, IORING_OP_TIMEOUT, IORING_OP_POLL_ADD}))
+				{
+					m_ring.close();
+					err = -EOPNOTSUPP;
+				}
+
+				if (err == 0)
+					m_backend = IoBackend::Uring;
+				else if (backend == IoBackend::Uring)
+					throw std::system_error(-err, std::system_category(), "io_uring_setup");
+			}
+
+			if (m_backend != IoBackend::Uring)
+			{
+				m_backend = IoBackend::Epoll;
+				m_epoll = epoll_create1(EPOLL_CLOEXEC);
+				if (m_epoll < 0)
+					throw std::system_error(errno, std::system_category(), "epoll_create1");
+
+				m_wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+				epoll_event ev;
+				ev.events = EPOLLIN;
+				ev.data.fd = m_wake;
+				if (m_wake < 0 || epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wake, &ev) < 0)
+				{
+					int err = errno;
+					if (m_wake >= 0)
+						close(m_wake);
+					close(m_epoll);
+					throw std::system_error(err, std::system_category(), "eventfd");
+				}
+			}
+
+			m_thread = std::thread(&IoService::run, this);
+		}
+
+		~IoService()
+		{
+			m_stop.store(true);
+			if (m_backend == IoBackend::Uring)
+			{
+				//user_data为0的NOP唤醒I/O线程
+				std::lock_guard<std::mutex> locker(m_sqMutex);
+				io_uring_sqe *sqe = next_sqe();
+				sqe->opcode = IORING_OP_NOP;
+				m_ring.advance();
+				m_ring.submit();
+			}
+			else
+			{
+				wake();
+			}
+
+			m_thread.join();
+			if (m_backend == IoBackend::Epoll)
+			{
+				close(m_wake);
+				close(m_epoll);
+			}
+		}
+
+		IoService(const IoService &) = delete;
+		IoService &operator=(const IoService &) = delete;
+
+		IoBackend backend() const
+		{
+			return m_backend;
+		}
+
+		/**
+		 * @brief co_await io.read(fd, buf, len, offset)
+		 *
+		 * @param offset 文件偏移，<0时从文件当前位置读(套接字、管道)
+		 * @return int 读到的字节数，0为文件尾或对端关闭，失败为-errno
+		 */
+		detail::IoAwaiter read(int fd, void *buf, size_t len, int64_t offset = -1)
+		{
+			return make(detail::IoOpcode::Read, fd, buf, len, offset, 0);
+		}
+
+		detail::IoAwaiter write(int fd, const void *buf, size_t len, int64_t offset = -1)
+		{
+			return make(detail::IoOpcode::Write, fd, const_cast<void *>(buf), len, offset, 0);
+		}
+
+		/**
+		 * @brief 读到register_buffers()注册的缓冲区中
+		 * @details io_uring不再为每次读写映射用户页；epoll后端与read()相同
+		 *
+		 * @param buf 在第index个注册缓冲区之内
+		 * @param index 注册缓冲区序号
+		 */
+		detail::IoAwaiter read_fixed(int fd, void *buf, size_t len, int64_t offset, int index)
+		{
+			return make(detail::IoOpcode::ReadFixed, fd, buf, len, offset, index);
+		}
+
+		detail::IoAwaiter write_fixed(int fd, const void *buf, size_t len, int64_t offset, int index)
+		{
+			return make(detail::IoOpcode::WriteFixed, fd, const_cast<void *>(buf), len, offset, index);
+		}
+
+		detail::IoAwaiter recv(int fd, void *buf, size_t len, int flags = 0)
+		{
+			return make(detail::IoOpcode::Recv, fd, buf, len, -1, flags);
+		}
+
+		detail::IoAwaiter send(int fd, const void *buf, size_t len, int flags = MSG_NOSIGNAL)
+		{
+			return make(detail::IoOpcode::Send, fd, const_cast<void *>(buf), len, -1, flags);
+		}
+
+		/**
+		 * @brief co_await io.accept(fd)
+		 *
+		 * @return int 非阻塞的新连接fd，失败为-errno
+		 */
+		detail::IoAwaiter accept(int fd, sockaddr *addr = nullptr, socklen_t *addrlen = nullptr)
+		{
+			detail::IoAwaiter a = make(detail::IoOpcode::Accept, fd, addr, 0, -1, 0);
+			a.addrlen = addrlen;
+			return a;
+		}
+
+		// co_await io.connect(fd, addr, len)，成功为0
+		detail::IoAwaiter connect(int fd, const sockaddr *addr, socklen_t addrlen)
+		{
+			return make(detail::IoOpcode::Connect, fd, const_cast<sockaddr *>(addr), addrlen, -1, 0);
+		}
+
+		// co_await io.sleep_for(d)，不占用工作线程的定时
+		detail::IoAwaiter sleep_for(std::chrono::nanoseconds d)
+		{
+			detail::IoAwaiter a = make(detail::IoOpcode::Timeout, -1, nullptr, 0, -1, 0);
+			if (d.count() < 0)
+				d = d.zero();
+			a.ts.tv_sec = d.count() / 1000000000;
+			a.ts.tv_nsec = d.count() % 1000000000;
+			a.deadline = std::chrono::steady_clock::now() + d;
+			return a;
+		}
+
+		/**
+		 * @brief 注册固定缓冲区，供read_fixed()/write_fixed()使用
+		 * @details 注册时内核一次性锁定这些页，应在没有操作进行时调用；epoll后端什么也不做
+		 *
+		 * @return int 0或-errno
+		 */
+		int register_buffers(const iovec *iov, unsigned count)
+		{
+			return m_backend == IoBackend::Uring ? m_ring.register_buffers(iov, count) : 0;
+		}
+
+		int unregister_buffers()
+		{
+			return m_backend == IoBackend::Uring ? m_ring.unregister_buffers() : 0;
+		}
+
+	private:
+		friend struct detail::IoAwaiter;
+		friend class IoBatch;
+
+		struct FdState
+		{
+			detail::WaitList readers;
+			detail::WaitList writers;
+		};
+
+		detail::IoAwaiter make(detail::IoOpcode code, int fd, void *addr, size_t len, int64_t offset, int flags)
+		{
+			detail::IoAwaiter a;
+			a.io = this;
+			a.code = code;
+			a.fd = fd;
+			a.addr = addr;
+			a.len = len;
+			a.offset = offset;
+			a.flags = flags;
+			return a;
+		}
+
+		// 不挂起就能完成时返回true
+		bool start(detail::IoOp &op)
+		{
+			if (op.code == detail::IoOpcode::Timeout)
+			{
+				op.result = 0;
+				return op.ts.tv_sec == 0 && op.ts.tv_nsec == 0;
+			}
+			//io_uring下套接字收发先在调用线程上试一次，已就绪时不经过I/O线程
+			if (m_backend == IoBackend::Uring && op.code != detail::IoOpcode::Recv && op.code != detail::IoOpcode::Send &&
+				op.code != detail::IoOpcode::Accept)
+				return false;
+
+			perform(op);
+			return op.result != -EAGAIN;
+		}
+
+		// 提交或登记等待，无法等待时返回false，op.result为错误
+		bool suspend(detail::IoOp &op)
+		{
+			if (m_backend == IoBackend::Uring)
+			{
+				submit_one(op);
+				return true;
+			}
+
+			if (op.code == detail::IoOpcode::Timeout)
+			{
+				add_timer(op);
+				return true;
+			}
+			return wait_fd(op);
+		}
+
+		// IoBatch：io_uring一次系统调用提交全部操作
+		void submit_all(detail::IoOp *ops, size_t count)
+		{
+			if (m_backend == IoBackend::Uring)
+			{
+				std::lock_guard<std::mutex> locker(m_sqMutex);
+				for (size_t i = 0; i < count; ++i)
+					prepare(ops[i]);
+				m_ring.submit();
+				return;
+			}
+
+			for (size_t i = 0; i < count; ++i)
+			{
+				if (start(ops[i]) || !suspend(ops[i]))
+					finish(ops[i], ops[i].result);
+			}
+		}
+
+		void finish(detail::IoOp &op, int res)
+		{
+			op.result = res;
+			if (detail::IoGroup *g = op.group)
+			{
+				if (g->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+					g->node.wake();
+			}
+			else
+			{
+				op.wake();
+			}
+		}
+
+		void run()
+		{
+			if (m_backend == IoBackend::Uring)
+				run_uring();
+			else
+				run_epoll();
+		}
+
+		//------------------------------ io_uring ------------------------------
+
+		// 提交队列满时先提交已有的项，需持有m_sqMutex
+		io_uring_sqe *next_sqe()
+		{
+			io_uring_sqe *sqe;
+			while (!(sqe = m_ring.get_sqe()))
+			{
+				if (m_ring.submit() <= 0)
+					std::this_thread::yield();
+			}
+			return sqe;
+		}
+
+		void prepare(detail::IoOp &op)
+		{
+			detail::io_handoff_release(&op);
+			io_uring_sqe *sqe = next_sqe();
+			sqe->user_data = (uint64_t)(uintptr_t)&op;
+			sqe->fd = op.fd;
+			sqe->addr = (uint64_t)(uintptr_t)op.addr;
+			sqe->len = (uint32_t)op.len;
+			sqe->off = (uint64_t)op.offset;
+
+			if (op.polling)
+			{
+				sqe->opcode = IORING_OP_POLL_ADD;
+				sqe->addr = 0;
+				sqe->len = 0;
+				sqe->off = 0;
+				sqe->poll32_events = op.reads() ? POLLIN : POLLOUT;
+				m_ring.advance();
+				return;
+			}
+
+			switch (op.code)
+			{
+			case detail::IoOpcode::Read:
+				sqe->opcode = IORING_OP_READ;
+				break;
+			case detail::IoOpcode::Write:
+				sqe->opcode = IORING_OP_WRITE;
+				break;
+			case detail::IoOpcode::ReadFixed:
+				sqe->opcode = IORING_OP_READ_FIXED;
+				sqe->buf_index = (uint16_t)op.flags;
+				break;
+			case detail::IoOpcode::WriteFixed:
+				sqe->opcode = IORING_OP_WRITE_FIXED;
+				sqe->buf_index = (uint16_t)op.flags;
+				break;
+			case detail::IoOpcode::Recv:
+				sqe->opcode = IORING_OP_RECV;
+				sqe->off = 0;
+				sqe->msg_flags = (uint32_t)op.flags;
+				break;
+			case detail::IoOpcode::Send:
+				sqe->opcode = IORING_OP_SEND;
+				sqe->off = 0;
+				sqe->msg_flags = (uint32_t)op.flags;
+				break;
+			case detail::IoOpcode::Accept:
+				sqe->opcode = IORING_OP_ACCEPT;
+				sqe->len = 0;
+				sqe->addr2 = (uint64_t)(uintptr_t)op.addrlen;
+				sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+				break;
+			case detail::IoOpcode::Connect:
+				sqe->opcode = IORING_OP_CONNECT;
+				sqe->len = 0;
+				sqe->off = op.len;
+				break;
+			case detail::IoOpcode::Timeout:
+				sqe->opcode = IORING_OP_TIMEOUT;
+				sqe->fd = -1;
+				sqe->addr = (uint64_t)(uintptr_t)&op.ts;
+				sqe->len = 1;
+				sqe->off = 0;
+				break;
+			}
+			m_ring.advance();
+		}
+
+		void complete_uring(detail::IoOp &op, int res)
+		{
+			detail::io_handoff_acquire(&op);
+			if (op.polling)
+			{
+				//就绪后重新提交原操作；connect就绪即完成，取套接字上的错误
+				op.polling = false;
+				if (res >= 0 && op.code == detail::IoOpcode::Connect)
+				{
+					res = -socket_error(op.fd);
+				}
+				else if (res >= 0)
+				{
+					submit_one(op);
+					return;
+				}
+			}
+			else if (res == -EAGAIN || (res == -EINPROGRESS && op.code == detail::IoOpcode::Connect))
+			{
+				op.polling = true;
+				submit_one(op);
+				return;
+			}
+
+			if (op.code == detail::IoOpcode::Timeout && res == -ETIME)
+				res = 0;
+			finish(op, res);
+		}
+
+		void submit_one(detail::IoOp &op)
+		{
+			std::lock_guard<std::mutex> locker(m_sqMutex);
+			prepare(op);
+			m_ring.submit();
+		}
+
+		void run_uring()
+		{
+			for (;;)
+			{
+				{
+					//提交失败时留下的项
+					std::unique_lock<std::mutex> locker(m_sqMutex, std::try_to_lock);
+					if (locker && m_ring.unsubmitted())
+						m_ring.submit();
+				}
+
+				m_ring.wait();
+
+				bool stop = false;
+				m_ring.reap([this, &stop](uint64_t data, int res) {
+					if (data == 0)
+						stop = true;
+					else
+						complete_uring(*reinterpret_cast<detail::IoOp *>((uintptr_t)data), res);
+				});
+
+				if (stop && m_stop.load())
+					return;
+			}
+		}
+
+		//------------------------------ epoll ------------------------------
+
+		static int socket_error(int fd)
+		{
+			int err = 0;
+			socklen_t len = sizeof(err);
+			if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+				return errno;
+			return err;
+		}
+
+		// 直接执行一次系统调用，结果存入op.result
+		static void perform(detail::IoOp &op)
+		{
+			ssize_t ret = 0;
+			do
+			{
+				switch (op.code)
+				{
+				case detail::IoOpcode::Read:
+				case detail::IoOpcode::ReadFixed:
+					ret = op.offset < 0 ? ::read(op.fd, op.addr, op.len) : ::pread(op.fd, op.addr, op.len, op.offset);
+					break;
+				case detail::IoOpcode::Write:
+				case detail::IoOpcode::WriteFixed:
+					ret = op.offset < 0 ? ::write(op.fd, op.addr, op.len) : ::pwrite(op.fd, op.addr, op.len, op.offset);
+					break;
+				case detail::IoOpcode::Recv:
+					ret = ::recv(op.fd, op.addr, op.len, op.flags);
+					break;
+				case detail::IoOpcode::Send:
+					ret = ::send(op.fd, op.addr, op.len, op.flags);
+					break;
+				case detail::IoOpcode::Accept:
+					ret = ::accept4(op.fd, static_cast<sockaddr *>(op.addr), op.addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+					break;
+				case detail::IoOpcode::Connect:
+					if (op.started)
+					{
+						op.result = -socket_error(op.fd);
+						return;
+					}
+					op.started = true;
+					ret = ::connect(op.fd, static_cast<sockaddr *>(op.addr), (socklen_t)op.len);
+					if (ret < 0 && errno == EINPROGRESS)
+					{
+						op.result = -EAGAIN;
+						return;
+					}
+					break;
+				case detail::IoOpcode::Timeout:
+					break;
+				}
+			} while (ret < 0 && errno == EINTR);
+
+			op.result = ret < 0 ? -errno : (int)ret;
+		}
+
+		// 需持有m_mutex，按等待者重新设置关注的事件
+		int arm(int fd, FdState &s)
+		{
+			epoll_event ev;
+			ev.events = (uint32_t)EPOLLONESHOT | (s.readers.empty() ? 0u : (uint32_t)EPOLLIN) | (s.writers.empty() ? 0u : (uint32_t)EPOLLOUT);
+			ev.data.fd = fd;
+			if (epoll_ctl(m_epoll, EPOLL_CTL_MOD, fd, &ev) == 0)
+				return 0;
+			if (errno == ENOENT && epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev) == 0)
+				return 0;
+			return -errno;
+		}
+
+		bool wait_fd(detail::IoOp &op)
+		{
+			std::lock_guard<std::mutex> locker(m_mutex);
+			if ((size_t)op.fd >= m_fds.size())
+				m_fds.resize((size_t)op.fd + 1);
+
+			FdState &s = m_fds[op.fd];
+			detail::WaitList &list = op.reads() ? s.readers : s.writers;
+			list.push_back(&op);
+			int err = arm(op.fd, s);
+			if (err)
+			{
+				list.remove(&op);
+				op.result = err;
+				return false;
+			}
+			return true;
+		}
+
+		// fd就绪：取走对应方向的等待者逐个执行，仍是EAGAIN的放回去并重新关注
+		void on_ready(int fd, uint32_t events)
+		{
+			detail::WaitNode *readers = nullptr, *writers = nullptr;
+			{
+				std::lock_guard<std::mutex> locker(m_mutex);
+				FdState &s = m_fds[fd];
+				if (events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+					readers = s.readers.take_all();
+				if (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+					writers = s.writers.take_all();
+			}
+
+			detail::WaitList retry;
+			perform_all(readers, retry);
+			perform_all(writers, retry);
+
+			std::lock_guard<std::mutex> locker(m_mutex);
+			FdState &s = m_fds[fd];
+			while (detail::WaitNode *node = retry.pop_front())
+				(static_cast<detail::IoOp *>(node)->reads() ? s.readers : s.writers).push_back(node);
+			if (!s.readers.empty() || !s.writers.empty())
+				arm(fd, s);
+		}
+
+		void perform_all(detail::WaitNode *head, detail::WaitList &retry)
+		{
+			while (head)
+			{
+				detail::WaitNode *next = head->next;
+				detail::IoOp &op = *static_cast<detail::IoOp *>(head);
+				perform(op);
+				if (op.result == -EAGAIN)
+					retry.push_back(&op);
+				else
+					finish(op, op.result);
+				head = next;
+			}
+		}
+
+		void add_timer(detail::IoOp &op)
+		{
+			bool first;
+			{
+				std::lock_guard<std::mutex> locker(m_mutex);
+				auto it = m_timers.emplace(op.deadline, &op);
+				first = it == m_timers.begin();
+			}
+			if (first)
+				wake();
+		}
+
+		// 到最早定时的毫秒数，向上取整
+		int next_timeout()
+		{
+			std::lock_guard<std::mutex> locker(m_mutex);
+			if (m_timers.empty())
+				return -1;
+
+			auto left = m_timers.begin()->first - std::chrono::steady_clock::now();
+			if (left.count() <= 0)
+				return 0;
+			return (int)std::chrono::ceil<std::chrono::milliseconds>(left).count();
+		}
+
+		void expire_timers()
+		{
+			detail::WaitList expired;
+			{
+				std::lock_guard<std::mutex> locker(m_mutex);
+				auto now = std::chrono::steady_clock::now();
+				auto it = m_timers.begin();
+				for (; it != m_timers.end() && it->first <= now; ++it)
+					expired.push_back(it->second);
+				m_timers.erase(m_timers.begin(), it);
+			}
+
+			while (detail::WaitNode *node = expired.pop_front())
+				finish(*static_cast<detail::IoOp *>(node), 0);
+		}
+
+		void wake()
+		{
+			uint64_t one = 1;
+			ssize_t ret = ::write(m_wake, &one, sizeof(one));
+			(void)ret;
+		}
+
+		void run_epoll()
+		{
+			epoll_event events[128];
+			while (!m_stop.load())
+			{
+				int n = epoll_wait(m_epoll, events, 128, next_timeout());
+				for (int i = 0; i < n; ++i)
+				{
+					if (events[i].data.fd == m_wake)
+					{
+						uint64_t value;
+						ssize_t ret = ::read(m_wake, &value, sizeof(value));
+						(void)ret;
+						continue;
+					}
+					on_ready(events[i].data.fd, events[i].events);
+				}
+				expire_timers();
+			}
+		}
+
+		IoBackend m_backend = IoBackend::Epoll;
+		std::atomic_bool m_stop{false};
+		std::thread m_thread;
+
+		detail::IoUring m_ring;
+		std::mutex m_sqMutex; //保护提交队列
+
+		int m_epoll = -1;
+		int m_wake = -1;
+		std::mutex m_mutex; //保护m_fds与m_timers
+		std::vector<FdState> m_fds; //按fd索引的等待者
+		std::multimap<std::chrono::steady_clock::time_point, detail::IoOp *> m_timers;
+	};
+
+	namespace detail
+	{
+
+		inline bool IoAwaiter::await_ready()
+		{
+			return io->start(*this);
+		}
+
+		inline bool IoAwaiter::await_suspend(std::coroutine_handle<> h)
+		{
+			suspend_on(h);
+			return io->suspend(*this);
+		}
+
+	} // namespace detail
+
+	/**
+	 * @brief 批量提交：先添加多个操作，co_await时io_uring一次系统调用全部提交，全部完成后恢复
+	 * @details 各操作并发执行，完成顺序不定，结果用添加时返回的序号取。co_await结束后可以clear()复用。
+	 *          epoll后端逐个执行，不能立即完成的登记等待
+	 *
+	 */
+	class IoBatch
+	{
+	public:
+		explicit IoBatch(IoService &io, size_t reserve = 16) : m_io(io)
+		{
+			m_ops.reserve(reserve);
+		}
+
+		IoBatch(const IoBatch &) = delete;
+		IoBatch &operator=(const IoBatch &) = delete;
+
+		size_t read(int fd, void *buf, size_t len, int64_t offset = -1)
+		{
+			return add(m_io.read(fd, buf, len, offset));
+		}
+
+		size_t write(int fd, const void *buf, size_t len, int64_t offset = -1)
+		{
+			return add(m_io.write(fd, buf, len, offset));
+		}
+
+		size_t read_fixed(int fd, void *buf, size_t len, int64_t offset, int index)
+		{
+			return add(m_io.read_fixed(fd, buf, len, offset, index));
+		}
+
+		size_t write_fixed(int fd, const void *buf, size_t len, int64_t offset, int index)
+		{
+			return add(m_io.write_fixed(fd, buf, len, offset, index));
+		}
+
+		size_t recv(int fd, void *buf, size_t len, int flags = 0)
+		{
+			return add(m_io.recv(fd, buf, len, flags));
+		}
+
+		size_t send(int fd, const void *buf, size_t len, int flags = MSG_NOSIGNAL)
+		{
+			return add(m_io.send(fd, buf, len, flags));
+		}
+
+		// 第i个操作的结果，含义同IoService的对应操作
+		int result(size_t i) const
+		{
+			return m_ops[i].result;
+		}
+
+		size_t size() const
+		{
+			return m_ops.size();
+		}
+
+		void clear()
+		{
+			m_ops.clear();
+		}
+
+		auto operator co_await() noexcept
+		{
+			struct Awaiter
+			{
+				IoBatch &batch;
+
+				bool await_ready() const noexcept
+				{
+					return batch.m_ops.empty();
+				}
+
+				bool await_suspend(std::coroutine_handle<> h)
+				{
+					//多计一次，提交途中完成的操作不会提前唤醒
+					detail::IoGroup &g = batch.m_group;
+					size_t n = batch.m_ops.size();
+					g.node.suspend_on(h);
+					g.remaining.store(n + 1, std::memory_order_relaxed);
+					for (auto &op : batch.m_ops)
+						op.group = &g;
+
+					batch.m_io.submit_all(batch.m_ops.data(), n);
+					return g.remaining.fetch_sub(1, std::memory_order_acq_rel) != 1;
+				}
+
+				void await_resume() const noexcept
+				{
+				}
+			};
+			return Awaiter{*this};
+		}
+
+	private:
+		size_t add(const detail::IoAwaiter &a)
+		{
+			m_ops.push_back(a);
+			return m_ops.size() - 1;
+		}
+
+		IoService &m_io;
+		std::vector<detail::IoOp> m_ops;
+		detail::IoGroup m_group;
+	};
+
+} // namespace wotsen
+
+#endif // !__wotsen_CO_IO_SERVICE_H__
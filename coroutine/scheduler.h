@@ -0,0 +1,480 @@
+/**
+ * @file scheduler.h
+ * @author yuwangliang (wotsen@outlook.com)
+ * @brief M:N协程调度器
+ * @version 0.1
+ * @date 2020-08-16
+ *
+ * @copyright Copyright (c) 2020 yuwangliang
+ *
+ */
+#ifndef __wotsen_CO_SCHEDULER_H__
+#define __wotsen_CO_SCHEDULER_H__
+
+#include <mutex>
+#include <deque>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <coroutine>
+#include "task.h"
+#include "../thread-pool/adaptive-wait.h"
+
+namespace wotsen
+{
+
+	namespace detail
+	{
+
+		// spawn的外层协程，结束时自行销毁帧
+		struct Spawned
+		{
+			struct promise_type : PooledFrame
+			{
+				Spawned get_return_object() noexcept
+				{
+					return Spawned{std::coroutine_handle<promise_type>::from_promise(*this)};
+				}
+
+				std::suspend_always initial_suspend() noexcept
+				{
+					return {};
+				}
+
+				std::suspend_never final_suspend() noexcept
+				{
+					return {};
+				}
+
+				void return_void() noexcept
+				{
+				}
+
+				void unhandled_exception() noexcept
+				{
+					std::terminate();
+				}
+			};
+
+			std::coroutine_handle<promise_type> handle;
+		};
+
+	} // namespace detail
+
+	/**
+	 * @brief M:N协程调度器
+	 * @details 大量无栈协程(Task)在少量工作线程上执行。每个工作线程有一个定长的本地运行队列，
+	 *          只有自己在队尾放入，自己和其他线程都从队头CAS取出；本地队列满时把一半移到全局队列。
+	 *          工作线程依次从next槽、本地队列、全局队列取协程，都没有时从其他线程的本地队列偷一半，
+	 *          仍然没有才休眠。每执行61次检查一次全局队列，避免全局队列中的协程饿死。
+	 *          协程等待同步原语时不阻塞线程：原语保存其句柄后挂起，唤醒方调用post()重新入队，
+	 *          在工作线程中唤醒时放入next槽，被唤醒者紧接着在唤醒方的线程上执行(交接)
+	 *
+	 */
+	class Scheduler
+	{
+	public:
+		/**
+		 * @brief Construct a new Scheduler object
+		 *
+		 * @param workers 工作线程数，<=0时取CPU数
+		 */
+		explicit Scheduler(int workers = 0)
+		{
+			if (workers <= 0)
+				workers = std::max(1u, std::thread::hardware_concurrency());
+
+			for (int i = 0; i < workers; ++i)
+				m_workers.emplace_back(new Worker(i));
+			for (int i = 0; i < workers; ++i)
+				m_workers[i]->thread = std::thread(&Scheduler::worker_loop, this, i);
+		}
+
+		// 先等可运行的协程执行完，挂起中从未被唤醒的协程不会被销毁
+		~Scheduler()
+		{
+			stop();
+		}
+
+		Scheduler(const Scheduler &) = delete;
+		Scheduler &operator=(const Scheduler &) = delete;
+
+		/**
+		 * @brief 启动一个协程，不等待其结束
+		 * @details 任务抛出的异常被忽略
+		 *
+		 * @param task 任务
+		 */
+		void spawn(Task<void> task)
+		{
+			m_live.fetch_add(1, std::memory_order_relaxed);
+			post(run_spawned(this, std::move(task)).handle);
+		}
+
+		/**
+		 * @brief 协程重新入队
+		 * @details 在本调度器的工作线程中调用时放入该线程的next槽，原来的next移到本地队列尾部；
+		 *          其他线程调用时放入全局队列
+		 *
+		 * @param h 挂起的协程
+		 */
+		void post(std::coroutine_handle<> h)
+		{
+			Worker *w = local_worker();
+			if (!w)
+			{
+				push_global(h.address());
+				wake_one();
+				return;
+			}
+
+			void *old = w->next.exchange(h.address(), std::memory_order_acq_rel);
+			if (old)
+			{
+				push_local(*w, old);
+				wake_one();
+			}
+		}
+
+		/**
+		 * @brief 让出：co_await Scheduler::yield()把当前协程放到本地队列尾部，先执行其他协程
+		 * @details 不在工作线程中时不挂起
+		 *
+		 */
+		static auto yield() noexcept
+		{
+			struct Awaiter
+			{
+				Scheduler *sched;
+
+				bool await_ready() const noexcept
+				{
+					return sched == nullptr;
+				}
+
+				void await_suspend(std::coroutine_handle<> h)
+				{
+					//入队后协程可能已被其他线程偷走执行完，之后不能再访问帧中的awaiter
+					Scheduler *s = sched;
+					s->push_local(*s->m_workers[current_index()], h.address());
+					s->wake_one();
+				}
+
+				void await_resume() const noexcept
+				{
+				}
+			};
+			return Awaiter{current()};
+		}
+
+		// 等待所有spawn的协程结束
+		void wait()
+		{
+			m_done.wait([this] { return m_live.load() == 0; });
+		}
+
+		// 执行完可运行的协程后停止工作线程
+		void stop()
+		{
+			if (m_stop.exchange(true))
+				return;
+
+			m_park.notify_all();
+			for (auto &w : m_workers)
+			{
+				if (w->thread.joinable())
+					w->thread.join();
+			}
+		}
+
+		size_t workers() const
+		{
+			return m_workers.size();
+		}
+
+		// 尚未结束的spawn协程数
+		size_t live() const
+		{
+			return (size_t)m_live.load(std::memory_order_relaxed);
+		}
+
+		// 当前线程所属的调度器，非工作线程为nullptr
+		static Scheduler *current()
+		{
+			return current_ref();
+		}
+
+	private:
+		static const uint32_t LocalSize = 256; //本地队列容量
+		static const uint32_t GlobalTick = 61; //每执行多少次检查一次全局队列
+
+		struct alignas(CacheLineSize) Worker
+		{
+			explicit Worker(int i) : index(i)
+			{
+				for (auto &s : slots)
+					s.store(nullptr, std::memory_order_relaxed);
+			}
+
+			const int index;
+			std::atomic<void *> next{nullptr}; //下一个执行的协程
+			alignas(CacheLineSize) std::atomic<uint32_t> head{0}; //其他线程也会修改
+			alignas(CacheLineSize) std::atomic<uint32_t> tail{0}; //只有所属线程修改
+			std::atomic<void *> slots[LocalSize];				  //原子读写，偷取方可能读到正在被覆盖的槽，CAS失败后丢弃
+			uint32_t tick = 0;
+			uint32_t rand = 0;
+			std::thread thread;
+		};
+
+		static Scheduler *&current_ref()
+		{
+			static thread_local Scheduler *sched = nullptr;
+			return sched;
+		}
+
+		static int &current_index()
+		{
+			static thread_local int index = -1;
+			return index;
+		}
+
+		Worker *local_worker()
+		{
+			return current_ref() == this ? m_workers[current_index()].get() : nullptr;
+		}
+
+		static detail::Spawned run_spawned(Scheduler *sched, Task<void> task)
+		{
+			{
+				Task<void> t = std::move(task);
+				try
+				{
+					co_await t;
+				}
+				catch (...)
+				{
+				}
+			}
+
+			if (sched->m_live.fetch_sub(1) == 1)
+				sched->m_done.notify_all();
+		}
+
+		// 所属线程调用
+		void push_local(Worker &w, void *h)
+		{
+			for (;;)
+			{
+				uint32_t head = w.head.load(std::memory_order_acquire);
+				uint32_t tail = w.tail.load(std::memory_order_relaxed);
+				if (tail - head < LocalSize)
+				{
+					w.slots[tail % LocalSize].store(h, std::memory_order_relaxed);
+					w.tail.store(tail + 1, std::memory_order_release);
+					return;
+				}
+
+				//满了，一半连同h移到全局队列
+				uint32_t n = (tail - head) / 2;
+				void *batch[LocalSize / 2 + 1];
+				for (uint32_t i = 0; i < n; ++i)
+					batch[i] = w.slots[(head + i) % LocalSize].load(std::memory_order_relaxed);
+				if (!w.head.compare_exchange_strong(head, head + n, std::memory_order_acq_rel))
+					continue;
+
+				batch[n] = h;
+				std::lock_guard<std::mutex> locker(m_globalMutex);
+				m_global.insert(m_global.end(), batch, batch + n + 1);
+				m_globalSize.store(m_global.size(), std::memory_order_release);
+				return;
+			}
+		}
+
+		// 所属线程调用
+		void *pop_local(Worker &w)
+		{
+			if (w.next.load(std::memory_order_relaxed))
+			{
+				if (void *h = w.next.exchange(nullptr, std::memory_order_acq_rel))
+					return h;
+			}
+
+			uint32_t head = w.head.load(std::memory_order_acquire);
+			for (;;)
+			{
+				uint32_t tail = w.tail.load(std::memory_order_relaxed);
+				if (head == tail)
+					return nullptr;
+
+				void *h = w.slots[head % LocalSize].load(std::memory_order_relaxed);
+				if (w.head.compare_exchange_weak(head, head + 1, std::memory_order_acq_rel))
+					return h;
+			}
+		}
+
+		void push_global(void *h)
+		{
+			std::lock_guard<std::mutex> locker(m_globalMutex);
+			m_global.push_back(h);
+			m_globalSize.store(m_global.size(), std::memory_order_release);
+		}
+
+		// 从全局队列取一批到本地队列，返回其中一个
+		void *pop_global(Worker &w)
+		{
+			if (m_globalSize.load(std::memory_order_acquire) == 0)
+				return nullptr;
+
+			std::lock_guard<std::mutex> locker(m_globalMutex);
+			if (m_global.empty())
+				return nullptr;
+
+			//不超过本地队列的空位，push_local不会再转回全局队列
+			uint32_t used = w.tail.load(std::memory_order_relaxed) - w.head.load(std::memory_order_acquire);
+			size_t n = std::min(m_global.size() / m_workers.size() + 1, m_global.size());
+			n = std::min(n, (size_t)std::min(LocalSize - used, LocalSize / 2));
+			void *h = m_global.front();
+			m_global.pop_front();
+			for (size_t i = 1; i < n; ++i)
+			{
+				push_local(w, m_global.front());
+				m_global.pop_front();
+			}
+			m_globalSize.store(m_global.size(), std::memory_order_release);
+			return h;
+		}
+
+		// 从victim偷一半到w的本地队列(w的本地队列为空)，返回其中一个
+		void *steal(Worker &w, Worker &victim)
+		{
+			uint32_t tail = w.tail.load(std::memory_order_relaxed);
+			uint32_t n = 0;
+			for (;;)
+			{
+				uint32_t vhead = victim.head.load(std::memory_order_acquire);
+				uint32_t vtail = victim.tail.load(std::memory_order_acquire);
+				n = vtail - vhead;
+				n = n - n / 2;
+				if (n == 0)
+				{
+					//本地队列空时才偷next，它多半马上就会被所属线程执行
+					if (victim.next.load(std::memory_order_relaxed))
+						return victim.next.exchange(nullptr, std::memory_order_acq_rel);
+					return nullptr;
+				}
+				if (n > LocalSize / 2)
+					continue; //读到的head与tail不一致
+
+				for (uint32_t i = 0; i < n; ++i)
+				{
+					void *h = victim.slots[(vhead + i) % LocalSize].load(std::memory_order_relaxed);
+					w.slots[(tail + i) % LocalSize].store(h, std::memory_order_relaxed);
+				}
+				if (victim.head.compare_exchange_strong(vhead, vhead + n, std::memory_order_acq_rel))
+					break;
+			}
+
+			n--;
+			void *h = w.slots[(tail + n) % LocalSize].load(std::memory_order_relaxed);
+			if (n > 0)
+				w.tail.store(tail + n, std::memory_order_release);
+			return h;
+		}
+
+		// 唤醒一个空闲的工作线程；已有线程被唤醒还没开始取协程时不重复唤醒，由它取到协程后再接力唤醒
+		void wake_one()
+		{
+			if (m_waking.load(std::memory_order_relaxed) || m_waking.exchange(true))
+				return;
+			if (!m_park.notify(1))
+				m_waking.store(false);
+		}
+
+		void *find_work(Worker &w)
+		{
+			void *h = nullptr;
+			if (++w.tick % GlobalTick == 0 && (h = pop_global(w)))
+				return h;
+			if ((h = pop_local(w)) || (h = pop_global(w)))
+				return h;
+
+			size_t n = m_workers.size();
+			w.rand = w.rand * 1664525u + 1013904223u;
+			for (size_t i = 0; i < n; ++i)
+			{
+				Worker &victim = *m_workers[(w.rand + i) % n];
+				if (&victim != &w && (h = steal(w, victim)))
+					return h;
+			}
+			return nullptr;
+		}
+
+		bool has_work() const
+		{
+			if (m_globalSize.load(std::memory_order_acquire) > 0)
+				return true;
+
+			for (auto &w : m_workers)
+			{
+				if (w->next.load(std::memory_order_acquire) ||
+					w->head.load(std::memory_order_acquire) != w->tail.load(std::memory_order_acquire))
+					return true;
+			}
+			return false;
+		}
+
+		void worker_loop(int index)
+		{
+			current_ref() = this;
+			current_index() = index;
+			Worker &w = *m_workers[index];
+			w.rand = (uint32_t)index * 2654435761u + 1;
+
+			bool woken = false;
+			for (;;)
+			{
+				if (void *h = find_work(w))
+				{
+					if (woken)
+					{
+						woken = false;
+						if (has_work())
+							wake_one();
+					}
+					std::coroutine_handle<>::from_address(h).resume();
+					continue;
+				}
+
+				woken = false;
+				if (m_stop.load())
+					break;
+
+				//被唤醒时协程可能已被别的线程取走，也要退出等待交还m_waking，否则之后的post都不会再唤醒
+				m_park.wait([this] { return has_work() || m_stop.load() || m_waking.load(); });
+				m_waking.store(false);
+				woken = true;
+			}
+
+			current_ref() = nullptr;
+		}
+
+		std::vector<std::unique_ptr<Worker>> m_workers;
+
+		std::mutex m_globalMutex;
+		std::deque<void *> m_global; //全局队列
+		std::atomic<size_t> m_globalSize{0};
+
+		ParkWait m_park; //空闲的工作线程在此休眠
+		std::atomic_bool m_waking{false}; //已唤醒一个工作线程，它还没有取到协程
+		std::atomic_bool m_stop{false};
+
+		std::atomic<long> m_live{0}; //未结束的spawn协程数
+		ParkWait m_done;
+	};
+
+} // namespace wotsen
+
+#endif // !__wotsen_CO_SCHEDULER_H__
@@ -0,0 +1,495 @@
+/**
+ * @file task.h
+ * @author yuwangliang (wotsen@outlook.com)
+ * @brief C++20无栈协程任务
+ * @version 0.1
+ * @date 2020-08-16
+ *
+ * @copyright Copyright (c) 2020 yuwangliang
+ *
+ */
+#ifndef __wotsen_CO_TASK_H__
+#define __wotsen_CO_TASK_H__
+
+#if __cplusplus < 202002L
+#error "wotsen coroutine task.h requires C++20"
+#endif
+
+#include <new>
+#include <mutex>
+#include <cstddef>
+#include <utility>
+#include <exception>
+#include <coroutine>
+#include <type_traits>
+#include <condition_variable>
+#include "../thread-pool/thread-pool.h"
+
+namespace wotsen
+{
+
+	/**
+	 * @brief 协程帧分配器
+	 * @details 按64字节分级的线程局部空闲链表，协程结束后帧放回释放线程的链表，
+	 *          之后同一线程创建协程时直接复用，不经过全局new。每级最多缓存MaxCached个，
+	 *          超过1KB的帧直接使用全局new
+	 *
+	 */
+	class FramePool
+	{
+	public:
+		static const size_t Granularity = 64;
+		static const size_t ClassCount = 16;
+		static const size_t MaxCached = 256;
+
+		static void *allocate(size_t size)
+		{
+			size_t c = class_of(size);
+			Cache *cache = local();
+			if (cache && c < ClassCount && cache->head[c])
+			{
+				Node *node = cache->head[c];
+				cache->head[c] = node->next;
+				cache->count[c]--;
+				return node;
+			}
+
+			return ::operator new(c < ClassCount ? (c + 1) * Granularity : size);
+		}
+
+		static void deallocate(void *p, size_t size)
+		{
+			size_t c = class_of(size);
+			Cache *cache = local();
+			if (cache && c < ClassCount && cache->count[c] < MaxCached)
+			{
+				Node *node = static_cast<Node *>(p);
+				node->next = cache->head[c];
+				cache->head[c] = node;
+				cache->count[c]++;
+				return;
+			}
+
+			::operator delete(p);
+		}
+
+	private:
+		struct Node
+		{
+			Node *next;
+		};
+
+		struct Cache
+		{
+			Node *head[ClassCount] = {};
+			size_t count[ClassCount] = {};
+
+			~Cache()
+			{
+				destroyed() = true;
+				for (auto &h : head)
+				{
+					while (h)
+					{
+						Node *next = h->next;
+						::operator delete(h);
+						h = next;
+					}
+				}
+			}
+		};
+
+		static size_t class_of(size_t size)
+		{
+			return (size + Granularity - 1) / Granularity - 1;
+		}
+
+		// 本线程的缓存，已析构(线程退出、静态对象析构期间)时为nullptr，帧直接归还全局
+		static Cache *local()
+		{
+			if (destroyed())
+				return nullptr;
+			static thread_local Cache cache;
+			return &cache;
+		}
+
+		// 平凡析构，缓存析构之后仍然可以读取
+		static bool &destroyed()
+		{
+			static thread_local bool flag = false;
+			return flag;
+		}
+	};
+
+	template <typename T = void>
+	class Task;
+
+	namespace detail
+	{
+
+		// 协程帧从FramePool分配
+		struct PooledFrame
+		{
+			static void *operator new(size_t size)
+			{
+				return FramePool::allocate(size);
+			}
+
+			static void operator delete(void *p, size_t size)
+			{
+				FramePool::deallocate(p, size);
+			}
+		};
+
+		struct TaskPromiseBase : PooledFrame
+		{
+			// 结束时对称转移到等待者，不在当前栈上嵌套恢复
+			struct FinalAwaiter
+			{
+				bool await_ready() const noexcept
+				{
+					return false;
+				}
+
+				template <typename P>
+				std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept
+				{
+					std::coroutine_handle<> next = h.promise().continuation;
+					return next ? next : std::noop_coroutine();
+				}
+
+				void await_resume() noexcept
+				{
+				}
+			};
+
+			std::suspend_always initial_suspend() noexcept
+			{
+				return {};
+			}
+
+			FinalAwaiter final_suspend() noexcept
+			{
+				return {};
+			}
+
+			void unhandled_exception() noexcept
+			{
+				error = std::current_exception();
+			}
+
+			std::coroutine_handle<> continuation;
+			std::exception_ptr error;
+		};
+
+		template <typename T>
+		struct TaskPromise : TaskPromiseBase
+		{
+			Task<T> get_return_object() noexcept;
+
+			template <typename V>
+			void return_value(V &&v)
+			{
+				new (&storage) T(std::forward<V>(v));
+				has_value = true;
+			}
+
+			T &result()
+			{
+				if (error)
+					std::rethrow_exception(error);
+				return *std::launder(reinterpret_cast<T *>(&storage));
+			}
+
+			~TaskPromise()
+			{
+				if (has_value)
+					std::launder(reinterpret_cast<T *>(&storage))->~T();
+			}
+
+			alignas(T) unsigned char storage[sizeof(T)];
+			bool has_value = false;
+		};
+
+		template <>
+		struct TaskPromise<void> : TaskPromiseBase
+		{
+			Task<void> get_return_object() noexcept;
+
+			void return_void() noexcept
+			{
+			}
+
+			void result()
+			{
+				if (error)
+					std::rethrow_exception(error);
+			}
+		};
+
+	} // namespace detail
+
+	/**
+	 * @brief 惰性协程任务
+	 * @details 创建时不执行，被co_await时才开始；结束时通过对称转移直接恢复等待者，
+	 *          等待链再深也不会增加线程栈(GCC需开启优化，-O0下对称转移不是尾调用)。
+	 *          任务对象独占协程帧，析构时销毁未完成的帧。协程函数抛出的异常由co_await抛出。
+	 *          GCC 12对条件运算符中的co_await求值有误，应改写为if语句
+	 *
+	 * @tparam T 结果类型
+	 */
+	template <typename T>
+	class Task
+	{
+	public:
+		using promise_type = detail::TaskPromise<T>;
+		using handle_type = std::coroutine_handle<promise_type>;
+
+		Task() noexcept = default;
+
+		explicit Task(handle_type h) noexcept : m_handle(h)
+		{
+		}
+
+		Task(Task &&other) noexcept : m_handle(std::exchange(other.m_handle, nullptr))
+		{
+		}
+
+		Task &operator=(Task &&other) noexcept
+		{
+			if (this != &other)
+			{
+				if (m_handle)
+					m_handle.destroy();
+				m_handle = std::exchange(other.m_handle, nullptr);
+			}
+			return *this;
+		}
+
+		Task(const Task &) = delete;
+		Task &operator=(const Task &) = delete;
+
+		~Task()
+		{
+			if (m_handle)
+				m_handle.destroy();
+		}
+
+		bool valid() const noexcept
+		{
+			return (bool)m_handle;
+		}
+
+		bool done() const noexcept
+		{
+			return !m_handle || m_handle.done();
+		}
+
+		// co_await时对称转移到任务，任务结束后转移回等待者
+		auto operator co_await() && noexcept
+		{
+			return Awaiter{m_handle};
+		}
+
+		auto operator co_await() & noexcept
+		{
+			return Awaiter{m_handle};
+		}
+
+		handle_type handle() const noexcept
+		{
+			return m_handle;
+		}
+
+	private:
+		struct Awaiter
+		{
+			handle_type handle;
+
+			bool await_ready() const noexcept
+			{
+				return !handle || handle.done();
+			}
+
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept
+			{
+				handle.promise().continuation = caller;
+				return handle;
+			}
+
+			decltype(auto) await_resume()
+			{
+				if constexpr (std::is_void<T>::value)
+					handle.promise().result();
+				else
+					return std::move(handle.promise().result());
+			}
+		};
+
+		handle_type m_handle;
+	};
+
+	namespace detail
+	{
+
+		template <typename T>
+		Task<T> TaskPromise<T>::get_return_object() noexcept
+		{
+			return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+		}
+
+		inline Task<void> TaskPromise<void>::get_return_object() noexcept
+		{
+			return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+		}
+
+	} // namespace detail
+
+	/**
+	 * @brief 切换到线程池执行：co_await schedule_on(pool)之后的代码在线程池的工作线程中运行
+	 * @details 恢复协程的任务按priority投递；线程池已停止时投递被丢弃，协程不会再恢复
+	 *
+	 */
+	class ScheduleOn
+	{
+	public:
+		ScheduleOn(ThreadPool &pool, TaskPriority priority) noexcept : m_pool(pool), m_priority(priority)
+		{
+		}
+
+		bool await_ready() const noexcept
+		{
+			return false;
+		}
+
+		void await_suspend(std::coroutine_handle<> h)
+		{
+			m_pool.post([h] { h.resume(); }, m_priority);
+		}
+
+		void await_resume() const noexcept
+		{
+		}
+
+	private:
+		ThreadPool &m_pool;
+		TaskPriority m_priority;
+	};
+
+	inline ScheduleOn schedule_on(ThreadPool &pool, TaskPriority priority = TaskPriority::Normal) noexcept
+	{
+		return ScheduleOn(pool, priority);
+	}
+
+	namespace detail
+	{
+
+		struct SyncState
+		{
+			std::mutex mutex;
+			std::condition_variable cv;
+			bool done = false;
+		};
+
+		// sync_wait的外层协程，结束时唤醒等待线程
+		struct SyncWaiter
+		{
+			struct promise_type : PooledFrame
+			{
+				SyncWaiter get_return_object() noexcept
+				{
+					return SyncWaiter{std::coroutine_handle<promise_type>::from_promise(*this)};
+				}
+
+				std::suspend_always initial_suspend() noexcept
+				{
+					return {};
+				}
+
+				auto final_suspend() noexcept
+				{
+					struct Notify
+					{
+						bool await_ready() const noexcept
+						{
+							return false;
+						}
+
+						void await_suspend(std::coroutine_handle<promise_type> h) noexcept
+						{
+							//持锁通知，等待线程看到done时本函数已不再访问帧
+							SyncState &s = *h.promise().state;
+							std::lock_guard<std::mutex> locker(s.mutex);
+							s.done = true;
+							s.cv.notify_all();
+						}
+
+						void await_resume() noexcept
+						{
+						}
+					};
+					return Notify{};
+				}
+
+				void return_void() noexcept
+				{
+				}
+
+				void unhandled_exception() noexcept
+				{
+					std::terminate();
+				}
+
+				SyncState *state = nullptr;
+			};
+
+			std::coroutine_handle<promise_type> handle;
+		};
+
+		// 只负责等待结束，结果与异常留在task的promise中，由sync_wait取出
+		template <typename T>
+		SyncWaiter sync_waiter(Task<T> &task)
+		{
+			try
+			{
+				co_await task;
+			}
+			catch (...)
+			{
+			}
+		}
+
+		inline void run_sync(SyncWaiter waiter)
+		{
+			SyncState state;
+			waiter.handle.promise().state = &state;
+			waiter.handle.resume();
+
+			std::unique_lock<std::mutex> locker(state.mutex);
+			state.cv.wait(locker, [&state] { return state.done; });
+			locker.unlock();
+			waiter.handle.destroy();
+		}
+
+	} // namespace detail
+
+	/**
+	 * @brief 在当前线程启动任务并阻塞等待结果，用于从普通函数进入协程
+	 *
+	 * @param task 任务
+	 * @return T 结果
+	 * @throw 任务抛出的异常
+	 */
+	template <typename T>
+	T sync_wait(Task<T> task)
+	{
+		detail::run_sync(detail::sync_waiter(task));
+		if constexpr (std::is_void<T>::value)
+			task.handle().promise().result();
+		else
+			return std::move(task.handle().promise().result());
+	}
+
+} // namespace wotsen
+
+#endif // !__wotsen_CO_TASK_H__
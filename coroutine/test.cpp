@@ -0,0 +1,287 @@
+/**
+ * @file test.cpp
+ * @author yuwangliang (wotsen@outlook.com)
+ * @brief 有栈协程示例
+ * @version 0.1
+ * @date 2020-08-16
+ *
+ * @copyright Copyright (c) 2020 yuwangliang
+ *
+ */
+#include <iostream>
+#include <string>
+#include <stdexcept>
+#include "coroutine.h"
+#if __cplusplus >= 202002L
+#include "task.h"
+#include "scheduler.h"
+#include "co-sync.h"
+#include "channel.h"
+#include "io-service.h"
+#include <netinet/in.h>
+#endif
+
+using namespace wotsen;
+
+#if __cplusplus >= 202002L
+static Task<int> square(int v)
+{
+	co_return v * v;
+}
+
+// 切到线程池后再等待子任务
+static Task<int> sum_squares(ThreadPool &pool, int n)
+{
+	co_await schedule_on(pool);
+	int sum = 0;
+	for (int i = 1; i <= n; ++i)
+		sum += co_await square(i);
+	co_return sum;
+}
+
+static Task<void> fail()
+{
+	throw std::runtime_error("task boom");
+	co_return;
+}
+
+// 深度递归等待，对称转移不会让线程栈随深度增长
+static Task<long> depth(long n)
+{
+	if (n == 0)
+		co_return 0;
+	co_return 1 + co_await depth(n - 1);
+}
+
+// 让出后可能在另一个工作线程上继续
+static Task<void> count(std::atomic<int> &total, int n)
+{
+	for (int i = 0; i < n; ++i)
+	{
+		total++;
+		co_await Scheduler::yield();
+	}
+}
+
+static Task<void> produce(Channel<int> &ch, int from, int n)
+{
+	for (int i = from; i < from + n; ++i)
+		co_await ch.send(i);
+	ch.close();
+}
+
+// 从两个通道汇总，直到两个都关闭
+static Task<void> merge(Channel<int> &a, Channel<int> &b, int &sum)
+{
+	bool aOpen = true, bOpen = true;
+	while (aOpen && bOpen)
+	{
+		std::optional<int> x, y;
+		int i = co_await select(a.on_recv(x), b.on_recv(y));
+		if (i == 0)
+		{
+			if (x)
+				sum += *x;
+			else
+				aOpen = false;
+		}
+		else
+		{
+			if (y)
+				sum += *y;
+			else
+				bOpen = false;
+		}
+	}
+
+	Channel<int> &rest = aOpen ? a : b;
+	while (std::optional<int> v = co_await rest.recv())
+		sum += *v;
+}
+
+static Task<void> add_locked(CoMutex &mutex, long &counter, int n)
+{
+	for (int i = 0; i < n; ++i)
+	{
+		auto guard = co_await mutex.scoped_lock();
+		counter++;
+		co_await Scheduler::yield();
+	}
+}
+
+// 本机回环：接受一个连接，把收到的数据原样发回
+static Task<void> echo_once(IoService &io, int listener)
+{
+	int fd = co_await io.accept(listener);
+	char buf[64];
+	int n = co_await io.recv(fd, buf, sizeof(buf));
+	if (n > 0)
+		co_await io.send(fd, buf, (size_t)n);
+	close(fd);
+}
+
+static Task<std::string> ping(IoService &io, sockaddr_in addr, std::string msg)
+{
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	co_await io.connect(fd, (sockaddr *)&addr, sizeof(addr));
+	co_await io.send(fd, msg.data(), msg.size());
+	char buf[64];
+	int n = co_await io.recv(fd, buf, sizeof(buf));
+	close(fd);
+	co_return std::string(buf, n > 0 ? (size_t)n : 0);
+}
+
+// 一次提交两次写，再一次提交两次读
+static Task<std::string> file_roundtrip(IoService &io, int fd)
+{
+	IoBatch batch(io);
+	batch.write(fd, "hello ", 6, 0);
+	batch.write(fd, "io", 2, 6);
+	co_await batch;
+
+	char buf[8];
+	batch.clear();
+	batch.read(fd, buf, 6, 0);
+	batch.read(fd, buf + 6, 2, 6);
+	co_await batch;
+	co_return std::string(buf, (size_t)(batch.result(0) + batch.result(1)));
+}
+#endif
+
+int main(void)
+{
+	// 生成器：每次resume产生一个斐波那契数
+	long value = 0;
+	Coroutine fib([&value] {
+		long a = 0, b = 1;
+		for (;;)
+		{
+			value = a;
+			Coroutine::yield();
+			long next = a + b;
+			a = b;
+			b = next;
+		}
+	});
+
+	std::cout << "fib";
+	for (int i = 0; i < 10 && fib.resume(); ++i)
+		std::cout << " " << value;
+	std::cout << std::endl;
+
+	// 嵌套：内层yield回到外层
+	StackPool pool;
+	Coroutine outer([&pool] {
+		Coroutine inner([] {
+			std::cout << "inner 1" << std::endl;
+			Coroutine::yield();
+			std::cout << "inner 2" << std::endl;
+		}, pool);
+
+		inner.resume();
+		std::cout << "outer" << std::endl;
+		Coroutine::yield();
+		inner.resume();
+	}, pool);
+
+	while (outer.resume())
+		std::cout << "main" << std::endl;
+
+	// 异常由resume()抛出
+	Coroutine bad([] { throw std::runtime_error("boom"); });
+	try
+	{
+		bad.resume();
+	}
+	catch (const std::exception &e)
+	{
+		std::cout << "caught " << e.what() << " done " << bad.done() << std::endl;
+	}
+
+	// 析构未结束的协程会展开其栈上的对象
+	struct Guard
+	{
+		~Guard()
+		{
+			std::cout << "unwound" << std::endl;
+		}
+	};
+	{
+		Coroutine pending([] {
+			Guard guard;
+			Coroutine::yield();
+		}, pool);
+		pending.resume();
+	}
+
+	std::cout << "cached stacks " << pool.cached() << std::endl;
+
+#if __cplusplus >= 202002L
+	ThreadPool threads;
+	std::cout << "sum_squares " << sync_wait(sum_squares(threads, 10)) << std::endl;
+
+	try
+	{
+		sync_wait(fail());
+	}
+	catch (const std::exception &e)
+	{
+		std::cout << "caught " << e.what() << std::endl;
+	}
+
+	std::cout << "depth " << sync_wait(depth(1000000)) << std::endl;
+
+	// 线程退出时，晚于帧缓存析构的协程帧直接归还全局，不写入已析构的缓存
+	std::thread([] {
+		static thread_local std::unique_ptr<Task<int>> late;
+		late.reset(new Task<int>(square(3)));
+	}).join();
+	std::cout << "frame after cache teardown" << std::endl;
+
+	Scheduler sched(4);
+	std::atomic<int> total{0};
+	for (int i = 0; i < 1000; ++i)
+		sched.spawn(count(total, 10));
+	sched.wait();
+	std::cout << "scheduler total " << total << std::endl;
+
+	// 两个生产者经通道汇入一个消费者
+	Channel<int> odd, even(4);
+	int merged = 0;
+	sched.spawn(merge(odd, even, merged));
+	sched.spawn(produce(odd, 1, 50));
+	sched.spawn(produce(even, 51, 50));
+	sched.wait();
+	std::cout << "channel merged " << merged << std::endl;
+
+	// 持锁期间让出，其他协程拿不到锁
+	CoMutex mutex;
+	long counter = 0;
+	for (int i = 0; i < 100; ++i)
+		sched.spawn(add_locked(mutex, counter, 100));
+	sched.wait();
+	std::cout << "mutex counter " << counter << std::endl;
+
+	IoService io;
+	int listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t len = sizeof(addr);
+	bind(listener, (sockaddr *)&addr, sizeof(addr));
+	listen(listener, 8);
+	getsockname(listener, (sockaddr *)&addr, &len);
+	sched.spawn(echo_once(io, listener));
+	std::cout << "echo " << sync_wait(ping(io, addr, "ping")) << std::endl;
+	sched.wait();
+	close(listener);
+
+	char path[] = "/tmp/wotsen-io-XXXXXX";
+	int fd = mkstemp(path);
+	unlink(path);
+	std::cout << "file " << sync_wait(file_roundtrip(io, fd)) << std::endl;
+	close(fd);
+#endif
+
+	return 0;
+}
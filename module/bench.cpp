@@ -0,0 +1,457 @@
+/**
+ * @file bench.cpp
+ * @author yuwangliang (wotsen@outlook.com)
+ * @brief 模块管理性能测试
+ * @version 0.1
+ * @date 2020-07-19
+ *
+ * @copyright Copyright (c) 2020 yuwangliang
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "src/module.h"
+
+using namespace wotsen;
+using namespace std::chrono;
+
+static const int kModules = 50;
+static const auto kWork = microseconds(20);
+static const auto kDuration = milliseconds(1000);
+
+// 模拟模块接口耗时
+static void busy(microseconds us)
+{
+	auto end = steady_clock::now() + us;
+	while (steady_clock::now() < end)
+	{
+	}
+}
+
+static appmodule_err_t work_fn(appmodule_info_t *)
+{
+	busy(kWork);
+	return APP_MODULE_OK;
+}
+
+static app_module_run_status_t run_status_fn(appmodule_info_t *)
+{
+	return e_module_run_st_ok;
+}
+
+static appmodule_info_t g_infos[kModules];
+static std::atomic<size_t> g_sink(0);	///< 防止查询结果被优化掉
+static std::vector<std::shared_ptr<appmodule_t>> g_modules;	///< 最近一次make_modules创建的模块，查询时直接读其快照
+
+static AppModule *make_modules(app_module_fun_t chg_fn = work_fn)
+{
+	AppModule *am = new AppModule({}, 4);
+	g_modules.clear();
+
+	for (int i = 0; i < kModules; ++i)
+	{
+		appmodule_info_t &info = g_infos[i];
+		memset(&info, 0, sizeof(info));
+		snprintf(info.name, sizeof(info.name), "module-%d", i);
+		info.enable = true;
+		info.identifer = i + 1;
+		info.status = e_module_uninit;
+		// 每10个一组串成链
+		if (i % 10)
+		{
+			info.depends[0] = i;
+		}
+		g_modules.push_back(APP_MODULE(&info, work_fn, work_fn, chg_fn, work_fn, work_fn, run_status_fn));
+		am->register_module(g_modules.back());
+	}
+
+	return am;
+}
+
+// 持锁读写的对照组，读者与执行模块接口的写者共用一把锁
+struct locked_module
+{
+	std::mutex mtx;
+	appmodule_info_t info;
+};
+
+/**
+ * @brief 生命周期操作进行中并发查询
+ * @details 一个线程不断停止、启动、重新初始化模块，readers个线程轮询所有模块的状态和基本信息
+ *
+ */
+static void run_query(int readers)
+{
+	std::unique_ptr<AppModule> am(make_modules());
+	am->init_module();
+	am->run_module();
+
+	std::atomic<bool> stop(false);
+	std::atomic<long> queries(0), churn(0), worst(0);
+
+	std::thread writer([&] {
+		uint64_t id = 1;
+		while (!stop.load(std::memory_order_relaxed))
+		{
+			am->stop_module(id);
+			am->run_module(id);
+			if (id % 10 == 0)
+			{
+				am->finit_module(id);
+				am->init_module(id);
+				am->run_module(id);
+			}
+			id = id % kModules + 1;
+			churn.fetch_add(1, std::memory_order_relaxed);
+		}
+	});
+
+	std::vector<std::thread> threads;
+	for (int r = 0; r < readers; ++r)
+	{
+		threads.emplace_back([&] {
+			long n = 0;
+			size_t sink = 0;
+			std::vector<std::shared_ptr<appmodule_t>> modules = g_modules;
+			long slowest = 0;
+			while (!stop.load(std::memory_order_relaxed))
+			{
+				auto start = steady_clock::now();
+				for (auto &m : modules)
+				{
+					appmodule_base_info_t info = m->module_info();
+					sink += (int)info.status + (int)m->run_status();
+				}
+				n += modules.size();
+				slowest = std::max(slowest, (long)duration_cast<microseconds>(steady_clock::now() - start).count());
+			}
+			queries.fetch_add(n, std::memory_order_relaxed);
+			for (long w = worst.load(); w < slowest && !worst.compare_exchange_weak(w, slowest);)
+			{
+			}
+			g_sink.fetch_add(sink, std::memory_order_relaxed);
+		});
+	}
+
+	std::this_thread::sleep_for(kDuration);
+	stop = true;
+	writer.join();
+	for (auto &t : threads)
+	{
+		t.join();
+	}
+
+	double secs = duration_cast<duration<double>>(kDuration).count();
+	printf("snapshot  readers %d: %10.0f polls/s, worst sweep %6ld us, %6.0f lifecycle ops/s\n",
+		   readers, queries.load() / secs, worst.load(), churn.load() / secs);
+}
+
+static void run_query_locked(int readers)
+{
+	std::vector<locked_module> modules(kModules);
+	for (int i = 0; i < kModules; ++i)
+	{
+		modules[i].info = g_infos[i];
+	}
+
+	std::atomic<bool> stop(false);
+	std::atomic<long> queries(0), churn(0), worst(0);
+
+	std::thread writer([&] {
+		int i = 0;
+		while (!stop.load(std::memory_order_relaxed))
+		{
+			// 停止再启动，各持锁执行一次接口
+			for (int k = 0; k < 2; ++k)
+			{
+				std::lock_guard<std::mutex> lock(modules[i].mtx);
+				busy(kWork);
+				modules[i].info.status = k ? e_module_runing : e_module_unruning;
+			}
+			i = (i + 1) % kModules;
+			churn.fetch_add(1, std::memory_order_relaxed);
+		}
+	});
+
+	std::vector<std::thread> threads;
+	for (int r = 0; r < readers; ++r)
+	{
+		threads.emplace_back([&] {
+			long n = 0;
+			size_t sink = 0;
+			long slowest = 0;
+			while (!stop.load(std::memory_order_relaxed))
+			{
+				auto start = steady_clock::now();
+				for (auto &m : modules)
+				{
+					std::lock_guard<std::mutex> lock(m.mtx);
+					appmodule_base_info_t info;
+					memcpy(&info, &m.info, sizeof(info));
+					sink += info.status;
+				}
+				n += modules.size();
+				slowest = std::max(slowest, (long)duration_cast<microseconds>(steady_clock::now() - start).count());
+			}
+			queries.fetch_add(n, std::memory_order_relaxed);
+			for (long w = worst.load(); w < slowest && !worst.compare_exchange_weak(w, slowest);)
+			{
+			}
+			g_sink.fetch_add(sink, std::memory_order_relaxed);
+		});
+	}
+
+	std::this_thread::sleep_for(kDuration);
+	stop = true;
+	writer.join();
+	for (auto &t : threads)
+	{
+		t.join();
+	}
+
+	double secs = duration_cast<duration<double>>(kDuration).count();
+	printf("locked    readers %d: %10.0f polls/s, worst sweep %6ld us, %6.0f lifecycle ops/s\n",
+		   readers, queries.load() / secs, worst.load(), churn.load() / secs);
+}
+
+static void bench_query(void)
+{
+	for (int readers : {1, 2, 4})
+	{
+		run_query(readers);
+		run_query_locked(readers);
+	}
+}
+
+// 一次参数修改，记录提交时间
+struct change_req
+{
+	steady_clock::time_point submit;
+};
+
+static std::atomic<long> g_applied(0);		///< 变更接口调用次数
+static std::atomic<long> g_delay_sum(0);	///< 提交到生效的总延迟(us)
+static std::atomic<long> g_delay_max(0);	///< 提交到生效的最大延迟(us)
+
+static appmodule_err_t change_fn(appmodule_info_t *info)
+{
+	busy(kWork);
+
+	const change_req *req = (const change_req *)info->param;
+	long delay = (long)duration_cast<microseconds>(steady_clock::now() - req->submit).count();
+	g_applied.fetch_add(1, std::memory_order_relaxed);
+	g_delay_sum.fetch_add(delay, std::memory_order_relaxed);
+	for (long m = g_delay_max.load(); m < delay && !g_delay_max.compare_exchange_weak(m, delay);)
+	{
+	}
+
+	return APP_MODULE_OK;
+}
+
+/**
+ * @brief 按固定速率向各模块提交参数修改
+ * @details producers个线程共提交rate次/秒，轮流修改kModules个模块，变更接口耗时kWork
+ *
+ */
+static void run_change_async(int producers, long rate)
+{
+	std::unique_ptr<AppModule> am(make_modules(change_fn));
+	am->init_module();
+	am->run_module();
+	g_applied = 0;
+	g_delay_sum = 0;
+	g_delay_max = 0;
+
+	const long per_thread = rate * duration_cast<milliseconds>(kDuration).count() / 1000 / producers;
+	const long batch = 100;
+	std::vector<std::vector<change_req>> reqs(producers, std::vector<change_req>(per_thread));
+	std::vector<std::vector<AsyncFuture<appmodule_err_t>>> futures(producers);
+
+	auto start = steady_clock::now();
+	std::vector<std::thread> threads;
+	for (int p = 0; p < producers; ++p)
+	{
+		threads.emplace_back([&, p] {
+			// 每批batch次，按速率等到该批的时刻再提交
+			auto period = duration_cast<steady_clock::duration>(duration<double>((double)batch * producers / rate));
+			auto next = steady_clock::now();
+			futures[p].reserve(per_thread);
+			for (long i = 0; i < per_thread; ++i)
+			{
+				if (i % batch == 0)
+				{
+					std::this_thread::sleep_until(next);
+					next += period;
+				}
+				change_req &req = reqs[p][i];
+				req.submit = steady_clock::now();
+				futures[p].push_back(am->change_module_async((i * producers + p) % kModules + 1, &req));
+			}
+		});
+	}
+	for (auto &t : threads)
+	{
+		t.join();
+	}
+	double submit_secs = duration_cast<duration<double>>(steady_clock::now() - start).count();
+
+	long failed = 0;
+	for (auto &list : futures)
+	{
+		for (auto &f : list)
+		{
+			failed += f.get() != APP_MODULE_OK;
+		}
+	}
+	double total_secs = duration_cast<duration<double>>(steady_clock::now() - start).count();
+
+	long updates = per_thread * producers;
+	long applied = g_applied.load();
+	printf("async  producers %d: %8.0f updates/s submitted, all done in %.2fs, %7ld change_ calls (%.1f%% coalesced), "
+		   "delay avg %5ld us max %6ld us, failed %ld\n",
+		   producers, updates / submit_secs, total_secs, applied, 100.0 * (updates - applied) / updates,
+		   applied ? g_delay_sum.load() / applied : 0, g_delay_max.load(), failed);
+}
+
+// 同步修改能达到的速率，对照
+static void run_change_sync(int producers)
+{
+	std::unique_ptr<AppModule> am(make_modules(change_fn));
+	am->init_module();
+	am->run_module();
+	g_applied = 0;
+
+	std::atomic<bool> stop(false);
+	std::atomic<long> updates(0);
+	std::vector<std::thread> threads;
+	for (int p = 0; p < producers; ++p)
+	{
+		threads.emplace_back([&, p] {
+			change_req req;
+			long n = 0;
+			while (!stop.load(std::memory_order_relaxed))
+			{
+				req.submit = steady_clock::now();
+				am->change_module((n * producers + p) % kModules + 1, &req);
+				++n;
+			}
+			updates.fetch_add(n, std::memory_order_relaxed);
+		});
+	}
+
+	std::this_thread::sleep_for(kDuration);
+	stop = true;
+	for (auto &t : threads)
+	{
+		t.join();
+	}
+
+	double secs = duration_cast<duration<double>>(kDuration).count();
+	printf("sync   producers %d: %8.0f updates/s\n", producers, updates.load() / secs);
+}
+
+static void bench_change(void)
+{
+	run_change_async(1, 100000);
+	run_change_async(2, 100000);
+	run_change_sync(1);
+	run_change_sync(2);
+}
+
+static const char *g_plugin = "plugin/demo-module.so";	///< 第二个参数可指定
+
+static double elapsed_us(steady_clock::time_point start)
+{
+	return duration_cast<duration<double, std::micro>>(steady_clock::now() - start).count();
+}
+
+/**
+ * @brief 动态库模块加载
+ * @details 对比延迟与立即启动的启动耗时、第一次使用的耗时，以及反复卸载再加载的耗时
+ *
+ */
+static void bench_load(void)
+{
+	long value = 1;
+
+	if (access(g_plugin, R_OK) != 0)
+	{
+		printf("skip: %s not found, build plugin/demo-module.cpp or pass its path as the second argument\n", g_plugin);
+		return;
+	}
+
+	for (bool lazy : {true, false})
+	{
+		std::unique_ptr<AppModule> am(make_modules());
+
+		auto start = steady_clock::now();
+		uint64_t id = am->load_module(g_plugin, lazy);
+		am->init_module();
+		am->run_module();
+		double startup = elapsed_us(start);
+
+		start = steady_clock::now();
+		appmodule_err_t ret = am->change_module(id, &value);
+		double first = elapsed_us(start);
+
+		start = steady_clock::now();
+		const int n = 10000;
+		for (int i = 0; i < n; ++i)
+		{
+			am->change_module(id, &value);
+		}
+		double later = elapsed_us(start) / n;
+
+		printf("%-5s startup %9.1f us (with %d static modules), first change %8.1f us (ret %llu), later %6.2f us\n",
+			   lazy ? "lazy" : "eager", startup, kModules, first, (unsigned long long)ret, later);
+	}
+
+	std::unique_ptr<AppModule> am(new AppModule({}, 1));
+	const int cycles = 200;
+	auto start = steady_clock::now();
+	for (int i = 0; i < cycles; ++i)
+	{
+		uint64_t id = am->load_module(g_plugin, true);
+		am->change_module(id, &value);
+		am->unregister_module(id);
+	}
+	printf("load, first change, unload: %.1f us per cycle\n", elapsed_us(start) / cycles);
+}
+
+struct bench_case
+{
+	const char *name;
+	void (*fn)(void);
+};
+
+static bench_case cases[] = {
+	{"query", bench_query},
+	{"change", bench_change},
+	{"load", bench_load},
+};
+
+int main(int argc, char **argv)
+{
+	if (argc > 2)
+	{
+		g_plugin = argv[2];
+	}
+
+	for (auto &c : cases)
+	{
+		if (argc > 1 && strcmp(argv[1], c.name))
+			continue;
+
+		printf("== %s ==\n", c.name);
+		c.fn();
+	}
+
+	return 0;
+}
@@ -0,0 +1,92 @@
+/**
+ * @file demo-module.cpp
+ * @author yuwangliang (wotsen@outlook.com)
+ * @brief 动态库模块示例，由AppModule::load_module加载
+ * @details g++ -shared -fPIC -fvisibility=hidden demo-module.cpp -o demo-module.so，
+ *          -DDEMO_MODULE_ID=n 指定模块标识，-DDEMO_MODULE_INIT_US=n 模拟初始化耗时
+ * @version 0.1
+ * @date 2020-07-19
+ *
+ * @copyright Copyright (c) 2020 yuwangliang
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include "../src/module_def.h"
+
+#ifndef DEMO_MODULE_ID
+#define DEMO_MODULE_ID 1000
+#endif
+
+#ifndef DEMO_MODULE_INIT_US
+#define DEMO_MODULE_INIT_US 5000
+#endif
+
+// 模块私有数据
+struct demo_data_t {
+	long changes;		///< 修改次数
+	long last;			///< 最近一次的参数
+	bool running;		///< 已启动未停止，停止后不接受修改
+};
+
+static demo_data_t demo_data;
+
+static appmodule_info_t demo_info = []() {
+	appmodule_info_t info;
+	memset(&info, 0, sizeof(info));
+	snprintf(info.name, sizeof(info.name), "demo-%d", DEMO_MODULE_ID);
+	info.enable = true;
+	info.identifer = DEMO_MODULE_ID;
+	info.status = e_module_uninit;
+	info.data = &demo_data;
+	return info;
+}();
+
+static appmodule_err_t demo_init(appmodule_info_t *info)
+{
+	std::this_thread::sleep_for(std::chrono::microseconds(DEMO_MODULE_INIT_US));
+	memset(info->data, 0, sizeof(demo_data_t));
+	return APP_MODULE_OK;
+}
+
+static appmodule_err_t demo_run(appmodule_info_t *info)
+{
+	((demo_data_t *)info->data)->running = true;
+	return APP_MODULE_OK;
+}
+
+// 参数为long*
+static appmodule_err_t demo_change(appmodule_info_t *info)
+{
+	demo_data_t *data = (demo_data_t *)info->data;
+
+	if (!info->param || !data->running)
+	{
+		return APP_MODULE_ERROR;
+	}
+
+	data->changes++;
+	data->last = *(const long *)info->param;
+
+	return APP_MODULE_OK;
+}
+
+static appmodule_err_t demo_stop(appmodule_info_t *info)
+{
+	((demo_data_t *)info->data)->running = false;
+	return APP_MODULE_OK;
+}
+
+static appmodule_err_t demo_exit(appmodule_info_t *)
+{
+	return APP_MODULE_OK;
+}
+
+static app_module_run_status_t demo_run_status(appmodule_info_t *info)
+{
+	return info->status == e_module_runing ? e_module_run_st_ok : e_module_run_st_unknown;
+}
+
+APP_MODULE_EXPORT(&demo_info, demo_init, demo_run, demo_change, demo_stop, demo_exit, demo_run_status);
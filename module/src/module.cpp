@@ -9,11 +9,59 @@
  * 
  */
 
+#include <cstring>
+#include <dlfcn.h>
+#include <thread>
+#include <algorithm>
+#include <unordered_map>
 #include "module.h"
+#include "../../thread-pool/task-graph.h"
 
 namespace wotsen
 {
 
+namespace
+{
+
+// 深度优先找环，找到时path为环上的模块下标，首尾相同
+bool find_cycle(const std::vector<std::vector<size_t>> &deps, size_t i, std::vector<char> &color, std::vector<size_t> &path)
+{
+	color[i] = 1;
+	path.push_back(i);
+
+	for (size_t d : deps[i])
+	{
+		if (color[d] == 1)
+		{
+			path.erase(path.begin(), std::find(path.begin(), path.end(), d));
+			path.push_back(d);
+			return true;
+		}
+
+		if (color[d] == 0 && find_cycle(deps, d, color, path))
+		{
+			return true;
+		}
+	}
+
+	color[i] = 2;
+	path.pop_back();
+
+	return false;
+}
+
+std::chrono::microseconds since(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to)
+{
+	if (from == std::chrono::steady_clock::time_point() || to < from)
+	{
+		return std::chrono::microseconds(0);
+	}
+
+	return std::chrono::duration_cast<std::chrono::microseconds>(to - from);
+}
+
+} // namespace
+
 /**
  * @brief Construct a new App Module Configure object
  * @details 构造模块配置
@@ -32,14 +80,22 @@ AppModuleConfigure::AppModuleConfigure(appmodule_info_t *info,
 					app_module_fun_t chg_fn,
 					app_module_fun_t stop_fn,
 					app_module_fun_t exit_fn,
-					app_module_status_fun_t run_st_fn) throw(std::logic_error) :
+					app_module_status_fun_t run_st_fn) :
 					info_(info),
 					init_(init_fn),
 					run_(run_fn),
 					change_(chg_fn),
-					stop_(stop_),
+					stop_(stop_fn),
 					exit_(exit_fn),
-					run_status_(run_st_fn)
+					run_status_(run_st_fn),
+					seq_(0),
+					status_(e_module_uninit),
+					change_posted_(false),
+					change_pending_(false),
+					change_param_(nullptr),
+					change_closed_(false),
+					lazy_(false),
+					started_(false)
 {
 	if (!info_) {
 		throw std::logic_error("module info null");
@@ -48,10 +104,19 @@ AppModuleConfigure::AppModuleConfigure(appmodule_info_t *info,
 	}
 
 	// TODO:更多校验
+
+	std::lock_guard<std::mutex> lock(mtx_);
+	publish_info();
 }
 
 AppModuleConfigure::~AppModuleConfigure()
 {
+	// 没有初始化过的模块信息可能属于另一个对象(如重复加载同一动态库)，不能清理
+	if (!started_)
+	{
+		return;
+	}
+
 	if (info_->status == e_module_runing)
 	{
 		stop_(info_);
@@ -68,17 +133,22 @@ AppModuleConfigure::~AppModuleConfigure()
 // 初始化
 appmodule_err_t AppModuleConfigure::init(void)
 {
+	std::lock_guard<std::mutex> lock(mtx_);
+
+	init_begin_ = clock::now();
 	appmodule_err_t ret = init_(info_);
+	init_end_ = clock::now();
 
 	if (APP_MODULE_OK == ret)
 	{
 		info_->status = e_module_inited;
+		started_ = true;
 	}
 	else
 	{
 		info_->status = e_module_uninit;
 	}
-	
+	publish_info();
 
 	return ret;
 }
@@ -86,7 +156,11 @@ appmodule_err_t AppModuleConfigure::init(void)
 // 启动
 appmodule_err_t AppModuleConfigure::run(void)
 {
+	std::lock_guard<std::mutex> lock(mtx_);
+
+	run_begin_ = clock::now();
 	appmodule_err_t ret = run_(info_);
+	run_end_ = clock::now();
 
 	if (APP_MODULE_OK == ret)
 	{
@@ -96,6 +170,7 @@ appmodule_err_t AppModuleConfigure::run(void)
 	{
 		info_->status = e_module_unruning;
 	}
+	publish_info();
 
 	return ret;
 }
@@ -103,6 +178,8 @@ appmodule_err_t AppModuleConfigure::run(void)
 // 修改参数
 appmodule_err_t AppModuleConfigure::change(void *param)
 {
+	std::lock_guard<std::mutex> lock(mtx_);
+
 	// 设置配置参数
 	info_->param = param;
 
@@ -110,6 +187,7 @@ appmodule_err_t AppModuleConfigure::change(void *param)
 
 	// 重置该变量
 	info_->param = nullptr;
+	publish_info();
 
 	return ret;
 }
@@ -117,9 +195,12 @@ appmodule_err_t AppModuleConfigure::change(void *param)
 // 停止
 appmodule_err_t AppModuleConfigure::stop(void)
 {
+	std::lock_guard<std::mutex> lock(mtx_);
+
 	appmodule_err_t ret = stop_(info_);
 
 	info_->status = e_module_unruning;
+	publish_info();
 
 	return ret;
 }
@@ -127,9 +208,12 @@ appmodule_err_t AppModuleConfigure::stop(void)
 // 退出
 appmodule_err_t AppModuleConfigure::exit(void)
 {
+	std::lock_guard<std::mutex> lock(mtx_);
+
 	appmodule_err_t ret = exit_(info_);
 
 	info_->status = e_module_uninit;
+	publish_info();
 
 	return ret;
 }
@@ -141,9 +225,73 @@ app_module_run_status_t AppModuleConfigure::run_status(void)
 }
 
 // 查询模块信息
-const appmodule_base_info_t& AppModuleConfigure::module_info(void) const
+appmodule_base_info_t AppModuleConfigure::module_info(void) const
 {
-	return *((appmodule_base_info_t*)info_);
+	// 基本信息是info_开头的公共部分，只读这部分
+	uint64_t words[(sizeof(appmodule_base_info_t) + sizeof(uint64_t) - 1) / sizeof(uint64_t)];
+	read_words(words, sizeof(words) / sizeof(words[0]));
+
+	appmodule_base_info_t info;
+	memcpy(&info, words, sizeof(info));
+
+	return info;
+}
+
+// 完整模块信息
+appmodule_info_t AppModuleConfigure::info(void) const
+{
+	uint64_t words[info_words];
+	read_words(words, info_words);
+
+	appmodule_info_t info;
+	memcpy(&info, words, sizeof(info));
+
+	return info;
+}
+
+// 读快照
+void AppModuleConfigure::read_words(uint64_t *words, size_t count) const
+{
+	unsigned seq = 0;
+
+	do
+	{
+		while ((seq = seq_.load(std::memory_order_acquire)) & 1)
+		{
+			std::this_thread::yield();
+		}
+
+		// acquire保证末尾的序号在读完数据之后读取
+		for (size_t i = 0; i < count; ++i)
+		{
+			words[i] = snapshot_[i].load(std::memory_order_acquire);
+		}
+	} while (seq_.load(std::memory_order_relaxed) != seq);
+}
+
+// 模块状态
+app_module_status_t AppModuleConfigure::status(void) const
+{
+	return (app_module_status_t)status_.load(std::memory_order_acquire);
+}
+
+// 更新快照
+void AppModuleConfigure::publish_info(void)
+{
+	uint64_t words[info_words] = {0};
+	memcpy(words, info_, sizeof(appmodule_info_t));
+
+	unsigned seq = seq_.load(std::memory_order_relaxed);
+	seq_.store(seq + 1, std::memory_order_relaxed);
+
+	// release保证读到新数据的读者也能读到奇数序号
+	for (size_t i = 0; i < info_words; ++i)
+	{
+		snapshot_[i].store(words[i], std::memory_order_release);
+	}
+
+	seq_.store(seq + 2, std::memory_order_release);
+	status_.store(info_->status, std::memory_order_release);
 }
 
 // 模块匹配
@@ -152,31 +300,620 @@ bool AppModuleConfigure::match(uint64_t identifier) const
 	return identifier == info_->identifer;
 }
 
+// 模块标识
+uint64_t AppModuleConfigure::identifier(void) const
+{
+	return info_->identifer;
+}
+
+// 依赖的模块标识
+std::vector<uint64_t> AppModuleConfigure::depends(void) const
+{
+	std::vector<uint64_t> ids;
+
+	for (uint64_t id : info_->depends)
+	{
+		if (APP_MODULE_INVALID_IDENTIFIER == id)
+		{
+			break;
+		}
+		ids.push_back(id);
+	}
+
+	return ids;
+}
+
+/**
+ * @brief 注册表快照，发布后只读
+ * 
+ */
+struct AppModule::registry_t {
+	std::vector<std::shared_ptr<appmodule_t>> modules;	///< 注册顺序
+	std::unordered_map<uint64_t, size_t> index;			///< 标识到modules下标
+	std::vector<std::vector<size_t>> deps;				///< 各模块依赖的模块
+	std::vector<std::vector<size_t>> users;				///< 依赖各模块的模块
+	std::string error;									///< 依赖不存在或有环时的描述
+};
+
+/**
+ * @brief 读侧临界区，期间registry指向的注册表不会被释放
+ * 
+ */
+class AppModule::read_guard {
+public:
+	explicit read_guard(const AppModule &am) : readers_(am.readers_[am.epoch_.load() & 1])
+	{
+		// 先计数后取注册表，写者替换后的等待一定能看到本读者
+		readers_.fetch_add(1);
+		registry = am.registry_.load();
+	}
+
+	~read_guard()
+	{
+		readers_.fetch_sub(1, std::memory_order_release);
+	}
+
+	read_guard(const read_guard &) = delete;
+	read_guard &operator=(const read_guard &) = delete;
+
+	const registry_t *registry;
+
+private:
+	std::atomic<unsigned> &readers_;
+};
+
 /**
  * @brief Construct a new App Module:: App Module object
  * 
- * @param li 
+ * @param li 模块列表
+ * @param threads 并行执行模块接口的线程数，0时取CPU数
  */
-AppModule::AppModule(const std::initializer_list<std::shared_ptr<appmodule_t>> &li) : modules_(li)
+AppModule::AppModule(const std::initializer_list<std::shared_ptr<appmodule_t>> &li, size_t threads) :
+	modules_(li), registry_(nullptr), epoch_(0),
+	pool_(new ThreadPool(threads ? (int)threads : (int)std::max(1u, std::thread::hardware_concurrency())))
 {
+	readers_[0] = 0;
+	readers_[1] = 0;
 
+	std::lock_guard<std::mutex> lock(mtx_);
+	publish();
 }
 
 AppModule::~AppModule()
 {
+	// 先等排队的参数修改完成，之后才能退出模块
+	for (auto &module : modules_)
+	{
+		std::unique_lock<std::mutex> lock(module->change_mtx_);
+		module->change_closed_ = true;
+		module->change_cv_.wait(lock, [&module] { return !module->change_posted_; });
+	}
+
+	try
+	{
+		finit_module();
+	}
+	catch (...)
+	{
+		// 依赖有误时由各模块析构自行停止
+	}
+
+	delete registry_.load();
 	modules_.clear();
 }
 
 // 动态注册模块
-int AppModule::register_module(const std::shared_ptr<appmodule_t> &module)
+int AppModule::register_module(const std::shared_ptr<appmodule_t> &module, bool lazy)
 {
+	std::lock_guard<std::mutex> lock(mtx_);
+
+	if (!module || find(module->identifier()))
+	{
+		return -1;
+	}
+
+	module->lazy_ = lazy;
 	modules_.push_back(module);
+	publish();
+
+	return 0;
+}
+
+// 从动态库加载模块
+uint64_t AppModule::load_module(const std::string &path, bool lazy)
+{
+	void *handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+	if (!handle)
+	{
+		throw std::runtime_error(dlerror());
+	}
+
+	// 先于module声明，module析构(可能调用退出接口)之后才关闭
+	std::shared_ptr<void> library(handle, dlclose);
+
+	const appmodule_descriptor_t *desc = (const appmodule_descriptor_t *)dlsym(handle, APP_MODULE_DESCRIPTOR_SYMBOL);
+	if (!desc || !desc->info)
+	{
+		throw std::runtime_error(path + ": no module descriptor");
+	}
+	else if (desc->abi_version != APP_MODULE_ABI_VERSION || desc->info_size != sizeof(appmodule_info_t))
+	{
+		throw std::runtime_error(path + ": module abi mismatch");
+	}
+
+	// 同一动态库再次dlopen得到同一句柄，模块信息与已注册的模块共用，不能再构造一份
+	if (find(desc->info->identifer))
+	{
+		throw std::runtime_error(path + ": module " + std::to_string(desc->info->identifer) + " already registered");
+	}
+
+	std::shared_ptr<appmodule_t> module = std::make_shared<appmodule_t>(desc->info, desc->init, desc->run, desc->change,
+																		 desc->stop, desc->exit, desc->run_status);
+	module->library_ = library;
+
+	if (register_module(module, lazy) != 0)
+	{
+		throw std::runtime_error(path + ": module " + std::to_string(module->identifier()) + " already registered");
+	}
+
+	return module->identifier();
 }
 
 // 动态卸载模块
-void AppModule::unregister_module(uint64_t identifier)
+int AppModule::unregister_module(uint64_t identifier)
 {
-	// modules_.erase()
+	std::lock_guard<std::mutex> lock(mtx_);
+
+	const registry_t &reg = *registry_.load();
+	auto it = reg.index.find(identifier);
+	if (it == reg.index.end() || !reg.users[it->second].empty())
+	{
+		return -1;
+	}
+
+	std::shared_ptr<appmodule_t> module = reg.modules[it->second];
+
+	// 先移出注册表，之后的查找都找不到本模块
+	modules_.erase(std::find(modules_.begin(), modules_.end(), module));
+	publish();
+
+	{
+		std::unique_lock<std::mutex> change_lock(module->change_mtx_);
+		module->change_closed_ = true;
+		module->change_cv_.wait(change_lock, [&module] { return !module->change_posted_; });
+	}
+
+	if (e_module_runing == module->status())
+	{
+		module->stop();
+	}
+	if (e_module_inited == module->status() || e_module_unruning == module->status())
+	{
+		module->exit();
+	}
+
+	// 仍在使用本模块的调用返回后，最后一个引用释放时关闭动态库
+	return 0;
+}
+
+// 初始化模块，可指定
+appmodule_err_t AppModule::init_module(uint64_t identifier)
+{
+	std::lock_guard<std::mutex> lock(mtx_);
+	return run_phase(phase_t::init, identifier);
+}
+
+// 运行模块，可指定
+appmodule_err_t AppModule::run_module(uint64_t identifier)
+{
+	std::lock_guard<std::mutex> lock(mtx_);
+	return run_phase(phase_t::run, identifier);
+}
+
+// 停止模块，可指定
+appmodule_err_t AppModule::stop_module(uint64_t identifier)
+{
+	std::lock_guard<std::mutex> lock(mtx_);
+	return run_phase(phase_t::stop, identifier);
+}
+
+// 反初始化模块，可指定
+appmodule_err_t AppModule::finit_module(uint64_t identifier)
+{
+	std::lock_guard<std::mutex> lock(mtx_);
+	return run_phase(phase_t::exit, identifier);
+}
+
+// 异步修改模块参数，不占用mtx_，与其他模块的操作并行
+AsyncFuture<appmodule_err_t> AppModule::change_module_async(uint64_t identifier, void *param)
+{
+	AsyncPromise<appmodule_err_t> promise(pool_.get());
+	AsyncFuture<appmodule_err_t> future = promise.get_future();
+
+	std::shared_ptr<appmodule_t> module = find(identifier);
+	if (!module || (module->lazy_ && e_module_uninit == module->status() && APP_MODULE_OK != activate(identifier)))
+	{
+		promise.set_value(APP_MODULE_ERROR);
+		return future;
+	}
+
+	bool post = false;
+	{
+		std::lock_guard<std::mutex> lock(module->change_mtx_);
+		if (module->change_closed_)
+		{
+			promise.set_value(APP_MODULE_ERROR);
+			return future;
+		}
+
+		module->change_param_ = param;
+		module->change_pending_ = true;
+		module->change_waiters_.push_back(std::move(promise));
+		if (!module->change_posted_)
+		{
+			module->change_posted_ = post = true;
+		}
+	}
+
+	if (post)
+	{
+		pool_->post([this, module] { drain_changes(module); });
+	}
+
+	return future;
+}
+
+// 启动延迟模块，第一次使用时由调用者线程执行
+appmodule_err_t AppModule::activate(uint64_t identifier)
+{
+	std::lock_guard<std::mutex> lock(mtx_);
+
+	appmodule_err_t ret = run_phase(phase_t::init, identifier);
+	if (APP_MODULE_OK != ret)
+	{
+		return ret;
+	}
+
+	return run_phase(phase_t::run, identifier);
+}
+
+// 修改模块参数
+appmodule_err_t AppModule::change_module(uint64_t identifier, void *param)
+{
+	return change_module_async(identifier, param).get();
+}
+
+// 查询模块信息
+bool AppModule::query_module(uint64_t identifier, appmodule_info_t &info)
+{
+	std::shared_ptr<appmodule_t> module = find(identifier);
+	if (!module)
+	{
+		return false;
+	}
+
+	info = module->info();
+
+	return true;
+}
+
+// 查询所有模块信息
+bool AppModule::query_module(std::vector<appmodule_info_t> &info)
+{
+	read_guard guard(*this);
+
+	info.clear();
+	for (auto &module : guard.registry->modules)
+	{
+		info.push_back(module->info());
+	}
+
+	return true;
+}
+
+// 各模块最近一次启动的耗时
+std::vector<appmodule_timing_t> AppModule::startup_timings(void)
+{
+	std::lock_guard<std::mutex> lock(mtx_);
+
+	std::chrono::steady_clock::time_point origin;
+	for (auto &module : modules_)
+	{
+		if (module->init_begin_ != origin && (origin == std::chrono::steady_clock::time_point() || module->init_begin_ < origin))
+		{
+			origin = module->init_begin_;
+		}
+	}
+
+	std::vector<appmodule_timing_t> timings;
+	for (auto &module : modules_)
+	{
+		appmodule_timing_t t;
+		t.identifier = module->identifier();
+		t.name = module->info_->name;
+		t.init = since(module->init_begin_, module->init_end_);
+		t.run = since(module->run_begin_, module->run_end_);
+		t.start = since(origin, module->init_begin_);
+		t.ready = since(origin, module->run_end_);
+		timings.push_back(t);
+	}
+
+	return timings;
+}
+
+// 按标识查找
+std::shared_ptr<appmodule_t> AppModule::find(uint64_t identifier) const
+{
+	read_guard guard(*this);
+
+	auto it = guard.registry->index.find(identifier);
+	if (it == guard.registry->index.end())
+	{
+		return nullptr;
+	}
+
+	return guard.registry->modules[it->second];
+}
+
+// 应用排队的参数修改
+void AppModule::drain_changes(const std::shared_ptr<appmodule_t> &module)
+{
+	std::vector<AsyncPromise<appmodule_err_t>> waiters;
+	void *param = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(module->change_mtx_);
+		param = module->change_param_;
+		waiters.swap(module->change_waiters_);
+		module->change_pending_ = false;
+	}
+
+	appmodule_err_t ret = module->change(param);
+	for (auto &waiter : waiters)
+	{
+		waiter.set_value(ret);
+	}
+
+	// 处理期间又有新参数时重新投递，不在一个模块上占住工作线程
+	bool again = false;
+	{
+		std::lock_guard<std::mutex> lock(module->change_mtx_);
+		again = module->change_pending_;
+		if (!again)
+		{
+			module->change_posted_ = false;
+			module->change_cv_.notify_all();
+		}
+	}
+
+	if (again)
+	{
+		pool_->post([this, module] { drain_changes(module); });
+	}
+}
+
+// 重建注册表
+void AppModule::publish(void)
+{
+	std::unique_ptr<registry_t> next(new registry_t);
+	const size_t n = modules_.size();
+
+	next->modules = modules_;
+	next->deps.resize(n);
+	next->users.resize(n);
+	for (size_t i = 0; i < n; ++i)
+	{
+		next->index[modules_[i]->identifier()] = i;
+	}
+
+	for (size_t i = 0; i < n && next->error.empty(); ++i)
+	{
+		for (uint64_t id : modules_[i]->depends())
+		{
+			auto it = next->index.find(id);
+			if (it == next->index.end())
+			{
+				next->error = std::string("module ") + modules_[i]->info_->name + " depends on missing module " + std::to_string(id);
+				break;
+			}
+			next->deps[i].push_back(it->second);
+			next->users[it->second].push_back(i);
+		}
+	}
+
+	std::vector<char> color(n, 0);
+	std::vector<size_t> path;
+	for (size_t i = 0; i < n && next->error.empty(); ++i)
+	{
+		if (color[i] == 0 && find_cycle(next->deps, i, color, path))
+		{
+			next->error = "module dependency cycle: ";
+			for (size_t k = 0; k < path.size(); ++k)
+			{
+				next->error += (k ? " -> " : "") + std::string(modules_[path[k]]->info_->name);
+			}
+		}
+	}
+
+	const registry_t *old = registry_.exchange(next.release());
+	if (old)
+	{
+		synchronize();
+		delete old;
+	}
+}
+
+// 两次翻转epoch_：第一次后新读者进入另一个计数槽，旧槽的读者只减不增；
+// 第二次覆盖翻转前已取到槽号、翻转后才计数的读者
+void AppModule::synchronize(void)
+{
+	for (int k = 0; k < 2; ++k)
+	{
+		unsigned slot = epoch_.load() & 1;
+		epoch_.store(slot ^ 1);
+		while (readers_[slot].load(std::memory_order_acquire) != 0)
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+// 在依赖图上并行执行一个阶段
+appmodule_err_t AppModule::run_phase(phase_t phase, uint64_t identifier)
+{
+	// 写者持有mtx_，注册表不会在此期间被替换
+	const registry_t &reg = *registry_.load();
+	const size_t n = reg.modules.size();
+	const std::vector<std::vector<size_t>> &deps = reg.deps;
+	const std::vector<std::vector<size_t>> &users = reg.users;
+
+	if (!reg.error.empty())
+	{
+		throw std::logic_error(reg.error);
+	}
+
+	// 启动沿依赖扩展，停止沿依赖本模块的方向扩展
+	const bool forward = phase == phase_t::init || phase == phase_t::run;
+	std::vector<char> selected(n, 0);
+	std::vector<size_t> stack;
+	if (APP_MODULE_INVALID_IDENTIFIER != identifier)
+	{
+		auto it = reg.index.find(identifier);
+		if (it == reg.index.end())
+		{
+			return APP_MODULE_ERROR;
+		}
+		stack.push_back(it->second);
+	}
+	else
+	{
+		// 未启动的延迟模块只在被依赖时随之启动
+		for (size_t i = n; i > 0; --i)
+		{
+			if (!forward || !reg.modules[i - 1]->lazy_ || e_module_uninit != reg.modules[i - 1]->status())
+			{
+				stack.push_back(i - 1);
+			}
+		}
+	}
+
+	while (!stack.empty())
+	{
+		size_t i = stack.back();
+		stack.pop_back();
+		if (selected[i])
+		{
+			continue;
+		}
+		selected[i] = 1;
+		for (size_t next : forward ? deps[i] : users[i])
+		{
+			stack.push_back(next);
+		}
+	}
+
+	std::vector<appmodule_err_t> errs(n, APP_MODULE_OK);
+	std::vector<char> failed(n, 0);
+	std::vector<TaskGraph::NodeId> nodes(n);
+	TaskGraph graph;
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		if (!selected[i])
+		{
+			continue;
+		}
+
+		nodes[i] = graph.add([&, i] {
+			appmodule_t &module = *reg.modules[i];
+			app_module_status_t status = module.status();
+			appmodule_err_t ret = APP_MODULE_OK;
+
+			// 依赖失败时跳过，依赖的标记在本节点开始前已写入
+			if (forward)
+			{
+				for (size_t d : deps[i])
+				{
+					if (failed[d])
+					{
+						failed[i] = 1;
+						return;
+					}
+				}
+			}
+
+			switch (phase)
+			{
+			case phase_t::init:
+				if (e_module_uninit == status || e_module_bad == status)
+				{
+					ret = module.init();
+				}
+				break;
+			case phase_t::run:
+				if (e_module_uninit == status || e_module_bad == status)
+				{
+					ret = APP_MODULE_ERROR;
+				}
+				else if (e_module_runing != status)
+				{
+					ret = module.run();
+				}
+				break;
+			case phase_t::stop:
+				if (e_module_runing == status)
+				{
+					ret = module.stop();
+				}
+				break;
+			case phase_t::exit:
+				if (e_module_runing == status)
+				{
+					ret = module.stop();
+					status = module.status();
+				}
+				if (e_module_inited == status || e_module_unruning == status)
+				{
+					appmodule_err_t exit_ret = module.exit();
+					ret = APP_MODULE_OK == ret ? exit_ret : ret;
+				}
+				break;
+			}
+
+			if (APP_MODULE_OK != ret)
+			{
+				failed[i] = 1;
+				errs[i] = ret;
+			}
+		});
+	}
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		if (!selected[i])
+		{
+			continue;
+		}
+
+		for (size_t d : deps[i])
+		{
+			if (selected[d])
+			{
+				forward ? graph.precede(nodes[d], nodes[i]) : graph.precede(nodes[i], nodes[d]);
+			}
+		}
+	}
+
+	graph.run(*pool_).get();
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		if (APP_MODULE_OK != errs[i])
+		{
+			return errs[i];
+		}
+	}
+
+	return APP_MODULE_OK;
 }
 
 }
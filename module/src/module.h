@@ -12,16 +12,20 @@
 #define __wotsen_app_MODULE_H__
 
 #include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
 #include <vector>
 #include <memory>
 #include <exception>
+#include <stdexcept>
+#include <condition_variable>
+#include "../../thread-pool/async-future.h"
 #include "module_def.h"
 
 namespace wotsen
 {
 
-using appmodule_t = AppModuleConfigure;
-
 /**
  * @brief 模块配置
  * 
@@ -39,6 +43,7 @@ public:
 	 * @param stop_fn 停止接口
 	 * @param exit_fn 退出接口
 	 * @param run_st_fn 运行时状态
+	 * @throw std::logic_error 模块信息或接口为空
 	 */
 	AppModuleConfigure(appmodule_info_t *info,
 					   app_module_fun_t init_fn,
@@ -46,7 +51,7 @@ public:
 					   app_module_fun_t chg_fn,
 					   app_module_fun_t stop_fn,
 					   app_module_fun_t exit_fn,
-					   app_module_status_fun_t run_st_fn) throw(std::logic_error);
+					   app_module_status_fun_t run_st_fn);
 	~AppModuleConfigure();
 
 public:
@@ -60,14 +65,34 @@ public:
 	appmodule_err_t stop(void);
 	// 退出
 	appmodule_err_t exit(void);
-	// 运行时状态查询
+	// 运行时状态查询，直接调用模块的接口
 	app_module_run_status_t run_status(void); 
-	// 查询模块信息
-	const appmodule_base_info_t& module_info(void) const;
+	// 查询模块信息，读快照，不加锁
+	appmodule_base_info_t module_info(void) const;
+	// 完整模块信息，读快照，不加锁
+	appmodule_info_t info(void) const;
+	// 模块状态，不加锁
+	app_module_status_t status(void) const;
 	// 模块匹配
 	bool match(uint64_t identifier) const;
+	// 模块标识
+	uint64_t identifier(void) const;
+	// 依赖的模块标识
+	std::vector<uint64_t> depends(void) const;
 
 private:
+	friend class AppModule;
+
+	using clock = std::chrono::steady_clock;
+
+	// 按字保存的info_大小
+	static constexpr size_t info_words = (sizeof(appmodule_info_t) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+	// 由info_更新快照，需持有mtx_
+	void publish_info(void);
+	// 读快照的前count个字
+	void read_words(uint64_t *words, size_t count) const;
+
 	std::mutex mtx_;					///< 操作锁
 	// TODO:改为只能指针?
 	appmodule_info_t *info_;			///< 模块信息
@@ -77,6 +102,45 @@ private:
 	app_module_fun_t stop_;				///< 模块停止
 	app_module_fun_t exit_;				///< 模块卸载
 	app_module_status_fun_t run_status_;	///< 模块运行时状态
+	clock::time_point init_begin_;		///< 最近一次init_开始时间
+	clock::time_point init_end_;		///< 最近一次init_结束时间
+	clock::time_point run_begin_;		///< 最近一次run_开始时间
+	clock::time_point run_end_;			///< 最近一次run_结束时间
+	/**
+	 * @brief info_的快照
+	 * @details 顺序锁：写者持有mtx_，序号置为奇数后逐字写入，写完再置为偶数；
+	 *          读者不加锁，读到奇数或前后序号不同时重读。按原子字读写，读写并发时不存在数据竞争
+	 * 
+	 */
+	std::atomic<unsigned> seq_;
+	std::atomic<uint64_t> snapshot_[info_words];
+	std::atomic<int> status_;			///< 快照中的状态，单独保存供status()使用
+	std::mutex change_mtx_;				///< 保护以下待应用的参数修改
+	std::condition_variable change_cv_;	///< 排队的修改全部完成时通知
+	bool change_posted_;				///< 已投递到线程池，尚未处理完
+	bool change_pending_;				///< 有待应用的参数
+	void *change_param_;				///< 最新的参数，覆盖之前未应用的
+	std::vector<AsyncPromise<appmodule_err_t>> change_waiters_;	///< 等待本轮参数生效的调用者
+	bool change_closed_;				///< 已卸载，不再接受修改
+	bool lazy_;							///< 第一次使用时才启动，注册前设置
+	bool started_;						///< 由本对象初始化过，析构时只清理自己启动的模块
+	std::shared_ptr<void> library_;		///< 模块所在的动态库，最后一个引用释放时关闭
+};
+
+using appmodule_t = AppModuleConfigure;
+
+/**
+ * @brief 模块启动耗时
+ * @details 时刻均相对于最近一次启动中最早开始init_的模块
+ * 
+ */
+struct appmodule_timing_t {
+	uint64_t identifier;				///< 模块标识
+	std::string name;					///< 模块名称
+	std::chrono::microseconds init;		///< init_耗时
+	std::chrono::microseconds run;		///< run_耗时
+	std::chrono::microseconds start;	///< 开始init_的时刻
+	std::chrono::microseconds ready;	///< run_完成的时刻
 };
 
 /**
@@ -86,34 +150,125 @@ private:
 class AppModule
 {
 public:
-	AppModule(const std::initializer_list<std::shared_ptr<appmodule_t>> &li);
+	/**
+	 * @brief Construct a new App Module object
+	 * 
+	 * @param li 模块列表
+	 * @param threads 并行执行模块接口的线程数，0时取CPU数
+	 */
+	AppModule(const std::initializer_list<std::shared_ptr<appmodule_t>> &li, size_t threads = 0);
+	// 按依赖的逆序停止并退出所有模块
 	~AppModule();
 
 public:
-	// 动态注册模块
-	int register_module(const std::shared_ptr<appmodule_t> &module);
-	// 动态卸载模块
-	void unregister_module(uint64_t identifier);
+	/**
+	 * @brief 动态注册模块
+	 * 
+	 * @param module 模块
+	 * @param lazy 为true时不随全部模块的init_module()/run_module()启动，
+	 *             第一次修改参数、被其他模块依赖或单独初始化时才启动
+	 * @return int 成功为0，模块为空或标识已存在为-1
+	 */
+	int register_module(const std::shared_ptr<appmodule_t> &module, bool lazy = false);
+	/**
+	 * @brief 从动态库加载并注册模块
+	 * @details 动态库用APP_MODULE_EXPORT导出模块描述；模块卸载且不再被引用后关闭动态库
+	 * 
+	 * @param path 动态库路径
+	 * @param lazy 同register_module
+	 * @return uint64_t 模块标识
+	 * @throw std::runtime_error 打开失败、没有模块描述、版本不符或标识已存在
+	 * @throw std::logic_error 模块描述中信息或接口为空
+	 */
+	uint64_t load_module(const std::string &path, bool lazy = true);
+	/**
+	 * @brief 动态卸载模块
+	 * @details 不再接受新的参数修改，等排队的修改完成后停止并退出模块，再从注册表中移除
+	 * 
+	 * @param identifier 模块标识
+	 * @return int 成功为0，模块不存在或仍被其他模块依赖为-1
+	 */
+	int unregister_module(uint64_t identifier);
 
 public:
-	// 初始化模块，可指定
+	/**
+	 * @brief 生命周期操作
+	 * @details 按依赖关系组成有向无环图，没有依赖关系的模块在线程池中并行执行。
+	 *          init/run按拓扑序，依赖先执行，指定模块时连同其未就绪的依赖一起执行；
+	 *          依赖失败的模块跳过；不指定模块时跳过未启动的延迟模块，除非被其他模块依赖。stop/finit按拓扑逆序，依赖本模块的先停止，
+	 *          指定模块时连同依赖它的模块一起停止；停止失败不影响其他模块继续停止。
+	 *          已处于目标状态的模块不再执行。模块接口中不能再调用AppModule的接口
+	 * 
+	 * @param identifier 模块标识，APP_MODULE_INVALID_IDENTIFIER为全部模块
+	 * @return appmodule_err_t 成功为APP_MODULE_OK，否则为第一个失败模块(按注册顺序)的错误码，
+	 *         模块不存在或未初始化就启动为APP_MODULE_ERROR
+	 * @throw std::logic_error 依赖不存在或有环，异常信息中给出环上的模块
+	 */
 	appmodule_err_t init_module(uint64_t identifier = APP_MODULE_INVALID_IDENTIFIER);
 	// 运行模块，可指定
 	appmodule_err_t run_module(uint64_t identifier = APP_MODULE_INVALID_IDENTIFIER);
 	// 停止模块，可指定
 	appmodule_err_t stop_module(uint64_t identifier = APP_MODULE_INVALID_IDENTIFIER);
-	// 反初始化模块，可指定
+	// 反初始化模块，运行中的先停止，可指定
 	appmodule_err_t finit_module(uint64_t identifier = APP_MODULE_INVALID_IDENTIFIER);
-	// 修改模块参数
+	/**
+	 * @brief 异步修改模块参数
+	 * @details 按模块排队，在线程池中调用模块的变更接口，同一模块的修改按提交顺序生效。
+	 *          前一次修改尚未开始时新参数覆盖旧参数，被覆盖的调用者与之一起得到最新参数的结果，
+	 *          因此param在得到结果前需保持有效
+	 * 
+	 * @param identifier 模块标识
+	 * @param param 参数，调用变更接口期间置于info->param
+	 * @return AsyncFuture<appmodule_err_t> 变更接口的返回值，模块不存在为APP_MODULE_ERROR
+	 */
+	AsyncFuture<appmodule_err_t> change_module_async(uint64_t identifier, void *param);
+	// 修改模块参数，与异步修改一起排队，生效后返回
 	appmodule_err_t change_module(uint64_t identifier, void *param);
 	// 查询模块信息
 	bool query_module(uint64_t identifier, appmodule_info_t &info);
 	// 查询所有模块信息
 	bool query_module(std::vector<appmodule_info_t> &info);
+	// 各模块最近一次启动的耗时，按注册顺序
+	std::vector<appmodule_timing_t> startup_timings(void);
 
-public:
-	std::mutex mtx_;
-	std::vector<std::shared_ptr<appmodule_t>> modules_;	///< 模块列表，改为二叉搜索树?
+private:
+	enum class phase_t {
+		init,
+		run,
+		stop,
+		exit,
+	};
+
+	struct registry_t;
+	class read_guard;
+
+	// 在依赖图上并行执行一个阶段，需持有mtx_
+	appmodule_err_t run_phase(phase_t phase, uint64_t identifier);
+	// 按标识查找，不加锁
+	std::shared_ptr<appmodule_t> find(uint64_t identifier) const;
+	// 由modules_重建注册表并替换，等读者离开旧注册表后释放，需持有mtx_
+	void publish(void);
+	// 等待替换前进入的读者全部离开
+	void synchronize(void);
+	// 应用模块排队的参数修改，还有新的修改时重新投递
+	void drain_changes(const std::shared_ptr<appmodule_t> &module);
+	// 启动未启动的延迟模块
+	appmodule_err_t activate(uint64_t identifier);
+
+	std::mutex mtx_;									///< 写锁，注册和生命周期操作互斥
+	std::vector<std::shared_ptr<appmodule_t>> modules_;	///< 模块列表，修改后需publish
+
+	/**
+	 * @brief 注册表
+	 * @details 写时复制：写者在mtx_下由modules_生成新注册表后整体替换，读者不加锁，
+	 *          只在进入时对所在计数槽加一、离开时减一；写者翻转epoch_两次，
+	 *          分别等两个计数槽归零后再释放旧注册表
+	 * 
+	 */
+	std::atomic<const registry_t*> registry_;
+	std::atomic<unsigned> epoch_;					///< 新读者使用的计数槽
+	mutable std::atomic<unsigned> readers_[2];		///< 各计数槽中的读者数
+	std::unique_ptr<ThreadPool> pool_;	///< 执行生命周期操作和参数修改
 };
 
 #define APP_MODULE(info, init, run, chg, stop, exit, run_st) \
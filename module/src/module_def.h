@@ -17,11 +17,6 @@
 typedef uint64_t appmodule_err_t;
 typedef struct appmodule_info_s appmodule_info_t;
 typedef struct appmodule_base_info_s appmodule_base_info_t;
-typedef enum app_module_status_e app_module_status_t;
-typedef enum app_module_run_status_e app_module_run_status_t;
-
-typedef appmodule_err_t (*app_module_fun_t)(appmodule_info_t*);
-typedef app_module_run_status_t (*app_module_status_fun_t)(appmodule_info_t*);
 
 ///< 起始错误码
 #define APP_MODULE_OK 0
@@ -32,6 +27,9 @@ typedef app_module_run_status_t (*app_module_status_fun_t)(appmodule_info_t*);
 ///< 非法模块标识
 #define APP_MODULE_INVALID_IDENTIFIER 0
 
+///< 最多依赖的模块数
+#define APP_MODULE_MAX_DEPENDS 16
+
 /**
  * @brief 模块状态码
  * 
@@ -42,7 +40,7 @@ typedef enum app_module_status_e {
 	e_module_unruning,
 	e_module_runing,
 	e_module_bad,
-};
+} app_module_status_t;
 
 /**
  * @brief 模块运行状态码
@@ -52,7 +50,10 @@ typedef enum app_module_run_status_e {
 	e_module_run_st_ok,
 	e_module_run_st_err,
 	e_module_run_st_unknown,
-};
+} app_module_run_status_t;
+
+typedef appmodule_err_t (*app_module_fun_t)(appmodule_info_t*);
+typedef app_module_run_status_t (*app_module_status_fun_t)(appmodule_info_t*);
 
 /**
  * @brief 模块权限
@@ -107,6 +108,42 @@ struct appmodule_info_s {
 	void *handle;			///< 句柄
 	void *param;			///< 配置，临时变量，每次调用配置修改时会置位
 	void *data;				///< 私有数据
+	uint64_t depends[APP_MODULE_MAX_DEPENDS];	///< 依赖的模块标识，遇到APP_MODULE_INVALID_IDENTIFIER结束；依赖先于本模块启动、后于本模块停止
 };
 
+///< 动态库模块描述的版本，描述或模块信息的布局变化时递增
+#define APP_MODULE_ABI_VERSION 1
+
+///< 动态库中模块描述的符号名
+#define APP_MODULE_DESCRIPTOR_SYMBOL "wotsen_app_module_descriptor"
+
+/**
+ * @brief 动态库模块描述
+ * @details 动态库用APP_MODULE_EXPORT导出，由AppModule::load_module加载
+ * 
+ */
+typedef struct appmodule_descriptor_s {
+	uint32_t abi_version;				///< APP_MODULE_ABI_VERSION
+	uint32_t info_size;					///< sizeof(appmodule_info_t)
+	appmodule_info_t *info;				///< 模块信息，位于动态库中
+	app_module_fun_t init;				///< 初始化接口
+	app_module_fun_t run;				///< 启动接口
+	app_module_fun_t change;			///< 变更接口
+	app_module_fun_t stop;				///< 停止接口
+	app_module_fun_t exit;				///< 退出接口
+	app_module_status_fun_t run_status;	///< 运行时状态
+} appmodule_descriptor_t;
+
+#ifdef __cplusplus
+#define APP_MODULE_EXTERN_C extern "C"
+#else
+#define APP_MODULE_EXTERN_C
+#endif
+
+///< 在动态库中导出模块描述，每个动态库一个
+#define APP_MODULE_EXPORT(info, init, run, chg, stop, exit, run_st) \
+APP_MODULE_EXTERN_C __attribute__((visibility("default"))) const appmodule_descriptor_t wotsen_app_module_descriptor = { \
+	APP_MODULE_ABI_VERSION, (uint32_t)sizeof(appmodule_info_t), info, init, run, chg, stop, exit, run_st \
+}
+
 #endif // !__wotsen_app_MODULE_DEF_H__
@@ -0,0 +1,315 @@
+/**
+ * @file test.cpp
+ * @author yuwangliang (wotsen@outlook.com)
+ * @brief 模块管理示例：依赖图启动、延迟启动、卸载、重复加载
+ * @details g++ -std=c++11 -pthread test.cpp src/module.cpp -ldl，
+ *          动态库部分需要先编译plugin/demo-module.cpp，第一个参数可指定其路径
+ * @version 0.1
+ * @date 2020-07-19
+ *
+ * @copyright Copyright (c) 2020 yuwangliang
+ *
+ */
+#include <string.h>
+#include <unistd.h>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include "src/module.h"
+
+using namespace wotsen;
+
+// 各接口的调用次数
+static int g_inits, g_runs, g_stops, g_exits;
+static int g_failed;
+
+static appmodule_err_t count_init(appmodule_info_t *)
+{
+	g_inits++;
+	return APP_MODULE_OK;
+}
+
+static appmodule_err_t count_run(appmodule_info_t *)
+{
+	g_runs++;
+	return APP_MODULE_OK;
+}
+
+static appmodule_err_t count_change(appmodule_info_t *)
+{
+	return APP_MODULE_OK;
+}
+
+static appmodule_err_t count_stop(appmodule_info_t *)
+{
+	g_stops++;
+	return APP_MODULE_OK;
+}
+
+static appmodule_err_t count_exit(appmodule_info_t *)
+{
+	g_exits++;
+	return APP_MODULE_OK;
+}
+
+static app_module_run_status_t count_run_status(appmodule_info_t *)
+{
+	return e_module_run_st_ok;
+}
+
+// 按依赖启动的模块记录调用顺序，正数为初始化，负数为停止
+static std::mutex g_log_mtx;
+static std::vector<long> g_log;
+static std::atomic<int> g_active(0), g_peak(0);
+static const uint64_t kFailing = 20;	///< 初始化失败的模块
+
+static void log_call(long id)
+{
+	std::lock_guard<std::mutex> lock(g_log_mtx);
+	g_log.push_back(id);
+}
+
+static size_t log_pos(long id)
+{
+	std::lock_guard<std::mutex> lock(g_log_mtx);
+	return std::find(g_log.begin(), g_log.end(), id) - g_log.begin();
+}
+
+static appmodule_err_t graph_init(appmodule_info_t *info)
+{
+	int active = ++g_active;
+	int peak = g_peak.load();
+	while (active > peak && !g_peak.compare_exchange_weak(peak, active))
+	{
+	}
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	log_call((long)info->identifer);
+	g_active--;
+
+	return kFailing == info->identifer ? APP_MODULE_ERROR : APP_MODULE_OK;
+}
+
+static appmodule_err_t graph_ok(appmodule_info_t *)
+{
+	return APP_MODULE_OK;
+}
+
+static appmodule_err_t graph_stop(appmodule_info_t *info)
+{
+	log_call(-(long)info->identifer);
+	return APP_MODULE_OK;
+}
+
+static void check(bool ok, const char *what)
+{
+	std::cout << (ok ? "ok   " : "FAIL ") << what << std::endl;
+	if (!ok)
+	{
+		g_failed++;
+	}
+}
+
+static appmodule_info_t make_info(uint64_t identifier)
+{
+	appmodule_info_t info;
+	memset(&info, 0, sizeof(info));
+	snprintf(info.name, sizeof(info.name), "count-%llu", (unsigned long long)identifier);
+	info.enable = true;
+	info.identifer = identifier;
+	info.status = e_module_uninit;
+	return info;
+}
+
+int main(int argc, char **argv)
+{
+	const char *plugin = argc > 1 ? argv[1] : "plugin/demo-module.so";
+
+	// 依赖图：10 <- 11、12 <- 13，11与12互不依赖，并行初始化；停止按逆序
+	{
+		static appmodule_info_t infos[4] = {make_info(10), make_info(11), make_info(12), make_info(13)};
+		infos[1].depends[0] = 10;
+		infos[2].depends[0] = 10;
+		infos[3].depends[0] = 11;
+		infos[3].depends[1] = 12;
+
+		AppModule am({}, 4);
+		for (auto &info : infos)
+		{
+			am.register_module(APP_MODULE(&info, graph_init, graph_ok, graph_ok, graph_stop, graph_ok, count_run_status));
+		}
+
+		check(am.init_module() == APP_MODULE_OK && am.run_module() == APP_MODULE_OK, "graph init and run");
+		check(log_pos(10) < log_pos(11) && log_pos(10) < log_pos(12) && log_pos(11) < log_pos(13) && log_pos(12) < log_pos(13),
+			  "dependencies initialised first");
+		check(g_peak.load() >= 2, "independent modules initialised in parallel");
+
+		check(am.stop_module() == APP_MODULE_OK, "graph stop");
+		check(log_pos(-13) < log_pos(-11) && log_pos(-13) < log_pos(-12) && log_pos(-11) < log_pos(-10) && log_pos(-12) < log_pos(-10),
+			  "users stopped before their dependencies");
+	}
+
+	// 依赖初始化失败的模块跳过，返回失败模块的错误码
+	{
+		static appmodule_info_t failing = make_info(kFailing), user = make_info(21);
+		user.depends[0] = kFailing;
+
+		AppModule am({}, 2);
+		am.register_module(APP_MODULE(&failing, graph_init, graph_ok, graph_ok, graph_stop, graph_ok, count_run_status));
+		am.register_module(APP_MODULE(&user, graph_init, graph_ok, graph_ok, graph_stop, graph_ok, count_run_status));
+
+		check(am.init_module() == APP_MODULE_ERROR, "failed dependency reported");
+		check(log_pos(21) == g_log.size(), "module with failed dependency skipped");
+	}
+
+	// 依赖有环时抛出logic_error，信息中给出环上的模块
+	{
+		static appmodule_info_t first = make_info(30), second = make_info(31);
+		first.depends[0] = 31;
+		second.depends[0] = 30;
+
+		AppModule am({}, 1);
+		am.register_module(APP_MODULE(&first, graph_init, graph_ok, graph_ok, graph_stop, graph_ok, count_run_status));
+		am.register_module(APP_MODULE(&second, graph_init, graph_ok, graph_ok, graph_stop, graph_ok, count_run_status));
+
+		std::string error;
+		try
+		{
+			am.init_module();
+		}
+		catch (const std::logic_error &e)
+		{
+			error = e.what();
+		}
+		std::cout << "     " << error << std::endl;
+		check(error.find("count-30") != std::string::npos && error.find("count-31") != std::string::npos, "cycle named in logic_error");
+	}
+
+	// 注册、卸载的同时无锁查找：常驻模块始终找得到，找到的模块信息与标识一致
+	{
+		static appmodule_info_t resident = make_info(40);
+		static appmodule_info_t churn[8] = {make_info(41), make_info(42), make_info(43), make_info(44),
+											make_info(45), make_info(46), make_info(47), make_info(48)};
+
+		AppModule am({}, 1);
+		am.register_module(APP_MODULE(&resident, graph_ok, graph_ok, graph_ok, graph_ok, graph_ok, count_run_status));
+
+		std::atomic<bool> stop(false);
+		std::atomic<long> lookups(0), misses(0), mismatches(0);
+		std::vector<std::thread> readers;
+		for (int r = 0; r < 2; ++r)
+		{
+			readers.emplace_back([&] {
+				appmodule_info_t info;
+				while (!stop.load())
+				{
+					if (!am.query_module(40, info) || info.identifer != 40)
+					{
+						misses++;
+					}
+					for (uint64_t id = 41; id <= 48; ++id)
+					{
+						if (am.query_module(id, info) && info.identifer != id)
+						{
+							mismatches++;
+						}
+					}
+					lookups++;
+				}
+			});
+		}
+
+		for (int round = 0; round < 200; ++round)
+		{
+			for (auto &info : churn)
+			{
+				am.register_module(APP_MODULE(&info, graph_ok, graph_ok, graph_ok, graph_ok, graph_ok, count_run_status));
+			}
+			for (auto &info : churn)
+			{
+				am.unregister_module(info.identifer);
+			}
+		}
+		stop = true;
+		for (auto &t : readers)
+		{
+			t.join();
+		}
+
+		check(lookups.load() > 0 && misses.load() == 0, "resident module found during registration churn");
+		check(mismatches.load() == 0, "lookups return the requested module");
+	}
+
+	// 延迟模块在第一次使用时才初始化、启动，卸载时各停止、退出一次
+	{
+		static appmodule_info_t info = make_info(1);
+		AppModule am({}, 1);
+
+		am.register_module(APP_MODULE(&info, count_init, count_run, count_change, count_stop, count_exit, count_run_status), true);
+		am.init_module();
+		am.run_module();
+		check(g_inits == 0 && g_runs == 0, "lazy module not started by init_module/run_module");
+
+		long value = 1;
+		check(am.change_module(1, &value) == APP_MODULE_OK, "first change succeeds");
+		check(g_inits == 1 && g_runs == 1, "first use starts lazy module once");
+		am.change_module(1, &value);
+		check(g_inits == 1 && g_runs == 1, "later use does not start again");
+
+		check(am.unregister_module(1) == 0, "unregister");
+		check(g_stops == 1 && g_exits == 1, "unregister stops and exits once");
+	}
+	check(g_stops == 1 && g_exits == 1, "no extra stop/exit after destruction");
+
+	// 注册失败的重复模块与已注册的模块共用信息，析构时不能停止已注册的模块
+	{
+		static appmodule_info_t info = make_info(2);
+		AppModule am({}, 1);
+
+		am.register_module(APP_MODULE(&info, count_init, count_run, count_change, count_stop, count_exit, count_run_status));
+		am.init_module();
+		am.run_module();
+
+		int stops = g_stops, exits = g_exits;
+		check(am.register_module(APP_MODULE(&info, count_init, count_run, count_change, count_stop, count_exit, count_run_status)) != 0,
+			  "duplicate identifier rejected");
+		check(g_stops == stops && g_exits == exits, "rejected duplicate does not tear down live module");
+		check(info.status == e_module_runing, "live module still running");
+	}
+
+	// 同一动态库加载两次，第二次被拒绝，已加载的模块不受影响
+	if (access(plugin, R_OK) == 0)
+	{
+		AppModule am({}, 1);
+		long value = 1;
+
+		uint64_t id = am.load_module(plugin, true);
+		check(am.change_module(id, &value) == APP_MODULE_OK, "plugin change after lazy start");
+
+		bool rejected = false;
+		try
+		{
+			am.load_module(plugin, true);
+		}
+		catch (const std::runtime_error &e)
+		{
+			rejected = true;
+			std::cout << "     " << e.what() << std::endl;
+		}
+		check(rejected, "second load of same plugin rejected");
+		check(am.change_module(id, &value) == APP_MODULE_OK, "plugin still running after rejected load");
+
+		check(am.unregister_module(id) == 0, "plugin unregister");
+		check(am.change_module(id, &value) == APP_MODULE_ERROR, "unregistered plugin not found");
+	}
+	else
+	{
+		std::cout << "skip: " << plugin << " not found, build plugin/demo-module.cpp or pass its path as the first argument" << std::endl;
+	}
+
+	return g_failed ? 1 : 0;
+}
@@ -0,0 +1,213 @@
+/**
+ * @file adaptive-wait.h
+ * @author yuwangliang (wotsen@outlook.com)
+ * @brief 自旋-让出-休眠的自适应等待
+ * @version 0.1
+ * @date 2020-08-16
+ *
+ * @copyright Copyright (c) 2020 yuwangliang
+ *
+ */
+#ifndef __wotsen_ADAPTIVE_WAIT_H__
+#define __wotsen_ADAPTIVE_WAIT_H__
+
+#include <atomic>
+#include <thread>
+#include <climits>
+#include <algorithm>
+#include <stdint.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#else
+#include <mutex>
+#include <condition_variable>
+#endif
+
+namespace wotsen
+{
+
+	// 自旋等待时提示CPU降低功耗并让出流水线给超线程
+	inline void cpu_relax(void)
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+		asm volatile("yield" ::: "memory");
+#else
+		std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+	}
+
+	/**
+	 * @brief 休眠等待，Linux下直接使用futex
+	 * @details 只有确实有线程休眠时通知才进入内核，且只唤醒指定个数；
+	 *          等待方先登记再检查条件，通知方先修改条件再检查登记，
+	 *          两边之间都有顺序一致的栅栏，因此不会丢失唤醒
+	 *
+	 */
+	class ParkWait
+	{
+	public:
+		ParkWait() : m_seq(0), m_sleepers(0)
+		{
+		}
+
+		ParkWait(const ParkWait &) = delete;
+		ParkWait &operator=(const ParkWait &) = delete;
+
+		/**
+		 * @brief 等待直到条件成立
+		 *
+		 * @param pred 条件，只能读取原子变量，不能依赖调用方持有的锁
+		 */
+		template <typename Pred>
+		void wait(Pred pred)
+		{
+			while (!pred())
+			{
+				m_sleepers.fetch_add(1);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				uint32_t seq = m_seq.load();
+				if (!pred())
+					park(seq);
+				m_sleepers.fetch_sub(1);
+			}
+		}
+
+		// 唤醒最多n个休眠的线程，返回是否有线程休眠
+		bool notify(int n)
+		{
+			//条件可能只是release写入，需要栅栏保证其先于读取登记数
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (n <= 0 || m_sleepers.load(std::memory_order_relaxed) == 0)
+				return false;
+
+			m_seq.fetch_add(1);
+			unpark(n);
+			return true;
+		}
+
+		void notify_all(void)
+		{
+			notify(INT_MAX);
+		}
+
+	private:
+#ifdef __linux__
+		void park(uint32_t seq)
+		{
+			syscall(SYS_futex, (uint32_t *)&m_seq, FUTEX_WAIT_PRIVATE, seq, nullptr, nullptr, 0);
+		}
+
+		void unpark(int n)
+		{
+			syscall(SYS_futex, (uint32_t *)&m_seq, FUTEX_WAKE_PRIVATE, n, nullptr, nullptr, 0);
+		}
+#else
+		void park(uint32_t seq)
+		{
+			std::unique_lock<std::mutex> locker(m_mutex);
+			m_cv.wait(locker, [this, seq] { return m_seq.load() != seq; });
+		}
+
+		void unpark(int n)
+		{
+			std::lock_guard<std::mutex> locker(m_mutex);
+			if (n == INT_MAX)
+				m_cv.notify_all();
+			else
+				while (n-- > 0)
+					m_cv.notify_one();
+		}
+
+		std::mutex m_mutex;
+		std::condition_variable m_cv;
+#endif
+
+		static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex word must be 32 bits");
+
+		std::atomic<uint32_t> m_seq;  //每次通知加1，futex等待的字
+		std::atomic<int> m_sleepers;  //休眠的线程数
+	};
+
+	/**
+	 * @brief 自适应等待：先有限自旋，再让出CPU，最后休眠
+	 * @details 自旋上限按最近成功自旋的次数自动调整(移动平均的两倍)，
+	 *          自旋总是失败时逐渐降到最低；单核机器上不自旋
+	 *
+	 */
+	class AdaptiveWait
+	{
+	public:
+		AdaptiveWait() : m_spin(MinSpin), m_maxSpin(std::thread::hardware_concurrency() > 1 ? MaxSpin : 0)
+		{
+		}
+
+		template <typename Pred>
+		void wait(Pred pred)
+		{
+			if (spin(pred))
+				return;
+
+			for (int i = 0; i < YieldCount; ++i)
+			{
+				if (pred())
+					return;
+				std::this_thread::yield();
+			}
+
+			m_park.wait(pred);
+		}
+
+		void notify(int n)
+		{
+			m_park.notify(n);
+		}
+
+		void notify_all(void)
+		{
+			m_park.notify_all();
+		}
+
+		// 当前的自旋次数估计
+		int spin_count(void) const
+		{
+			return m_spin.load(std::memory_order_relaxed);
+		}
+
+	private:
+		static const int MinSpin = 16;
+		static const int MaxSpin = 4096; //pause约几十个周期，总计约数十微秒
+		static const int YieldCount = 4;
+
+		template <typename Pred>
+		bool spin(Pred pred)
+		{
+			int spins = m_spin.load(std::memory_order_relaxed);
+			int limit = std::min(m_maxSpin, spins * 2 + MinSpin);
+
+			for (int i = 0; i < limit; ++i)
+			{
+				if (pred())
+				{
+					m_spin.store(spins + (i - spins) / 8, std::memory_order_relaxed);
+					return true;
+				}
+				cpu_relax();
+			}
+
+			if (limit > 0)
+				m_spin.store(spins - spins / 8, std::memory_order_relaxed);
+			return false;
+		}
+
+		std::atomic<int> m_spin; //自旋次数的移动平均
+		int m_maxSpin;
+		ParkWait m_park;
+	};
+
+} // namespace wotsen
+
+#endif // !__wotsen_ADAPTIVE_WAIT_H__
@@ -0,0 +1,165 @@
+/**
+ * @file admission.h
+ * @author yuwangliang (wotsen@outlook.com)
+ * @brief 准入控制
+ * @version 0.1
+ * @date 2020-08-16
+ *
+ * @copyright Copyright (c) 2020 yuwangliang
+ *
+ */
+#ifndef __wotsen_ADMISSION_H__
+#define __wotsen_ADMISSION_H__
+
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#include "lockfree-queue.h"
+#include "pool-trace.h"
+
+namespace wotsen
+{
+
+	/**
+	 * @brief 准入统计
+	 *
+	 */
+	struct AdmissionStats
+	{
+		uint64_t admitted;		   //try_add_task接受的任务数
+		uint64_t rejected;		   //快速失败或Reject策略拒绝的提交数
+		uint64_t dropped;		   //排队超时或过载时未执行而丢弃的任务数
+		bool overloaded;		   //当前是否过载
+		std::chrono::nanoseconds p50;  //排队时间分位数，未启用CoDel时为0
+		std::chrono::nanoseconds p99;
+		std::chrono::nanoseconds p999;
+		std::chrono::nanoseconds max;
+	};
+
+	/**
+	 * @brief CoDel方式的过载判定
+	 * @details 任务出队时记录排队时间：只要有一个任务的排队时间低于target，说明队列能及时排空，
+	 *          积压只是突发；连续interval都高于target说明形成了常驻队列，进入过载状态，
+	 *          直到再次出现低于target的排队时间。过载且队列非空时拒绝快速失败的提交，
+	 *          已接受的可丢弃任务排队超过target时在出队时丢弃(CoDel在队头丢包)，尽快排空常驻队列。
+	 *          状态只在变化时写入，出队路径上通常只有读
+	 *
+	 */
+	class AdmissionControl
+	{
+	public:
+		/**
+		 * @brief Construct a new Admission Control object
+		 *
+		 * @param target 目标排队时间，为0时不启用
+		 * @param interval 判定常驻队列的时间窗口
+		 */
+		AdmissionControl(std::chrono::nanoseconds target, std::chrono::nanoseconds interval)
+			: m_target(target.count()), m_interval(interval.count())
+		{
+		}
+
+		bool enabled() const
+		{
+			return m_target > 0;
+		}
+
+		// 是否接受一个快速失败的提交
+		bool admit(size_t depth)
+		{
+			if (depth > 0 && m_overloaded.load(std::memory_order_relaxed))
+			{
+				on_reject();
+				return false;
+			}
+			return true;
+		}
+
+		/**
+		 * @brief 任务出队
+		 *
+		 * @param sojourn 排队时间(ns)
+		 * @param now 当前时间(ns)
+		 * @return true 正常执行
+		 * @return false 过载中且排队超过目标，可丢弃的任务应丢弃
+		 */
+		bool on_dequeue(int64_t sojourn, int64_t now)
+		{
+			m_sojourn.record(sojourn);
+
+			if (sojourn < m_target)
+			{
+				if (m_firstAbove.value.load(std::memory_order_relaxed) != 0)
+					m_firstAbove.value.store(0, std::memory_order_relaxed);
+				if (m_overloaded.load(std::memory_order_relaxed))
+					m_overloaded.store(false, std::memory_order_relaxed);
+				return true;
+			}
+
+			if (m_overloaded.load(std::memory_order_relaxed))
+				return false;
+
+			int64_t first = m_firstAbove.value.load(std::memory_order_relaxed);
+			if (first == 0)
+				m_firstAbove.value.compare_exchange_strong(first, now + m_interval, std::memory_order_relaxed);
+			else if (now >= first)
+				m_overloaded.store(true, std::memory_order_relaxed);
+			return true;
+		}
+
+		void on_admit()
+		{
+			m_admitted.value.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		void on_reject()
+		{
+			m_rejected.value.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		void on_drop()
+		{
+			m_dropped.value.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		bool overloaded() const
+		{
+			return m_overloaded.load(std::memory_order_relaxed);
+		}
+
+		AdmissionStats stats() const
+		{
+			AdmissionStats s;
+			s.admitted = m_admitted.value.load(std::memory_order_relaxed);
+			s.rejected = m_rejected.value.load(std::memory_order_relaxed);
+			s.dropped = m_dropped.value.load(std::memory_order_relaxed);
+			s.overloaded = overloaded();
+			s.p50 = std::chrono::nanoseconds(m_sojourn.percentile(0.5));
+			s.p99 = std::chrono::nanoseconds(m_sojourn.percentile(0.99));
+			s.p999 = std::chrono::nanoseconds(m_sojourn.percentile(0.999));
+			s.max = std::chrono::nanoseconds(m_sojourn.max());
+			return s;
+		}
+
+	private:
+		struct Counter
+		{
+			std::atomic<int64_t> value{0};
+			char pad[CacheLineSize - sizeof(std::atomic<int64_t>)];
+		};
+
+		const int64_t m_target;	  //目标排队时间(ns)
+		const int64_t m_interval; //时间窗口(ns)
+
+		Counter m_firstAbove;				//持续高于目标的窗口结束时间，0为未高于
+		std::atomic_bool m_overloaded{false}; //过载
+		char m_pad[CacheLineSize];
+		Counter m_admitted;
+		Counter m_rejected;
+		Counter m_dropped;
+		LatencyHistogram m_sojourn; //排队时间
+	};
+
+} // namespace wotsen
+
+#endif // !__wotsen_ADMISSION_H__
@@ -0,0 +1,531 @@
+/**
+ * @file async-future.h
+ * @author yuwangliang (wotsen@outlook.com)
+ * @brief 非阻塞未来值，支持then/when_all/when_any续接
+ * @version 0.1
+ * @date 2020-08-16
+ *
+ * @copyright Copyright (c) 2020 yuwangliang
+ *
+ */
+#ifndef __wotsen_ASYNC_FUTURE_H__
+#define __wotsen_ASYNC_FUTURE_H__
+
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <future>
+#include <exception>
+#include <stdexcept>
+#include <functional>
+#include <condition_variable>
+#include "thread-pool.h"
+
+namespace wotsen
+{
+
+	template <typename T>
+	class AsyncFuture;
+
+	template <typename T>
+	class AsyncPromise;
+
+	namespace detail
+	{
+
+		// 在线程池上执行，没有线程池，或队列满(Reject策略下提交会抛出)、线程池已关闭时直接执行，
+		// 异常不会抛给写入结果的一方
+		inline void dispatch(ThreadPool *pool, std::function<void()> &&fn)
+		{
+			UniqueTask task(std::move(fn));
+
+			if (!pool || !pool->try_post(task))
+				task();
+		}
+
+		/**
+		 * @brief 共享状态，完成时依次触发登记的回调
+		 *
+		 */
+		class FutureStateBase
+		{
+		public:
+			bool ready()
+			{
+				std::lock_guard<std::mutex> locker(m_mutex);
+				return m_ready;
+			}
+
+			void wait()
+			{
+				std::unique_lock<std::mutex> locker(m_mutex);
+				m_cv.wait(locker, [this] { return m_ready; });
+			}
+
+			// 登记完成回调，已完成时立即执行
+			void on_ready(std::function<void()> &&cb)
+			{
+				{
+					std::lock_guard<std::mutex> locker(m_mutex);
+					if (!m_ready)
+					{
+						m_callbacks.push_back(std::move(cb));
+						return;
+					}
+				}
+				cb();
+			}
+
+			void set_exception(std::exception_ptr error)
+			{
+				std::unique_lock<std::mutex> locker(m_mutex);
+				check_unsatisfied();
+				m_error = error;
+				finish(locker);
+			}
+
+			std::exception_ptr error()
+			{
+				std::lock_guard<std::mutex> locker(m_mutex);
+				return m_error;
+			}
+
+		protected:
+			void check_unsatisfied()
+			{
+				if (m_ready)
+					throw std::future_error(std::future_errc::promise_already_satisfied);
+			}
+
+			void finish(std::unique_lock<std::mutex> &locker)
+			{
+				std::vector<std::function<void()>> callbacks;
+
+				m_ready = true;
+				callbacks.swap(m_callbacks);
+				//持锁通知：等待者醒来后可能立即销毁共享状态，解锁后不能再访问成员
+				m_cv.notify_all();
+				locker.unlock();
+
+				for (auto &cb : callbacks)
+					cb();
+			}
+
+			std::mutex m_mutex;
+			std::condition_variable m_cv;
+			bool m_ready = false;
+			std::exception_ptr m_error;
+			std::vector<std::function<void()>> m_callbacks;
+		};
+
+		template <typename T>
+		class FutureState : public FutureStateBase
+		{
+		public:
+			using reference = const T &;
+
+			void set_value(T value)
+			{
+				std::unique_lock<std::mutex> locker(m_mutex);
+				check_unsatisfied();
+				m_value.reset(new T(std::move(value)));
+				finish(locker);
+			}
+
+			reference get()
+			{
+				wait();
+				if (m_error)
+					std::rethrow_exception(m_error);
+				return *m_value;
+			}
+
+		private:
+			std::unique_ptr<T> m_value;
+		};
+
+		template <>
+		class FutureState<void> : public FutureStateBase
+		{
+		public:
+			using reference = void;
+
+			void set_value(void)
+			{
+				std::unique_lock<std::mutex> locker(m_mutex);
+				check_unsatisfied();
+				finish(locker);
+			}
+
+			void get()
+			{
+				wait();
+				if (m_error)
+					std::rethrow_exception(m_error);
+			}
+		};
+
+		// 续接函数返回类型
+		template <typename F, typename T>
+		struct then_ret
+		{
+			using type = callable_ret_type<F, const T &>;
+		};
+
+		template <typename F>
+		struct then_ret<F, void>
+		{
+			using type = callable_ret_type<F>;
+		};
+
+		// 执行函数并写入结果，S为FutureState或AsyncPromise
+		template <typename R>
+		struct Setter
+		{
+			template <typename S, typename F, typename... A>
+			static void call(S &next, F &f, A &&... a)
+			{
+				next.set_value(f(std::forward<A>(a)...));
+			}
+		};
+
+		template <>
+		struct Setter<void>
+		{
+			template <typename S, typename F, typename... A>
+			static void call(S &next, F &f, A &&... a)
+			{
+				f(std::forward<A>(a)...);
+				next.set_value();
+			}
+		};
+
+		// 以前一个结果为参数执行续接函数
+		template <typename T>
+		struct Invoker
+		{
+			template <typename R, typename S, typename F>
+			static void call(FutureState<T> &prev, S &next, F &f)
+			{
+				Setter<R>::call(next, f, prev.get());
+			}
+		};
+
+		template <>
+		struct Invoker<void>
+		{
+			template <typename R, typename S, typename F>
+			static void call(FutureState<void> &, S &next, F &f)
+			{
+				Setter<R>::call(next, f);
+			}
+		};
+
+		template <typename T, typename R, typename F>
+		void run_continuation(FutureState<T> &prev, AsyncPromise<R> &next, F &f)
+		{
+			std::exception_ptr error = prev.error();
+			if (error)
+			{
+				//前一步失败，跳过续接函数直接传递异常
+				next.set_exception(error);
+				return;
+			}
+
+			try
+			{
+				Invoker<T>::template call<R>(prev, next, f);
+			}
+			catch (...)
+			{
+				next.set_exception(std::current_exception());
+			}
+		}
+
+		// when_all汇总结果
+		template <typename T>
+		struct Gather
+		{
+			using type = std::vector<T>;
+
+			template <typename Futures>
+			static void call(Futures &futures, FutureState<type> &next)
+			{
+				type values;
+				values.reserve(futures.size());
+				for (auto &f : futures)
+					values.push_back(f.get());
+				next.set_value(std::move(values));
+			}
+		};
+
+		template <>
+		struct Gather<void>
+		{
+			using type = void;
+
+			template <typename Futures>
+			static void call(Futures &futures, FutureState<void> &next)
+			{
+				for (auto &f : futures)
+					f.get();
+				next.set_value();
+			}
+		};
+
+	} // namespace detail
+
+	/**
+	 * @brief 非阻塞未来值
+	 * @details 可复制，多个副本共享同一结果；then()登记的续接在结果就绪后投递到线程池执行，
+	 *          不占用任何线程等待
+	 *
+	 * @tparam T 结果类型
+	 */
+	template <typename T>
+	class AsyncFuture
+	{
+	public:
+		AsyncFuture() : m_pool(nullptr)
+		{
+		}
+
+		AsyncFuture(ThreadPool *pool, const std::shared_ptr<detail::FutureState<T>> &state) : m_pool(pool), m_state(state)
+		{
+		}
+
+		bool valid() const
+		{
+			return (bool)m_state;
+		}
+
+		bool is_ready() const
+		{
+			return m_state->ready();
+		}
+
+		// 阻塞等待，只应在流水线的最末端使用
+		void wait() const
+		{
+			m_state->wait();
+		}
+
+		typename detail::FutureState<T>::reference get() const
+		{
+			return m_state->get();
+		}
+
+		/**
+		 * @brief 结果就绪后在线程池上执行f
+		 * @details 前一步抛出异常时跳过f，异常传递给返回的未来值
+		 *
+		 * @param f 续接函数，参数为前一步结果，T为void时无参数
+		 * @return AsyncFuture<R> f的结果
+		 */
+		template <typename F>
+		AsyncFuture<typename detail::then_ret<F, T>::type> then(F &&f) const
+		{
+			using R = typename detail::then_ret<F, T>::type;
+
+			//续接任务被线程池丢弃时，promise析构写入broken_promise
+			auto next = std::make_shared<AsyncPromise<R>>(m_pool);
+			auto fn = std::make_shared<typename std::decay<F>::type>(std::forward<F>(f));
+			auto prev = m_state;
+			ThreadPool *pool = m_pool;
+			AsyncFuture<R> ret = next->get_future();
+
+			m_state->on_ready([pool, prev, next, fn] {
+				detail::dispatch(pool, [prev, next, fn] { detail::run_continuation(*prev, *next, *fn); });
+			});
+
+			return ret;
+		}
+
+		ThreadPool *pool() const
+		{
+			return m_pool;
+		}
+
+	private:
+		template <typename U>
+		friend AsyncFuture<size_t> when_any(const std::vector<AsyncFuture<U>> &futures);
+
+		template <typename U>
+		friend AsyncFuture<typename detail::Gather<U>::type> when_all(const std::vector<AsyncFuture<U>> &futures);
+
+		ThreadPool *m_pool;
+		std::shared_ptr<detail::FutureState<T>> m_state;
+	};
+
+	/**
+	 * @brief 非阻塞未来值的写入端
+	 * @details 析构时仍未写入结果则写入broken_promise异常
+	 *
+	 * @tparam T 结果类型
+	 */
+	template <typename T>
+	class AsyncPromise
+	{
+	public:
+		explicit AsyncPromise(ThreadPool *pool = nullptr)
+			: m_pool(pool), m_state(std::make_shared<detail::FutureState<T>>())
+		{
+		}
+
+		AsyncPromise(AsyncPromise &&) = default;
+		AsyncPromise &operator=(AsyncPromise &&) = default;
+
+		~AsyncPromise()
+		{
+			if (m_state && !m_state->ready())
+			{
+				try
+				{
+					m_state->set_exception(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+				}
+				catch (...)
+				{
+				}
+			}
+		}
+
+		AsyncFuture<T> get_future() const
+		{
+			return AsyncFuture<T>(m_pool, m_state);
+		}
+
+		template <typename... V>
+		void set_value(V &&... v)
+		{
+			m_state->set_value(std::forward<V>(v)...);
+		}
+
+		void set_exception(std::exception_ptr error)
+		{
+			m_state->set_exception(error);
+		}
+
+	private:
+		ThreadPool *m_pool;
+		std::shared_ptr<detail::FutureState<T>> m_state;
+	};
+
+	namespace detail
+	{
+
+		// async_task投递的任务，promise与绑定的调用都按值保存
+		template <typename R, typename Bound>
+		struct AsyncCall
+		{
+			AsyncPromise<R> promise;
+			Bound fn;
+
+			void operator()()
+			{
+				try
+				{
+					Setter<R>::call(promise, fn);
+				}
+				catch (...)
+				{
+					promise.set_exception(std::current_exception());
+				}
+			}
+		};
+
+	} // namespace detail
+
+	/**
+	 * @brief 在线程池上执行任务，返回非阻塞未来值
+	 *
+	 * @param pool 线程池
+	 * @param f 可调用对象
+	 * @param args 参数
+	 * @return AsyncFuture<callable_ret_type<F, Args...>> 未来值
+	 */
+	template <typename F, typename... Args>
+	AsyncFuture<callable_ret_type<F, Args...>> async_task(ThreadPool &pool, F &&f, Args &&... args)
+	{
+		using R = callable_ret_type<F, Args...>;
+		using Bound = decltype(bind_task(std::forward<F>(f), std::forward<Args>(args)...));
+
+		//任务被线程池丢弃时，promise析构写入broken_promise
+		AsyncPromise<R> promise(&pool);
+		AsyncFuture<R> ret = promise.get_future();
+
+		pool.post(detail::AsyncCall<R, Bound>{std::move(promise), bind_task(std::forward<F>(f), std::forward<Args>(args)...)});
+
+		return ret;
+	}
+
+	/**
+	 * @brief 全部完成后就绪
+	 * @details 结果按输入顺序排列，任意一个失败则传递第一个失败者的异常
+	 *
+	 * @param futures 未来值列表
+	 * @return AsyncFuture<std::vector<T>> T为void时为AsyncFuture<void>
+	 */
+	template <typename T>
+	AsyncFuture<typename detail::Gather<T>::type> when_all(const std::vector<AsyncFuture<T>> &futures)
+	{
+		using R = typename detail::Gather<T>::type;
+
+		auto next = std::make_shared<detail::FutureState<R>>();
+		auto inputs = std::make_shared<std::vector<AsyncFuture<T>>>(futures);
+		auto remaining = std::make_shared<std::atomic<size_t>>(futures.size() + 1);
+		ThreadPool *pool = futures.empty() ? nullptr : futures.front().m_pool;
+
+		auto done = [inputs, remaining, next] {
+			if (remaining->fetch_sub(1) != 1)
+				return;
+
+			try
+			{
+				detail::Gather<T>::call(*inputs, *next);
+			}
+			catch (...)
+			{
+				next->set_exception(std::current_exception());
+			}
+		};
+
+		for (auto &f : futures)
+			f.m_state->on_ready(done);
+
+		//最后一个计数保证登记过程中不会提前完成
+		done();
+
+		return AsyncFuture<R>(pool, next);
+	}
+
+	/**
+	 * @brief 任意一个完成后就绪
+	 *
+	 * @param futures 未来值列表，不能为空
+	 * @return AsyncFuture<size_t> 最先完成者的下标
+	 */
+	template <typename T>
+	AsyncFuture<size_t> when_any(const std::vector<AsyncFuture<T>> &futures)
+	{
+		auto next = std::make_shared<detail::FutureState<size_t>>();
+		auto fired = std::make_shared<std::atomic_bool>(false);
+		ThreadPool *pool = futures.empty() ? nullptr : futures.front().m_pool;
+
+		if (futures.empty())
+			next->set_exception(std::make_exception_ptr(std::invalid_argument("when_any on empty list")));
+
+		for (size_t i = 0; i < futures.size(); ++i)
+		{
+			futures[i].m_state->on_ready([fired, next, i] {
+				if (!fired->exchange(true))
+					next->set_value(i);
+			});
+		}
+
+		return AsyncFuture<size_t>(pool, next);
+	}
+
+} // namespace wotsen
+
+#endif // !__wotsen_ASYNC_FUTURE_H__
@@ -0,0 +1,1295 @@
+/**
+ * @file bench.cpp
+ * @author yuwangliang (wotsen@outlook.com)
+ * @brief 线程池性能测试
+ * @version 0.1
+ * @date 2020-08-16
+ *
+ * @copyright Copyright (c) 2020 yuwangliang
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <chrono>
+#include <fstream>
+#include <algorithm>
+#include <new>
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#include "thread-pool.h"
+#include "task-graph.h"
+#include "sync-queue.h"
+#include "spsc-queue.h"
+#include "mpsc-queue.h"
+#include "strand.h"
+#include "task-group.h"
+#ifdef __linux__
+#include "reactor.h"
+#endif
+
+using namespace wotsen;
+using namespace std::chrono;
+
+// 统计堆分配次数，替换全部形式的operator new/delete，统一经malloc/free，
+// 不内联，避免编译器把内联后的free与new配对检查
+static std::atomic<uint64_t> g_allocs(0);
+
+__attribute__((noinline)) static void *counted_alloc(size_t size, size_t align = 0)
+{
+	g_allocs.fetch_add(1, std::memory_order_relaxed);
+	void *p = nullptr;
+	if (align > sizeof(void *))
+	{
+		if (posix_memalign(&p, align, size ? size : 1) != 0)
+			p = nullptr;
+	}
+	else
+	{
+		p = malloc(size ? size : 1);
+	}
+	return p;
+}
+
+__attribute__((noinline)) static void counted_free(void *p) noexcept
+{
+	free(p);
+}
+
+void *operator new(size_t size)
+{
+	if (void *p = counted_alloc(size))
+		return p;
+	throw std::bad_alloc();
+}
+
+void *operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+	return counted_alloc(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+	return counted_alloc(size);
+}
+
+void operator delete(void *p) noexcept
+{
+	counted_free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+	counted_free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	counted_free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+	counted_free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept
+{
+	counted_free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+	counted_free(p);
+}
+
+#ifdef __cpp_aligned_new
+void *operator new(size_t size, std::align_val_t align)
+{
+	if (void *p = counted_alloc(size, (size_t)align))
+		return p;
+	throw std::bad_alloc();
+}
+
+void *operator new[](size_t size, std::align_val_t align)
+{
+	return operator new(size, align);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept
+{
+	counted_free(p);
+}
+
+void operator delete[](void *p, std::align_val_t) noexcept
+{
+	counted_free(p);
+}
+
+void operator delete(void *p, size_t, std::align_val_t) noexcept
+{
+	counted_free(p);
+}
+
+void operator delete[](void *p, size_t, std::align_val_t) noexcept
+{
+	counted_free(p);
+}
+#endif
+
+// 忙等指定时间，模拟计算任务
+static void busy_for(nanoseconds d)
+{
+	auto end = steady_clock::now() + d;
+	while (steady_clock::now() < end)
+		;
+}
+
+static void print_percentile(const char *name, std::vector<int64_t> &lat)
+{
+	if (lat.empty())
+		return;
+
+	std::sort(lat.begin(), lat.end());
+	auto at = [&lat](double p) { return lat[std::min(lat.size() - 1, (size_t)(p * lat.size()))]; };
+
+	printf("%-24s n=%-7zu p50=%8.1fus p99=%8.1fus p999=%8.1fus max=%8.1fus\n",
+		   name, lat.size(), at(0.5) / 1e3, at(0.99) / 1e3, at(0.999) / 1e3, lat.back() / 1e3);
+}
+
+/**
+ * @brief 线程池被后台任务占满时，高优先级任务从提交到开始执行的延迟
+ *
+ */
+static void bench_priority(void)
+{
+	const int rounds = 2000;
+	TaskPriority modes[] = {TaskPriority::Background, TaskPriority::High};
+	const char *names[] = {"fifo(same priority)", "high over background"};
+
+	for (int m = 0; m < 2; ++m)
+	{
+		ThreadPool pool;
+		std::atomic_bool stop(false);
+		std::vector<int64_t> lat;
+		lat.reserve(rounds);
+
+		// 持续用后台任务压满队列
+		std::thread feeder([&pool, &stop] {
+			while (!stop)
+				pool.add_priority_task(TaskPriority::Background, [] { busy_for(microseconds(20)); });
+		});
+
+		std::this_thread::sleep_for(milliseconds(50));
+
+		for (int i = 0; i < rounds; ++i)
+		{
+			auto submit = steady_clock::now();
+			auto f = pool.add_priority_task(modes[m], [submit] {
+				return (int64_t)duration_cast<nanoseconds>(steady_clock::now() - submit).count();
+			});
+			lat.push_back(f.get());
+		}
+
+		stop = true;
+		feeder.join();
+		pool.stop();
+
+		print_percentile(names[m], lat);
+	}
+}
+
+/**
+ * @brief 任务内阻塞(模拟IO)时，弹性线程数与固定线程数的吞吐对比
+ *
+ */
+static void bench_elastic(void)
+{
+	const int tasks = 400;
+
+	for (int elastic = 0; elastic < 2; ++elastic)
+	{
+		ThreadPoolOptions options;
+		options.min_threads = 2;
+		options.max_threads = elastic ? 64 : 2;
+		options.max_tasks = 1000;
+		options.idle_timeout = milliseconds(100);
+
+		ThreadPool pool(options);
+		std::vector<std::future<void>> futures;
+		size_t peak = 0;
+
+		auto start = steady_clock::now();
+		for (int i = 0; i < tasks; ++i)
+		{
+			futures.push_back(pool.add_task([&pool] {
+				ThreadPool::BlockingScope scope(pool);
+				std::this_thread::sleep_for(milliseconds(2));
+			}));
+		}
+		for (auto &f : futures)
+		{
+			peak = std::max(peak, pool.thread_count());
+			f.get();
+		}
+		auto cost = duration_cast<milliseconds>(steady_clock::now() - start).count();
+
+		std::this_thread::sleep_for(milliseconds(300));
+
+		printf("%-8s tasks=%d cost=%5lldms peak_threads=%zu threads_after_idle=%zu depth=%zu\n",
+			   elastic ? "elastic" : "fixed", tasks, (long long)cost, peak, pool.thread_count(), pool.queue_depth());
+	}
+}
+
+/**
+ * @brief 深链与宽汇聚：续接/任务图与阻塞get()的对比
+ *
+ */
+static void bench_continuation(void)
+{
+	const int depth = 10000;
+	const int width = 10000;
+	ThreadPool pool;
+
+	// 深链，阻塞方式：每一步提交后等待结果
+	auto start = steady_clock::now();
+	int value = 0;
+	for (int i = 0; i < depth; ++i)
+		value = pool.add_task([](int v) { return v + 1; }, value).get();
+	auto blocking = duration_cast<microseconds>(steady_clock::now() - start).count();
+
+	// 深链，续接方式
+	start = steady_clock::now();
+	AsyncFuture<int> chain = async_task(pool, [] { return 0; });
+	for (int i = 1; i < depth; ++i)
+		chain = chain.then([](const int &v) { return v + 1; });
+	chain.get();
+	auto continued = duration_cast<microseconds>(steady_clock::now() - start).count();
+
+	printf("chain    depth=%d blocking=%8lldus then=%8lldus\n", depth, (long long)blocking, (long long)continued);
+
+	// 宽汇聚，阻塞方式：汇总任务占用一个工作线程等待全部结果
+	start = steady_clock::now();
+	std::vector<std::future<int>> futures;
+	for (int i = 0; i < width; ++i)
+		futures.push_back(pool.add_task([i] { return i; }));
+	long long sum = pool.add_task([&futures] {
+		long long s = 0;
+		for (auto &f : futures)
+			s += f.get();
+		return s;
+	}).get();
+	blocking = duration_cast<microseconds>(steady_clock::now() - start).count();
+
+	// 宽汇聚，when_all方式
+	start = steady_clock::now();
+	std::vector<AsyncFuture<int>> asyncs;
+	for (int i = 0; i < width; ++i)
+		asyncs.push_back(async_task(pool, [i] { return i; }));
+	long long sum2 = when_all(asyncs).then([](const std::vector<int> &v) {
+		long long s = 0;
+		for (int x : v)
+			s += x;
+		return s;
+	}).get();
+	continued = duration_cast<microseconds>(steady_clock::now() - start).count();
+
+	printf("fan-in   width=%d blocking=%8lldus when_all=%8lldus (%lld/%lld)\n", width, (long long)blocking, (long long)continued, sum, sum2);
+
+	// 同样的宽汇聚用任务图表示
+	std::atomic<long long> total(0);
+	TaskGraph graph;
+	std::vector<TaskGraph::NodeId> leaves;
+	for (int i = 0; i < width; ++i)
+		leaves.push_back(graph.add([i, &total] { total += i; }));
+	TaskGraph::NodeId join = graph.add([] {});
+	for (auto id : leaves)
+		graph.precede(id, join);
+
+	start = steady_clock::now();
+	graph.run(pool).get();
+	auto graphed = duration_cast<microseconds>(steady_clock::now() - start).count();
+
+	printf("graph    width=%d run=%8lldus (%lld)\n", width, (long long)graphed, total.load());
+}
+
+/**
+ * @brief 空任务的单任务开销，分别以是否定义WOTSEN_THREAD_POOL_TRACE编译对比
+ *
+ */
+static void bench_overhead(void)
+{
+	const int tasks = 200000;
+	ThreadPoolOptions options;
+	options.max_tasks = 4096;
+	ThreadPool pool(options);
+	std::atomic<int> done(0);
+
+	auto start = steady_clock::now();
+	for (int i = 0; i < tasks; ++i)
+		pool.post([&done] { done.fetch_add(1, std::memory_order_relaxed); });
+	while (done.load() < tasks)
+		std::this_thread::yield();
+	auto cost = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+
+	printf("post     tasks=%d %6.1fns/task\n", tasks, (double)cost / tasks);
+
+#ifdef WOTSEN_THREAD_POOL_TRACE
+	PoolTrace &trace = pool.trace();
+	printf("queue_wait p50=%lldns p99=%lldns max=%lldns\n", (long long)trace.queue_wait().percentile(0.5),
+		   (long long)trace.queue_wait().percentile(0.99), (long long)trace.queue_wait().max());
+	printf("run_time   p50=%lldns p99=%lldns max=%lldns\n", (long long)trace.run_time().percentile(0.5),
+		   (long long)trace.run_time().percentile(0.99), (long long)trace.run_time().max());
+	for (size_t i = 0; i < trace.worker_count(); ++i)
+	{
+		const WorkerCounters &w = trace.worker(i);
+		if (w.tasks)
+			printf("worker %zu tasks=%llu busy=%.1fms idle=%.1fms steals=%llu\n", i, (unsigned long long)w.tasks.load(),
+				   w.busy_ns / 1e6, w.idle_ns / 1e6, (unsigned long long)w.steals.load());
+	}
+
+	trace.start_recording(1000);
+	std::vector<std::future<void>> futures;
+	for (int i = 0; i < 1000; ++i)
+		futures.push_back(pool.add_task([] { busy_for(microseconds(10)); }));
+	for (auto &f : futures)
+		f.get();
+	trace.stop_recording();
+
+	std::ofstream out("thread-pool-trace.json");
+	trace.export_chrome_trace(out);
+	printf("timeline written to thread-pool-trace.json\n");
+#endif
+}
+
+/**
+ * @brief 一百万个未到期定时器：添加、取消与集中到期
+ *
+ */
+static void bench_timer(void)
+{
+	const int timers = 1000000;
+	ThreadPoolOptions options;
+	options.max_tasks = 65536;
+	ThreadPool pool(options);
+	std::vector<TimerId> ids;
+	ids.reserve(timers);
+
+	auto start = steady_clock::now();
+	for (int i = 0; i < timers; ++i)
+		ids.push_back(pool.schedule_after(seconds(10 + i % 3600), [] {}));
+	auto cost = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+	printf("schedule %d pending: %6.1fns/timer\n", timers, (double)cost / timers);
+
+	start = steady_clock::now();
+	for (auto id : ids)
+		pool.cancel_timer(id);
+	cost = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+	printf("cancel   %d pending: %6.1fns/timer\n", timers, (double)cost / timers);
+
+	// 全部在500ms内到期，统计触发延迟
+	std::atomic<int> fired(0);
+	std::atomic<int64_t> late(0);
+	std::atomic<int64_t> maxLate(0);
+	auto base = steady_clock::now() + milliseconds(100);
+
+	for (int i = 0; i < timers; ++i)
+	{
+		auto when = base + microseconds(i / 2);
+		pool.schedule_at(when, [when, &fired, &late, &maxLate] {
+			int64_t l = duration_cast<microseconds>(steady_clock::now() - when).count();
+			int64_t m = maxLate.load();
+			while (l > m && !maxLate.compare_exchange_weak(m, l))
+				;
+			late += l;
+			fired++;
+		});
+	}
+	while (fired.load() < timers)
+		std::this_thread::sleep_for(milliseconds(1));
+
+	printf("fire     %d in 500ms: avg_late=%.1fus max_late=%lldus\n", timers,
+		   (double)late.load() / timers, (long long)maxLate.load());
+}
+
+/**
+ * @brief 64个线程各自执行长任务且队列已满时的停止延迟
+ * @details 任务每隔约50us轮询一次取消令牌；
+ *          drain模式在截止时间内执行完剩余任务，now模式立即取消并丢弃
+ *
+ */
+static void bench_shutdown(void)
+{
+	const int threads = 64;
+	const int queued = 4096;
+
+	for (int mode = 0; mode < 2; ++mode)
+	{
+		ThreadPoolOptions options;
+		options.min_threads = options.max_threads = threads;
+		options.max_tasks = queued;
+		ThreadPool pool(options);
+
+		std::vector<AsyncFuture<void>> futures;
+		CancellationToken token = pool.token();
+
+		// 长任务占住全部线程
+		for (int i = 0; i < threads; ++i)
+		{
+			futures.push_back(async_task(pool, [token] {
+				for (int n = 0; n < 2000; ++n)
+				{
+					token.throw_if_cancelled();
+					busy_for(microseconds(50));
+				}
+			}));
+		}
+
+		// 填满队列的短任务
+		for (int i = 0; i < queued; ++i)
+			futures.push_back(async_task(pool, [] { busy_for(microseconds(20)); }));
+
+		auto start = steady_clock::now();
+		size_t discarded = 0;
+		bool drained = false;
+		if (mode == 0)
+			drained = pool.shutdown(milliseconds(50));
+		else
+			discarded = pool.shutdown_now();
+		int64_t cost = duration_cast<microseconds>(steady_clock::now() - start).count();
+
+		int done = 0, cancelled = 0, broken = 0;
+		for (auto &f : futures)
+		{
+			try
+			{
+				f.get();
+				done++;
+			}
+			catch (TaskCancelled &)
+			{
+				cancelled++;
+			}
+			catch (std::future_error &)
+			{
+				broken++;
+			}
+		}
+
+		printf("%-5s: stop=%6lldus drained=%d discarded=%zu done=%d cancelled=%d broken_promise=%d\n",
+			   mode == 0 ? "drain" : "now", (long long)cost, drained, discarded, done, cancelled, broken);
+	}
+}
+
+// 同一种等待策略下的三种负载
+template <typename Wait>
+static void run_sync_queue(const char *name)
+{
+	char title[64];
+
+	// 轻负载：两个线程一问一答，统计往返时间
+	{
+		const int rounds = 20000;
+		SyncQueue<int64_t, Wait> ping(1), pong(1);
+		std::vector<int64_t> rtt;
+		rtt.reserve(rounds);
+
+		std::thread echo([&] {
+			for (int i = 0; i < rounds; ++i)
+			{
+				int64_t v = 0;
+				ping.take(v);
+				pong.put(v);
+			}
+		});
+
+		for (int i = 0; i < rounds; ++i)
+		{
+			int64_t begin = duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+			int64_t v = 0;
+			ping.put(begin);
+			pong.take(v);
+			rtt.push_back(duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count() - v);
+		}
+		echo.join();
+
+		snprintf(title, sizeof(title), "%s ping-pong rtt", name);
+		print_percentile(title, rtt);
+	}
+
+	// 突发负载：每次32个后停顿200us，两个消费者，统计排队延迟
+	{
+		const int bursts = 500;
+		const int burst = 32;
+		const int consumers = 2;
+		SyncQueue<int64_t, Wait> queue(1024);
+		std::vector<std::vector<int64_t>> lat(consumers);
+		std::vector<std::thread> threads;
+
+		for (int c = 0; c < consumers; ++c)
+		{
+			threads.emplace_back([&queue, &lat, c] {
+				for (;;)
+				{
+					int64_t v = 0;
+					queue.take(v);
+					if (v < 0)
+						return;
+					lat[c].push_back(duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count() - v);
+				}
+			});
+		}
+
+		for (int b = 0; b < bursts; ++b)
+		{
+			for (int i = 0; i < burst; ++i)
+				queue.put(duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count());
+			std::this_thread::sleep_for(microseconds(200));
+		}
+		for (int c = 0; c < consumers; ++c)
+			queue.put(-1);
+		for (auto &t : threads)
+			t.join();
+
+		std::vector<int64_t> all;
+		for (auto &l : lat)
+			all.insert(all.end(), l.begin(), l.end());
+		snprintf(title, sizeof(title), "%s bursty latency", name);
+		print_percentile(title, all);
+	}
+
+	// 饱和负载：4生产者4消费者，统计吞吐
+	{
+		const int producers = 4;
+		const int perProducer = 100000;
+		SyncQueue<int64_t, Wait> queue(1024);
+		std::vector<std::thread> threads;
+		auto start = steady_clock::now();
+
+		for (int c = 0; c < producers; ++c)
+		{
+			threads.emplace_back([&queue] {
+				for (int i = 0; i < perProducer; ++i)
+				{
+					int64_t v = 0;
+					queue.take(v);
+				}
+			});
+		}
+		for (int p = 0; p < producers; ++p)
+		{
+			threads.emplace_back([&queue] {
+				for (int i = 0; i < perProducer; ++i)
+					queue.put(i);
+			});
+		}
+		for (auto &t : threads)
+			t.join();
+
+		double sec = duration_cast<duration<double>>(steady_clock::now() - start).count();
+		printf("%-24s %.2f Mops/s\n", (std::string(name) + " saturated").c_str(), producers * perProducer / sec / 1e6);
+	}
+}
+
+/**
+ * @brief 同步队列在轻、突发、饱和负载下直接休眠与自适应等待的对比
+ *
+ */
+static void bench_sync_queue(void)
+{
+	run_sync_queue<ParkWait>("park");
+	run_sync_queue<AdaptiveWait>("adaptive");
+}
+
+// 指定大小的元素
+template <size_t N>
+struct Payload
+{
+	char data[N];
+};
+
+// producers个生产者与一个消费者，返回吞吐(Mops/s)
+template <typename Queue, size_t N>
+static double run_topology(int producers)
+{
+	const int total = 400000;
+	const int perProducer = total / producers;
+	Queue queue(1024);
+	std::vector<std::thread> threads;
+	auto start = steady_clock::now();
+
+	threads.emplace_back([&queue, producers, perProducer] {
+		Payload<N> v;
+		for (int i = 0; i < producers * perProducer; ++i)
+			queue.take(v);
+	});
+	for (int p = 0; p < producers; ++p)
+	{
+		threads.emplace_back([&queue, perProducer] {
+			Payload<N> v;
+			memset(v.data, 1, N);
+			for (int i = 0; i < perProducer; ++i)
+				queue.put(v);
+		});
+	}
+	for (auto &t : threads)
+		t.join();
+
+	double sec = duration_cast<duration<double>>(steady_clock::now() - start).count();
+	return producers * perProducer / sec / 1e6;
+}
+
+template <size_t N>
+static void run_topologies(void)
+{
+	printf("%4zuB  1P1C: sync=%6.2f mpsc=%6.2f spsc=%6.2f  4P1C: sync=%6.2f mpsc=%6.2f Mops/s\n", N,
+		   run_topology<SyncQueue<Payload<N>>, N>(1),
+		   run_topology<MpscQueue<Payload<N>>, N>(1),
+		   run_topology<SpscQueue<Payload<N>>, N>(1),
+		   run_topology<SyncQueue<Payload<N>>, N>(4),
+		   run_topology<MpscQueue<Payload<N>>, N>(4));
+}
+
+/**
+ * @brief 同一接口的三种队列在不同元素大小下的吞吐
+ *
+ */
+static void bench_topology(void)
+{
+	run_topologies<8>();
+	run_topologies<64>();
+	run_topologies<256>();
+}
+
+/**
+ * @brief 10万个键、倾斜流量下的按键串行执行
+ * @details 80%的任务落在1%的热键上；对比每个键一把互斥锁的做法，
+ *          后者阻塞工作线程且不能保证同一个键的执行顺序
+ *
+ */
+static void bench_strand(void)
+{
+	const int keys = 100000;
+	const int hotKeys = keys / 100;
+	const int tasks = 500000;
+
+	// 预先生成键序列与每个任务在其键内的序号
+	std::vector<int> keyOf(tasks);
+	std::vector<int> seqOf(tasks);
+	std::vector<int> posted(keys, 0);
+	uint64_t rng = 88172645463325252ull;
+	auto next = [&rng] {
+		rng ^= rng << 13;
+		rng ^= rng >> 7;
+		rng ^= rng << 17;
+		return rng;
+	};
+	for (int i = 0; i < tasks; ++i)
+	{
+		keyOf[i] = next() % 100 < 80 ? (int)(next() % hotKeys) : (int)(next() % keys);
+		seqOf[i] = posted[keyOf[i]]++;
+	}
+
+	ThreadPoolOptions options;
+	options.min_threads = options.max_threads = 8;
+	options.max_tasks = 65536;
+
+	// 每个键一个Strand
+	{
+		ThreadPool pool(options);
+		KeyedStrands<int> strands(pool);
+		std::vector<int> expected(keys, 0);
+		std::atomic<int> done(0), violations(0);
+
+		auto start = steady_clock::now();
+		for (int i = 0; i < tasks; ++i)
+		{
+			int key = keyOf[i], seq = seqOf[i];
+			strands.post(key, [&expected, &done, &violations, key, seq] {
+				if (expected[key]++ != seq)
+					violations++;
+				busy_for(nanoseconds(200));
+				done++;
+			});
+		}
+		while (done.load() < tasks)
+			std::this_thread::sleep_for(microseconds(100));
+		double sec = duration_cast<duration<double>>(steady_clock::now() - start).count();
+
+		printf("strand      : %6.2f Mtasks/s strands=%zu order_violations=%d\n", tasks / sec / 1e6, strands.size(), violations.load());
+	}
+
+	// 每个键一把互斥锁
+	{
+		ThreadPool pool(options);
+		std::unique_ptr<std::mutex[]> locks(new std::mutex[keys]);
+		std::vector<int> expected(keys, 0);
+		std::atomic<int> done(0), violations(0);
+
+		auto start = steady_clock::now();
+		for (int i = 0; i < tasks; ++i)
+		{
+			int key = keyOf[i], seq = seqOf[i];
+			pool.post([&locks, &expected, &done, &violations, key, seq] {
+				std::lock_guard<std::mutex> locker(locks[key]);
+				if (expected[key]++ != seq)
+					violations++;
+				busy_for(nanoseconds(200));
+				done++;
+			});
+		}
+		while (done.load() < tasks)
+			std::this_thread::sleep_for(microseconds(100));
+		double sec = duration_cast<duration<double>>(steady_clock::now() - start).count();
+
+		printf("mutex-per-key: %6.2f Mtasks/s order_violations=%d\n", tasks / sec / 1e6, violations.load());
+	}
+}
+
+static long fib_serial(int n)
+{
+	return n < 2 ? n : fib_serial(n - 1) + fib_serial(n - 2);
+}
+
+// 每层拆出一个子任务，另一半在当前线程计算
+static long fib_parallel(ThreadPool &pool, int n)
+{
+	if (n < 20)
+		return fib_serial(n);
+
+	long a = 0;
+	TaskGroup group(pool);
+	group.run([&pool, &a, n] { a = fib_parallel(pool, n - 1); });
+	long b = fib_parallel(pool, n - 2);
+	group.wait();
+	return a + b;
+}
+
+static void quicksort_parallel(ThreadPool &pool, int *first, int *last)
+{
+	if (last - first < 10000)
+	{
+		std::sort(first, last);
+		return;
+	}
+
+	int pivot = first[(last - first) / 2];
+	int *mid1 = std::partition(first, last, [pivot](int v) { return v < pivot; });
+	int *mid2 = std::partition(mid1, last, [pivot](int v) { return !(pivot < v); });
+
+	TaskGroup group(pool);
+	group.run([&pool, first, mid1] { quicksort_parallel(pool, first, mid1); });
+	quicksort_parallel(pool, mid2, last);
+	group.wait();
+}
+
+/**
+ * @brief 递归分治：斐波那契与快速排序
+ * @details 2个线程的线程池上递归深度远超线程数，wait()帮忙执行任务，不会死锁
+ *
+ */
+static void bench_fork_join(void)
+{
+	const int n = 35;
+	const int count = 4000000;
+
+	for (int threads : {2, 8})
+	{
+		ThreadPoolOptions options;
+		options.min_threads = options.max_threads = threads;
+		options.max_tasks = 1024;
+		ThreadPool pool(options);
+
+		auto start = steady_clock::now();
+		long serial = fib_serial(n);
+		double serialMs = duration_cast<duration<double, std::milli>>(steady_clock::now() - start).count();
+
+		start = steady_clock::now();
+		long parallel = fib_parallel(pool, n);
+		double parallelMs = duration_cast<duration<double, std::milli>>(steady_clock::now() - start).count();
+
+		printf("threads=%d fib(%d)      : serial=%7.1fms task_group=%7.1fms %s\n", threads, n, serialMs, parallelMs,
+			   serial == parallel ? "ok" : "MISMATCH");
+
+		std::vector<int> data(count);
+		uint64_t rng = 88172645463325252ull;
+		for (auto &v : data)
+		{
+			rng ^= rng << 13;
+			rng ^= rng >> 7;
+			rng ^= rng << 17;
+			v = (int)(rng & 0x7fffffff);
+		}
+		std::vector<int> copy = data;
+
+		start = steady_clock::now();
+		std::sort(copy.begin(), copy.end());
+		serialMs = duration_cast<duration<double, std::milli>>(steady_clock::now() - start).count();
+
+		start = steady_clock::now();
+		quicksort_parallel(pool, data.data(), data.data() + data.size());
+		parallelMs = duration_cast<duration<double, std::milli>>(steady_clock::now() - start).count();
+
+		printf("threads=%d quicksort(%dM): serial=%7.1fms task_group=%7.1fms %s\n", threads, count / 1000000, serialMs, parallelMs,
+			   data == copy ? "ok" : "MISMATCH");
+	}
+}
+
+/**
+ * @brief 用户态指令计数，包括之后创建的线程(线程退出后计入)；不支持时返回-1
+ *
+ */
+class InstructionCounter
+{
+public:
+	InstructionCounter() : m_fd(-1)
+	{
+#ifdef __linux__
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.inherit = 1;
+		m_fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+	}
+
+	~InstructionCounter()
+	{
+#ifdef __linux__
+		if (m_fd >= 0)
+			close(m_fd);
+#endif
+	}
+
+	int64_t read_count() const
+	{
+		int64_t value = -1;
+#ifdef __linux__
+		if (m_fd < 0 || read(m_fd, &value, sizeof(value)) != sizeof(value))
+			return -1;
+#endif
+		return value;
+	}
+
+private:
+	int m_fd;
+};
+
+// 一种提交方式提交tasks个任务并等待完成，统计每个任务的指令数、分配次数与时间
+template <typename Submit>
+static void run_submit(const char *name, int tasks, Submit submit)
+{
+	InstructionCounter counter;
+	int64_t before = counter.read_count();
+	uint64_t allocs = 0;
+	double ns = 0;
+
+	{
+		ThreadPoolOptions options;
+		options.min_threads = options.max_threads = 1;
+		options.max_tasks = 65536;
+		ThreadPool pool(options);
+		std::atomic<int> done(0);
+
+		uint64_t a = g_allocs.load();
+		auto start = steady_clock::now();
+		for (int i = 0; i < tasks; ++i)
+			submit(pool, done, i);
+		while (done.load() < tasks)
+			std::this_thread::yield();
+		ns = (double)duration_cast<nanoseconds>(steady_clock::now() - start).count();
+		allocs = g_allocs.load() - a;
+	}
+
+	int64_t after = counter.read_count();
+	if (before >= 0 && after >= 0)
+		printf("%-30s %7.1f ns/task %5.2f allocs/task %8.1f instr/task\n", name, ns / tasks, (double)allocs / tasks,
+			   (double)(after - before) / tasks);
+	else
+		printf("%-30s %7.1f ns/task %5.2f allocs/task      n/a instr/task\n", name, ns / tasks, (double)allocs / tasks);
+}
+
+/**
+ * @brief 旧的bind + shared_ptr<packaged_task> + std::function提交路径与新路径对比
+ *
+ */
+static void bench_invoke(void)
+{
+	const int tasks = 200000;
+
+	run_submit("legacy add_task (bind)", tasks, [](ThreadPool &pool, std::atomic<int> &done, int i) {
+		auto task = std::make_shared<std::packaged_task<int()>>(std::bind([&done](int v) { done++; return v; }, i));
+		pool.post(std::function<void()>([task] { (*task)(); }));
+	});
+
+	run_submit("add_task (in place)", tasks, [](ThreadPool &pool, std::atomic<int> &done, int i) {
+		pool.add_task([&done](int v) { done++; return v; }, i);
+	});
+
+	run_submit("add_task move-only arg", tasks, [](ThreadPool &pool, std::atomic<int> &done, int i) {
+		pool.add_task([&done](std::unique_ptr<int> v) { done++; return *v; }, std::unique_ptr<int>(new int(i)));
+	});
+
+	run_submit("legacy post (std::function)", tasks, [](ThreadPool &pool, std::atomic<int> &done, int i) {
+		int64_t a = i, b = i, c = i;
+		pool.post(std::function<void()>([&done, a, b, c] { done += (int)((a + b + c) & 1) | 1; }));
+	});
+
+	run_submit("post (in place)", tasks, [](ThreadPool &pool, std::atomic<int> &done, int i) {
+		int64_t a = i, b = i, c = i;
+		pool.post([&done, a, b, c] { done += (int)((a + b + c) & 1) | 1; });
+	});
+}
+
+/**
+ * @brief 生产者线程数从1增加到128时的提交吞吐，单队列与分片队列对比
+ * @details 任务只做一次原子加，吞吐主要取决于提交路径上的竞争
+ *
+ */
+static void run_shards(int shards)
+{
+	const int tasks = 256000;
+
+	for (int producers = 1; producers <= 128; producers *= 2)
+	{
+		ThreadPoolOptions options;
+		options.min_threads = options.max_threads = (int)std::max(2u, std::thread::hardware_concurrency());
+		options.max_tasks = 65536;
+		options.shards = shards;
+		ThreadPool pool(options);
+
+		std::atomic<int> done(0);
+		std::atomic<bool> go(false);
+		std::vector<std::thread> threads;
+		int each = tasks / producers;
+		for (int p = 0; p < producers; ++p)
+		{
+			threads.emplace_back([&pool, &done, &go, each] {
+				while (!go.load())
+					std::this_thread::yield();
+				for (int i = 0; i < each; ++i)
+					pool.post([&done] { done.fetch_add(1, std::memory_order_relaxed); });
+			});
+		}
+
+		auto start = steady_clock::now();
+		go = true;
+		for (auto &t : threads)
+			t.join();
+		while (done.load() < each * producers)
+			std::this_thread::yield();
+		double sec = duration_cast<duration<double>>(steady_clock::now() - start).count();
+
+		printf("shards=%-3d producers=%-4d %8.2f Mtask/s\n", shards, producers, each * producers / sec / 1e6);
+	}
+}
+
+static void bench_shards(void)
+{
+	run_shards(1);
+	run_shards(8);
+}
+
+/**
+ * @brief 过载时的排队延迟：阻塞提交、CoDel快速失败与排队超时丢弃对比
+ * @details 单个任务忙100us，提交速度约为处理能力的4倍，持续1秒；
+ *          延迟为提交到开始执行的时间，只统计实际执行了的任务
+ *
+ */
+static void run_overload(const char *name, ThreadPoolOptions options, bool fastFail)
+{
+	const auto work = microseconds(100);
+	const auto gap = microseconds(25);
+
+	options.min_threads = options.max_threads = 1;
+	options.max_tasks = 20000;
+	ThreadPool pool(options);
+
+	std::vector<int64_t> lat;
+	std::mutex latMutex;
+	int offered = 0;
+
+	auto start = steady_clock::now();
+	auto next = start;
+	while (steady_clock::now() - start < seconds(1))
+	{
+		auto submitted = steady_clock::now();
+		auto task = [&lat, &latMutex, submitted, work] {
+			int64_t wait = duration_cast<nanoseconds>(steady_clock::now() - submitted).count();
+			busy_for(work);
+			std::lock_guard<std::mutex> locker(latMutex);
+			lat.push_back(wait);
+		};
+
+		if (fastFail)
+			pool.try_add_task(task);
+		else
+			pool.post(task);
+		offered++;
+
+		next += gap;
+		while (steady_clock::now() < next)
+			;
+	}
+	double offerSec = duration_cast<duration<double>>(steady_clock::now() - start).count();
+	pool.shutdown();
+
+	AdmissionStats s = pool.admission_stats();
+	printf("%-24s offered=%-6d ran=%-6zu rejected=%-6llu dropped=%-6llu submit %.2fs\n", name, offered, lat.size(),
+		   (unsigned long long)s.rejected, (unsigned long long)s.dropped, offerSec);
+	print_percentile(name, lat);
+}
+
+static void bench_admission(void)
+{
+	ThreadPoolOptions options;
+	run_overload("blocking post", options, false);
+
+	ThreadPoolOptions codel;
+	codel.codel_target = milliseconds(5);
+	codel.codel_interval = milliseconds(50);
+	run_overload("codel try_add_task", codel, true);
+
+	ThreadPoolOptions timeout;
+	timeout.task_timeout = milliseconds(20);
+	run_overload("task_timeout 20ms", timeout, false);
+}
+
+#ifdef __linux__
+/**
+ * @brief 回环TCP回显：每个连接一问一答，服务端与客户端都由同一个反应器和线程池驱动
+ * @details 连接数受RLIMIT_NOFILE限制，每个连接占两个fd
+ *
+ */
+static void run_echo(TriggerMode mode, int conns, int rounds)
+{
+	const size_t MsgSize = 64;
+
+	struct Client
+	{
+		int fd = -1;
+		size_t received = 0;
+		int round = 0;
+		steady_clock::time_point sent;
+	};
+
+	ThreadPool pool;
+	Reactor reactor(pool, TaskPriority::Normal, 1024);
+	std::vector<Client> clients((size_t)conns);
+	std::vector<int64_t> lat((size_t)conns * rounds);
+	std::vector<int> accepted;
+	std::mutex acceptMutex;
+	std::atomic<int> done(0), errors(0);
+	char msg[MsgSize];
+	memset(msg, 'x', sizeof(msg));
+
+	int listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t len = sizeof(addr);
+	if (bind(listener, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(listener, 4096) < 0 ||
+		getsockname(listener, (sockaddr *)&addr, &len) < 0)
+	{
+		perror("listen");
+		close(listener);
+		return;
+	}
+
+	//服务端：读到什么写回什么，边沿触发时读到EAGAIN
+	auto echo = [&reactor, &errors, mode](int fd) {
+		char buf[4096];
+		for (;;)
+		{
+			ssize_t n = read(fd, buf, sizeof(buf));
+			if (n > 0)
+			{
+				if (write(fd, buf, (size_t)n) != n)
+					errors++;
+				if (mode == TriggerMode::Level)
+					return;
+				continue;
+			}
+			if (n < 0 && errno == EAGAIN)
+				return;
+			reactor.remove(fd);
+			return;
+		}
+	};
+
+	reactor.add(listener, [&](int fd) {
+		for (;;)
+		{
+			int c = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK);
+			if (c < 0)
+				return;
+			int one = 1;
+			setsockopt(c, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			{
+				std::lock_guard<std::mutex> locker(acceptMutex);
+				accepted.push_back(c);
+			}
+			reactor.add(c, echo, nullptr, mode);
+		}
+	}, nullptr, TriggerMode::Edge);
+
+	//客户端：收齐一条回显后记录延迟并发下一条
+	auto reply = [&](Client &c) {
+		char buf[MsgSize];
+		for (;;)
+		{
+			ssize_t n = read(c.fd, buf, MsgSize - c.received);
+			if (n <= 0)
+			{
+				if (n == 0 || errno != EAGAIN)
+					errors++;
+				return;
+			}
+
+			c.received += (size_t)n;
+			if (c.received < MsgSize)
+				continue;
+
+			auto now = steady_clock::now();
+			lat[(size_t)(&c - clients.data()) * rounds + c.round] = duration_cast<nanoseconds>(now - c.sent).count();
+			c.received = 0;
+			if (++c.round == rounds)
+			{
+				done++;
+				return;
+			}
+
+			c.sent = now;
+			if (write(c.fd, msg, MsgSize) != (ssize_t)MsgSize)
+				errors++;
+			if (mode == TriggerMode::Level)
+				return;
+		}
+	};
+
+	for (auto &c : clients)
+	{
+		c.fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (c.fd < 0 || connect(c.fd, (sockaddr *)&addr, sizeof(addr)) < 0)
+		{
+			perror("connect");
+			errors++;
+			break;
+		}
+		int one = 1;
+		setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		fcntl(c.fd, F_SETFL, fcntl(c.fd, F_GETFL) | O_NONBLOCK);
+		Client *p = &c;
+		reactor.add(c.fd, [p, &reply](int) { reply(*p); }, nullptr, mode);
+	}
+
+	auto start = steady_clock::now();
+	if (!errors.load())
+	{
+		for (auto &c : clients)
+		{
+			c.sent = steady_clock::now();
+			if (write(c.fd, msg, MsgSize) != (ssize_t)MsgSize)
+				errors++;
+		}
+
+		while (done.load() < conns && !errors.load() && steady_clock::now() - start < seconds(60))
+			std::this_thread::sleep_for(milliseconds(1));
+	}
+	double secs = duration_cast<duration<double>>(steady_clock::now() - start).count();
+
+	reactor.stop();
+	pool.shutdown();
+
+	char name[64];
+	snprintf(name, sizeof(name), "echo %s x%d", mode == TriggerMode::Edge ? "edge" : "level", conns);
+	printf("%-24s %8.0f req/s errors=%d\n", name, (double)conns * rounds / secs, errors.load());
+	print_percentile(name, lat);
+
+	for (auto &c : clients)
+		if (c.fd >= 0)
+			close(c.fd);
+	for (int fd : accepted)
+		close(fd);
+	close(listener);
+}
+
+static void bench_echo(void)
+{
+	const int rounds = 10;
+	int conns = 10000;
+
+	//每个连接两个fd，另留少量给监听、epoll、eventfd和标准输入输出
+	rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0)
+	{
+		if (limit.rlim_cur < limit.rlim_max)
+		{
+			limit.rlim_cur = limit.rlim_max;
+			setrlimit(RLIMIT_NOFILE, &limit);
+		}
+		if (limit.rlim_cur != RLIM_INFINITY && (rlim_t)conns * 2 + 64 > limit.rlim_cur)
+			conns = (int)((limit.rlim_cur - 64) / 2);
+	}
+
+	run_echo(TriggerMode::Level, conns, rounds);
+	run_echo(TriggerMode::Edge, conns, rounds);
+}
+#endif
+
+struct bench_case
+{
+	const char *name;
+	void (*fn)(void);
+};
+
+static bench_case cases[] = {
+	{"priority", bench_priority},
+	{"elastic", bench_elastic},
+	{"continuation", bench_continuation},
+	{"overhead", bench_overhead},
+	{"timer", bench_timer},
+	{"shutdown", bench_shutdown},
+	{"syncqueue", bench_sync_queue},
+	{"topology", bench_topology},
+	{"strand", bench_strand},
+	{"forkjoin", bench_fork_join},
+	{"invoke", bench_invoke},
+	{"shards", bench_shards},
+	{"admission", bench_admission},
+#ifdef __linux__
+	{"echo", bench_echo},
+#endif
+};
+
+int main(int argc, char **argv)
+{
+	for (auto &c : cases)
+	{
+		if (argc > 1 && strcmp(argv[1], c.name))
+			continue;
+
+		printf("== %s ==\n", c.name);
+		c.fn();
+	}
+
+	return 0;
+}
@@ -0,0 +1,97 @@
+/**
+ * @file cancellation.h
+ * @author yuwangliang (wotsen@outlook.com)
+ * @brief 协作式取消
+ * @version 0.1
+ * @date 2020-08-16
+ *
+ * @copyright Copyright (c) 2020 yuwangliang
+ *
+ */
+#ifndef __wotsen_CANCELLATION_H__
+#define __wotsen_CANCELLATION_H__
+
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+
+namespace wotsen
+{
+
+	/**
+	 * @brief 任务被取消
+	 *
+	 */
+	class TaskCancelled : public std::runtime_error
+	{
+	public:
+		TaskCancelled() : std::runtime_error("task cancelled")
+		{
+		}
+	};
+
+	/**
+	 * @brief 取消令牌，任务通过轮询得知是否应尽快结束
+	 * @details 默认构造的令牌永远不会被取消
+	 *
+	 */
+	class CancellationToken
+	{
+	public:
+		CancellationToken() = default;
+
+		bool is_cancelled() const
+		{
+			return m_flag && m_flag->load(std::memory_order_relaxed);
+		}
+
+		// 已取消时抛出TaskCancelled
+		void throw_if_cancelled() const
+		{
+			if (is_cancelled())
+				throw TaskCancelled();
+		}
+
+	private:
+		friend class CancellationSource;
+
+		explicit CancellationToken(const std::shared_ptr<std::atomic_bool> &flag) : m_flag(flag)
+		{
+		}
+
+		std::shared_ptr<std::atomic_bool> m_flag;
+	};
+
+	/**
+	 * @brief 取消源，一个源可以发出多个令牌
+	 *
+	 */
+	class CancellationSource
+	{
+	public:
+		CancellationSource() : m_flag(std::make_shared<std::atomic_bool>(false))
+		{
+		}
+
+		CancellationToken token() const
+		{
+			return CancellationToken(m_flag);
+		}
+
+		void cancel()
+		{
+			m_flag->store(true);
+		}
+
+		bool is_cancelled() const
+		{
+			return m_flag->load();
+		}
+
+	private:
+		std::shared_ptr<std::atomic_bool> m_flag;
+	};
+
+} // namespace wotsen
+
+#endif // !__wotsen_CANCELLATION_H__
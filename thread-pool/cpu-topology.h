@@ -0,0 +1,343 @@
+/**
+ * @file cpu-topology.h
+ * @author yuwangliang (wotsen@outlook.com)
+ * @brief CPU拓扑与工作线程绑核
+ * @version 0.1
+ * @date 2020-08-16
+ *
+ * @copyright Copyright (c) 2020 yuwangliang
+ *
+ */
+#ifndef __wotsen_CPU_TOPOLOGY_H__
+#define __wotsen_CPU_TOPOLOGY_H__
+
+#include <map>
+#include <string>
+#include <vector>
+#include <thread>
+#include <fstream>
+#include <algorithm>
+#include <stdlib.h>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace wotsen
+{
+
+	/**
+	 * @brief 逻辑CPU在拓扑中的位置
+	 *
+	 */
+	struct CpuInfo
+	{
+		int cpu;  //逻辑CPU编号
+		int core; //物理核
+		int l3;	  //共享L3的域
+		int node; //NUMA节点
+	};
+
+	/**
+	 * @brief 工作线程绑核策略
+	 *
+	 */
+	enum class AffinityPolicy
+	{
+		None,	 //不绑核，由系统调度
+		PinCore, //每个线程绑定cpuset中的一个CPU，相邻线程尽量共享缓存
+		PerL3,	 //线程按L3域轮流分配，绑定到整个域
+		PerNode, //线程按NUMA节点轮流分配，绑定到整个节点
+	};
+
+	/**
+	 * @brief 一个工作线程的位置
+	 *
+	 */
+	struct WorkerPlacement
+	{
+		std::vector<int> cpus; //允许运行的CPU
+		int domain;			   //所属的域(CPU/L3/节点编号)
+	};
+
+	/**
+	 * @brief CPU拓扑
+	 * @details 可从sysfs探测，也可以手工描述，便于在单路机器上模拟多NUMA布局
+	 *
+	 */
+	class CpuTopology
+	{
+	public:
+		CpuTopology() = default;
+
+		explicit CpuTopology(const std::vector<CpuInfo> &cpus) : m_cpus(cpus)
+		{
+			std::sort(m_cpus.begin(), m_cpus.end(), [](const CpuInfo &a, const CpuInfo &b) {
+				if (a.node != b.node)
+					return a.node < b.node;
+				if (a.l3 != b.l3)
+					return a.l3 < b.l3;
+				if (a.core != b.core)
+					return a.core < b.core;
+				return a.cpu < b.cpu;
+			});
+		}
+
+		/**
+		 * @brief 模拟拓扑，CPU按节点、L3、核、超线程依次编号
+		 *
+		 * @param nodes NUMA节点数
+		 * @param l3PerNode 每节点L3域数
+		 * @param coresPerL3 每个L3域的核数
+		 * @param threadsPerCore 每核超线程数
+		 * @return CpuTopology 拓扑
+		 */
+		static CpuTopology simulate(int nodes, int l3PerNode, int coresPerL3, int threadsPerCore = 1)
+		{
+			std::vector<CpuInfo> cpus;
+			int cpu = 0;
+			int core = 0;
+
+			for (int n = 0; n < nodes; ++n)
+			{
+				for (int l = 0; l < l3PerNode; ++l)
+				{
+					for (int c = 0; c < coresPerL3; ++c, ++core)
+					{
+						for (int t = 0; t < threadsPerCore; ++t)
+							cpus.push_back(CpuInfo{cpu++, core, n * l3PerNode + l, n});
+					}
+				}
+			}
+
+			return CpuTopology(cpus);
+		}
+
+		/**
+		 * @brief 从sysfs探测本机拓扑，失败时视为单节点单L3
+		 *
+		 * @return CpuTopology 拓扑
+		 */
+		static CpuTopology detect(void)
+		{
+			std::vector<int> online = parse_cpu_list(read_line("/sys/devices/system/cpu/online"));
+			std::map<int, int> nodeOf;
+			std::vector<CpuInfo> cpus;
+
+			if (online.empty())
+			{
+				for (unsigned i = 0; i < std::max(1u, std::thread::hardware_concurrency()); ++i)
+					online.push_back((int)i);
+			}
+
+			for (int node = 0; node < 1024; ++node)
+			{
+				std::string list = read_line("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+				if (list.empty() && node > 0)
+					break;
+				for (int cpu : parse_cpu_list(list))
+					nodeOf[cpu] = node;
+			}
+
+			for (int cpu : online)
+			{
+				std::string base = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+				int package = atoi(read_line(base + "/topology/physical_package_id").c_str());
+				int coreId = atoi(read_line(base + "/topology/core_id").c_str());
+				std::vector<int> shared = parse_cpu_list(read_line(base + "/cache/index3/shared_cpu_list"));
+
+				CpuInfo info;
+				info.cpu = cpu;
+				info.core = package * 65536 + coreId;
+				info.l3 = shared.empty() ? package : shared.front();
+				info.node = nodeOf.count(cpu) ? nodeOf[cpu] : 0;
+				cpus.push_back(info);
+			}
+
+			return CpuTopology(cpus);
+		}
+
+		/**
+		 * @brief 解析"0-3,8,10-11"形式的CPU列表
+		 *
+		 * @param list 列表
+		 * @return std::vector<int> CPU编号
+		 */
+		static std::vector<int> parse_cpu_list(const std::string &list)
+		{
+			std::vector<int> cpus;
+			size_t pos = 0;
+
+			while (pos < list.size())
+			{
+				size_t end = list.find(',', pos);
+				if (end == std::string::npos)
+					end = list.size();
+
+				std::string item = list.substr(pos, end - pos);
+				size_t dash = item.find('-');
+				if (!item.empty())
+				{
+					int first = atoi(item.c_str());
+					int last = dash == std::string::npos ? first : atoi(item.c_str() + dash + 1);
+					for (int cpu = first; cpu <= last; ++cpu)
+						cpus.push_back(cpu);
+				}
+
+				pos = end + 1;
+			}
+
+			return cpus;
+		}
+
+		const std::vector<CpuInfo> &cpus() const
+		{
+			return m_cpus;
+		}
+
+		const CpuInfo *find(int cpu) const
+		{
+			for (auto &info : m_cpus)
+			{
+				if (info.cpu == cpu)
+					return &info;
+			}
+			return nullptr;
+		}
+
+		/**
+		 * @brief 两个CPU之间的距离
+		 *
+		 * @return int 0同一CPU，1同一物理核，2同一L3，3同一节点，4跨节点
+		 */
+		int distance(int a, int b) const
+		{
+			const CpuInfo *x = find(a);
+			const CpuInfo *y = find(b);
+
+			if (a == b)
+				return 0;
+			if (!x || !y)
+				return 4;
+			if (x->core == y->core)
+				return 1;
+			if (x->l3 == y->l3)
+				return 2;
+			if (x->node == y->node)
+				return 3;
+			return 4;
+		}
+
+		/**
+		 * @brief 按策略规划工作线程位置，第i个线程使用第i % size()个位置
+		 *
+		 * @param policy 绑核策略
+		 * @param cpuset 允许使用的CPU，为空时使用全部
+		 * @return std::vector<WorkerPlacement> 位置列表，None时为空
+		 */
+		std::vector<WorkerPlacement> plan(AffinityPolicy policy, const std::vector<int> &cpuset) const
+		{
+			std::vector<WorkerPlacement> slots;
+			std::vector<const CpuInfo *> usable;
+
+			for (auto &info : m_cpus)
+			{
+				if (cpuset.empty() || std::find(cpuset.begin(), cpuset.end(), info.cpu) != cpuset.end())
+					usable.push_back(&info);
+			}
+
+			if (policy == AffinityPolicy::None || usable.empty())
+				return slots;
+
+			if (policy == AffinityPolicy::PinCore)
+			{
+				//先占满每个物理核的第一个超线程，再使用同核的其余超线程
+				std::vector<const CpuInfo *> primary, sibling;
+				for (size_t i = 0; i < usable.size(); ++i)
+				{
+					bool first = i == 0 || usable[i - 1]->core != usable[i]->core;
+					(first ? primary : sibling).push_back(usable[i]);
+				}
+				primary.insert(primary.end(), sibling.begin(), sibling.end());
+
+				for (auto info : primary)
+					slots.push_back(WorkerPlacement{{info->cpu}, info->cpu});
+				return slots;
+			}
+
+			//按域分组，线程在域之间轮转，使各域负载均衡
+			std::map<int, std::vector<int>> domains;
+			for (auto info : usable)
+				domains[policy == AffinityPolicy::PerL3 ? info->l3 : info->node].push_back(info->cpu);
+
+			for (auto &d : domains)
+				slots.push_back(WorkerPlacement{d.second, d.first});
+			return slots;
+		}
+
+		/**
+		 * @brief 按拓扑距离由近及远排列其他位置，用于选择窃取对象
+		 *
+		 * @param slots 位置列表
+		 * @param self 自身下标
+		 * @return std::vector<size_t> 其他位置的下标
+		 */
+		std::vector<size_t> steal_order(const std::vector<WorkerPlacement> &slots, size_t self) const
+		{
+			std::vector<size_t> order;
+
+			for (size_t i = 0; i < slots.size(); ++i)
+			{
+				if (i != self)
+					order.push_back(i);
+			}
+
+			std::stable_sort(order.begin(), order.end(), [this, &slots, self](size_t a, size_t b) {
+				return distance(slots[self].cpus.front(), slots[a].cpus.front()) <
+					   distance(slots[self].cpus.front(), slots[b].cpus.front());
+			});
+
+			return order;
+		}
+
+	private:
+		static std::string read_line(const std::string &path)
+		{
+			std::ifstream in(path);
+			std::string line;
+			std::getline(in, line);
+			return line;
+		}
+
+		std::vector<CpuInfo> m_cpus; //按节点、L3、核排序
+	};
+
+	/**
+	 * @brief 设置线程可运行的CPU，CPU不存在(如模拟拓扑)时忽略
+	 *
+	 * @param thread 线程
+	 * @param cpus CPU列表
+	 * @return true 成功
+	 * @return false 失败或平台不支持
+	 */
+	inline bool set_thread_affinity(std::thread &thread, const std::vector<int> &cpus)
+	{
+#ifdef __linux__
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (int cpu : cpus)
+		{
+			if (cpu >= 0 && cpu < CPU_SETSIZE)
+				CPU_SET(cpu, &set);
+		}
+		return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+#else
+		(void)thread;
+		(void)cpus;
+		return false;
+#endif
+	}
+
+} // namespace wotsen
+
+#endif // !__wotsen_CPU_TOPOLOGY_H__
@@ -0,0 +1,165 @@
+/**
+ * @file lockfree-queue.h
+ * @author yuwangliang (wotsen@outlook.com)
+ * @brief 有界无锁多生产者多消费者队列
+ * @version 0.1
+ * @date 2020-08-16
+ *
+ * @copyright Copyright (c) 2020 yuwangliang
+ *
+ */
+#ifndef __wotsen_LOCKFREE_QUEUE_H__
+#define __wotsen_LOCKFREE_QUEUE_H__
+
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace wotsen
+{
+
+	///< 缓存行大小，用于隔离热点原子变量
+	static const size_t CacheLineSize = 64;
+
+	/**
+	 * @brief 有界无锁队列(环形缓冲)
+	 * @details 每个槽位带序号，生产者与消费者各自只竞争一个位置原子量，
+	 *          槽位序号用于判断槽位是否可写/可读，不使用任何锁
+	 *
+	 * @tparam T 元素类型，需可默认构造与移动赋值
+	 */
+	template <typename T>
+	class LockFreeQueue
+	{
+	public:
+		/**
+		 * @brief Construct a new Lock Free Queue object
+		 *
+		 * @param capacity 容量，向上取整为2的幂
+		 */
+		explicit LockFreeQueue(size_t capacity) : m_mask(round_up(capacity) - 1),
+												  m_cells(new Cell[m_mask + 1])
+		{
+			for (size_t i = 0; i <= m_mask; ++i)
+			{
+				m_cells[i].seq.store(i, std::memory_order_relaxed);
+			}
+			m_enqueuePos.store(0, std::memory_order_relaxed);
+			m_dequeuePos.store(0, std::memory_order_relaxed);
+		}
+
+		LockFreeQueue(const LockFreeQueue &) = delete;
+		LockFreeQueue &operator=(const LockFreeQueue &) = delete;
+
+		/**
+		 * @brief 入队
+		 *
+		 * @param x 元素
+		 * @return true 成功
+		 * @return false 队列满
+		 */
+		bool try_push(T &&x)
+		{
+			Cell *cell = nullptr;
+			size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+
+			for (;;)
+			{
+				cell = &m_cells[pos & m_mask];
+				size_t seq = cell->seq.load(std::memory_order_acquire);
+				intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+				if (diff == 0)
+				{
+					if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+						break;
+				}
+				else if (diff < 0)
+				{
+					return false;
+				}
+				else
+				{
+					pos = m_enqueuePos.load(std::memory_order_relaxed);
+				}
+			}
+
+			cell->data = std::move(x);
+			cell->seq.store(pos + 1, std::memory_order_release);
+
+			return true;
+		}
+
+		/**
+		 * @brief 出队
+		 *
+		 * @param x[out] 元素
+		 * @return true 成功
+		 * @return false 队列空
+		 */
+		bool try_pop(T &x)
+		{
+			Cell *cell = nullptr;
+			size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+
+			for (;;)
+			{
+				cell = &m_cells[pos & m_mask];
+				size_t seq = cell->seq.load(std::memory_order_acquire);
+				intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+				if (diff == 0)
+				{
+					if (m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+						break;
+				}
+				else if (diff < 0)
+				{
+					return false;
+				}
+				else
+				{
+					pos = m_dequeuePos.load(std::memory_order_relaxed);
+				}
+			}
+
+			x = std::move(cell->data);
+			cell->seq.store(pos + m_mask + 1, std::memory_order_release);
+
+			return true;
+		}
+
+		size_t capacity() const
+		{
+			return m_mask + 1;
+		}
+
+	private:
+		static size_t round_up(size_t n)
+		{
+			size_t v = 2;
+			while (v < n)
+				v <<= 1;
+			return v;
+		}
+
+		struct Cell
+		{
+			std::atomic<size_t> seq;
+			T data;
+		};
+
+	private:
+		const size_t m_mask;						  //容量掩码
+		std::unique_ptr<Cell[]> m_cells;			  //槽位
+		char m_pad0[CacheLineSize];
+		std::atomic<size_t> m_enqueuePos; //生产位置
+		char m_pad1[CacheLineSize - sizeof(std::atomic<size_t>)];
+		std::atomic<size_t> m_dequeuePos; //消费位置
+		char m_pad2[CacheLineSize - sizeof(std::atomic<size_t>)];
+	};
+
+} // namespace wotsen
+
+#endif // !__wotsen_LOCKFREE_QUEUE_H__
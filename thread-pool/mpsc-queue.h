@@ -0,0 +1,293 @@
+/**
+ * @file mpsc-queue.h
+ * @author yuwangliang (wotsen@outlook.com)
+ * @brief 多生产者单消费者队列
+ * @version 0.1
+ * @date 2020-08-16
+ *
+ * @copyright Copyright (c) 2020 yuwangliang
+ *
+ */
+#ifndef __wotsen_MPSC_QUEUE_H__
+#define __wotsen_MPSC_QUEUE_H__
+
+#include <list>
+#include <atomic>
+#include <thread>
+#include "lockfree-queue.h"
+#include "adaptive-wait.h"
+
+namespace wotsen
+{
+
+	/**
+	 * @brief 侵入式节点，放入IntrusiveMpscQueue的类型需继承它
+	 *
+	 */
+	struct MpscNode
+	{
+		std::atomic<MpscNode *> next{nullptr};
+	};
+
+	/**
+	 * @brief 侵入式无界多生产者单消费者队列
+	 * @details 生产者只做一次交换，不分配内存；消费者不加锁。
+	 *          生产者在交换与链接之间被挂起时，消费者暂时看不到其后的节点，pop()返回nullptr
+	 *
+	 * @tparam Node 节点类型，继承自MpscNode
+	 */
+	template <typename Node>
+	class IntrusiveMpscQueue
+	{
+	public:
+		IntrusiveMpscQueue() : m_tail(&m_stub)
+		{
+			m_head.store(&m_stub, std::memory_order_relaxed);
+		}
+
+		IntrusiveMpscQueue(const IntrusiveMpscQueue &) = delete;
+		IntrusiveMpscQueue &operator=(const IntrusiveMpscQueue &) = delete;
+
+		// 任意线程调用
+		void push(Node *node)
+		{
+			link(node);
+		}
+
+		// 只由消费者调用
+		Node *pop()
+		{
+			MpscNode *tail = m_tail;
+			MpscNode *next = tail->next.load(std::memory_order_acquire);
+
+			if (tail == &m_stub)
+			{
+				if (!next)
+					return nullptr;
+				m_tail = next;
+				tail = next;
+				next = next->next.load(std::memory_order_acquire);
+			}
+
+			if (next)
+			{
+				m_tail = next;
+				return static_cast<Node *>(tail);
+			}
+
+			if (tail != m_head.load(std::memory_order_acquire))
+				return nullptr; //有生产者正在链接
+
+			//最后一个节点，放回哨兵后才能取出
+			link(&m_stub);
+			next = tail->next.load(std::memory_order_acquire);
+			if (next)
+			{
+				m_tail = next;
+				return static_cast<Node *>(tail);
+			}
+
+			return nullptr;
+		}
+
+	private:
+		void link(MpscNode *node)
+		{
+			node->next.store(nullptr, std::memory_order_relaxed);
+			MpscNode *prev = m_head.exchange(node, std::memory_order_acq_rel);
+			prev->next.store(node, std::memory_order_release);
+		}
+
+		std::atomic<MpscNode *> m_head; //生产者交换的位置
+		char m_pad0[CacheLineSize - sizeof(std::atomic<MpscNode *>)];
+		MpscNode *m_tail; //消费位置
+		MpscNode m_stub;  //哨兵
+	};
+
+	/**
+	 * @brief 多生产者单消费者同步队列
+	 * @details 接口与SyncQueue相同，可以作为模板参数互换。
+	 *          元素放在侵入式节点中，生产者之间只竞争容量计数与一次交换。
+	 *          每次put都会new一个节点、take时释放，并非无分配；
+	 *          需要无分配时直接使用IntrusiveMpscQueue，由调用者提供并复用节点
+	 *
+	 * @tparam T 元素类型
+	 * @tparam Wait 等待策略
+	 */
+	template <typename T, typename Wait = AdaptiveWait>
+	class MpscQueue
+	{
+	public:
+		MpscQueue(int maxSize) : m_maxSize((size_t)(maxSize > 0 ? maxSize : 1)), m_needStop(false), m_size(0)
+		{
+		}
+
+		~MpscQueue()
+		{
+			while (Item *item = m_queue.pop())
+				delete item;
+		}
+
+		MpscQueue(const MpscQueue &) = delete;
+		MpscQueue &operator=(const MpscQueue &) = delete;
+
+		void put(const T &x)
+		{
+			add(new Item(x));
+		}
+
+		void put(T &&x)
+		{
+			add(new Item(std::move(x)));
+		}
+
+		/**
+		 * @brief 取出全部数据，队列空时等待
+		 *
+		 * @param list[out] 数据，队列停止时不修改
+		 * @return true 成功
+		 * @return false 队列已停止
+		 */
+		bool take(std::list<T> &list)
+		{
+			if (!wait_not_empty())
+				return false;
+
+			list.clear();
+			size_t n = m_ready.exchange(0);
+			for (size_t i = 0; i < n; ++i)
+			{
+				Item *item = pop();
+				list.push_back(std::move(item->value));
+				delete item;
+			}
+
+			m_size.fetch_sub(n);
+			m_notFull.notify((int)n);
+			return true;
+		}
+
+		/**
+		 * @brief 取出一个数据，队列空时等待
+		 *
+		 * @param t[out] 数据，队列停止时不修改
+		 * @return true 成功
+		 * @return false 队列已停止
+		 */
+		bool take(T &t)
+		{
+			if (!wait_not_empty())
+				return false;
+
+			m_ready.fetch_sub(1);
+			Item *item = pop();
+			t = std::move(item->value);
+			delete item;
+
+			m_size.fetch_sub(1);
+			m_notFull.notify(1);
+			return true;
+		}
+
+		void stop()
+		{
+			m_needStop = true;
+			m_notFull.notify_all();
+			m_notEmpty.notify_all();
+		}
+
+		bool empty()
+		{
+			return size() == 0;
+		}
+
+		bool full()
+		{
+			return size() >= m_maxSize;
+		}
+
+		size_t size()
+		{
+			return m_size.load();
+		}
+
+		int count()
+		{
+			return (int)size();
+		}
+
+	private:
+		struct Item : MpscNode
+		{
+			explicit Item(const T &x) : value(x)
+			{
+			}
+
+			explicit Item(T &&x) : value(std::move(x))
+			{
+			}
+
+			T value;
+		};
+
+		// 计数已经确认有元素，等待可能仍在链接中的生产者
+		Item *pop()
+		{
+			Item *item;
+			while (!(item = m_queue.pop()))
+				std::this_thread::yield();
+			return item;
+		}
+
+		// 只由消费者调用，返回false表示已停止
+		bool wait_not_empty()
+		{
+			m_notEmpty.wait([this] { return m_needStop.load() || m_ready.load() > 0; });
+			return !m_needStop.load();
+		}
+
+		void add(Item *item)
+		{
+			//先占用容量，满时等待
+			size_t size = m_size.load();
+			for (;;)
+			{
+				if (m_needStop.load())
+				{
+					delete item;
+					return;
+				}
+
+				if (size >= m_maxSize)
+				{
+					m_notFull.wait([this] { return m_needStop.load() || m_size.load() < m_maxSize; });
+					size = m_size.load();
+					continue;
+				}
+
+				if (m_size.compare_exchange_weak(size, size + 1))
+					break;
+			}
+
+			m_queue.push(item);
+			m_ready.fetch_add(1);
+			m_notEmpty.notify(1);
+		}
+
+	private:
+		const size_t m_maxSize;		   //同步队列最大的size
+		IntrusiveMpscQueue<Item> m_queue; //缓冲区
+		Wait m_notEmpty;			   //不为空的等待
+		Wait m_notFull;				   //没有满的等待
+		std::atomic_bool m_needStop;   //停止的标志
+
+		char m_pad0[CacheLineSize];
+		std::atomic<size_t> m_size; //已占用的容量
+		char m_pad1[CacheLineSize - sizeof(std::atomic<size_t>)];
+		std::atomic<size_t> m_ready{0}; //已链接、消费者可取的元素数
+		char m_pad2[CacheLineSize - sizeof(std::atomic<size_t>)];
+	};
+
+} // namespace wotsen
+
+#endif // !__wotsen_MPSC_QUEUE_H__
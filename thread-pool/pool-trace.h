@@ -0,0 +1,323 @@
+/**
+ * @file pool-trace.h
+ * @author yuwangliang (wotsen@outlook.com)
+ * @brief 线程池统计与跟踪
+ * @details 定义WOTSEN_THREAD_POOL_TRACE后线程池与同步队列才会记录数据，
+ *          未定义时相关代码全部不参与编译
+ * @version 0.1
+ * @date 2020-08-16
+ *
+ * @copyright Copyright (c) 2020 yuwangliang
+ *
+ */
+#ifndef __wotsen_POOL_TRACE_H__
+#define __wotsen_POOL_TRACE_H__
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <ostream>
+#include <stdint.h>
+#include "lockfree-queue.h"
+
+#ifdef WOTSEN_THREAD_POOL_TRACE
+#define WOTSEN_POOL_TRACE(...) __VA_ARGS__
+#else
+#define WOTSEN_POOL_TRACE(...)
+#endif
+
+namespace wotsen
+{
+
+	/**
+	 * @brief 延迟直方图
+	 * @details HDR方式分桶：小于16ns逐个计数，之后每个2的幂区间再等分16份，
+	 *          相对误差不超过1/16，记录只有一次原子加
+	 *
+	 */
+	class LatencyHistogram
+	{
+	public:
+		LatencyHistogram()
+		{
+			reset();
+		}
+
+		void record(int64_t ns)
+		{
+			m_buckets[index(ns < 0 ? 0 : (uint64_t)ns)].fetch_add(1, std::memory_order_relaxed);
+		}
+
+		void reset()
+		{
+			for (auto &b : m_buckets)
+				b.store(0, std::memory_order_relaxed);
+		}
+
+		uint64_t count() const
+		{
+			uint64_t total = 0;
+			for (auto &b : m_buckets)
+				total += b.load(std::memory_order_relaxed);
+			return total;
+		}
+
+		/**
+		 * @brief 分位数
+		 *
+		 * @param p 0~1
+		 * @return int64_t 所在桶的上界(ns)，无数据时为0
+		 */
+		int64_t percentile(double p) const
+		{
+			uint64_t total = count();
+			if (total == 0)
+				return 0;
+
+			uint64_t target = (uint64_t)(p * (double)total);
+			if (target >= total)
+				target = total - 1;
+
+			uint64_t seen = 0;
+			for (size_t i = 0; i < BucketCount; ++i)
+			{
+				seen += m_buckets[i].load(std::memory_order_relaxed);
+				if (seen > target)
+					return (int64_t)upper(i);
+			}
+
+			return (int64_t)upper(BucketCount - 1);
+		}
+
+		int64_t max() const
+		{
+			for (size_t i = BucketCount; i > 0; --i)
+			{
+				if (m_buckets[i - 1].load(std::memory_order_relaxed))
+					return (int64_t)upper(i - 1);
+			}
+			return 0;
+		}
+
+	private:
+		static const int SubBits = 4;
+		static const uint64_t SubCount = 1 << SubBits;
+		static const int MaxExp = 47; //约39小时
+		static const size_t BucketCount = (MaxExp - SubBits + 1) * SubCount + SubCount;
+
+		static size_t index(uint64_t v)
+		{
+			if (v < SubCount)
+				return (size_t)v;
+
+			int e = 63 - __builtin_clzll(v);
+			if (e > MaxExp)
+				return BucketCount - 1;
+
+			return (size_t)(e - SubBits + 1) * SubCount + (size_t)((v >> (e - SubBits)) - SubCount);
+		}
+
+		static uint64_t lower(size_t i)
+		{
+			if (i < SubCount)
+				return i;
+
+			int e = (int)(i / SubCount) + SubBits - 1;
+			return (SubCount + i % SubCount) << (e - SubBits);
+		}
+
+		static uint64_t upper(size_t i)
+		{
+			return i + 1 < BucketCount ? lower(i + 1) - 1 : lower(i);
+		}
+
+		std::atomic<uint64_t> m_buckets[BucketCount];
+	};
+
+	/**
+	 * @brief 单个工作线程的计数
+	 *
+	 */
+	struct WorkerCounters
+	{
+		std::atomic<uint64_t> tasks{0};	  //执行的任务数
+		std::atomic<uint64_t> busy_ns{0}; //执行任务的时间
+		std::atomic<uint64_t> idle_ns{0}; //等待任务的时间
+		std::atomic<uint64_t> steals{0};  //从其他队列取得的任务数
+		char pad[CacheLineSize];
+	};
+
+	/**
+	 * @brief 一次任务执行
+	 *
+	 */
+	struct TraceEvent
+	{
+		int64_t enqueue; //入队时间(ns)
+		int64_t start;	 //开始执行
+		int64_t end;	 //执行结束
+	};
+
+	/**
+	 * @brief 线程池统计
+	 * @details 排队时间与执行时间直方图、各工作线程计数，
+	 *          可选地记录每个任务的时间线并导出为Chrome trace-event JSON
+	 *
+	 */
+	class PoolTrace
+	{
+	public:
+		explicit PoolTrace(size_t workers) : m_workers(new WorkerCounters[workers]), m_workerCount(workers),
+											 m_events(workers), m_eventMutex(new std::mutex[workers]), m_recording(false), m_maxEvents(0)
+		{
+		}
+
+		// 任务执行完成
+		void on_task(size_t worker, int64_t enqueue, int64_t start, int64_t end)
+		{
+			WorkerCounters &w = m_workers[worker];
+
+			w.tasks.fetch_add(1, std::memory_order_relaxed);
+			w.busy_ns.fetch_add((uint64_t)(end - start), std::memory_order_relaxed);
+			m_queueWait.record(start - enqueue);
+			m_runTime.record(end - start);
+
+			if (m_recording.load(std::memory_order_relaxed))
+			{
+				std::lock_guard<std::mutex> locker(m_eventMutex[worker]);
+				if (m_events[worker].size() < m_maxEvents.load(std::memory_order_relaxed))
+					m_events[worker].push_back(TraceEvent{enqueue, start, end});
+			}
+		}
+
+		// 等待任务
+		void on_idle(size_t worker, int64_t ns)
+		{
+			m_workers[worker].idle_ns.fetch_add((uint64_t)ns, std::memory_order_relaxed);
+		}
+
+		// 从其他队列取得任务
+		void on_steal(size_t worker)
+		{
+			m_workers[worker].steals.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		/**
+		 * @brief 开始记录时间线
+		 *
+		 * @param maxEventsPerWorker 每个工作线程最多记录的任务数
+		 */
+		void start_recording(size_t maxEventsPerWorker = 100000)
+		{
+			for (size_t i = 0; i < m_workerCount; ++i)
+			{
+				std::lock_guard<std::mutex> locker(m_eventMutex[i]);
+				m_events[i].clear();
+			}
+			m_maxEvents = maxEventsPerWorker;
+			m_recording = true;
+		}
+
+		void stop_recording()
+		{
+			m_recording = false;
+		}
+
+		/**
+		 * @brief 导出Chrome trace-event JSON，可在chrome://tracing或Perfetto中打开
+		 *
+		 * @param out 输出流
+		 */
+		void export_chrome_trace(std::ostream &out) const
+		{
+			bool first = true;
+			auto sep = [&out, &first] {
+				out << (first ? "\n" : ",\n");
+				first = false;
+			};
+
+			out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+			for (size_t i = 0; i < m_workerCount; ++i)
+			{
+				std::lock_guard<std::mutex> locker(m_eventMutex[i]);
+				if (m_events[i].empty())
+					continue;
+
+				sep();
+				out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << i
+					<< ",\"args\":{\"name\":\"worker " << i << "\"}}";
+
+				for (auto &e : m_events[i])
+				{
+					sep();
+					out << "{\"name\":\"task\",\"ph\":\"X\",\"pid\":0,\"tid\":" << i
+						<< ",\"ts\":";
+					write_us(out, e.start);
+					out << ",\"dur\":";
+					write_us(out, e.end - e.start);
+					out << ",\"args\":{\"queue_us\":";
+					write_us(out, e.start - e.enqueue);
+					out << "}}";
+				}
+			}
+			out << "\n]}\n";
+		}
+
+		const LatencyHistogram &queue_wait() const
+		{
+			return m_queueWait;
+		}
+
+		const LatencyHistogram &run_time() const
+		{
+			return m_runTime;
+		}
+
+		size_t worker_count() const
+		{
+			return m_workerCount;
+		}
+
+		const WorkerCounters &worker(size_t i) const
+		{
+			return m_workers[i];
+		}
+
+		// 当前时间(ns)
+		static int64_t now()
+		{
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(
+					   std::chrono::steady_clock::now().time_since_epoch())
+				.count();
+		}
+
+	private:
+		// 纳秒按微秒写出，保留全部精度；double默认只有6位有效数字，时间戳会被截断
+		static void write_us(std::ostream &out, int64_t ns)
+		{
+			if (ns < 0)
+			{
+				out << '-';
+				ns = -ns;
+			}
+
+			char frac[4] = {(char)('0' + ns / 100 % 10), (char)('0' + ns / 10 % 10), (char)('0' + ns % 10), 0};
+			out << ns / 1000 << '.' << frac;
+		}
+
+		LatencyHistogram m_queueWait; //排队时间
+		LatencyHistogram m_runTime;	  //执行时间
+		std::unique_ptr<WorkerCounters[]> m_workers;
+		size_t m_workerCount;
+
+		std::vector<std::vector<TraceEvent>> m_events; //各工作线程的时间线
+		std::unique_ptr<std::mutex[]> m_eventMutex;	   //只有导出时才会竞争
+		std::atomic_bool m_recording;
+		std::atomic<size_t> m_maxEvents;
+	};
+
+} // namespace wotsen
+
+#endif // !__wotsen_POOL_TRACE_H__
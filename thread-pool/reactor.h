@@ -0,0 +1,375 @@
+/**
+ * @file reactor.h
+ * @author yuwangliang (wotsen@outlook.com)
+ * @brief epoll事件分发
+ * @version 0.1
+ * @date 2020-08-16
+ *
+ * @copyright Copyright (c) 2020 yuwangliang
+ *
+ */
+#ifndef __wotsen_REACTOR_H__
+#define __wotsen_REACTOR_H__
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cerrno>
+#include <cstdint>
+#include <utility>
+#include <functional>
+#include <system_error>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "thread-pool.h"
+
+namespace wotsen
+{
+
+	/**
+	 * @brief 触发方式
+	 *
+	 */
+	enum class TriggerMode
+	{
+		Level, //水平触发，每次回调结束后重新注册，回调可以只读写一部分
+		Edge,  //边沿触发，只注册一次，回调必须读写到EAGAIN
+	};
+
+	/**
+	 * @brief epoll反应器
+	 * @details 一个线程等待fd就绪，就绪事件作为任务投递到线程池执行回调，工作线程不会阻塞在读写上。
+	 *          同一个fd的回调不会并发：回调执行期间到达的事件合并，回调返回后再执行一次。
+	 *          水平触发的fd以EPOLLONESHOT注册，回调返回后重新注册；边沿触发不需要重新注册，少一次系统调用。
+	 *          出错或对端关闭(EPOLLERR/EPOLLHUP/EPOLLRDHUP)时调用读回调，没有读回调时调用写回调。
+	 *          停止与注册变化通过eventfd唤醒反应器线程
+	 *
+	 */
+	class Reactor
+	{
+	public:
+		using Callback = std::function<void(int fd)>;
+
+		/**
+		 * @brief Construct a new Reactor object
+		 *
+		 * @param pool 执行回调的线程池，需比反应器后析构
+		 * @param priority 回调任务的优先级
+		 * @param maxEvents 一次epoll_wait最多取出的事件数
+		 * @throw std::system_error 创建epoll或eventfd失败
+		 */
+		explicit Reactor(ThreadPool &pool, TaskPriority priority = TaskPriority::Normal, int maxEvents = 256)
+			: m_core(std::make_shared<Core>(pool, priority)), m_maxEvents(maxEvents > 0 ? maxEvents : 1)
+		{
+			m_thread = std::thread(&Reactor::loop, this);
+		}
+
+		~Reactor()
+		{
+			stop();
+		}
+
+		Reactor(const Reactor &) = delete;
+		Reactor &operator=(const Reactor &) = delete;
+
+		/**
+		 * @brief 注册fd
+		 * @details 有读回调时关注可读，有写回调时关注可写；fd应为非阻塞
+		 *
+		 * @param fd 文件描述符
+		 * @param on_read 可读回调
+		 * @param on_write 可写回调
+		 * @param mode 触发方式
+		 * @return true 成功
+		 * @return false fd已注册、反应器已停止或epoll_ctl失败
+		 */
+		bool add(int fd, Callback on_read, Callback on_write = nullptr, TriggerMode mode = TriggerMode::Level)
+		{
+			if (fd < 0)
+				return false;
+
+			Core &core = *m_core;
+			std::shared_ptr<Handler> h = std::make_shared<Handler>();
+			h->fd = fd;
+			h->mode = mode;
+			h->on_read = std::move(on_read);
+			h->on_write = std::move(on_write);
+			h->interest = (h->on_read ? (uint32_t)(EPOLLIN | EPOLLRDHUP) : 0u) | (h->on_write ? (uint32_t)EPOLLOUT : 0u);
+
+			std::lock_guard<std::mutex> locker(core.mutex);
+			if (core.stopped.load() || ((size_t)fd < core.handlers.size() && core.handlers[fd]))
+				return false;
+
+			h->generation = ++core.generation;
+			epoll_event ev = core.event_of(*h);
+			if (epoll_ctl(core.epoll, EPOLL_CTL_ADD, fd, &ev) < 0)
+				return false;
+
+			if ((size_t)fd >= core.handlers.size())
+				core.handlers.resize((size_t)fd + 1);
+			core.handlers[fd] = std::move(h);
+			core.count++;
+			return true;
+		}
+
+		/**
+		 * @brief 修改关注的事件，例如写缓冲满时开启可写、写完后关闭
+		 *
+		 * @param fd 文件描述符
+		 * @param read 关注可读
+		 * @param write 关注可写
+		 * @return true 成功
+		 * @return false fd未注册
+		 */
+		bool set_interest(int fd, bool read, bool write)
+		{
+			Core &core = *m_core;
+			std::lock_guard<std::mutex> locker(core.mutex);
+
+			Handler *h = core.find(fd);
+			if (!h)
+				return false;
+
+			h->interest = (read ? (uint32_t)(EPOLLIN | EPOLLRDHUP) : 0u) | (write ? (uint32_t)EPOLLOUT : 0u);
+			epoll_event ev = core.event_of(*h);
+			return epoll_ctl(core.epoll, EPOLL_CTL_MOD, fd, &ev) == 0;
+		}
+
+		/**
+		 * @brief 注销fd，之后不再调用它的回调；可以在回调中调用
+		 * @details 已经开始执行的回调不会被打断，在其他线程注销后应等回调返回再释放回调用到的资源；
+		 *          关闭fd前先注销
+		 *
+		 * @param fd 文件描述符
+		 * @return true 成功
+		 * @return false fd未注册
+		 */
+		bool remove(int fd)
+		{
+			Core &core = *m_core;
+			std::lock_guard<std::mutex> locker(core.mutex);
+
+			Handler *h = core.find(fd);
+			if (!h)
+				return false;
+
+			h->removed = true;
+			epoll_ctl(core.epoll, EPOLL_CTL_DEL, fd, nullptr);
+			core.handlers[fd].reset();
+			core.count--;
+			return true;
+		}
+
+		// 停止反应器线程，已投递的回调仍会执行
+		void stop()
+		{
+			if (m_core->stopped.exchange(true))
+				return;
+
+			m_core->wakeup();
+			if (m_thread.joinable())
+				m_thread.join();
+		}
+
+		// 已注册的fd数
+		size_t size()
+		{
+			std::lock_guard<std::mutex> locker(m_core->mutex);
+			return m_core->count;
+		}
+
+	private:
+		static const uint64_t WakeKey = ~(uint64_t)0;
+		static const uint32_t EventMask = EPOLLIN | EPOLLPRI | EPOLLOUT | EPOLLERR | EPOLLHUP | EPOLLRDHUP;
+		static const uint32_t Running = 1u << 31; //pending中表示已有执行者
+
+		struct Handler
+		{
+			int fd = -1;
+			uint32_t generation = 0; //区分复用的fd号
+			TriggerMode mode = TriggerMode::Level;
+			uint32_t interest = 0; //受Core::mutex保护
+			Callback on_read;
+			Callback on_write;
+			std::atomic<uint32_t> pending{0}; //尚未处理的事件
+			std::atomic_bool removed{false};
+		};
+
+		struct Core
+		{
+			Core(ThreadPool &p, TaskPriority prio) : pool(p), priority(prio)
+			{
+				epoll = epoll_create1(EPOLL_CLOEXEC);
+				if (epoll < 0)
+					throw std::system_error(errno, std::system_category(), "epoll_create1");
+
+				wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+				if (wake < 0)
+				{
+					int err = errno;
+					close(epoll);
+					throw std::system_error(err, std::system_category(), "eventfd");
+				}
+
+				epoll_event ev = {};
+				ev.events = EPOLLIN;
+				ev.data.u64 = WakeKey;
+				epoll_ctl(epoll, EPOLL_CTL_ADD, wake, &ev);
+			}
+
+			~Core()
+			{
+				close(wake);
+				close(epoll);
+			}
+
+			void wakeup()
+			{
+				uint64_t one = 1;
+				ssize_t ret = write(wake, &one, sizeof(one));
+				(void)ret;
+			}
+
+			// 需持有mutex
+			Handler *find(int fd)
+			{
+				if (fd < 0 || (size_t)fd >= handlers.size())
+					return nullptr;
+				return handlers[fd].get();
+			}
+
+			epoll_event event_of(const Handler &h) const
+			{
+				epoll_event ev = {};
+				ev.events = h.interest | (h.mode == TriggerMode::Edge ? EPOLLET : EPOLLONESHOT);
+				ev.data.u64 = ((uint64_t)h.generation << 32) | (uint32_t)h.fd;
+				return ev;
+			}
+
+			// 反应器线程调用，事件并入pending，没有执行者时投递一个
+			static void dispatch(const std::shared_ptr<Core> &core, std::shared_ptr<Handler> &&h, uint32_t events)
+			{
+				if (h->pending.fetch_or((events & EventMask) | Running) & Running)
+					return;
+
+				std::shared_ptr<Handler> handler = std::move(h);
+				try
+				{
+					core->pool.post([core, handler] { core->run(*handler); }, core->priority);
+				}
+				catch (...)
+				{
+					//队列满且拒绝时在反应器线程中执行，否则该fd不会再被处理
+					core->run(*handler);
+				}
+			}
+
+			void run(Handler &h)
+			{
+				uint32_t events = h.pending.exchange(Running) & ~Running;
+				for (;;)
+				{
+					invoke(h, events);
+
+					uint32_t expected = Running;
+					if (h.pending.compare_exchange_strong(expected, 0))
+						break;
+					events = h.pending.exchange(Running) & ~Running;
+				}
+
+				if (h.mode == TriggerMode::Level)
+				{
+					std::lock_guard<std::mutex> locker(mutex);
+					if (!h.removed.load())
+					{
+						epoll_event ev = event_of(h);
+						epoll_ctl(epoll, EPOLL_CTL_MOD, h.fd, &ev);
+					}
+				}
+			}
+
+			// 回调抛出的异常被忽略，不影响后续事件
+			static void invoke(Handler &h, uint32_t events)
+			{
+				const uint32_t failed = EPOLLERR | EPOLLHUP | EPOLLRDHUP;
+				bool readable = (events & (EPOLLIN | EPOLLPRI)) || ((events & failed) && h.on_read);
+				bool writable = (events & EPOLLOUT) || ((events & failed) && !h.on_read);
+
+				try
+				{
+					if (readable && h.on_read && !h.removed.load())
+						h.on_read(h.fd);
+					if (writable && h.on_write && !h.removed.load())
+						h.on_write(h.fd);
+				}
+				catch (...)
+				{
+				}
+			}
+
+			ThreadPool &pool;
+			const TaskPriority priority;
+			int epoll = -1;
+			int wake = -1;
+			std::atomic_bool stopped{false};
+
+			std::mutex mutex;
+			std::vector<std::shared_ptr<Handler>> handlers; //按fd索引
+			uint32_t generation = 0;
+			size_t count = 0;
+		};
+
+		void loop()
+		{
+			std::shared_ptr<Core> core = m_core;
+			std::vector<epoll_event> events((size_t)m_maxEvents);
+			std::vector<std::pair<std::shared_ptr<Handler>, uint32_t>> ready;
+			ready.reserve(events.size());
+
+			while (!core->stopped.load())
+			{
+				int n = epoll_wait(core->epoll, events.data(), m_maxEvents, -1);
+				if (n < 0)
+				{
+					if (errno == EINTR)
+						continue;
+					break;
+				}
+
+				{
+					//一批事件只加一次锁，按代数丢弃已注销fd的残留事件
+					std::lock_guard<std::mutex> locker(core->mutex);
+					for (int i = 0; i < n; ++i)
+					{
+						uint64_t key = events[i].data.u64;
+						if (key == WakeKey)
+						{
+							uint64_t value;
+							ssize_t ret = read(core->wake, &value, sizeof(value));
+							(void)ret;
+							continue;
+						}
+
+						Handler *h = core->find((int)(uint32_t)key);
+						if (h && h->generation == (uint32_t)(key >> 32))
+							ready.emplace_back(core->handlers[h->fd], (uint32_t)events[i].events);
+					}
+				}
+
+				for (auto &r : ready)
+					Core::dispatch(core, std::move(r.first), r.second);
+				ready.clear();
+			}
+		}
+
+		std::shared_ptr<Core> m_core;
+		const int m_maxEvents;
+		std::thread m_thread;
+	};
+
+} // namespace wotsen
+
+#endif // !__wotsen_REACTOR_H__
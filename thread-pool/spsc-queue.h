@@ -0,0 +1,204 @@
+/**
+ * @file spsc-queue.h
+ * @author yuwangliang (wotsen@outlook.com)
+ * @brief 单生产者单消费者同步队列
+ * @version 0.1
+ * @date 2020-08-16
+ *
+ * @copyright Copyright (c) 2020 yuwangliang
+ *
+ */
+#ifndef __wotsen_SPSC_QUEUE_H__
+#define __wotsen_SPSC_QUEUE_H__
+
+#include <list>
+#include <atomic>
+#include <memory>
+#include "lockfree-queue.h"
+#include "adaptive-wait.h"
+
+namespace wotsen
+{
+
+	/**
+	 * @brief 单生产者单消费者队列(环形缓冲)
+	 * @details 接口与SyncQueue相同，可以作为模板参数互换。
+	 *          读写位置各占一个缓存行，双方各自缓存对方的位置，
+	 *          只有缓存值显示满/空时才去读对方的缓存行
+	 *
+	 * @tparam T 元素类型，需可默认构造与移动赋值
+	 * @tparam Wait 等待策略
+	 */
+	template <typename T, typename Wait = AdaptiveWait>
+	class SpscQueue
+	{
+	public:
+		/**
+		 * @brief Construct a new Spsc Queue object
+		 *
+		 * @param maxSize 容量，内部向上取整为2的幂
+		 */
+		SpscQueue(int maxSize) : m_maxSize((size_t)(maxSize > 0 ? maxSize : 1)), m_mask(round_up(m_maxSize) - 1),
+								 m_buffer(new T[m_mask + 1]), m_needStop(false)
+		{
+			m_head.store(0, std::memory_order_relaxed);
+			m_tail.store(0, std::memory_order_relaxed);
+			m_headCache = 0;
+			m_tailCache = 0;
+		}
+
+		SpscQueue(const SpscQueue &) = delete;
+		SpscQueue &operator=(const SpscQueue &) = delete;
+
+		void put(const T &x)
+		{
+			T tmp(x);
+			add(std::move(tmp));
+		}
+
+		void put(T &&x)
+		{
+			add(std::move(x));
+		}
+
+		/**
+		 * @brief 取出全部数据，队列空时等待
+		 *
+		 * @param list[out] 数据，队列停止时不修改
+		 * @return true 成功
+		 * @return false 队列已停止
+		 */
+		bool take(std::list<T> &list)
+		{
+			if (!wait_not_empty())
+				return false;
+
+			list.clear();
+			size_t head = m_head.load(std::memory_order_relaxed);
+			for (; head != m_tailCache; ++head)
+				list.push_back(std::move(m_buffer[head & m_mask]));
+			m_head.store(head, std::memory_order_release);
+			m_notFull.notify(1);
+			return true;
+		}
+
+		/**
+		 * @brief 取出一个数据，队列空时等待
+		 *
+		 * @param t[out] 数据，队列停止时不修改
+		 * @return true 成功
+		 * @return false 队列已停止
+		 */
+		bool take(T &t)
+		{
+			if (!wait_not_empty())
+				return false;
+
+			size_t head = m_head.load(std::memory_order_relaxed);
+			t = std::move(m_buffer[head & m_mask]);
+			m_head.store(head + 1, std::memory_order_release);
+			m_notFull.notify(1);
+			return true;
+		}
+
+		void stop()
+		{
+			m_needStop = true;
+			m_notFull.notify_all();
+			m_notEmpty.notify_all();
+		}
+
+		bool empty()
+		{
+			return size() == 0;
+		}
+
+		bool full()
+		{
+			return size() >= m_maxSize;
+		}
+
+		size_t size()
+		{
+			return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+		}
+
+		int count()
+		{
+			return (int)size();
+		}
+
+	private:
+		static size_t round_up(size_t n)
+		{
+			size_t v = 1;
+			while (v < n)
+				v <<= 1;
+			return v;
+		}
+
+		// 只由消费者调用，返回false表示已停止
+		bool wait_not_empty()
+		{
+			size_t head = m_head.load(std::memory_order_relaxed);
+
+			if (head == m_tailCache)
+			{
+				m_tailCache = m_tail.load(std::memory_order_acquire);
+				if (head == m_tailCache)
+				{
+					m_notEmpty.wait([this, head] {
+						return m_needStop.load() || m_tail.load(std::memory_order_acquire) != head;
+					});
+					m_tailCache = m_tail.load(std::memory_order_acquire);
+				}
+			}
+
+			return !m_needStop.load(std::memory_order_relaxed);
+		}
+
+		// 只由生产者调用
+		void add(T &&x)
+		{
+			size_t tail = m_tail.load(std::memory_order_relaxed);
+
+			if (tail - m_headCache >= m_maxSize)
+			{
+				m_headCache = m_head.load(std::memory_order_acquire);
+				if (tail - m_headCache >= m_maxSize)
+				{
+					m_notFull.wait([this, tail] {
+						return m_needStop.load() || tail - m_head.load(std::memory_order_acquire) < m_maxSize;
+					});
+					m_headCache = m_head.load(std::memory_order_acquire);
+				}
+			}
+
+			if (m_needStop.load(std::memory_order_relaxed))
+				return;
+
+			m_buffer[tail & m_mask] = std::move(x);
+			m_tail.store(tail + 1, std::memory_order_release);
+			m_notEmpty.notify(1);
+		}
+
+	private:
+		const size_t m_maxSize;		//同步队列最大的size
+		const size_t m_mask;		//缓冲区掩码
+		std::unique_ptr<T[]> m_buffer; //缓冲区
+		Wait m_notEmpty;			//不为空的等待
+		Wait m_notFull;				//没有满的等待
+		std::atomic_bool m_needStop; //停止的标志
+
+		char m_pad0[CacheLineSize];
+		std::atomic<size_t> m_head; //消费位置
+		size_t m_tailCache;			//消费者缓存的生产位置
+		char m_pad1[CacheLineSize - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+		std::atomic<size_t> m_tail; //生产位置
+		size_t m_headCache;			//生产者缓存的消费位置
+		char m_pad2[CacheLineSize - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+	};
+
+} // namespace wotsen
+
+#endif // !__wotsen_SPSC_QUEUE_H__
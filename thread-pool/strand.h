@@ -0,0 +1,284 @@
+/**
+ * @file strand.h
+ * @author yuwangliang (wotsen@outlook.com)
+ * @brief 串行执行器
+ * @version 0.1
+ * @date 2020-08-16
+ *
+ * @copyright Copyright (c) 2020 yuwangliang
+ *
+ */
+#ifndef __wotsen_STRAND_H__
+#define __wotsen_STRAND_H__
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include "thread-pool.h"
+#include "mpsc-queue.h"
+
+namespace wotsen
+{
+
+	/**
+	 * @brief 串行执行器
+	 * @details 投递到同一个Strand的任务按投递顺序逐个执行，不会并发；
+	 *          不占用专门的线程，有任务时只向线程池投递一个执行者，
+	 *          执行者每次最多连续执行BatchSize个任务后重新排队，避免长队列独占工作线程。
+	 *          线程池拒绝执行者(队列满或已关闭)时在投递者线程中执行；任务抛出的异常被忽略，
+	 *          不影响后续任务，需要结果时在任务内自行传递
+	 *
+	 */
+	class Strand
+	{
+	public:
+		using Task = std::function<void()>;
+
+		///< 执行者一次最多连续执行的任务数
+		static const size_t BatchSize = 64;
+
+		explicit Strand(ThreadPool &pool) : m_state(std::make_shared<State>(pool))
+		{
+		}
+
+		/**
+		 * @brief 投递任务，任何线程都可以调用
+		 *
+		 * @param task 任务
+		 */
+		void post(Task task)
+		{
+			State::post(m_state, std::move(task));
+		}
+
+		/**
+		 * @brief 已在本Strand中执行时直接调用，否则投递
+		 *
+		 * @param task 任务
+		 */
+		void dispatch(Task task)
+		{
+			if (running_in_this_thread())
+				task();
+			else
+				post(std::move(task));
+		}
+
+		// 当前线程是否正在执行本Strand的任务
+		bool running_in_this_thread() const
+		{
+			return State::current() == m_state.get();
+		}
+
+		ThreadPool &pool() const
+		{
+			return m_state->pool;
+		}
+
+	private:
+		struct Item : MpscNode
+		{
+			Task task;
+		};
+
+		struct State
+		{
+			explicit State(ThreadPool &p) : pool(p), pending(0)
+			{
+			}
+
+			~State()
+			{
+				//线程池停止后未执行的任务
+				while (Item *item = queue.pop())
+					delete item;
+			}
+
+			static void post(const std::shared_ptr<State> &self, Task &&task)
+			{
+				//从0变为1的投递者负责调度执行者，任务直接交给执行者，不经过队列
+				if (self->pending.fetch_add(1) == 0)
+				{
+					schedule(self, std::move(task));
+					return;
+				}
+
+				Item *item = new Item;
+				item->task = std::move(task);
+				self->queue.push(item);
+			}
+
+			static void schedule(const std::shared_ptr<State> &self, Task &&first)
+			{
+				std::shared_ptr<Task> task = first ? std::make_shared<Task>(std::move(first)) : nullptr;
+				if (!repost(self, task))
+					self->run(self, task.get());
+			}
+
+			// 向线程池投递执行者，不抛出不阻塞；被拒绝时返回false，由调用者在当前线程执行
+			static bool repost(const std::shared_ptr<State> &self, const std::shared_ptr<Task> &first)
+			{
+				std::shared_ptr<State> state = self;
+				UniqueTask runner([state, first] { state->run(state, first.get()); });
+				return self->pool.try_post(runner);
+			}
+
+			void run(const std::shared_ptr<State> &self, Task *first)
+			{
+				State *&cur = current();
+				State *prev = cur;
+				cur = this;
+
+				for (;;)
+				{
+					size_t n = 0;
+					if (first)
+					{
+						invoke(*first);
+						first = nullptr;
+						n++;
+					}
+
+					while (n < BatchSize && n < pending.load(std::memory_order_acquire))
+					{
+						Item *item;
+						while (!(item = queue.pop()))
+							std::this_thread::yield(); //计数已增加，投递者正在链接
+
+						invoke(item->task);
+						delete item;
+						n++;
+					}
+
+					//仍有任务时重新排队，让其他Strand有机会执行；线程池拒绝时继续在当前线程执行
+					if (pending.fetch_sub(n) == n || repost(self, nullptr))
+						break;
+				}
+
+				cur = prev;
+			}
+
+			// 执行一个任务，异常不离开执行者，否则计数无法归还，Strand不再执行
+			static void invoke(Task &task)
+			{
+				try
+				{
+					task();
+				}
+				catch (...)
+				{
+				}
+			}
+
+			// 当前线程正在执行的Strand
+			static State *&current()
+			{
+				static thread_local State *state = nullptr;
+				return state;
+			}
+
+			ThreadPool &pool;
+			IntrusiveMpscQueue<Item> queue;
+			std::atomic<size_t> pending; //已投递未执行的任务数，非0时恰有一个执行者
+		};
+
+		std::shared_ptr<State> m_state;
+	};
+
+	/**
+	 * @brief 按键分组的串行执行器
+	 * @details 同一个键的任务串行，不同键之间并行；键到Strand的映射分片加锁，
+	 *          分片数越多投递时的竞争越小。连接关闭后调用remove()释放对应的Strand
+	 *
+	 * @tparam Key 键类型
+	 * @tparam Hash 哈希函数
+	 */
+	template <typename Key, typename Hash = std::hash<Key>>
+	class KeyedStrands
+	{
+	public:
+		using Task = Strand::Task;
+
+		/**
+		 * @brief Construct a new Keyed Strands object
+		 *
+		 * @param pool 线程池
+		 * @param shards 映射分片数
+		 */
+		explicit KeyedStrands(ThreadPool &pool, size_t shards = 64) : m_pool(pool), m_shards(shards ? shards : 1)
+		{
+		}
+
+		/**
+		 * @brief 投递任务，同一个键的任务按投递顺序执行
+		 *
+		 * @param key 键
+		 * @param task 任务
+		 */
+		void post(const Key &key, Task task)
+		{
+			strand(key).post(std::move(task));
+		}
+
+		// 取得键对应的Strand，不存在时创建
+		Strand strand(const Key &key)
+		{
+			Shard &shard = shard_of(key);
+			std::lock_guard<std::mutex> locker(shard.mutex);
+
+			auto it = shard.strands.find(key);
+			if (it == shard.strands.end())
+				it = shard.strands.emplace(key, Strand(m_pool)).first;
+			return it->second;
+		}
+
+		/**
+		 * @brief 移除键，已投递的任务仍会执行完
+		 * @details 移除后再次投递同一个键会创建新的Strand，与旧Strand中剩余的任务之间不保证顺序
+		 *
+		 * @param key 键
+		 * @return true 成功
+		 * @return false 键不存在
+		 */
+		bool remove(const Key &key)
+		{
+			Shard &shard = shard_of(key);
+			std::lock_guard<std::mutex> locker(shard.mutex);
+			return shard.strands.erase(key) > 0;
+		}
+
+		size_t size()
+		{
+			size_t total = 0;
+			for (auto &shard : m_shards)
+			{
+				std::lock_guard<std::mutex> locker(shard.mutex);
+				total += shard.strands.size();
+			}
+			return total;
+		}
+
+	private:
+		struct Shard
+		{
+			std::mutex mutex;
+			std::unordered_map<Key, Strand, Hash> strands;
+			char pad[CacheLineSize];
+		};
+
+		Shard &shard_of(const Key &key)
+		{
+			return m_shards[m_hash(key) % m_shards.size()];
+		}
+
+		ThreadPool &m_pool;
+		std::vector<Shard> m_shards;
+		Hash m_hash;
+	};
+
+} // namespace wotsen
+
+#endif // !__wotsen_STRAND_H__
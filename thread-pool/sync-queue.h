@@ -14,18 +14,27 @@
 
 #include <list>
 #include <mutex>
+#include <atomic>
 #include <thread>
-#include <condition_variable>
-#include <iostream>
+#include "pool-trace.h"
+#include "adaptive-wait.h"
 
 namespace wotsen
 {
 
-	template <typename T>
+	/**
+	 * @brief 同步队列
+	 * @details 等待方式由Wait决定，默认AdaptiveWait先自旋再休眠；
+	 *          ParkWait直接休眠。等待条件只读原子计数，不持锁
+	 *
+	 * @tparam T 元素类型
+	 * @tparam Wait 等待策略
+	 */
+	template <typename T, typename Wait = AdaptiveWait>
 	class SyncQueue
 	{
 	public:
-		SyncQueue(int maxSize) : m_maxSize(maxSize), m_needStop(false)
+		SyncQueue(int maxSize) : m_maxSize(maxSize), m_size(0), m_needStop(false)
 		{
 		}
 
@@ -39,27 +48,52 @@ namespace wotsen
 			add(std::forward<T>(x));
 		}
 
-		void take(std::list<T> &list)
+		/**
+		 * @brief 取出全部数据，队列空时等待
+		 *
+		 * @param list[out] 数据，队列停止时不修改
+		 * @return true 成功
+		 * @return false 队列已停止
+		 */
+		bool take(std::list<T> &list)
 		{
 			std::unique_lock<std::mutex> locker(m_mutex);
-			m_notEmpty.wait(locker, [this] { return m_needStop || notEmpty(); });
+			WOTSEN_POOL_TRACE(int64_t begin = PoolTrace::now());
+			wait_not_empty(locker);
+			WOTSEN_POOL_TRACE(m_takeWait.record(PoolTrace::now() - begin));
 
 			if (m_needStop)
-				return;
+				return false;
 			list = std::move(m_queue);
-			m_notFull.notify_one();
+			m_queue.clear();
+			int freed = (int)m_size.exchange(0);
+			locker.unlock();
+			m_notFull.notify(freed); //空出多少位置就唤醒多少个生产者
+			return true;
 		}
 
-		void take(T &t)
+		/**
+		 * @brief 取出一个数据，队列空时等待
+		 *
+		 * @param t[out] 数据，队列停止时不修改
+		 * @return true 成功
+		 * @return false 队列已停止
+		 */
+		bool take(T &t)
 		{
 			std::unique_lock<std::mutex> locker(m_mutex);
-			m_notEmpty.wait(locker, [this] { return m_needStop || notEmpty(); });
+			WOTSEN_POOL_TRACE(int64_t begin = PoolTrace::now());
+			wait_not_empty(locker);
+			WOTSEN_POOL_TRACE(m_takeWait.record(PoolTrace::now() - begin));
 
 			if (m_needStop)
-				return;
+				return false;
 			t = m_queue.front();
 			m_queue.pop_front();
-			m_notFull.notify_one();
+			m_size.fetch_sub(1);
+			locker.unlock();
+			m_notFull.notify(1);
+			return true;
 		}
 
 		void stop()
@@ -92,16 +126,27 @@ namespace wotsen
 
 		int count()
 		{
-			return m_queue.size();
+			return (int)m_size.load(std::memory_order_relaxed);
+		}
+
+#ifdef WOTSEN_THREAD_POOL_TRACE
+		// 取数据时等待的时间(含加锁后的等待)
+		const LatencyHistogram &take_wait() const
+		{
+			return m_takeWait;
 		}
 
+		// 放数据时等待空位的时间
+		const LatencyHistogram &put_wait() const
+		{
+			return m_putWait;
+		}
+#endif
+
 	private:
 		bool notFull() const
 		{
-			bool full = m_queue.size() >= m_maxSize;
-			if (full)
-				std::cout << "full, waiting，thread id: " << std::this_thread::get_id() << std::endl;
-			return !full;
+			return m_queue.size() < (size_t)m_maxSize;
 		}
 
 		bool notEmpty() const
@@ -109,26 +154,57 @@ namespace wotsen
 			return !m_queue.empty();
 		}
 
+		// 持锁进入与返回，等待期间释放锁
+		void wait_not_empty(std::unique_lock<std::mutex> &locker)
+		{
+			while (!m_needStop && !notEmpty())
+			{
+				locker.unlock();
+				m_notEmpty.wait([this] { return m_needStop.load() || m_size.load() > 0; });
+				locker.lock();
+			}
+		}
+
+		void wait_not_full(std::unique_lock<std::mutex> &locker)
+		{
+			while (!m_needStop && !notFull())
+			{
+				locker.unlock();
+				m_notFull.wait([this] { return m_needStop.load() || m_size.load() < (size_t)m_maxSize; });
+				locker.lock();
+			}
+		}
+
 		template <typename F>
 		void add(F &&x)
 		{
 			std::unique_lock<std::mutex> locker(m_mutex);
-			m_notFull.wait(locker, [this] { return m_needStop || notFull(); });
+			WOTSEN_POOL_TRACE(int64_t begin = PoolTrace::now());
+			wait_not_full(locker);
+			WOTSEN_POOL_TRACE(m_putWait.record(PoolTrace::now() - begin));
 			if (m_needStop)
 				return;
 
 			m_queue.push_back(std::forward<F>(x));
-			m_notEmpty.notify_one();
+			m_size.fetch_add(1);
+			locker.unlock();
+			m_notEmpty.notify(1);
 		}
 
 	private:
-		std::list<T> m_queue;				//缓冲区
-		std::mutex m_mutex;					//互斥量和条件变量结合起来使用
-		std::condition_variable m_notEmpty; //不为空的条件变量
-		std::condition_variable m_notFull;	//没有满的条件变量
-		int m_maxSize;						//同步队列最大的size
-
-		bool m_needStop; //停止的标志
+		std::list<T> m_queue;	 //缓冲区
+		std::mutex m_mutex;		 //只保护缓冲区，等待时不持有
+		Wait m_notEmpty;		 //不为空的等待
+		Wait m_notFull;			 //没有满的等待
+		int m_maxSize;			 //同步队列最大的size
+		std::atomic<size_t> m_size; //元素个数，供无锁的等待条件读取
+
+		std::atomic_bool m_needStop; //停止的标志
+
+#ifdef WOTSEN_THREAD_POOL_TRACE
+		LatencyHistogram m_takeWait; //取数据等待时间
+		LatencyHistogram m_putWait;	 //放数据等待时间
+#endif
 	};
 
 } // namespace wotsen
@@ -0,0 +1,208 @@
+/**
+ * @file task-graph.h
+ * @author yuwangliang (wotsen@outlook.com)
+ * @brief 有向无环任务图
+ * @version 0.1
+ * @date 2020-08-16
+ *
+ * @copyright Copyright (c) 2020 yuwangliang
+ *
+ */
+#ifndef __wotsen_TASK_GRAPH_H__
+#define __wotsen_TASK_GRAPH_H__
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <stdexcept>
+#include <functional>
+#include <initializer_list>
+#include "async-future.h"
+
+namespace wotsen
+{
+
+	/**
+	 * @brief 任务图
+	 * @details 节点的全部前驱完成后立即投递到线程池，不占用线程等待依赖；
+	 *          任意节点抛出异常后其余未开始的节点不再执行，异常由run()返回的未来值传递
+	 *
+	 */
+	class TaskGraph
+	{
+	public:
+		using NodeId = size_t;
+		using Task = std::function<void()>;
+
+		/**
+		 * @brief 添加节点
+		 *
+		 * @param task 任务
+		 * @param deps 依赖的节点
+		 * @return NodeId 节点标识
+		 */
+		NodeId add(Task task, std::initializer_list<NodeId> deps = {})
+		{
+			NodeId id = m_nodes.size();
+
+			m_nodes.push_back(Node());
+			m_nodes.back().task = std::move(task);
+
+			for (NodeId dep : deps)
+				precede(dep, id);
+
+			return id;
+		}
+
+		/**
+		 * @brief 添加依赖，before完成后才执行after
+		 *
+		 * @param before 前驱
+		 * @param after 后继
+		 * @throw std::out_of_range 节点不存在
+		 */
+		void precede(NodeId before, NodeId after)
+		{
+			if (before >= m_nodes.size() || after >= m_nodes.size())
+				throw std::out_of_range("task graph node not exist");
+
+			m_nodes[before].successors.push_back(after);
+			m_nodes[after].deps++;
+		}
+
+		size_t size() const
+		{
+			return m_nodes.size();
+		}
+
+		/**
+		 * @brief 在线程池上执行整张图，可重复执行
+		 *
+		 * @param pool 线程池
+		 * @return AsyncFuture<void> 全部节点完成后就绪
+		 * @throw std::logic_error 图中有环
+		 */
+		AsyncFuture<void> run(ThreadPool &pool) const
+		{
+			check_acyclic();
+
+			auto run = std::make_shared<Run>(pool, m_nodes);
+			AsyncFuture<void> ret = run->promise.get_future();
+
+			if (m_nodes.empty())
+			{
+				run->promise.set_value();
+				return ret;
+			}
+
+			for (NodeId id = 0; id < m_nodes.size(); ++id)
+			{
+				if (m_nodes[id].deps == 0)
+					Run::schedule(run, id);
+			}
+
+			return ret;
+		}
+
+	private:
+		struct Node
+		{
+			Task task;
+			size_t deps = 0;			   //前驱数
+			std::vector<NodeId> successors; //后继
+		};
+
+		// 一次执行的状态
+		struct Run
+		{
+			Run(ThreadPool &p, const std::vector<Node> &n)
+				: pool(p), nodes(n), pending(n.size()), remaining(n.size()), failed(false), promise(&p)
+			{
+				for (size_t i = 0; i < n.size(); ++i)
+					pending[i] = n[i].deps;
+			}
+
+			// 线程池拒绝(队列满或已关闭)时在当前线程执行，不抛出，已开始的执行不会无人推进
+			static void schedule(const std::shared_ptr<Run> &run, NodeId id)
+			{
+				UniqueTask task([run, id] { run->execute(run, id); });
+				if (!run->pool.try_post(task))
+					task();
+			}
+
+			void execute(const std::shared_ptr<Run> &self, NodeId id)
+			{
+				if (!failed.load())
+				{
+					try
+					{
+						nodes[id].task();
+					}
+					catch (...)
+					{
+						if (!failed.exchange(true))
+							error = std::current_exception();
+					}
+				}
+
+				for (NodeId next : nodes[id].successors)
+				{
+					if (pending[next].fetch_sub(1) == 1)
+						schedule(self, next);
+				}
+
+				if (remaining.fetch_sub(1) == 1)
+				{
+					if (error)
+						promise.set_exception(error);
+					else
+						promise.set_value();
+				}
+			}
+
+			ThreadPool &pool;
+			std::vector<Node> nodes;
+			std::vector<std::atomic<size_t>> pending; //各节点未完成的前驱数
+			std::atomic<size_t> remaining;			  //未完成的节点数
+			std::atomic_bool failed;
+			std::exception_ptr error;
+			AsyncPromise<void> promise;
+		};
+
+		// 拓扑排序检查环
+		void check_acyclic() const
+		{
+			std::vector<size_t> deps(m_nodes.size());
+			std::vector<NodeId> ready;
+			size_t visited = 0;
+
+			for (NodeId id = 0; id < m_nodes.size(); ++id)
+			{
+				deps[id] = m_nodes[id].deps;
+				if (deps[id] == 0)
+					ready.push_back(id);
+			}
+
+			while (!ready.empty())
+			{
+				NodeId id = ready.back();
+				ready.pop_back();
+				visited++;
+
+				for (NodeId next : m_nodes[id].successors)
+				{
+					if (--deps[next] == 0)
+						ready.push_back(next);
+				}
+			}
+
+			if (visited != m_nodes.size())
+				throw std::logic_error("task graph has cycle");
+		}
+
+		std::vector<Node> m_nodes;
+	};
+
+} // namespace wotsen
+
+#endif // !__wotsen_TASK_GRAPH_H__
@@ -0,0 +1,184 @@
+/**
+ * @file task-group.h
+ * @author yuwangliang (wotsen@outlook.com)
+ * @brief 分治任务组
+ * @version 0.1
+ * @date 2020-08-16
+ *
+ * @copyright Copyright (c) 2020 yuwangliang
+ *
+ */
+#ifndef __wotsen_TASK_GROUP_H__
+#define __wotsen_TASK_GROUP_H__
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <exception>
+#include <functional>
+#include <condition_variable>
+#include "thread-pool.h"
+
+namespace wotsen
+{
+
+	/**
+	 * @brief 分治任务组
+	 * @details run()提交的子任务先放在组内的双端队列，同时向线程池投递一个取任务的执行者：
+	 *          工作线程从队头取(最早提交、通常最大的子问题)，wait()的调用者从队尾取(最近提交的，缓存最热)。
+	 *          wait()不休眠而是自己执行组内剩余的子任务，组内取空后再帮线程池执行排队的任务，
+	 *          只有全部子任务都已被其他线程取走时才休眠。因此在工作线程中递归分治不会占死线程池。
+	 *          任一子任务抛出异常后，组内尚未开始的子任务不再执行，异常由wait()抛出
+	 *
+	 */
+	class TaskGroup
+	{
+	public:
+		using Task = std::function<void()>;
+
+		explicit TaskGroup(ThreadPool &pool) : m_pool(pool), m_state(std::make_shared<State>())
+		{
+		}
+
+		// 析构前未wait()时等待全部子任务结束，忽略异常
+		~TaskGroup()
+		{
+			try
+			{
+				wait();
+			}
+			catch (...)
+			{
+			}
+		}
+
+		TaskGroup(const TaskGroup &) = delete;
+		TaskGroup &operator=(const TaskGroup &) = delete;
+
+		/**
+		 * @brief 提交子任务
+		 *
+		 * @param task 子任务
+		 */
+		void run(Task task)
+		{
+			m_state->pending.fetch_add(1);
+			{
+				std::lock_guard<std::mutex> locker(m_state->mutex);
+				m_state->tasks.push_back(std::move(task));
+				if (m_state->waiters)
+					m_state->cv.notify_all();
+			}
+
+			std::shared_ptr<State> state = m_state;
+			m_pool.post([state] {
+				Task task;
+				if (state->pop(task, true))
+					state->execute(task);
+			});
+		}
+
+		/**
+		 * @brief 等待全部子任务完成，等待期间执行组内或线程池中的任务
+		 *
+		 * @throw 第一个失败的子任务抛出的异常
+		 */
+		void wait()
+		{
+			State &s = *m_state;
+			Task task;
+
+			while (s.pending.load() > 0)
+			{
+				if (s.pop(task, false))
+				{
+					s.execute(task);
+					task = nullptr;
+					continue;
+				}
+
+				//组内已取空，剩下的正在其他线程执行，先帮线程池干活
+				if (m_pool.run_pending_task())
+					continue;
+
+				std::unique_lock<std::mutex> locker(s.mutex);
+				s.waiters++;
+				s.cv.wait(locker, [&s] { return s.pending.load() == 0 || !s.tasks.empty(); });
+				s.waiters--;
+			}
+
+			std::exception_ptr error;
+			{
+				std::lock_guard<std::mutex> locker(s.mutex);
+				std::swap(error, s.error);
+				s.failed = false;
+			}
+
+			if (error)
+				std::rethrow_exception(error);
+		}
+
+	private:
+		struct State
+		{
+			// front为true时取最早提交的
+			bool pop(Task &task, bool front)
+			{
+				std::lock_guard<std::mutex> locker(mutex);
+				if (tasks.empty())
+					return false;
+
+				if (front)
+				{
+					task = std::move(tasks.front());
+					tasks.pop_front();
+				}
+				else
+				{
+					task = std::move(tasks.back());
+					tasks.pop_back();
+				}
+				return true;
+			}
+
+			void execute(Task &task)
+			{
+				if (!failed.load())
+				{
+					try
+					{
+						task();
+					}
+					catch (...)
+					{
+						std::lock_guard<std::mutex> locker(mutex);
+						if (!error)
+							error = std::current_exception();
+						failed = true;
+					}
+				}
+
+				if (pending.fetch_sub(1) == 1)
+				{
+					std::lock_guard<std::mutex> locker(mutex);
+					cv.notify_all();
+				}
+			}
+
+			std::mutex mutex;
+			std::condition_variable cv;
+			std::deque<Task> tasks;			//尚未开始的子任务
+			std::atomic<size_t> pending{0}; //尚未完成的子任务
+			std::atomic_bool failed{false};
+			std::exception_ptr error;
+			int waiters = 0;
+		};
+
+		ThreadPool &m_pool;
+		std::shared_ptr<State> m_state;
+	};
+
+} // namespace wotsen
+
+#endif // !__wotsen_TASK_GROUP_H__
@@ -0,0 +1,678 @@
+/**
+ * @file task-queue.h
+ * @author yuwangliang (wotsen@outlook.com)
+ * @brief 分优先级的任务队列
+ * @version 0.1
+ * @date 2020-08-16
+ *
+ * @copyright Copyright (c) 2020 yuwangliang
+ *
+ */
+#ifndef __wotsen_TASK_QUEUE_H__
+#define __wotsen_TASK_QUEUE_H__
+
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <algorithm>
+#include <functional>
+#include <condition_variable>
+#include "lockfree-queue.h"
+#include "unique-task.h"
+
+namespace wotsen
+{
+
+	using TaskClock = std::chrono::steady_clock;
+
+	/**
+	 * @brief from之后timeout的时间点，超出时钟范围时取max，与wait_for一样不会因溢出变成过去的时间
+	 *
+	 * @param from 起始时间
+	 * @param timeout 时长
+	 * @return TaskClock::time_point 时间点
+	 */
+	inline TaskClock::time_point time_after(TaskClock::time_point from, TaskClock::duration timeout)
+	{
+		if (timeout > TaskClock::duration::zero() && timeout >= TaskClock::time_point::max() - from)
+			return TaskClock::time_point::max();
+		return from + timeout;
+	}
+
+	/**
+	 * @brief 任务优先级
+	 *
+	 */
+	enum class TaskPriority : int
+	{
+		High = 0,	//高优先级，延迟敏感
+		Normal,		//普通
+		Background, //后台批量任务
+	};
+
+	/**
+	 * @brief 队列中的任务项
+	 *
+	 */
+	struct TaskItem
+	{
+		UniqueTask task;				   //任务
+		TaskClock::time_point enqueue; //入队时间
+		TaskClock::time_point deadline; //截止时间，无截止时间为max
+		TaskClock::time_point expire;	//超过该时间仍未执行则丢弃，不超时为max
+		bool sheddable;					//过载时可以在出队时丢弃
+	};
+
+	/**
+	 * @brief 分优先级任务队列
+	 * @details 高、普通、后台各一个无锁队列，带截止时间的任务按最早截止时间优先(EDF)
+	 *          单独排序。出队顺序为 高 > 截止时间 > 普通 > 后台，某一级别超过老化时间
+	 *          未被调度时优先调度该级别，防止饥饿。
+	 *          阻塞/唤醒只在队列空或满时才使用互斥量。
+	 *          分片数大于1时，上述队列与计数每个分片一份，各自独占缓存行：提交者按线程哈希
+	 *          (或home_shard())选择分片，分片满时依次尝试其他分片；取任务时先取本线程的分片，
+	 *          取空后按steal_order()(未设置时按编号)依次从其他分片取。优先级与截止时间只在分片内部保证
+	 */
+	class TaskQueue
+	{
+	public:
+		/**
+		 * @brief Construct a new Task Queue object
+		 *
+		 * @param maxSize 队列最大任务数，分片时平分到各分片，除不尽的余数分给编号小的分片
+		 * @param aging 老化时间，低级别等待超过该时间后提升调度
+		 * @param shards 分片数
+		 */
+		TaskQueue(int maxSize, TaskClock::duration aging = std::chrono::milliseconds(20), int shards = 1)
+			: m_maxSize(maxSize), m_aging(aging.count()), m_needStop(false), m_closed(false)
+		{
+			if (shards < 1)
+				shards = 1;
+			if (shards > maxSize)
+				shards = maxSize > 0 ? maxSize : 1;
+
+			for (int i = 0; i < shards; ++i)
+				m_shards.emplace_back(new Shard(maxSize / shards + (i < maxSize % shards ? 1 : 0)));
+
+			m_takeWaiters.store(0, std::memory_order_relaxed);
+			m_putWaiters.store(0, std::memory_order_relaxed);
+		}
+
+		/**
+		 * @brief 按优先级入队，队列满时阻塞
+		 *
+		 * @param item 任务
+		 * @param priority 优先级
+		 * @return true 成功
+		 * @return false 队列已停止
+		 */
+		bool put(TaskItem &&item, TaskPriority priority)
+		{
+			Shard *shard = reserve(true);
+			if (!shard)
+				return false;
+
+			push(*shard, item, to_level(priority));
+			return true;
+		}
+
+		/**
+		 * @brief 按优先级入队，队列满时立即返回
+		 *
+		 * @param item 任务，失败时保持不变
+		 * @param priority 优先级
+		 * @return true 成功
+		 * @return false 队列满或已停止
+		 */
+		bool try_put(TaskItem &item, TaskPriority priority)
+		{
+			Shard *shard = reserve(false);
+			if (!shard)
+				return false;
+
+			push(*shard, item, to_level(priority));
+			return true;
+		}
+
+		/**
+		 * @brief 按截止时间入队，队列满时阻塞
+		 *
+		 * @param item 任务，deadline有效
+		 * @return true 成功
+		 * @return false 队列已停止
+		 */
+		bool put_deadline(TaskItem &&item)
+		{
+			Shard *shard = reserve(true);
+			if (!shard)
+				return false;
+
+			push(*shard, item, LevelDeadline);
+			return true;
+		}
+
+		/**
+		 * @brief 按截止时间入队，队列满时立即返回
+		 *
+		 * @param item 任务，deadline有效，失败时保持不变
+		 * @return true 成功
+		 * @return false 队列满或已停止
+		 */
+		bool try_put_deadline(TaskItem &item)
+		{
+			Shard *shard = reserve(false);
+			if (!shard)
+				return false;
+
+			push(*shard, item, LevelDeadline);
+			return true;
+		}
+
+		/**
+		 * @brief 取任务，队列空时阻塞
+		 *
+		 * @param item[out] 任务
+		 * @return true 成功
+		 * @return false 队列已停止
+		 */
+		bool take(TaskItem &item)
+		{
+			return take(item, TaskClock::duration::max());
+		}
+
+		/**
+		 * @brief 取任务，队列空时立即返回
+		 *
+		 * @param item[out] 任务
+		 * @param stolen[out] 非空时写入任务是否取自其他分片
+		 * @return true 成功
+		 * @return false 队列空或已停止
+		 */
+		bool try_take(TaskItem &item, bool *stolen = nullptr)
+		{
+			if (m_needStop.load())
+				return false;
+
+			Shard *shard = claim(stolen);
+			if (!shard)
+				return false;
+
+			pop_any(*shard, item);
+			release(*shard);
+			return true;
+		}
+
+		/**
+		 * @brief 取任务，队列空时最多等待timeout
+		 *
+		 * @param item[out] 任务
+		 * @param timeout 等待时间
+		 * @param stolen[out] 非空时写入任务是否取自其他分片
+		 * @return true 成功
+		 * @return false 超时、队列已停止或已关闭且取空，用finished()区分
+		 */
+		bool take(TaskItem &item, TaskClock::duration timeout, bool *stolen = nullptr)
+		{
+			bool forever = timeout == TaskClock::duration::max();
+			TaskClock::time_point until = forever ? TaskClock::time_point::max() : time_after(TaskClock::now(), timeout);
+			forever = until == TaskClock::time_point::max(); //很大的超时同样视为一直等待
+
+			for (;;)
+			{
+				if (m_needStop.load())
+					return false;
+
+				if (Shard *shard = claim(stolen))
+				{
+					pop_any(*shard, item);
+					release(*shard);
+					return true;
+				}
+
+				if (finished())
+					return false;
+
+				std::unique_lock<std::mutex> locker(m_mutex);
+				auto ready = [this] { return finished() || size() > 0; };
+				m_takeWaiters.fetch_add(1);
+				if (forever)
+				{
+					m_notEmpty.wait(locker, ready);
+				}
+				else if (!m_notEmpty.wait_until(locker, until, ready))
+				{
+					m_takeWaiters.fetch_sub(1);
+					return false;
+				}
+				m_takeWaiters.fetch_sub(1);
+			}
+		}
+
+		void stop()
+		{
+			{
+				std::lock_guard<std::mutex> locker(m_mutex);
+				m_needStop = true;
+			}
+			m_notFull.notify_all();
+			m_notEmpty.notify_all();
+		}
+
+		/**
+		 * @brief 关闭队列，不再接受新任务，已有任务仍可取出，取空后take返回false
+		 *
+		 */
+		void close()
+		{
+			{
+				std::lock_guard<std::mutex> locker(m_mutex);
+				m_closed = true;
+			}
+			m_notFull.notify_all();
+			m_notEmpty.notify_all();
+		}
+
+		/**
+		 * @brief 丢弃队列中的全部任务，任务对象随之析构
+		 *
+		 * @return size_t 丢弃的任务数
+		 */
+		size_t discard()
+		{
+			TaskItem item;
+			size_t n = 0;
+
+			while (Shard *shard = claim())
+			{
+				pop_any(*shard, item);
+				release(*shard);
+				item.task = nullptr;
+				n++;
+			}
+
+			return n;
+		}
+
+		bool stopped() const
+		{
+			return m_needStop.load();
+		}
+
+		// 已停止或已关闭，不再接受新任务
+		bool closed() const
+		{
+			return m_needStop.load() || m_closed.load();
+		}
+
+		// 已停止，或已关闭且全部任务都已取出
+		bool finished() const
+		{
+			return m_needStop.load() || (m_closed.load() && reserved() == 0);
+		}
+
+		size_t capacity() const
+		{
+			return (size_t)m_maxSize;
+		}
+
+		bool empty() const
+		{
+			return size() == 0;
+		}
+
+		size_t size() const
+		{
+			size_t n = 0;
+			for (auto &shard : m_shards)
+				n += shard->items.value.load();
+			return n;
+		}
+
+		size_t size(TaskPriority priority) const
+		{
+			size_t n = 0;
+			for (auto &shard : m_shards)
+				n += shard->count[to_level(priority)].value.load(std::memory_order_relaxed);
+			return n;
+		}
+
+		size_t shard_count() const
+		{
+			return m_shards.size();
+		}
+
+		/**
+		 * @brief 当前线程优先使用的分片编号，对分片数取模
+		 * @details 默认为线程ID的哈希；线程池的工作线程设为自己的编号，
+		 *          使工作线程提交的任务留在自己的分片，相邻编号的线程互为后备
+		 *
+		 */
+		static size_t &home_shard()
+		{
+			static thread_local size_t home = std::hash<std::thread::id>()(std::this_thread::get_id());
+			return home;
+		}
+
+		/**
+		 * @brief 当前线程取空自己的分片后，依次尝试的其他分片编号
+		 * @details 默认为空，按编号依次；线程池的工作线程按CPU拓扑距离由近到远设置
+		 *
+		 */
+		static std::vector<size_t> &steal_order()
+		{
+			static thread_local std::vector<size_t> order;
+			return order;
+		}
+
+	private:
+		enum
+		{
+			LevelHigh = 0,
+			LevelDeadline,
+			LevelNormal,
+			LevelBackground,
+			LevelCount,
+		};
+
+		// 独占缓存行的计数，避免伪共享
+		struct Counter
+		{
+			std::atomic<size_t> value;
+			char pad[CacheLineSize - sizeof(std::atomic<size_t>)];
+		};
+
+		struct Stamp
+		{
+			std::atomic<int64_t> value;
+			char pad[CacheLineSize - sizeof(std::atomic<int64_t>)];
+		};
+
+		// 一个分片：各级别队列与计数
+		struct Shard
+		{
+			explicit Shard(int maxSize) : limit(maxSize)
+			{
+				for (int level = 0; level < LevelCount; ++level)
+				{
+					if (level != LevelDeadline)
+						fifo[level].reset(new LockFreeQueue<TaskItem>(maxSize));
+					count[level].value.store(0, std::memory_order_relaxed);
+					lastServe[level].value.store(0, std::memory_order_relaxed);
+				}
+				slots.value.store(0, std::memory_order_relaxed);
+				items.value.store(0, std::memory_order_relaxed);
+			}
+
+			int limit;												   //分片最大任务数
+			std::unique_ptr<LockFreeQueue<TaskItem>> fifo[LevelCount]; //各优先级无锁队列
+			std::vector<TaskItem> deadline;							   //截止时间小顶堆
+			std::mutex deadlineMutex;								   //截止时间堆互斥量
+
+			char pad[CacheLineSize];
+			Counter count[LevelCount];  //各级别任务数
+			Stamp lastServe[LevelCount]; //各级别最近一次被调度的时间
+			Counter slots;			   //已预留的空位
+			Counter items;			   //已发布未取出的任务
+		};
+
+		static int to_level(TaskPriority priority)
+		{
+			switch (priority)
+			{
+			case TaskPriority::High:
+				return LevelHigh;
+			case TaskPriority::Background:
+				return LevelBackground;
+			default:
+				return LevelNormal;
+			}
+		}
+
+		static bool later_deadline(const TaskItem &a, const TaskItem &b)
+		{
+			return a.deadline > b.deadline;
+		}
+
+		static int64_t now_ticks()
+		{
+			return TaskClock::now().time_since_epoch().count();
+		}
+
+		size_t home() const
+		{
+			return home_shard() % m_shards.size();
+		}
+
+		// 全部分片已预留的空位
+		size_t reserved() const
+		{
+			size_t n = 0;
+			for (auto &shard : m_shards)
+				n += shard->slots.value.load();
+			return n;
+		}
+
+		// 在分片中预留一个空位
+		bool try_reserve(Shard &shard)
+		{
+			size_t n = shard.slots.value.load();
+			while (n < (size_t)shard.limit)
+			{
+				if (shard.slots.value.compare_exchange_weak(n, n + 1))
+					return true;
+			}
+			return false;
+		}
+
+		// 预留一个空位，先本线程的分片，再依次其他分片；全部满时按block决定是否阻塞
+		Shard *reserve(bool block)
+		{
+			size_t first = home();
+			for (;;)
+			{
+				if (closed())
+					return nullptr;
+
+				for (size_t i = 0; i < m_shards.size(); ++i)
+				{
+					Shard &shard = *m_shards[(first + i) % m_shards.size()];
+					if (try_reserve(shard))
+						return &shard;
+				}
+
+				if (!block)
+					return nullptr;
+
+				std::unique_lock<std::mutex> locker(m_mutex);
+				m_putWaiters.fetch_add(1);
+				m_notFull.wait(locker, [this] { return closed() || reserved() < capacity(); });
+				m_putWaiters.fetch_sub(1);
+			}
+		}
+
+		// 写入已预留空位并发布
+		void push(Shard &shard, TaskItem &item, int level)
+		{
+			if (level == LevelDeadline)
+			{
+				std::lock_guard<std::mutex> locker(shard.deadlineMutex);
+				shard.deadline.push_back(std::move(item));
+				std::push_heap(shard.deadline.begin(), shard.deadline.end(), later_deadline);
+			}
+			else
+			{
+				while (!shard.fifo[level]->try_push(std::move(item)))
+				{
+					//预留了空位则环形缓冲必有空槽，这里只等待出队方写回槽位序号
+					std::this_thread::yield();
+				}
+			}
+
+			publish(shard, level);
+
+			//与stop()并发时，stop()之后才发布的任务由发布者自己丢弃
+			if (m_needStop.load())
+				discard();
+		}
+
+		// 发布一个任务，有等待者时唤醒一个
+		void publish(Shard &shard, int level)
+		{
+			if (shard.count[level].value.fetch_add(1) == 0)
+			{
+				//由空变为非空，重新开始计算老化时间
+				shard.lastServe[level].value.store(now_ticks(), std::memory_order_relaxed);
+			}
+
+			shard.items.value.fetch_add(1);
+			if (m_takeWaiters.load() > 0)
+			{
+				std::lock_guard<std::mutex> locker(m_mutex);
+				m_notEmpty.notify_one();
+			}
+		}
+
+		// 在分片中占有一个已发布的任务
+		static bool try_claim(Shard &shard)
+		{
+			size_t n = shard.items.value.load();
+			while (n > 0)
+			{
+				if (shard.items.value.compare_exchange_weak(n, n - 1))
+					return true;
+			}
+			return false;
+		}
+
+		// 占有一个已发布的任务，先本线程的分片，再按steal_order()或编号依次其他分片
+		Shard *claim(bool *stolen = nullptr)
+		{
+			size_t first = home();
+			Shard *shard = m_shards[first].get();
+			bool other = false;
+
+			if (!try_claim(*shard))
+			{
+				shard = nullptr;
+				other = true;
+
+				const std::vector<size_t> &order = steal_order();
+				for (size_t i = 0; i < order.size() && !shard; ++i)
+				{
+					size_t index = order[i] % m_shards.size();
+					if (index != first && try_claim(*m_shards[index]))
+						shard = m_shards[index].get();
+				}
+
+				//未设置顺序时按编号依次
+				for (size_t i = 1; i < m_shards.size() && order.empty() && !shard; ++i)
+				{
+					Shard &next = *m_shards[(first + i) % m_shards.size()];
+					if (try_claim(next))
+						shard = &next;
+				}
+			}
+
+			if (shard && stolen)
+				*stolen = other;
+			return shard;
+		}
+
+		// 归还空位
+		void release(Shard &shard)
+		{
+			shard.slots.value.fetch_sub(1);
+			if (m_putWaiters.load() > 0)
+			{
+				std::lock_guard<std::mutex> locker(m_mutex);
+				m_notFull.notify_one();
+			}
+
+			if (m_closed.load() && reserved() == 0)
+			{
+				//已关闭的队列取空，唤醒全部等待者退出
+				std::lock_guard<std::mutex> locker(m_mutex);
+				m_notEmpty.notify_all();
+			}
+		}
+
+		bool pop_level(Shard &shard, int level, TaskItem &item)
+		{
+			if (shard.count[level].value.load(std::memory_order_relaxed) == 0)
+				return false;
+
+			if (level == LevelDeadline)
+			{
+				std::lock_guard<std::mutex> locker(shard.deadlineMutex);
+				if (shard.deadline.empty())
+					return false;
+				std::pop_heap(shard.deadline.begin(), shard.deadline.end(), later_deadline);
+				item = std::move(shard.deadline.back());
+				shard.deadline.pop_back();
+			}
+			else if (!shard.fifo[level]->try_pop(item))
+			{
+				return false;
+			}
+
+			shard.count[level].value.fetch_sub(1);
+			return true;
+		}
+
+		// 按优先级与老化规则从分片取出一个任务，调用前已经占有了该分片的一个任务
+		void pop_any(Shard &shard, TaskItem &item)
+		{
+			int64_t now = now_ticks();
+			int starved = -1;
+			int64_t oldest = now - m_aging;
+
+			for (int level = LevelDeadline; level < LevelCount; ++level)
+			{
+				int64_t last = shard.lastServe[level].value.load(std::memory_order_relaxed);
+				if (last < oldest && shard.count[level].value.load(std::memory_order_relaxed) > 0)
+				{
+					starved = level;
+					oldest = last;
+				}
+			}
+
+			if (starved >= 0 && pop_level(shard, starved, item))
+			{
+				shard.lastServe[starved].value.store(now, std::memory_order_relaxed);
+				return;
+			}
+
+			for (;;)
+			{
+				for (int level = LevelHigh; level < LevelCount; ++level)
+				{
+					if (pop_level(shard, level, item))
+					{
+						shard.lastServe[level].value.store(now, std::memory_order_relaxed);
+						return;
+					}
+				}
+			}
+		}
+
+	private:
+		std::vector<std::unique_ptr<Shard>> m_shards; //分片
+
+		std::mutex m_mutex;					//只在阻塞等待时使用
+		std::condition_variable m_notEmpty; //不为空的条件变量
+		std::condition_variable m_notFull;	//没有满的条件变量
+		std::atomic<int> m_takeWaiters;		//等待任务的线程数
+		std::atomic<int> m_putWaiters;		//等待空位的线程数
+
+		int m_maxSize;		  //队列最大任务数
+		int64_t m_aging;	  //老化时间
+		std::atomic_bool m_needStop; //停止的标志
+		std::atomic_bool m_closed;	 //关闭的标志，关闭后取空即结束
+	};
+
+} // namespace wotsen
+
+#endif // !__wotsen_TASK_QUEUE_H__
@@ -1,7 +1,127 @@
+#include <iostream>
+#include <sstream>
+#include <fcntl.h>
 #include "thread-pool.h"
+#include "task-graph.h"
+#include "task-group.h"
+#include "reactor.h"
+#include "strand.h"
+#include "sync-queue.h"
+#include "spsc-queue.h"
+#include "mpsc-queue.h"
 
 using namespace wotsen;
 
+// 条件在timeout内成立时返回true
+template <typename F>
+static bool wait_until(F f, std::chrono::milliseconds timeout = std::chrono::milliseconds(2000))
+{
+	auto end = std::chrono::steady_clock::now() + timeout;
+	while (!f())
+	{
+		if (std::chrono::steady_clock::now() > end)
+			return false;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return true;
+}
+
+// 最小的JSON语法检查，只用于验证导出的trace
+static bool json_value(const std::string &s, size_t &i);
+
+static void json_space(const std::string &s, size_t &i)
+{
+	while (i < s.size() && isspace((unsigned char)s[i]))
+		i++;
+}
+
+static bool json_string(const std::string &s, size_t &i)
+{
+	if (s[i++] != '"')
+		return false;
+	while (i < s.size() && s[i] != '"')
+		i += s[i] == '\\' ? 2 : 1;
+	return i++ < s.size();
+}
+
+static bool json_list(const std::string &s, size_t &i, char close, bool object)
+{
+	i++;
+	json_space(s, i);
+	if (i < s.size() && s[i] == close)
+		return ++i, true;
+	for (;;)
+	{
+		json_space(s, i);
+		if (object)
+		{
+			if (i >= s.size() || !json_string(s, i))
+				return false;
+			json_space(s, i);
+			if (i >= s.size() || s[i++] != ':')
+				return false;
+		}
+		if (!json_value(s, i))
+			return false;
+		json_space(s, i);
+		if (i >= s.size())
+			return false;
+		if (s[i] == close)
+			return ++i, true;
+		if (s[i++] != ',')
+			return false;
+	}
+}
+
+static bool json_value(const std::string &s, size_t &i)
+{
+	json_space(s, i);
+	if (i >= s.size())
+		return false;
+	if (s[i] == '{')
+		return json_list(s, i, '}', true);
+	if (s[i] == '[')
+		return json_list(s, i, ']', false);
+	if (s[i] == '"')
+		return json_string(s, i);
+
+	size_t begin = i;
+	if (s[i] == '-')
+		i++;
+	while (i < s.size() && (isdigit((unsigned char)s[i]) || s[i] == '.' || s[i] == 'e' || s[i] == 'E' || s[i] == '+' || s[i] == '-'))
+		i++;
+	return i > begin && isdigit((unsigned char)s[i - 1]);
+}
+
+static bool json_valid(const std::string &s)
+{
+	size_t i = 0;
+	if (!json_value(s, i))
+		return false;
+	json_space(s, i);
+	return i == s.size();
+}
+
+// 单线程的线程池：唯一的线程阻塞在gate上，队列填满
+static std::unique_ptr<ThreadPool> full_pool(BackpressurePolicy policy, std::shared_future<void> gate)
+{
+	ThreadPoolOptions options;
+	options.min_threads = options.max_threads = 1;
+	options.max_tasks = 2;
+	options.backpressure = policy;
+	std::unique_ptr<ThreadPool> pool(new ThreadPool(options));
+
+	std::atomic<bool> started(false);
+	pool->post([gate, &started] {
+		started = true;
+		gate.wait();
+	});
+	wait_until([&started] { return started.load(); });
+	while (pool->try_add_task([gate] { gate.wait(); }).valid())
+		;
+	return pool;
+}
+
 int main(void)
 {
 	ThreadPool pool;
@@ -13,7 +133,425 @@ int main(void)
 
 	std::cout << "back" << ret.get() << std::endl;
 
+	auto high = pool.add_priority_task(TaskPriority::High, [] { return 1; });
+	auto low = pool.add_priority_task(TaskPriority::Background, [] { return 2; });
+	auto edf = pool.add_deadline_task(TaskClock::now() + std::chrono::milliseconds(10), [] { return 3; });
+
+	std::cout << "priority " << high.get() << low.get() << edf.get() << std::endl;
+
+	// 与std::bind一致，保存的参数按左值传给左值引用形参
+	int counter = 0;
+	auto inc = pool.add_task([](int &v) { return ++v; }, counter);
+	auto ref = pool.add_task([](int &v) { return ++v; }, std::ref(counter));
+	std::cout << "lvalue args " << inc.get() << ref.get() << counter << std::endl;
+
+	// 很大的排队超时不会溢出成过去的时间而被丢弃
+	auto patient = pool.add_timeout_task(TaskClock::duration::max(), [] { return 6; });
+	auto almost = pool.add_timeout_task(TaskClock::duration::max() - std::chrono::seconds(1), [] { return 7; });
+	std::cout << "timeout " << patient.get() << almost.get() << std::endl;
+
+	// 快速失败的提交，被拒绝时未来值无效
+	auto fast = pool.try_add_task([] { return 5; });
+	std::cout << "try_add_task " << (fast.valid() ? fast.get() : -1) << std::endl;
+
+	auto chain = async_task(pool, [] { return 1; }).then([](const int &v) { return v + 1; });
+	auto all = when_all(std::vector<AsyncFuture<int>>{chain, async_task(pool, [] { return 3; })});
+	std::cout << "then " << chain.get() << " when_all " << all.get().size() << std::endl;
+
+	// Reject策略的线程池队列满时，后续回调在写入结果的线程中执行，TaskRejected不会抛给写入方
+	{
+		ThreadPoolOptions options;
+		options.min_threads = options.max_threads = 1;
+		options.max_tasks = 4;
+		options.backpressure = BackpressurePolicy::Reject;
+		ThreadPool full(options);
+
+		std::promise<void> release;
+		std::shared_future<void> gate = release.get_future().share();
+		while (full.try_add_task([gate] { gate.wait(); }).valid())
+			;
+
+		AsyncPromise<int> promise(&full);
+		auto next = promise.get_future().then([](const int &v) { return v + 1; });
+		promise.set_value(1);
+		std::cout << "full pool then " << next.get() << std::endl;
+
+		// 任务图的节点同样在提交线程中执行，run()不抛出，未来值完成
+		TaskGraph full_graph;
+		int steps = 0;
+		auto first = full_graph.add([&steps] { steps++; });
+		full_graph.add([&steps] { steps++; }, {first});
+		full_graph.run(full).get();
+		std::cout << "full pool graph " << steps << std::endl;
+
+		// 线程池拒绝执行者时在投递者线程中执行，Strand不会卡住
+		Strand serial(full);
+		int serial_runs = 0;
+		serial.post([&serial_runs] { serial_runs++; });
+		serial.post([&serial_runs] { serial_runs++; });
+		std::cout << "full pool strand " << serial_runs << std::endl;
+
+		// 到期的定时任务不抛出也不在时间轮线程中执行，队列有空位后再投递
+		std::promise<std::thread::id> fired;
+		full.schedule_after(std::chrono::milliseconds(1), [&fired] { fired.set_value(std::this_thread::get_id()); });
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		release.set_value();
+		std::thread::id ran = fired.get_future().get();
+		std::cout << "full pool timer " << (ran != std::this_thread::get_id()) << std::endl;
+	}
+
+	// 分片后容量与配置一致，余数分给编号小的分片
+	{
+		TaskQueue queue(100, std::chrono::milliseconds(20), 8);
+		TaskItem item;
+		size_t n = 0;
+		while (queue.try_put(item, TaskPriority::Normal))
+			n++;
+		std::cout << "sharded capacity " << queue.capacity() << " " << n << std::endl;
+	}
+
+	// 同一个键的任务按投递顺序逐个执行，抛出异常的任务不影响后续任务
+	{
+		const int keys = 4, each = 1000;
+		KeyedStrands<int> strands(pool);
+		std::vector<std::vector<int>> order(keys);
+		std::vector<std::unique_ptr<std::atomic<int>>> active;
+		std::atomic<int> overlap(0), done(0);
+		for (int key = 0; key < keys; ++key)
+			active.emplace_back(new std::atomic<int>(0));
+
+		for (int i = 0; i < each; ++i)
+		{
+			for (int key = 0; key < keys; ++key)
+			{
+				strands.post(key, [&order, &active, &overlap, &done, key, i] {
+					if (active[key]->fetch_add(1) != 0)
+						overlap++;
+					order[key].push_back(i);
+					active[key]->fetch_sub(1);
+					done++;
+					if (i == each / 2)
+						throw std::runtime_error("strand task");
+				});
+			}
+		}
+
+		while (done.load() < keys * each)
+			std::this_thread::yield();
+
+		bool ordered = true;
+		for (auto &v : order)
+			ordered = ordered && v.size() == (size_t)each && std::is_sorted(v.begin(), v.end());
+		std::cout << "strand ordered " << ordered << " overlap " << overlap << std::endl;
+	}
+
+	// 同步队列停止后take返回false，不修改输出参数
+	{
+		SyncQueue<int> queue(4);
+		queue.put(1);
+		int v = 0;
+		bool first = queue.take(v);
+		std::thread stopper([&queue] {
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			queue.stop();
+		});
+		int untouched = -1;
+		bool second = queue.take(untouched);
+		stopper.join();
+		std::cout << "sync queue take " << first << v << " after stop " << second << untouched << std::endl;
+	}
+
+	// 单生产者队列容量很小时仍按顺序送达
+	{
+		const int count = 100000;
+		SpscQueue<int> queue(8);
+		std::thread producer([&queue] {
+			for (int i = 0; i < count; ++i)
+				queue.put(i);
+		});
+		bool ordered = true;
+		for (int i = 0; i < count; ++i)
+		{
+			int v = -1;
+			ordered = queue.take(v) && v == i && ordered;
+		}
+		producer.join();
+		std::cout << "spsc ordered " << ordered << std::endl;
+	}
+
+	// 多生产者：每个生产者的数据按各自顺序送达，总数不丢
+	{
+		const int producers = 4, count = 20000;
+		MpscQueue<int> queue(16);
+		std::vector<std::thread> threads;
+		for (int p = 0; p < producers; ++p)
+		{
+			threads.emplace_back([&queue, p] {
+				for (int i = 0; i < count; ++i)
+					queue.put(p * count + i);
+			});
+		}
+		std::vector<int> last(producers, -1);
+		bool ordered = true;
+		for (int i = 0; i < producers * count; ++i)
+		{
+			int v = -1;
+			ordered = queue.take(v) && ordered;
+			ordered = v % count > last[v / count] && ordered;
+			last[v / count] = v % count;
+		}
+		for (auto &t : threads)
+			t.join();
+		std::cout << "mpsc ordered " << ordered << std::endl;
+	}
+
+	// 停止后阻塞在空队列上的消费者与满队列上的生产者都返回
+	{
+		SpscQueue<int> spsc(1);
+		MpscQueue<int> mpsc(1);
+		mpsc.put(0);
+		bool spscTaken = true;
+		std::thread consumer([&spsc, &spscTaken] {
+			int v = 0;
+			spscTaken = spsc.take(v);
+		});
+		std::thread producer([&mpsc] { mpsc.put(1); });
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		spsc.stop();
+		mpsc.stop();
+		consumer.join();
+		producer.join();
+		int v = 0;
+		std::cout << "queues stopped " << spscTaken << mpsc.take(v) << std::endl;
+	}
+
+	// 积压时线程增长到max_threads，空闲超过idle_timeout后退回min_threads
+	{
+		ThreadPoolOptions options;
+		options.min_threads = 1;
+		options.max_threads = 4;
+		options.idle_timeout = std::chrono::milliseconds(20);
+		ThreadPool elastic(options);
+
+		std::promise<void> release;
+		std::shared_future<void> gate = release.get_future().share();
+		std::vector<std::future<void>> held;
+		for (int i = 0; i < 8; ++i)
+			held.push_back(elastic.add_task([gate] { gate.wait(); }));
+
+		bool grown = wait_until([&elastic] { return elastic.thread_count() == 4; });
+		release.set_value();
+		for (auto &f : held)
+			f.get();
+		bool retired = wait_until([&elastic] { return elastic.thread_count() == 1; });
+		std::cout << "elastic grown " << grown << " retired " << retired << std::endl;
+	}
+
+	// 队列满时的三种策略
+	{
+		std::promise<void> release;
+		std::shared_future<void> gate = release.get_future().share();
+
+		// Block：提交者等到有空位
+		auto block = full_pool(BackpressurePolicy::Block, gate);
+		std::atomic<bool> submitted(false);
+		std::thread submitter([&block, &submitted] {
+			block->add_task([] {});
+			submitted = true;
+		});
+		bool waited = !wait_until([&submitted] { return submitted.load(); }, std::chrono::milliseconds(20));
+
+		// Reject：抛出TaskRejected
+		auto reject = full_pool(BackpressurePolicy::Reject, gate);
+		bool rejected = false;
+		try
+		{
+			reject->add_task([] {});
+		}
+		catch (const TaskRejected &)
+		{
+			rejected = true;
+		}
+
+		// CallerRuns：在提交者线程执行
+		auto caller = full_pool(BackpressurePolicy::CallerRuns, gate);
+		std::thread::id ran = caller->add_task([] { return std::this_thread::get_id(); }).get();
+
+		release.set_value();
+		submitter.join();
+		std::cout << "backpressure block " << (waited && submitted) << " reject " << rejected
+				  << " caller runs " << (ran == std::this_thread::get_id()) << std::endl;
+	}
+
+	// 导出的时间线是合法的Chrome trace JSON，真实量级的时间戳不丢精度
+	{
+		PoolTrace trace(3);
+		trace.start_recording();
+		int64_t now = PoolTrace::now();
+		trace.on_task(0, now, now + 1000, now + 5000);
+		trace.on_task(0, now, now + 6000, now + 6500);
+		trace.on_task(2, now, now + 7000, now + 9000);
+
+		std::ostringstream out;
+		trace.export_chrome_trace(out);
+		std::string json = out.str();
+
+		size_t tasks = 0;
+		for (size_t pos = 0; (pos = json.find("\"ph\":\"X\"", pos)) != std::string::npos; ++pos)
+			tasks++;
+		std::ostringstream second;
+		second << "\"ts\":" << (now + 6000) / 1000 << '.' << (now + 6000) % 1000 / 100;
+		std::cout << "chrome trace valid " << json_valid(json) << " tasks " << tasks
+				  << " exact ts " << (json.find(second.str()) != std::string::npos) << std::endl;
+	}
+
+	// shutdown()执行完排队的任务；shutdown_now()丢弃未开始的任务并返回丢弃数
+	{
+		ThreadPoolOptions options;
+		options.min_threads = options.max_threads = 1;
+
+		ThreadPool graceful(options);
+		std::atomic<int> ran(0);
+		for (int i = 0; i < 10; ++i)
+			graceful.post([&ran] {
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				ran++;
+			});
+		bool drained = graceful.shutdown();
+		std::cout << "shutdown drained " << drained << " ran " << ran << std::endl;
+
+		std::promise<void> release;
+		std::shared_future<void> gate = release.get_future().share();
+		ThreadPool abrupt(options);
+		std::atomic<bool> started(false);
+		abrupt.post([gate, &started] {
+			started = true;
+			gate.wait();
+		});
+		wait_until([&started] { return started.load(); });
+
+		std::vector<std::future<int>> queued;
+		for (int i = 0; i < 5; ++i)
+			queued.push_back(abrupt.add_task([] { return 1; }));
+
+		// shutdown_now()等待正在执行的任务结束
+		std::thread releaser([&release] {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			release.set_value();
+		});
+		size_t discarded = abrupt.shutdown_now();
+		releaser.join();
+
+		int broken = 0;
+		for (auto &f : queued)
+		{
+			try
+			{
+				f.get();
+			}
+			catch (const std::future_error &e)
+			{
+				broken += e.code() == std::future_errc::broken_promise;
+			}
+		}
+		std::cout << "shutdown_now discarded " << discarded << " broken " << broken << std::endl;
+	}
+
+	// 开始执行前令牌已取消的任务不执行，未来值得到TaskCancelled
+	{
+		ThreadPoolOptions options;
+		options.min_threads = options.max_threads = 1;
+		ThreadPool serial(options);
+
+		std::promise<void> release;
+		std::shared_future<void> gate = release.get_future().share();
+		serial.post([gate] { gate.wait(); });
+
+		CancellationSource source;
+		std::atomic<bool> ran(false);
+		auto cancelled = serial.add_cancellable_task(source.token(), [&ran] { ran = true; });
+		source.cancel();
+		release.set_value();
+
+		bool skipped = false;
+		try
+		{
+			cancelled.get();
+		}
+		catch (const TaskCancelled &)
+		{
+			skipped = true;
+		}
+		std::cout << "cancelled skipped " << (skipped && !ran) << std::endl;
+	}
+
+	TaskGraph graph;
+	auto a = graph.add([] { std::cout << "graph a" << std::endl; });
+	auto b = graph.add([] { std::cout << "graph b" << std::endl; }, {a});
+	graph.add([] { std::cout << "graph c" << std::endl; }, {a, b});
+	graph.run(pool).get();
+
+	std::atomic<int> ticks(0);
+	auto every = pool.schedule_every(std::chrono::milliseconds(5), [&ticks] { ticks++; });
+	auto never = pool.schedule_after(std::chrono::seconds(1), [] { std::cout << "cancelled timer fired" << std::endl; });
+	pool.cancel_timer(never);
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	pool.cancel_timer(every);
+	std::cout << "periodic " << (ticks > 0) << std::endl;
+
+	// 递归分治，wait()期间执行子任务而不是阻塞工作线程
+	std::function<long(int, int)> sum = [&pool, &sum](int first, int last) -> long {
+		if (last - first <= 1000)
+			return (long)(first + last - 1) * (last - first) / 2;
+		long left = 0;
+		TaskGroup group(pool);
+		group.run([&] { left = sum(first, (first + last) / 2); });
+		long right = sum((first + last) / 2, last);
+		group.wait();
+		return left + right;
+	};
+	std::cout << "task group " << sum(0, 1000000) << std::endl;
+
+	// 管道可读时由线程池执行回调，工作线程不阻塞在read上
+	{
+		int fds[2];
+		if (pipe2(fds, O_NONBLOCK) == 0)
+		{
+			AsyncPromise<std::string> got;
+			Reactor reactor(pool);
+			reactor.add(fds[0], [&got](int fd) {
+				char buf[64];
+				ssize_t n = read(fd, buf, sizeof(buf));
+				if (n > 0)
+					got.set_value(std::string(buf, (size_t)n));
+			}, nullptr, TriggerMode::Edge);
+
+			ssize_t ret = write(fds[1], "ping", 4);
+			(void)ret;
+			std::cout << "reactor " << got.get_future().get() << std::endl;
+			reactor.remove(fds[0]);
+			close(fds[0]);
+			close(fds[1]);
+		}
+	}
+
 	pool.stop();
 
+	// 单路机器上用模拟的2节点拓扑验证分组
+	ThreadPoolOptions options;
+	options.min_threads = options.max_threads = 8;
+	options.affinity = AffinityPolicy::PerL3;
+	options.topology = std::make_shared<CpuTopology>(CpuTopology::simulate(2, 2, 4, 2));
+	ThreadPool numa(options);
+
+	for (size_t i = 0; i < numa.placement().size(); ++i)
+	{
+		std::cout << "l3 " << numa.placement()[i].domain << " cpus " << numa.placement()[i].cpus.size() << " steal:";
+		for (auto v : options.topology->steal_order(numa.placement(), i))
+			std::cout << " " << numa.placement()[v].domain;
+		std::cout << std::endl;
+	}
+	std::cout << "numa " << numa.add_task([] { return 4; }).get() << std::endl;
+
 	return 0;
 }
@@ -12,32 +12,99 @@
 #define __wotsen_THREAD_POLL_H__
 
 #include <list>
+#include <algorithm>
 #include <thread>
 #include <functional>
 #include <future>
 #include <memory>
 #include <atomic>
-#include "sync-queue.h"
+#include <stdexcept>
+#include "task-queue.h"
+#include "cpu-topology.h"
+#include "pool-trace.h"
+#include "timer-wheel.h"
+#include "cancellation.h"
+#include "admission.h"
 
 namespace wotsen
 {
 
-	// 可调用对象返回类型
+	// 可调用对象返回类型，保留旧名称兼容，新代码使用invoke_result_t
 	template <typename F, typename... Args>
-	using callable_ret_type = typename std::result_of<F(Args...)>::type;
+	using callable_ret_type = invoke_result_t<F, Args...>;
 
 	// 可调用对象返回值
 	template <typename F, typename... Args>
 	using future_callback_type = std::future<callable_ret_type<F, Args...>>;
 
 	static const int MaxTaskCount = 100;
+
+	/**
+	 * @brief 队列满时的处理策略
+	 *
+	 */
+	enum class BackpressurePolicy
+	{
+		Block,		//阻塞提交者直到有空位
+		Reject,		//抛出TaskRejected
+		CallerRuns, //在提交者线程中直接执行
+	};
+
+	/**
+	 * @brief 任务被拒绝
+	 *
+	 */
+	class TaskRejected : public std::runtime_error
+	{
+	public:
+		using std::runtime_error::runtime_error;
+	};
+
+	/**
+	 * @brief 线程池配置
+	 *
+	 */
+	struct ThreadPoolOptions
+	{
+		int min_threads = std::thread::hardware_concurrency();	   //最少线程数，空闲线程不会退出到该数目以下
+		int max_threads = std::thread::hardware_concurrency();	   //最多线程数
+		int max_tasks = MaxTaskCount;							   //队列容量
+		TaskClock::duration idle_timeout = std::chrono::seconds(60); //空闲线程超过该时间后退出
+		BackpressurePolicy backpressure = BackpressurePolicy::Block; //队列满时的处理策略
+		AffinityPolicy affinity = AffinityPolicy::None;			   //绑核策略
+		std::vector<int> cpuset;								   //允许使用的CPU，为空时使用全部
+		std::shared_ptr<const CpuTopology> topology;			   //CPU拓扑，为空时探测本机
+		int shards = 1;											   //提交队列分片数，大量线程同时提交时增大
+		TaskClock::duration codel_target = TaskClock::duration::zero();	  //目标排队时间，非0时启用准入控制与排队时间统计
+		TaskClock::duration codel_interval = std::chrono::milliseconds(100); //排队时间持续高于目标多久判定为过载
+		TaskClock::duration task_timeout = TaskClock::duration::max();	  //任务排队超过该时间后丢弃
+	};
+
 	class ThreadPool
 	{
 	public:
+		///< 公开的任务类型，与之前一致；内部以UniqueTask保存，post()也接受只可移动的可调用对象
 		using Task = std::function<void()>;
-		ThreadPool(int numThreads = std::thread::hardware_concurrency()) : m_queue(MaxTaskCount)
+		ThreadPool(int numThreads = std::thread::hardware_concurrency()) : ThreadPool(fixed_options(numThreads))
+		{
+		}
+
+		/**
+		 * @brief Construct a new Thread Pool object
+		 * @details 启动min_threads个线程，队列积压或线程阻塞时增长到max_threads，
+		 *          多出的线程空闲超过idle_timeout后退出
+		 * 
+		 * @param options 线程池配置
+		 */
+		ThreadPool(const ThreadPoolOptions &options)
+			: m_options(normalize(options)), m_queue(m_options.max_tasks, std::chrono::milliseconds(20), m_options.shards),
+			  m_admission(m_options.codel_target, m_options.codel_interval)
+			WOTSEN_POOL_TRACE(, m_trace(m_options.max_threads))
 		{
-			start(numThreads);
+			if (m_options.affinity != AffinityPolicy::None)
+				m_placement = m_options.topology->plan(m_options.affinity, m_options.cpuset);
+
+			start(m_options.min_threads);
 		}
 
 		~ThreadPool(void)
@@ -46,73 +113,773 @@ namespace wotsen
 			stop();
 		}
 
+		// 立即停止，等同于shutdown_now()
 		void stop()
 		{
-			std::call_once(m_flag, [this] { stop_thread_group(); }); //保证多线程情况下只调用一次StopThreadGroup
+			shutdown_now();
+		}
+
+		/**
+		 * @brief 优雅关闭
+		 * @details 不再接受新任务，等待队列中已有的任务全部执行完；超过timeout仍未执行完时
+		 *          转为shutdown_now()：取消令牌置位，剩余任务丢弃，其未来值得到broken_promise
+		 * 
+		 * @param timeout 最长等待时间
+		 * @return true 全部任务都已执行
+		 * @return false 超时后丢弃了部分任务，或线程池已经停止过
+		 */
+		bool shutdown(TaskClock::duration timeout = TaskClock::duration::max())
+		{
+			bool drained = false;
+			std::call_once(m_flag, [this, timeout, &drained] { drained = stop_thread_group(true, timeout, nullptr); }); //保证多线程情况下只调用一次StopThreadGroup
+			return drained;
+		}
+
+		/**
+		 * @brief 立即关闭
+		 * @details 不再接受新任务，取消令牌置位，队列中未开始的任务丢弃，其未来值得到broken_promise，
+		 *          等待正在执行的任务结束
+		 * 
+		 * @return size_t 丢弃的任务数
+		 */
+		size_t shutdown_now()
+		{
+			size_t discarded = 0;
+			std::call_once(m_flag, [this, &discarded] { stop_thread_group(false, TaskClock::duration::zero(), &discarded); }); //保证多线程情况下只调用一次StopThreadGroup
+			return discarded;
+		}
+
+		// 线程池的取消令牌，shutdown_now()或优雅关闭超时时置位，长任务应定期检查
+		CancellationToken token() const
+		{
+			return m_cancel.token();
 		}
 
 		template <typename F, typename... Args>
 		std::future<callable_ret_type<F, Args...>>
 		add_task(F&& f, Args &&... args)
 		{
-			// 可调用对象封装为void(void)
-			auto task = std::make_shared<std::packaged_task<callable_ret_type<F, Args...>()>>(
-			std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+			return add_priority_task(TaskPriority::Normal, std::forward<F>(f), std::forward<Args>(args)...);
+		}
+
+		/**
+		 * @brief 按优先级添加任务
+		 * 
+		 * @param priority 优先级
+		 * @param f 可调用对象
+		 * @param args 参数
+		 * @return std::future<callable_ret_type<F, Args...>> 未来值
+		 * @throw TaskRejected 队列满且策略为Reject
+		 */
+		template <typename F, typename... Args>
+		std::future<callable_ret_type<F, Args...>>
+		add_priority_task(TaskPriority priority, F&& f, Args &&... args)
+		{
+			auto task = package(std::forward<F>(f), std::forward<Args>(args)...);
+
+			// 获取未来值对象
+			std::future<callable_ret_type<F, Args...>> ret = task.get_future();
+
+			TaskItem item = make_item(std::move(task));
+			submit(item, priority, false);
+
+			return ret;
+		}
+
+		/**
+		 * @brief 添加可取消的任务，开始执行前令牌已置位则不执行，未来值得到TaskCancelled
+		 * 
+		 * @param token 取消令牌
+		 * @param f 可调用对象
+		 * @param args 参数
+		 * @return std::future<callable_ret_type<F, Args...>> 未来值
+		 */
+		template <typename F, typename... Args>
+		std::future<callable_ret_type<F, Args...>>
+		add_cancellable_task(CancellationToken token, F&& f, Args &&... args)
+		{
+			using R = callable_ret_type<F, Args...>;
+			using Bound = decltype(bind_task(std::forward<F>(f), std::forward<Args>(args)...));
+
+			std::packaged_task<R()> task(CancellableCall<R, Bound>{token, bind_task(std::forward<F>(f), std::forward<Args>(args)...)});
+
+			// 获取未来值对象
+			std::future<R> ret = task.get_future();
+
+			TaskItem item = make_item(std::move(task));
+			submit(item, TaskPriority::Normal, false);
+
+			return ret;
+		}
+
+		/**
+		 * @brief 添加带截止时间的任务，截止时间越早越先执行
+		 * 
+		 * @param deadline 截止时间
+		 * @param f 可调用对象
+		 * @param args 参数
+		 * @return std::future<callable_ret_type<F, Args...>> 未来值
+		 * @throw TaskRejected 队列满且策略为Reject
+		 */
+		template <typename F, typename... Args>
+		std::future<callable_ret_type<F, Args...>>
+		add_deadline_task(TaskClock::time_point deadline, F&& f, Args &&... args)
+		{
+			auto task = package(std::forward<F>(f), std::forward<Args>(args)...);
+
+			// 获取未来值对象
+			std::future<callable_ret_type<F, Args...>> ret = task.get_future();
+
+			TaskItem item = make_item(std::move(task));
+			item.deadline = deadline;
+			submit(item, TaskPriority::Normal, true);
+
+			return ret;
+		}
+
+		/**
+		 * @brief 快速失败地添加任务，不阻塞
+		 * @details 队列满、线程池已关闭，或启用CoDel时判定为过载，都立即返回无效的未来值；
+		 *          接受后的任务可丢弃：过载期间排队超过目标时间的在出队时丢弃，未来值得到broken_promise
+		 * 
+		 * @param f 可调用对象
+		 * @param args 参数
+		 * @return std::future<callable_ret_type<F, Args...>> 未来值，被拒绝时valid()为false
+		 */
+		template <typename F, typename... Args>
+		std::future<callable_ret_type<F, Args...>>
+		try_add_task(F&& f, Args &&... args)
+		{
+			if (m_queue.closed() || !m_admission.admit(m_queue.size()))
+				return std::future<callable_ret_type<F, Args...>>();
+
+			auto task = package(std::forward<F>(f), std::forward<Args>(args)...);
+			std::future<callable_ret_type<F, Args...>> ret = task.get_future();
+
+			TaskItem item = make_item(std::move(task));
+			item.sheddable = true;
+			if (!m_queue.try_put(item, TaskPriority::Normal))
+			{
+				if (!m_queue.closed())
+					grow();
+				m_admission.on_reject();
+				return std::future<callable_ret_type<F, Args...>>();
+			}
+
+			m_admission.on_admit();
+			if (m_idle.load() == 0)
+				grow();
+			return ret;
+		}
+
+		/**
+		 * @brief 添加任务，排队超过timeout仍未开始执行则丢弃，未来值得到broken_promise
+		 * 
+		 * @param timeout 排队超时时间，超出时钟范围时视为不超时
+		 * @param f 可调用对象
+		 * @param args 参数
+		 * @return std::future<callable_ret_type<F, Args...>> 未来值
+		 * @throw TaskRejected 队列满且策略为Reject
+		 */
+		template <typename F, typename... Args>
+		std::future<callable_ret_type<F, Args...>>
+		add_timeout_task(TaskClock::duration timeout, F&& f, Args &&... args)
+		{
+			auto task = package(std::forward<F>(f), std::forward<Args>(args)...);
 
 			// 获取未来值对象
-			std::future<callable_ret_type<F, Args...>> ret = task->get_future();
+			std::future<callable_ret_type<F, Args...>> ret = task.get_future();
 
-			m_queue.put([task]() { (*task)(); });
+			TaskItem item = make_item(std::move(task));
+			item.expire = time_after(TaskClock::now(), timeout);
+			submit(item, TaskPriority::Normal, false);
 
 			return ret;
 		}
 
+		/**
+		 * @brief 延迟执行
+		 * 
+		 * @param delay 延迟时间
+		 * @param f 可调用对象
+		 * @param args 参数
+		 * @return TimerId 定时器标识，可用于cancel_timer
+		 */
+		template <typename F, typename... Args>
+		TimerId schedule_after(TaskClock::duration delay, F&& f, Args &&... args)
+		{
+			return timers().schedule(TaskClock::now() + delay, TaskClock::duration::zero(),
+									 std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+		}
+
+		/**
+		 * @brief 在指定时间执行
+		 * 
+		 * @param when 执行时间
+		 * @param f 可调用对象
+		 * @param args 参数
+		 * @return TimerId 定时器标识，可用于cancel_timer
+		 */
+		template <typename F, typename... Args>
+		TimerId schedule_at(TaskClock::time_point when, F&& f, Args &&... args)
+		{
+			return timers().schedule(when, TaskClock::duration::zero(),
+									 std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+		}
+
+		/**
+		 * @brief 周期执行，首次在一个周期后
+		 * 
+		 * @param period 周期
+		 * @param f 可调用对象
+		 * @param args 参数
+		 * @return TimerId 定时器标识，可用于cancel_timer
+		 */
+		template <typename F, typename... Args>
+		TimerId schedule_every(TaskClock::duration period, F&& f, Args &&... args)
+		{
+			return timers().schedule(TaskClock::now() + period, period,
+									 std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+		}
+
+		/**
+		 * @brief 取消定时任务，已经进入队列的执行不受影响
+		 * 
+		 * @param id 定时器标识
+		 * @return true 成功
+		 * @return false 定时器不存在或已执行
+		 */
+		bool cancel_timer(TimerId id)
+		{
+			return timers().cancel(id);
+		}
+
+		/**
+		 * @brief 提交不需要返回值的任务
+		 * @details 在本线程池的工作线程中提交且队列满时直接在当前线程执行，
+		 *          避免工作线程互相等待空位
+		 * 
+		 * @param task 任务
+		 * @param priority 优先级
+		 */
+		void post(UniqueTask task, TaskPriority priority = TaskPriority::Normal)
+		{
+			TaskItem item = make_item(std::move(task));
+
+			if (current() == this)
+			{
+				if (!m_queue.try_put(item, priority) && !m_queue.closed())
+					item.task();
+				return;
+			}
+
+			submit(item, priority, false);
+		}
+
+		/**
+		 * @brief 不阻塞、不抛异常地提交任务
+		 * @details 不受背压策略影响：队列满或线程池已关闭时返回false，task保持不变，由调用者决定如何处理
+		 * 
+		 * @param task 任务，成功时被移走
+		 * @param priority 优先级
+		 * @return true 已入队
+		 * @return false 队列满或已关闭
+		 */
+		bool try_post(UniqueTask &task, TaskPriority priority = TaskPriority::Normal)
+		{
+			TaskItem item = make_item(std::move(task));
+
+			if (!m_queue.try_put(item, priority))
+			{
+				task = std::move(item.task);
+				if (!m_queue.closed())
+					grow();
+				return false;
+			}
+
+			if (m_idle.load() == 0)
+				grow();
+			return true;
+		}
+
+		/**
+		 * @brief 在当前线程执行一个排队中的任务
+		 * @details 供等待者帮忙消化队列，不阻塞
+		 *
+		 * @return true 执行了一个任务
+		 * @return false 队列空
+		 */
+		bool run_pending_task()
+		{
+			TaskItem item;
+			bool stolen = false;
+			if (!m_queue.try_take(item, &stolen))
+				return false;
+
+			WOTSEN_POOL_TRACE(if (stolen && current() == this) m_trace.on_steal(worker_slot()));
+
+			if (admit_dequeued(item))
+				item.task();
+			return true;
+		}
+
+		// 当前线程所属的线程池，非工作线程为nullptr
+		static ThreadPool *&current()
+		{
+			static thread_local ThreadPool *pool = nullptr;
+			return pool;
+		}
+
+		/**
+		 * @brief 任务中即将阻塞时声明，线程池据此补充线程
+		 * 
+		 */
+		class BlockingScope
+		{
+		public:
+			explicit BlockingScope(ThreadPool &pool) : m_pool(pool)
+			{
+				m_pool.m_blocked.fetch_add(1);
+				if (m_pool.m_queue.size() > 0)
+					m_pool.grow();
+			}
+
+			~BlockingScope()
+			{
+				m_pool.m_blocked.fetch_sub(1);
+			}
+
+			BlockingScope(const BlockingScope &) = delete;
+			BlockingScope &operator=(const BlockingScope &) = delete;
+
+		private:
+			ThreadPool &m_pool;
+		};
+
+		// 当前线程数
+		size_t thread_count() const
+		{
+			return m_threadCount.load();
+		}
+
+		// 空闲线程数
+		size_t idle_count() const
+		{
+			return m_idle.load();
+		}
+
+		// 声明阻塞中的线程数
+		size_t blocked_count() const
+		{
+			return m_blocked.load();
+		}
+
+		// 排队中的任务数
+		size_t queue_depth() const
+		{
+			return m_queue.size();
+		}
+
+		// 队列容量
+		size_t queue_capacity() const
+		{
+			return m_queue.capacity();
+		}
+
+		// 拒绝、丢弃计数与排队时间分位数
+		AdmissionStats admission_stats() const
+		{
+			return m_admission.stats();
+		}
+
+		const ThreadPoolOptions &options() const
+		{
+			return m_options;
+		}
+
+#ifdef WOTSEN_THREAD_POOL_TRACE
+		// 统计与时间线
+		PoolTrace &trace()
+		{
+			return m_trace;
+		}
+#endif
+
+		// 当前线程在所属线程池中的编号，非工作线程为-1
+		static int current_worker()
+		{
+			return worker_slot();
+		}
+
+		// 工作线程位置，编号为i的线程使用第i % size()个位置，不绑核时为空
+		const std::vector<WorkerPlacement> &placement() const
+		{
+			return m_placement;
+		}
+
 	private:
+		using ThreadGroup = std::list<std::shared_ptr<std::thread>>;
+
+		static ThreadPoolOptions fixed_options(int numThreads)
+		{
+			ThreadPoolOptions options;
+			options.min_threads = numThreads;
+			options.max_threads = numThreads;
+			return options;
+		}
+
+		static ThreadPoolOptions normalize(ThreadPoolOptions options)
+		{
+			if (options.max_threads < 1)
+				options.max_threads = 1;
+			if (options.min_threads < 0)
+				options.min_threads = 0;
+			if (options.min_threads > options.max_threads)
+				options.min_threads = options.max_threads;
+			if (options.max_tasks < 1)
+				options.max_tasks = 1;
+			if (options.shards < 1)
+				options.shards = 1;
+			if (options.affinity != AffinityPolicy::None && !options.topology)
+				options.topology = std::make_shared<CpuTopology>(CpuTopology::detect());
+			return options;
+		}
+
+		// 可调用对象与参数按值绑定后封装为packaged_task，参数可以只可移动
+		template <typename F, typename... Args>
+		static std::packaged_task<callable_ret_type<F, Args...>()>
+		package(F&& f, Args &&... args)
+		{
+			return std::packaged_task<callable_ret_type<F, Args...>()>(
+			bind_task(std::forward<F>(f), std::forward<Args>(args)...));
+		}
+
+		// 执行前检查取消令牌
+		template <typename R, typename Bound>
+		struct CancellableCall
+		{
+			CancellationToken token;
+			Bound fn;
+
+			R operator()()
+			{
+				token.throw_if_cancelled();
+				return fn();
+			}
+		};
+
+		TaskItem make_item(UniqueTask &&task)
+		{
+			TaskItem item;
+			item.task = std::move(task);
+			item.deadline = TaskClock::time_point::max();
+			item.expire = TaskClock::time_point::max();
+			item.sheddable = false;
+
+			//只有需要排队时间时才取时钟
+			bool stamp = m_admission.enabled() || m_options.task_timeout != TaskClock::duration::max();
+			WOTSEN_POOL_TRACE(stamp = true);
+			if (stamp)
+			{
+				item.enqueue = TaskClock::now();
+				if (m_options.task_timeout != TaskClock::duration::max())
+					item.expire = time_after(item.enqueue, m_options.task_timeout);
+			}
+			return item;
+		}
+
+		// 出队后检查：记录排队时间，排队超时或过载时可丢弃的任务丢弃，返回是否执行
+		bool admit_dequeued(TaskItem &item)
+		{
+			if (!m_admission.enabled() && item.expire == TaskClock::time_point::max())
+				return true;
+
+			TaskClock::time_point now = TaskClock::now();
+			bool keep = true;
+			if (m_admission.enabled())
+				keep = m_admission.on_dequeue(std::chrono::duration_cast<std::chrono::nanoseconds>(now - item.enqueue).count(),
+											  std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count());
+
+			if (now > item.expire || (!keep && item.sheddable))
+			{
+				item.task = nullptr; //未来值得到broken_promise
+				m_admission.on_drop();
+				return false;
+			}
+			return true;
+		}
+
+		// 时间轮在第一次使用时创建，到期任务投递到本线程池；
+		// 不受背压策略影响：不在时间轮线程中执行也不阻塞它，队列满时由时间轮下一个刻度重试，已关闭时丢弃
+		TimerWheel &timers()
+		{
+			std::call_once(m_timerFlag, [this] {
+				m_timers.reset(new TimerWheel([this](TimerWheel::Task &task) {
+					UniqueTask item(task);
+					return try_post(item) || m_queue.closed();
+				}));
+			});
+			return *m_timers;
+		}
+
+		// 入队，队列满时按策略处理
+		void submit(TaskItem &item, TaskPriority priority, bool deadline)
+		{
+			bool ok = deadline ? m_queue.try_put_deadline(item) : m_queue.try_put(item, priority);
+
+			if (!ok && !m_queue.closed())
+			{
+				//队列积压，先尝试扩充线程
+				grow();
+
+				switch (m_options.backpressure)
+				{
+				case BackpressurePolicy::Reject:
+					m_admission.on_reject();
+					throw TaskRejected("thread pool queue full");
+				case BackpressurePolicy::CallerRuns:
+					item.task();
+					return;
+				default:
+					ok = deadline ? m_queue.put_deadline(std::move(item)) : m_queue.put(std::move(item), priority);
+					break;
+				}
+			}
+
+			if (ok && m_idle.load() == 0)
+				grow();
+		}
+
 		void start(int numThreads)
 		{
 			m_running = true;
+			m_idle = 0;
+			m_blocked = 0;
+			m_threadCount = 0;
+			m_live = 0;
+			m_slotUsed.assign(m_options.max_threads, false);
+
 			//创建线程组
+			std::lock_guard<std::mutex> locker(m_threadMutex);
 			for (int i = 0; i < numThreads; ++i)
 			{
-				m_threadgroup.push_back(std::make_shared<std::thread>(&ThreadPool::run_in_thread, this));
+				spawn();
+			}
+		}
+
+		// 增加一个线程，需持有m_threadMutex
+		void spawn()
+		{
+			//占用最小的空闲编号，线程退出后编号可复用
+			int slot = (int)(std::find(m_slotUsed.begin(), m_slotUsed.end(), false) - m_slotUsed.begin());
+			m_slotUsed[slot] = true;
+
+			auto self = m_threadgroup.insert(m_threadgroup.end(), nullptr);
+			*self = std::make_shared<std::thread>(&ThreadPool::run_in_thread, this, self, slot);
+			m_threadCount = m_threadgroup.size();
+			m_live++;
+
+			if (!m_placement.empty())
+				set_thread_affinity(**self, m_placement[slot % m_placement.size()].cpus);
+		}
+
+		static int &worker_slot()
+		{
+			static thread_local int slot = -1;
+			return slot;
+		}
+
+		// 线程数未到上限时增加一个线程
+		void grow()
+		{
+			if (m_threadCount.load() >= (size_t)m_options.max_threads)
+				return;
+
+			std::lock_guard<std::mutex> locker(m_threadMutex);
+			reap();
+			if (!m_running || m_threadgroup.size() >= (size_t)m_options.max_threads)
+				return;
+			spawn();
+		}
+
+		// 回收已退出的线程，需持有m_threadMutex
+		void reap()
+		{
+			for (auto thread : m_exited)
+			{
+				if (thread)
+					thread->join();
 			}
+			m_exited.clear();
+		}
+
+		// 空闲超时的线程退出，不低于最少线程数
+		bool retire(ThreadGroup::iterator self)
+		{
+			std::lock_guard<std::mutex> locker(m_threadMutex);
+			if (!m_running || m_threadgroup.size() <= (size_t)m_options.min_threads)
+				return false;
+
+			m_exited.splice(m_exited.end(), m_threadgroup, self);
+			m_threadCount = m_threadgroup.size();
+			m_slotUsed[worker_slot()] = false;
+			return true;
 		}
 
-		void run_in_thread()
+		// 工作线程取空自己的分片后依次尝试的分片：先拓扑距离近的工作线程的分片，未设置亲和性时为空(按编号依次)
+		std::vector<size_t> shard_steal_order(int slot) const
 		{
+			std::vector<size_t> order;
+			size_t shards = m_queue.shard_count();
+			if (m_placement.empty() || shards == 1)
+				return order;
+
+			//分片k是编号为k的工作线程的分片，位置为m_placement[k % m_placement.size()]
+			size_t home = (size_t)slot % shards;
+			size_t self = (size_t)slot % m_placement.size();
+			std::vector<size_t> near = m_options.topology->steal_order(m_placement, self);
+			near.insert(near.begin(), self);
+
+			for (size_t place : near)
+			{
+				for (size_t k = 0; k < shards; ++k)
+				{
+					if (k != home && k % m_placement.size() == place)
+						order.push_back(k);
+				}
+			}
+
+			return order;
+		}
+
+		void run_in_thread(ThreadGroup::iterator self, int slot)
+		{
+			current() = this;
+			worker_slot() = slot;
+			TaskQueue::home_shard() = (size_t)slot; //先取自己的分片，提交的任务也留在自己的分片
+			TaskQueue::steal_order() = shard_steal_order(slot);
+
+			worker_loop(self, slot);
+
+			{
+				std::lock_guard<std::mutex> locker(m_threadMutex);
+				m_live--;
+			}
+			m_exitCv.notify_all();
+		}
+
+		void worker_loop(ThreadGroup::iterator self, int slot)
+		{
+			(void)slot; //未开启WOTSEN_THREAD_POOL_TRACE时不使用
+			TaskItem item;
 			while (m_running)
 			{
-				//取任务分别执行
-				std::list<Task> list;
-				m_queue.take(list);
+				//按优先级逐个取任务执行
+				m_idle.fetch_add(1);
+				WOTSEN_POOL_TRACE(int64_t wait = PoolTrace::now());
+				bool stolen = false;
+				bool ok = m_queue.take(item, m_options.idle_timeout, &stolen);
+				WOTSEN_POOL_TRACE(int64_t start = PoolTrace::now());
+				WOTSEN_POOL_TRACE(m_trace.on_idle(slot, start - wait));
+				WOTSEN_POOL_TRACE(if (stolen) m_trace.on_steal(slot));
+				m_idle.fetch_sub(1);
 
-				for (auto &task : list)
+				if (!ok)
 				{
-					if (!m_running)
+					if (m_queue.finished() || retire(self))
 						return;
-
-					task();
+					continue;
 				}
+
+				if (!admit_dequeued(item))
+					continue;
+
+				item.task();
+				item.task = nullptr;
+
+				WOTSEN_POOL_TRACE(m_trace.on_task(slot,
+					std::chrono::duration_cast<std::chrono::nanoseconds>(item.enqueue.time_since_epoch()).count(),
+					start, PoolTrace::now()));
 			}
 		}
 
-		void stop_thread_group()
+		// 停止线程组，drain为true时先等待队列取空，返回是否全部执行完
+		bool stop_thread_group(bool drain, TaskClock::duration timeout, size_t *discarded)
 		{
+			if (m_timers)
+				m_timers->stop(); //先停止时间轮，不再投递到期任务
+
+			bool drained = false;
+
+			if (drain)
+			{
+				m_queue.close(); //不再接受新任务，工作线程取空队列后退出
+				if (!m_queue.empty())
+					grow(); //线程可能已全部空闲退出
+
+				std::unique_lock<std::mutex> locker(m_threadMutex);
+				auto exited = [this] { return m_live == 0; };
+				if (timeout == TaskClock::duration::max())
+				{
+					m_exitCv.wait(locker, exited);
+					drained = true;
+				}
+				else
+				{
+					drained = m_exitCv.wait_for(locker, timeout, exited);
+				}
+			}
+
+			if (!drained)
+			{
+				m_cancel.cancel(); //通知正在执行的任务尽快结束
+			}
+
 			m_queue.stop();	   //让同步队列中的线程停止
 			m_running = false; //置为false，让内部线程跳出循环并退出
 
-			for (auto thread : m_threadgroup) //等待线程结束
+			size_t n = m_queue.discard(); //丢弃的任务析构时向未来值写入broken_promise
+			if (discarded)
+				*discarded = n;
+
+			ThreadGroup threads;
+			{
+				std::lock_guard<std::mutex> locker(m_threadMutex);
+				threads.swap(m_threadgroup);
+				threads.splice(threads.end(), m_exited);
+				m_threadCount = 0;
+			}
+
+			for (auto thread : threads) //等待线程结束
 			{
 				if (thread)
 					thread->join();
 			}
-			m_threadgroup.clear();
+
+			return drained;
 		}
 
-		std::list<std::shared_ptr<std::thread>> m_threadgroup; //处理任务的线程组
-		SyncQueue<Task> m_queue;							   //同步队列
-		std::atomic_bool m_running;							   //是否停止的标志
+		ThreadPoolOptions m_options;	   //线程池配置
+		ThreadGroup m_threadgroup;		   //处理任务的线程组
+		ThreadGroup m_exited;			   //已退出待回收的线程
+		std::vector<WorkerPlacement> m_placement; //工作线程位置
+		std::vector<bool> m_slotUsed;	   //工作线程编号占用情况
+		std::mutex m_threadMutex;		   //线程组互斥量
+		TaskQueue m_queue;				   //分优先级任务队列
+		AdmissionControl m_admission;	   //准入控制与排队时间统计
+		std::atomic_bool m_running;		   //是否停止的标志
+		std::atomic<size_t> m_threadCount; //当前线程数
+		std::atomic<size_t> m_idle;		   //等待任务的线程数
+		std::atomic<size_t> m_blocked;	   //声明阻塞中的线程数
+		size_t m_live;					   //未退出的线程数，受m_threadMutex保护
+		std::condition_variable m_exitCv;  //线程退出通知
+		CancellationSource m_cancel;	   //关闭时通知正在执行的任务
 		std::once_flag m_flag;
+		std::unique_ptr<TimerWheel> m_timers; //定时任务
+		std::once_flag m_timerFlag;
+#ifdef WOTSEN_THREAD_POOL_TRACE
+		PoolTrace m_trace; //统计与时间线
+#endif
 	};
 
 } // namespace wotsen
@@ -0,0 +1,403 @@
+/**
+ * @file timer-wheel.h
+ * @author yuwangliang (wotsen@outlook.com)
+ * @brief 分层时间轮
+ * @version 0.1
+ * @date 2020-08-16
+ *
+ * @copyright Copyright (c) 2020 yuwangliang
+ *
+ */
+#ifndef __wotsen_TIMER_WHEEL_H__
+#define __wotsen_TIMER_WHEEL_H__
+
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+#include <stdint.h>
+
+namespace wotsen
+{
+
+	///< 定时器标识，低32位为节点下标，高32位为代数，节点复用后旧标识失效
+	using TimerId = uint64_t;
+
+	///< 非法定时器标识
+	static const TimerId InvalidTimerId = 0;
+
+	/**
+	 * @brief 分层时间轮
+	 * @details 4层，每层256个槽，最低层每槽一个刻度，覆盖2^32个刻度(1ms刻度约49天)。
+	 *          定时器节点是槽内的双向链表，添加与取消都是O(1)；
+	 *          一个线程按刻度推进，到期的任务收集后在锁外统一交给派发函数，派发函数拒绝的推迟一个刻度重试；
+	 *          周期任务按上次到期时间加周期重新入轮，不累积漂移。
+	 *
+	 */
+	class TimerWheel
+	{
+	public:
+		using Clock = std::chrono::steady_clock;
+		using Task = std::function<void()>;
+		using Dispatch = std::function<bool(Task &)>;
+
+		/**
+		 * @brief Construct a new Timer Wheel object
+		 *
+		 * @param dispatch 到期任务的派发函数，在时间轮线程中调用，不应阻塞或抛出异常；
+		 *                 返回false表示暂时无法派发(如队列满)，task保持不变，下一个刻度重试
+		 * @param tick 刻度
+		 */
+		explicit TimerWheel(Dispatch dispatch, Clock::duration tick = std::chrono::milliseconds(1))
+			: m_dispatch(std::move(dispatch)), m_tick(tick), m_start(Clock::now()), m_current(0), m_pending(0), m_free(nullptr), m_stop(false)
+		{
+			for (int level = 0; level < Levels; ++level)
+			{
+				m_count[level] = 0;
+				for (int slot = 0; slot < Slots; ++slot)
+				{
+					m_slots[level][slot].prev = &m_slots[level][slot];
+					m_slots[level][slot].next = &m_slots[level][slot];
+				}
+			}
+
+			m_thread = std::thread(&TimerWheel::run, this);
+		}
+
+		~TimerWheel()
+		{
+			stop();
+		}
+
+		TimerWheel(const TimerWheel &) = delete;
+		TimerWheel &operator=(const TimerWheel &) = delete;
+
+		/**
+		 * @brief 添加定时器
+		 *
+		 * @param when 到期时间
+		 * @param period 周期，为0时只执行一次
+		 * @param task 任务
+		 * @return TimerId 定时器标识
+		 */
+		TimerId schedule(Clock::time_point when, Clock::duration period, Task task)
+		{
+			std::unique_lock<std::mutex> locker(m_mutex);
+
+			if (m_pending == 0)
+			{
+				//空闲后重新对齐当前刻度，避免从很久以前的刻度开始推进
+				m_current = std::max(m_current, to_tick(Clock::now()));
+			}
+
+			Node *node = alloc();
+			node->task = std::make_shared<Task>(std::move(task));
+			node->period = period > Clock::duration::zero() ? std::max<uint64_t>(1, period / m_tick) : 0;
+			node->expire = to_tick(when, true);
+
+			bool wake = m_pending == 0 || node->expire < m_wakeTick;
+			link(node);
+			m_pending++;
+			//解锁后节点可能已到期被复用，标识在锁内生成
+			TimerId id = make_id(node);
+			locker.unlock();
+
+			if (wake)
+				m_cv.notify_one();
+
+			return id;
+		}
+
+		/**
+		 * @brief 取消定时器，已经派发出去的执行不受影响
+		 *
+		 * @param id 定时器标识
+		 * @return true 成功
+		 * @return false 定时器不存在或已到期
+		 */
+		bool cancel(TimerId id)
+		{
+			std::lock_guard<std::mutex> locker(m_mutex);
+
+			size_t index = (size_t)(id & 0xffffffff);
+			if (id == InvalidTimerId || index >= m_nodes.size())
+				return false;
+
+			Node *node = &m_nodes[index];
+			if (!node->active || node->gen != (uint32_t)(id >> 32))
+				return false;
+
+			unlink(node);
+			release(node);
+			m_pending--;
+			return true;
+		}
+
+		// 未到期的定时器数
+		size_t size()
+		{
+			std::lock_guard<std::mutex> locker(m_mutex);
+			return m_pending;
+		}
+
+		void stop()
+		{
+			{
+				std::lock_guard<std::mutex> locker(m_mutex);
+				if (m_stop)
+					return;
+				m_stop = true;
+			}
+			m_cv.notify_one();
+
+			if (m_thread.joinable())
+				m_thread.join();
+		}
+
+	private:
+		static const int Levels = 4;
+		static const int SlotBits = 8;
+		static const int Slots = 1 << SlotBits;
+		static const uint64_t SlotMask = Slots - 1;
+
+		struct Node
+		{
+			Node *prev = nullptr;
+			Node *next = nullptr;
+			uint64_t expire = 0;  //到期刻度
+			uint64_t period = 0;  //周期刻度数
+			uint32_t index = 0;	  //在m_nodes中的下标
+			uint32_t gen = 1;	  //代数
+			int level = 0;		  //所在层
+			bool active = false;  //是否在轮中
+			std::shared_ptr<Task> task;
+		};
+
+		// 时间转为刻度，到期时间向上取整，保证不会提前触发
+		uint64_t to_tick(Clock::time_point t, bool ceil = false) const
+		{
+			if (t <= m_start)
+				return 0;
+
+			Clock::duration d = t - m_start;
+			uint64_t tick = (uint64_t)(d / m_tick);
+			if (ceil && d % m_tick != Clock::duration::zero())
+				tick++;
+			return tick;
+		}
+
+		TimerId make_id(const Node *node) const
+		{
+			return ((TimerId)node->gen << 32) | node->index;
+		}
+
+		Node *alloc()
+		{
+			Node *node = m_free;
+			if (node)
+			{
+				m_free = node->next;
+			}
+			else
+			{
+				m_nodes.push_back(Node());
+				node = &m_nodes.back();
+				node->index = (uint32_t)(m_nodes.size() - 1);
+			}
+			node->active = true;
+			return node;
+		}
+
+		void release(Node *node)
+		{
+			node->active = false;
+			node->task.reset();
+			node->gen = node->gen == UINT32_MAX ? 1 : node->gen + 1;
+			node->next = m_free;
+			m_free = node;
+		}
+
+		// 按到期刻度与当前刻度的距离选择层与槽
+		void link(Node *node)
+		{
+			uint64_t expire = std::max(node->expire, m_current);
+			uint64_t delta = expire - m_current;
+			int level = 0;
+
+			while (level < Levels - 1 && delta >= ((uint64_t)1 << (SlotBits * (level + 1))))
+				level++;
+
+			if (delta >= ((uint64_t)1 << (SlotBits * Levels)))
+			{
+				//超出范围的放到最高层最远的槽，转动到时重新计算
+				expire = m_current + ((uint64_t)1 << (SlotBits * Levels)) - 1;
+			}
+
+			Node *head = &m_slots[level][(expire >> (SlotBits * level)) & SlotMask];
+			node->level = level;
+			node->prev = head->prev;
+			node->next = head;
+			head->prev->next = node;
+			head->prev = node;
+			m_count[level]++;
+		}
+
+		void unlink(Node *node)
+		{
+			node->prev->next = node->next;
+			node->next->prev = node->prev;
+			node->prev = node->next = nullptr;
+			m_count[node->level]--;
+		}
+
+		// 下一个需要处理的刻度
+		uint64_t next_event_tick() const
+		{
+			if (m_count[0])
+				return m_current;
+
+			for (int level = 1; level < Levels; ++level)
+			{
+				if (m_count[level])
+					return ((m_current >> (SlotBits * level)) + 1) << (SlotBits * level);
+			}
+
+			return UINT64_MAX;
+		}
+
+		// 将高层槽中的定时器重新分配到低层
+		void cascade(int level, uint64_t slot)
+		{
+			Node *head = &m_slots[level][slot];
+			Node *node = head->next;
+
+			head->prev = head->next = head;
+			while (node != head)
+			{
+				Node *next = node->next;
+				m_count[level]--;
+				link(node);
+				node = next;
+			}
+		}
+
+		// 处理当前刻度，到期任务放入expired
+		void process(std::vector<std::shared_ptr<Task>> &expired)
+		{
+			for (int level = 1; level < Levels; ++level)
+			{
+				if (m_current & (((uint64_t)1 << (SlotBits * level)) - 1))
+					break;
+				cascade(level, (m_current >> (SlotBits * level)) & SlotMask);
+			}
+
+			Node *head = &m_slots[0][m_current & SlotMask];
+			while (head->next != head)
+			{
+				Node *node = head->next;
+				unlink(node);
+				expired.push_back(node->task);
+
+				if (node->period)
+				{
+					node->expire += node->period;
+					link(node);
+				}
+				else
+				{
+					release(node);
+					m_pending--;
+				}
+			}
+		}
+
+		// 派发被拒绝的任务作为一次性定时器在下一个刻度重试，已取消不影响它
+		void retry_later(const std::shared_ptr<Task> &task)
+		{
+			Node *node = alloc();
+			node->task = task;
+			node->period = 0;
+			node->expire = m_current;
+			link(node);
+			m_pending++;
+		}
+
+		void run()
+		{
+			std::vector<std::shared_ptr<Task>> expired;
+			std::vector<std::shared_ptr<Task>> refused;
+			std::unique_lock<std::mutex> locker(m_mutex);
+
+			while (!m_stop)
+			{
+				uint64_t target = to_tick(Clock::now());
+
+				while (m_current <= target)
+				{
+					uint64_t next = next_event_tick();
+					if (next > target)
+					{
+						m_current = target + 1;
+						break;
+					}
+
+					m_current = next;
+					process(expired);
+					m_current++;
+				}
+
+				if (!expired.empty())
+				{
+					//锁外派发，不阻塞添加与取消
+					locker.unlock();
+					for (auto &task : expired)
+					{
+						std::shared_ptr<Task> fn = task;
+						Task call = [fn] { (*fn)(); };
+						if (!m_dispatch(call))
+							refused.push_back(task);
+					}
+					expired.clear();
+					locker.lock();
+
+					for (auto &task : refused)
+						retry_later(task);
+					refused.clear();
+					continue;
+				}
+
+				m_wakeTick = next_event_tick();
+				if (m_wakeTick == UINT64_MAX)
+					m_cv.wait(locker);
+				else
+					m_cv.wait_until(locker, m_start + m_tick * m_wakeTick);
+				m_wakeTick = UINT64_MAX;
+			}
+		}
+
+	private:
+		Dispatch m_dispatch;	   //到期任务派发
+		Clock::duration m_tick;	   //刻度
+		Clock::time_point m_start; //刻度0对应的时间
+		uint64_t m_current;		   //下一个要处理的刻度
+		uint64_t m_wakeTick = UINT64_MAX; //时间轮线程计划醒来的刻度
+		size_t m_pending;		   //未到期的定时器数
+
+		Node m_slots[Levels][Slots]; //各层槽的链表头
+		size_t m_count[Levels];		 //各层定时器数
+		std::deque<Node> m_nodes;	 //节点，地址稳定
+		Node *m_free;				 //空闲节点链表
+
+		std::mutex m_mutex;
+		std::condition_variable m_cv;
+		std::thread m_thread;
+		bool m_stop;
+	};
+
+} // namespace wotsen
+
+#endif // !__wotsen_TIMER_WHEEL_H__
@@ -0,0 +1,346 @@
+/**
+ * @file unique-task.h
+ * @author yuwangliang (wotsen@outlook.com)
+ * @brief 只可移动的任务对象与参数绑定
+ * @version 0.1
+ * @date 2020-08-16
+ *
+ * @copyright Copyright (c) 2020 yuwangliang
+ *
+ */
+#ifndef __wotsen_UNIQUE_TASK_H__
+#define __wotsen_UNIQUE_TASK_H__
+
+#include <tuple>
+#include <new>
+#include <cstddef>
+#include <utility>
+#include <functional>
+#include <type_traits>
+
+namespace wotsen
+{
+
+	// 调用结果类型，C++17起使用std::invoke_result_t，之前用std::result_of兼容
+#if __cplusplus >= 201703L
+	template <typename F, typename... Args>
+	using invoke_result_t = std::invoke_result_t<F, Args...>;
+#else
+	template <typename F, typename... Args>
+	using invoke_result_t = typename std::result_of<F(Args...)>::type;
+#endif
+
+	namespace detail
+	{
+
+		template <size_t... I>
+		struct index_sequence
+		{
+		};
+
+		template <size_t N, size_t... I>
+		struct make_index_sequence : make_index_sequence<N - 1, N - 1, I...>
+		{
+		};
+
+		template <size_t... I>
+		struct make_index_sequence<0, I...> : index_sequence<I...>
+		{
+		};
+
+		// 成员指针通过mem_fn调用，支持对象、指针与智能指针
+		template <typename F, typename... A>
+		invoke_result_t<F, A...> invoke(std::true_type, F &&f, A &&... a)
+		{
+			return std::mem_fn(f)(std::forward<A>(a)...);
+		}
+
+		template <typename F, typename... A>
+		invoke_result_t<F, A...> invoke(std::false_type, F &&f, A &&... a)
+		{
+			return std::forward<F>(f)(std::forward<A>(a)...);
+		}
+
+		template <typename F>
+		bool is_empty_callable(const F &)
+		{
+			return false;
+		}
+
+		template <typename S>
+		bool is_empty_callable(const std::function<S> &f)
+		{
+			return !f;
+		}
+
+		template <typename R, typename... A>
+		bool is_empty_callable(R (*f)(A...))
+		{
+			return f == nullptr;
+		}
+
+		// 能否按左值调用，SFINAE
+		template <typename F, typename... Args>
+		struct lvalue_callable
+		{
+			template <typename G, typename = invoke_result_t<G &, Args &...>>
+			static std::true_type test(int);
+
+			template <typename G>
+			static std::false_type test(...);
+
+			static const bool value = decltype(test<F>(0))::value;
+		};
+
+		// 按左值或右值调用的结果类型，只实例化选中的一种
+		template <bool Lvalue, typename F, typename... Args>
+		struct bound_result
+		{
+			using type = invoke_result_t<F &, Args &...>;
+		};
+
+		template <typename F, typename... Args>
+		struct bound_result<false, F, Args...>
+		{
+			using type = invoke_result_t<F, Args...>;
+		};
+
+	} // namespace detail
+
+	/**
+	 * @brief 调用可调用对象，等同于C++17的std::invoke
+	 *
+	 */
+	template <typename F, typename... A>
+	invoke_result_t<F, A...> invoke(F &&f, A &&... a)
+	{
+		return detail::invoke(std::is_member_pointer<typename std::decay<F>::type>(), std::forward<F>(f), std::forward<A>(a)...);
+	}
+
+	/**
+	 * @brief 绑定了参数的一次性调用
+	 * @details 与std::bind一样调用时参数按左值传入，可以绑定到左值引用参数；
+	 *          按左值无法调用时(如按值接收只可移动的unique_ptr)改为按右值传入。不需要可复制，只能调用一次
+	 *
+	 * @tparam F 可调用对象类型(已退化)
+	 * @tparam Args 参数类型(已退化)
+	 */
+	template <typename F, typename... Args>
+	class BoundTask
+	{
+	public:
+		static const bool lvalue = detail::lvalue_callable<F, Args...>::value;
+		using result_type = typename detail::bound_result<lvalue, F, Args...>::type;
+
+		template <typename G, typename... A>
+		explicit BoundTask(G &&g, A &&... a) : m_fn(std::forward<G>(g)), m_args(std::forward<A>(a)...)
+		{
+		}
+
+		result_type operator()()
+		{
+			return call(std::integral_constant<bool, lvalue>(), detail::make_index_sequence<sizeof...(Args)>());
+		}
+
+	private:
+		template <size_t... I>
+		result_type call(std::true_type, detail::index_sequence<I...>)
+		{
+			return wotsen::invoke(m_fn, std::get<I>(m_args)...);
+		}
+
+		template <size_t... I>
+		result_type call(std::false_type, detail::index_sequence<I...>)
+		{
+			return wotsen::invoke(std::move(m_fn), std::move(std::get<I>(m_args))...);
+		}
+
+		F m_fn;
+		std::tuple<Args...> m_args;
+	};
+
+	/**
+	 * @brief 绑定参数，参数按值保存
+	 *
+	 */
+	template <typename F, typename... Args>
+	BoundTask<typename std::decay<F>::type, typename std::decay<Args>::type...> bind_task(F &&f, Args &&... args)
+	{
+		return BoundTask<typename std::decay<F>::type, typename std::decay<Args>::type...>(std::forward<F>(f), std::forward<Args>(args)...);
+	}
+
+	/**
+	 * @brief 只可移动的void()任务
+	 * @details 不超过InlineSize且可无异常移动的可调用对象直接构造在对象内部，不分配内存，
+	 *          放入队列时随队列槽位一起移动；否则放在堆上。与std::function相比可以保存只可移动的对象
+	 *          (如std::packaged_task)，调用只有一次间接跳转
+	 *
+	 */
+	class UniqueTask
+	{
+	public:
+		///< 内联保存的最大字节数，可容纳std::function或两个shared_ptr
+		static const size_t InlineSize = 48;
+
+		UniqueTask() noexcept : m_ops(nullptr)
+		{
+		}
+
+		UniqueTask(std::nullptr_t) noexcept : m_ops(nullptr)
+		{
+		}
+
+		template <typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, UniqueTask>::value>::type>
+		UniqueTask(F &&f) : m_ops(nullptr)
+		{
+			using Fn = typename std::decay<F>::type;
+
+			if (detail::is_empty_callable(f))
+				return;
+
+			construct<Fn>(std::forward<F>(f), std::integral_constant<bool, fits<Fn>()>());
+		}
+
+		UniqueTask(UniqueTask &&other) noexcept : m_ops(nullptr)
+		{
+			move_from(other);
+		}
+
+		UniqueTask &operator=(UniqueTask &&other) noexcept
+		{
+			if (this != &other)
+			{
+				reset();
+				move_from(other);
+			}
+			return *this;
+		}
+
+		UniqueTask &operator=(std::nullptr_t) noexcept
+		{
+			reset();
+			return *this;
+		}
+
+		UniqueTask(const UniqueTask &) = delete;
+		UniqueTask &operator=(const UniqueTask &) = delete;
+
+		~UniqueTask()
+		{
+			reset();
+		}
+
+		explicit operator bool() const noexcept
+		{
+			return m_ops != nullptr;
+		}
+
+		void operator()()
+		{
+			m_ops->invoke(m_storage);
+		}
+
+	private:
+		struct Ops
+		{
+			void (*invoke)(void *);
+			void (*relocate)(void *dst, void *src); //移动到dst并析构src
+			void (*destroy)(void *);
+		};
+
+		template <typename Fn>
+		static constexpr bool fits()
+		{
+			return sizeof(Fn) <= InlineSize && alignof(Fn) <= alignof(std::max_align_t) &&
+				   std::is_nothrow_move_constructible<Fn>::value;
+		}
+
+		template <typename Fn>
+		struct InlineOps
+		{
+			static void invoke(void *p)
+			{
+				(*static_cast<Fn *>(p))();
+			}
+
+			static void relocate(void *dst, void *src)
+			{
+				new (dst) Fn(std::move(*static_cast<Fn *>(src)));
+				static_cast<Fn *>(src)->~Fn();
+			}
+
+			static void destroy(void *p)
+			{
+				static_cast<Fn *>(p)->~Fn();
+			}
+
+			static const Ops ops;
+		};
+
+		template <typename Fn>
+		struct HeapOps
+		{
+			static void invoke(void *p)
+			{
+				(**static_cast<Fn **>(p))();
+			}
+
+			static void relocate(void *dst, void *src)
+			{
+				*static_cast<Fn **>(dst) = *static_cast<Fn **>(src);
+			}
+
+			static void destroy(void *p)
+			{
+				delete *static_cast<Fn **>(p);
+			}
+
+			static const Ops ops;
+		};
+
+		template <typename Fn, typename F>
+		void construct(F &&f, std::true_type)
+		{
+			new (m_storage) Fn(std::forward<F>(f));
+			m_ops = &InlineOps<Fn>::ops;
+		}
+
+		template <typename Fn, typename F>
+		void construct(F &&f, std::false_type)
+		{
+			*reinterpret_cast<Fn **>(m_storage) = new Fn(std::forward<F>(f));
+			m_ops = &HeapOps<Fn>::ops;
+		}
+
+		void move_from(UniqueTask &other) noexcept
+		{
+			if (other.m_ops)
+			{
+				other.m_ops->relocate(m_storage, other.m_storage);
+				m_ops = other.m_ops;
+				other.m_ops = nullptr;
+			}
+		}
+
+		void reset() noexcept
+		{
+			if (m_ops)
+			{
+				m_ops->destroy(m_storage);
+				m_ops = nullptr;
+			}
+		}
+
+		const Ops *m_ops;
+		alignas(std::max_align_t) unsigned char m_storage[InlineSize];
+	};
+
+	template <typename Fn>
+	const UniqueTask::Ops UniqueTask::InlineOps<Fn>::ops = {&InlineOps<Fn>::invoke, &InlineOps<Fn>::relocate, &InlineOps<Fn>::destroy};
+
+	template <typename Fn>
+	const UniqueTask::Ops UniqueTask::HeapOps<Fn>::ops = {&HeapOps<Fn>::invoke, &HeapOps<Fn>::relocate, &HeapOps<Fn>::destroy};
+
+} // namespace wotsen
+
+#endif // !__wotsen_UNIQUE_TASK_H__